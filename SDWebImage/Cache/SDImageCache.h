@@ -37,7 +37,15 @@ typedef NS_OPTIONS(NSUInteger, SDImageCacheOptions) {
      * 默认情况下，图像被解码，以尊重其原始大小。在iOS上，这面旗帜将会缩小。
      * 图像的大小与设备的受限内存兼容。
      */
-    SDImageCacheScaleDownLargeImages = 1 << 2
+    SDImageCacheScaleDownLargeImages = 1 << 2,
+    /**
+     * 异步查询磁盘缓存时，图像在共享的解码调度器中解码。此掩码以高优先级解码。
+     */
+    SDImageCacheHighPriority = 1 << 3,
+    /**
+     * 此掩码以低优先级解码。
+     */
+    SDImageCacheLowPriority = 1 << 4
 };
 
 typedef void(^SDCacheQueryCompletedBlock)(UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType);
@@ -61,7 +69,7 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 @property (nonatomic, nonnull, readonly) SDImageCacheConfig *config;
 
 /**
- * 内存镜像缓存的最大“总成本”。成本函数是内存中的像素个数。
+ * 内存镜像缓存的最大“总成本”。成本函数是图像位图的字节数按每像素4字节折算的像素个数（见 `sd_memoryCost`），所以8位灰度和16位的图像比32位的图像成本更低。
  */
 @property (assign, nonatomic) NSUInteger maxMemoryCost;
 
@@ -70,6 +78,41 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 @property (assign, nonatomic) NSUInteger maxMemoryCountLimit;
 
+#pragma mark - Write Metrics
+
+/**
+ * 写入磁盘缓存的文件数和字节数。
+ */
+@property (assign, atomic, readonly) NSUInteger diskWriteCount;
+@property (assign, atomic, readonly) NSUInteger diskWriteBytes;
+
+/**
+ * 其中由编码图像(而不是原始图像数据)产生的文件数和字节数。
+ */
+@property (assign, atomic, readonly) NSUInteger encodedWriteCount;
+@property (assign, atomic, readonly) NSUInteger encodedWriteBytes;
+
+/**
+ * 直接从下载的文件移动到磁盘缓存、没有再写一次的文件数和字节数，不计入 `diskWriteCount` 和 `diskWriteBytes`。
+ */
+@property (assign, atomic, readonly) NSUInteger movedFileCount;
+@property (assign, atomic, readonly) NSUInteger movedFileBytes;
+
+/**
+ * 覆盖已存在文件的写入字节数。同一个键被重复写入时增加，与 `diskWriteBytes` 的比值反映写放大。
+ */
+@property (assign, atomic, readonly) NSUInteger overwrittenBytes;
+
+/**
+ * 因为等待编码的存储超过 `SDImageCacheConfig.maxPendingEncodes` 而被丢弃的存储数。
+ */
+@property (assign, atomic, readonly) NSUInteger droppedEncodeCount;
+
+/**
+ * 当前等待或正在编码、尚未写入磁盘的存储数。
+ */
+@property (assign, nonatomic, readonly) NSUInteger pendingEncodeCount;
+
 #pragma mark - Singleton and initialization
 
 /**
@@ -105,6 +148,11 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (void)addReadOnlyCachePath:(nonnull NSString *)path;
 
+/**
+ * 正在写入的下载文件所在的目录，在磁盘缓存目录内，因此完成的文件可以直接移动到缓存中。清理过期文件时也会删除这里过期的文件。
+ */
+@property (nonatomic, copy, nonnull, readonly) NSString *downloadingDiskCachePath;
+
 #pragma mark - Store Ops
 
 /**
@@ -140,6 +188,49 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
             toDisk:(BOOL)toDisk
         completion:(nullable SDWebImageNoParamsBlock)completionBlock;
 
+/**
+ * 异步地将以解码选项解码的图像存储在内存和磁盘缓存中。
+ * 内存缓存使用 `SDImageKeyForDecodeOptions` 返回的包含目标尺寸的键，因此同一URL的不同尺寸分别缓存。
+ * 原始图像数据存储到原始键对应的磁盘缓存；如果没有图像数据，则将缩小后的图像编码并存储到包含目标尺寸的键下。
+ *
+ * @param decodeOptions   解码图像时使用的选项，参见 `SDWebImageCoderDecodeTargetPixelSizeKey`
+ */
+- (void)storeImage:(nullable UIImage *)image
+         imageData:(nullable NSData *)imageData
+            forKey:(nullable NSString *)key
+     decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions
+            toDisk:(BOOL)toDisk
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock;
+
+/**
+ * 异步地将以解码选项解码的图像存储在内存和磁盘缓存中，并指定编码的优先级。
+ * 没有图像数据时，图像在独立的有界编码队列中按优先级编码，完成后再交给磁盘写入，因此不会阻塞磁盘读取。编码完成前，查询该键的磁盘数据会等待编码结果，而不是返回空。
+ *
+ * @param priority        编码的优先级。等待编码的存储过多时，优先级最低的存储被丢弃。
+ */
+- (void)storeImage:(nullable UIImage *)image
+         imageData:(nullable NSData *)imageData
+            forKey:(nullable NSString *)key
+     decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions
+          priority:(NSOperationQueuePriority)priority
+            toDisk:(BOOL)toDisk
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock;
+
+/**
+ * 异步地将图像存储在内存和磁盘缓存中，磁盘缓存直接使用图像数据所在的文件。
+ * 文件在IO队列中移动到键对应的缓存路径，替换已有的文件，不会再写一次数据。文件应该在 `downloadingDiskCachePath` 中，移动失败时(比如文件已被删除)写入图像数据。
+ *
+ * @param imageData       由文件映射的图像数据，参见 `SDWebImageDownloaderStreamToDisk`
+ * @param fileURL         图像数据所在的文件，为nil时与 `storeImage:imageData:forKey:decodeOptions:toDisk:completion:` 相同
+ */
+- (void)storeImage:(nullable UIImage *)image
+         imageData:(nullable NSData *)imageData
+           fileURL:(nullable NSURL *)fileURL
+            forKey:(nullable NSString *)key
+     decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions
+            toDisk:(BOOL)toDisk
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock;
+
 /**
  * 同步地将图像NSData存储到给定密钥的磁盘缓存中。
  * @param key        唯一的图像缓存键，通常是图像绝对URL。
@@ -174,6 +265,12 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key options:(SDImageCacheOptions)options done:(nullable SDCacheQueryCompletedBlock)doneBlock;
 
+/**
+ * 操作以异步方式查询缓存，并在完成时调用完成。
+ * 如果解码选项包含目标尺寸，内存缓存使用包含目标尺寸的键查询，磁盘数据直接以目标尺寸解码。
+ */
+- (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key options:(SDImageCacheOptions)options decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions done:(nullable SDCacheQueryCompletedBlock)doneBlock;
+
 /**
  * 同步查询内存缓存。
  */
@@ -10,16 +10,17 @@
 #import <CommonCrypto/CommonDigest.h>
 #import "NSImage+WebCache.h"
 #import "SDWebImageCodersManager.h"
+#import "SDWebImageAnimatedImage.h"
+#import "SDWebImageDecodeScheduler.h"
+#import "UIImage+MultiFormat.h"
+#import "SDWebImageCoderHelper.h"
 
 #define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
 #define UNLOCK(lock) dispatch_semaphore_signal(lock);
 
 FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
-#if SD_MAC
-    return image.size.height * image.size.width;
-#elif SD_UIKIT || SD_WATCH
-    return image.size.height * image.size.width * image.scale * image.scale;
-#endif
+    // 以4字节像素计算的位图字节数，BGRA图像的成本等于像素数，灰度和16位图像的成本更低
+    return MAX(1, image.sd_memoryCost / 4);
 }
 
 // A memory cache which auto purge the cache on memory warning and support weak cache.
@@ -118,6 +119,22 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 
 @end
 
+// 一个等待编码的存储。编码完成前，磁盘读取从这里获得数据
+@interface SDImageCachePendingStore : NSObject
+
+@property (nonatomic, copy, nonnull) NSString *key;
+@property (nonatomic, assign) NSOperationQueuePriority priority;
+@property (nonatomic, weak, nullable) NSOperation *operation; // 编码队列持有它直到完成
+@property (nonatomic, strong, nullable) UIImage *image; // 编码完成或取消后释放
+@property (nonatomic, strong, nullable) NSData *data; // 编码后的数据，写入前一直持有
+@property (nonatomic, copy, nullable) SDWebImageNoParamsBlock completionBlock;
+@property (nonatomic, assign, getter=isCancelled) BOOL cancelled; // 被丢弃、取代或删除，数据不会写入
+
+@end
+
+@implementation SDImageCachePendingStore
+@end
+
 @interface SDImageCache ()
 
 #pragma mark - Properties
@@ -126,6 +143,20 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 @property (strong, nonatomic, nullable) NSMutableArray<NSString *> *customPaths;
 @property (strong, nonatomic, nullable) dispatch_queue_t ioQueue;
 @property (strong, nonatomic, nonnull) NSFileManager *fileManager;
+@property (strong, nonatomic, nonnull) NSOperationQueue *encodeQueue;
+// 按磁盘键索引的所有等待中的存储，以及按提交顺序排列的尚未开始编码的存储。两者都由 `pendingStoresLock` 保护。
+@property (strong, nonatomic, nonnull) NSMutableDictionary<NSString *, SDImageCachePendingStore *> *pendingStores;
+@property (strong, nonatomic, nonnull) NSMutableArray<SDImageCachePendingStore *> *queuedEncodes;
+@property (strong, nonatomic, nonnull) dispatch_semaphore_t pendingStoresLock;
+
+@property (assign, atomic, readwrite) NSUInteger diskWriteCount;
+@property (assign, atomic, readwrite) NSUInteger diskWriteBytes;
+@property (assign, atomic, readwrite) NSUInteger encodedWriteCount;
+@property (assign, atomic, readwrite) NSUInteger encodedWriteBytes;
+@property (assign, atomic, readwrite) NSUInteger movedFileCount;
+@property (assign, atomic, readwrite) NSUInteger movedFileBytes;
+@property (assign, atomic, readwrite) NSUInteger overwrittenBytes;
+@property (assign, atomic, readwrite) NSUInteger droppedEncodeCount;
 
 @end
 
@@ -160,7 +191,15 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         // Create IO serial queue
         _ioQueue = dispatch_queue_create("com.hackemist.SDWebImageCache", DISPATCH_QUEUE_SERIAL);
         
+        // 创建编码队列，编码没有数据的图像不会阻塞IO队列上的磁盘读取
+        _encodeQueue = [NSOperationQueue new];
+        _encodeQueue.name = @"com.hackemist.SDWebImageCache.encode";
+        _pendingStores = [NSMutableDictionary dictionary];
+        _queuedEncodes = [NSMutableArray array];
+        _pendingStoresLock = dispatch_semaphore_create(1);
+        
         _config = [[SDImageCacheConfig alloc] init];
+        _encodeQueue.maxConcurrentOperationCount = _config.maxConcurrentEncodes;
         
         // Init the memory cache
         _memCache = [[SDMemoryCache alloc] init];
@@ -173,6 +212,8 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
             NSString *path = [self makeDiskCachePath:ns];
             _diskCachePath = path;
         }
+        // 隐藏目录，过期清理和大小统计会跳过它
+        _downloadingDiskCachePath = [_diskCachePath stringByAppendingPathComponent:@".downloading"];
 
         dispatch_sync(_ioQueue, ^{
             self.fileManager = [NSFileManager new];
@@ -260,33 +301,61 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
             forKey:(nullable NSString *)key
             toDisk:(BOOL)toDisk
         completion:(nullable SDWebImageNoParamsBlock)completionBlock {
+    [self storeImage:image imageData:imageData forKey:key decodeOptions:nil toDisk:toDisk completion:completionBlock];
+}
+
+- (void)storeImage:(nullable UIImage *)image
+         imageData:(nullable NSData *)imageData
+            forKey:(nullable NSString *)key
+     decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions
+            toDisk:(BOOL)toDisk
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock {
+    [self storeImage:image imageData:imageData forKey:key decodeOptions:decodeOptions priority:NSOperationQueuePriorityNormal toDisk:toDisk completion:completionBlock];
+}
+
+- (void)storeImage:(nullable UIImage *)image
+         imageData:(nullable NSData *)imageData
+            forKey:(nullable NSString *)key
+     decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions
+          priority:(NSOperationQueuePriority)priority
+            toDisk:(BOOL)toDisk
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock {
     if (!image || !key) {
         if (completionBlock) {
             completionBlock();
         }
         return;
     }
+    // 缩小尺寸解码的图像在内存缓存中使用包含目标尺寸的键
+    NSString *memoryKey = SDImageKeyForDecodeOptions(key, decodeOptions);
     // if memory cache is enabled
     if (self.config.shouldCacheImagesInMemory) {
         NSUInteger cost = SDCacheCostForImage(image);
-        [self.memCache setObject:image forKey:key cost:cost];
+        [self.memCache setObject:image forKey:memoryKey cost:cost];
     }
     
     if (toDisk) {
+        // 原始数据存储在原始键下；没有数据时编码的是缩小后的图像，不能覆盖原始键
+        if (!imageData) {
+            key = memoryKey;
+        }
+        NSData *data = imageData;
+        if (!data && [image isKindOfClass:[SDWebImageAnimatedImage class]]) {
+            // 按需解码帧的动图持有压缩数据，不需要重新编码
+            data = ((SDWebImageAnimatedImage *)image).animatedImageData;
+        }
+        if (!data) {
+            // 没有数据时在编码队列中编码，完成后再写入磁盘
+            [self enqueueEncodeForImage:image forKey:key priority:priority completion:completionBlock];
+            return;
+        }
+        // 新数据取代尚未写入的编码结果
+        LOCK(self.pendingStoresLock);
+        [self cancelPendingStore:self.pendingStores[key]];
+        UNLOCK(self.pendingStoresLock);
         dispatch_async(self.ioQueue, ^{
             @autoreleasepool {
-                NSData *data = imageData;
-                if (!data && image) {
-                    // 如果我们没有任何数据来检测图像格式，请检查它是否包含使用PNG或JPEG格式的alpha通道。
-                    SDImageFormat format;
-                    if (SDCGImageRefContainsAlpha(image.CGImage)) {
-                        format = SDImageFormatPNG;
-                    } else {
-                        format = SDImageFormatJPEG;
-                    }
-                    data = [[SDWebImageCodersManager sharedInstance] encodedDataWithImage:image format:format];
-                }
-                [self _storeImageDataToDisk:data forKey:key];
+                [self _storeImageDataToDisk:data forKey:key encoded:NO];
             }
             
             if (completionBlock) {
@@ -302,6 +371,219 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     }
 }
 
+- (void)enqueueEncodeForImage:(nonnull UIImage *)image forKey:(nonnull NSString *)key priority:(NSOperationQueuePriority)priority completion:(nullable SDWebImageNoParamsBlock)completionBlock {
+    SDImageCachePendingStore *pendingStore = [SDImageCachePendingStore new];
+    pendingStore.key = key;
+    pendingStore.priority = priority;
+    pendingStore.image = image;
+    pendingStore.completionBlock = completionBlock;
+    NSBlockOperation *operation = [NSBlockOperation blockOperationWithBlock:^{
+        [self encodePendingStore:pendingStore];
+    }];
+    operation.queuePriority = priority;
+    pendingStore.operation = operation;
+    
+    LOCK(self.pendingStoresLock);
+    [self cancelPendingStore:self.pendingStores[key]];
+    self.pendingStores[key] = pendingStore;
+    [self.queuedEncodes addObject:pendingStore];
+    NSUInteger maxPendingEncodes = self.config.maxPendingEncodes;
+    if (maxPendingEncodes > 0 && self.queuedEncodes.count > maxPendingEncodes) {
+        // 背压：丢弃优先级最低且最早提交的存储，它的图像仍在内存缓存中
+        SDImageCachePendingStore *droppedStore;
+        for (SDImageCachePendingStore *queuedStore in self.queuedEncodes) {
+            if (!droppedStore || queuedStore.priority < droppedStore.priority) {
+                droppedStore = queuedStore;
+            }
+        }
+        [self cancelPendingStore:droppedStore];
+        self.droppedEncodeCount++;
+    }
+    UNLOCK(self.pendingStoresLock);
+    
+    self.encodeQueue.maxConcurrentOperationCount = self.config.maxConcurrentEncodes;
+    [self.encodeQueue addOperation:operation];
+}
+
+// 在编码队列中调用
+- (void)encodePendingStore:(nonnull SDImageCachePendingStore *)pendingStore {
+    LOCK(self.pendingStoresLock);
+    [self.queuedEncodes removeObjectIdenticalTo:pendingStore];
+    UIImage *image = pendingStore.image;
+    UNLOCK(self.pendingStoresLock);
+    if (!image) {
+        // 已被取消
+        return;
+    }
+    
+    @autoreleasepool {
+        // 如果我们没有任何数据来检测图像格式，请检查它是否包含使用PNG或JPEG格式的alpha通道。
+        SDImageFormat format;
+        if (SDCGImageRefContainsAlpha(image.CGImage)) {
+            format = SDImageFormatPNG;
+        } else {
+            format = SDImageFormatJPEG;
+        }
+        NSData *data = [[SDWebImageCodersManager sharedInstance] encodedDataWithImage:image format:format];
+        LOCK(self.pendingStoresLock);
+        pendingStore.image = nil;
+        if (!pendingStore.isCancelled) {
+            pendingStore.data = data;
+        }
+        UNLOCK(self.pendingStoresLock);
+    }
+    
+    dispatch_async(self.ioQueue, ^{
+        LOCK(self.pendingStoresLock);
+        NSData *data = pendingStore.data;
+        SDWebImageNoParamsBlock completionBlock = pendingStore.completionBlock;
+        if (!pendingStore.isCancelled) {
+            pendingStore.completionBlock = nil;
+        } else {
+            // 等待编码期间被丢弃、取代或删除的存储已经完成了回调
+            data = nil;
+            completionBlock = nil;
+        }
+        UNLOCK(self.pendingStoresLock);
+        @autoreleasepool {
+            [self _storeImageDataToDisk:data forKey:pendingStore.key encoded:YES];
+        }
+        // 写入完成后才由磁盘文件回答读取，IO队列之外的读取不会在写入期间两边都找不到
+        LOCK(self.pendingStoresLock);
+        if (self.pendingStores[pendingStore.key] == pendingStore) {
+            [self.pendingStores removeObjectForKey:pendingStore.key];
+        }
+        pendingStore.data = nil;
+        UNLOCK(self.pendingStoresLock);
+        
+        if (completionBlock) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock();
+            });
+        }
+    });
+}
+
+// 一定要持有pendingStoresLock调用。存储的回调会立即被调用。
+- (void)cancelPendingStore:(nullable SDImageCachePendingStore *)pendingStore {
+    if (!pendingStore || pendingStore.isCancelled) {
+        return;
+    }
+    pendingStore.cancelled = YES;
+    pendingStore.image = nil;
+    pendingStore.data = nil;
+    [self.queuedEncodes removeObjectIdenticalTo:pendingStore];
+    if (self.pendingStores[pendingStore.key] == pendingStore) {
+        [self.pendingStores removeObjectForKey:pendingStore.key];
+    }
+    SDWebImageNoParamsBlock completionBlock = pendingStore.completionBlock;
+    pendingStore.completionBlock = nil;
+    if (completionBlock) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completionBlock();
+        });
+    }
+}
+
+- (BOOL)hasPendingStoreForKey:(nullable NSString *)key {
+    if (!key) {
+        return NO;
+    }
+    LOCK(self.pendingStoresLock);
+    BOOL exists = self.pendingStores[key] != nil;
+    UNLOCK(self.pendingStoresLock);
+    return exists;
+}
+
+// 返回等待写入的编码数据，编码还没有完成时返回nil。不等待编码，读取可能在IO队列上
+- (nullable NSData *)pendingStoreDataForKey:(nullable NSString *)key {
+    if (!key) {
+        return nil;
+    }
+    LOCK(self.pendingStoresLock);
+    NSData *data = self.pendingStores[key].data;
+    UNLOCK(self.pendingStoresLock);
+    return data;
+}
+
+// 返回还在等待编码的图像。读取直接使用它，不等待编码；同时提高编码的优先级，让磁盘尽快有数据
+- (nullable UIImage *)pendingStoreImageForKey:(nullable NSString *)key {
+    if (!key) {
+        return nil;
+    }
+    LOCK(self.pendingStoresLock);
+    SDImageCachePendingStore *pendingStore = self.pendingStores[key];
+    UIImage *image = pendingStore.data ? nil : pendingStore.image;
+    NSOperation *operation = pendingStore.operation;
+    UNLOCK(self.pendingStoresLock);
+    if (image) {
+        operation.queuePriority = NSOperationQueuePriorityVeryHigh;
+    }
+    return image;
+}
+
+- (NSUInteger)pendingEncodeCount {
+    LOCK(self.pendingStoresLock);
+    NSUInteger count = self.pendingStores.count;
+    UNLOCK(self.pendingStoresLock);
+    return count;
+}
+
+- (void)storeImage:(nullable UIImage *)image
+         imageData:(nullable NSData *)imageData
+           fileURL:(nullable NSURL *)fileURL
+            forKey:(nullable NSString *)key
+     decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions
+            toDisk:(BOOL)toDisk
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock {
+    if (!image || !key || !imageData || !fileURL || !toDisk) {
+        [self storeImage:image imageData:imageData forKey:key decodeOptions:decodeOptions toDisk:toDisk completion:completionBlock];
+        return;
+    }
+    if (self.config.shouldCacheImagesInMemory) {
+        NSUInteger cost = SDCacheCostForImage(image);
+        [self.memCache setObject:image forKey:SDImageKeyForDecodeOptions(key, decodeOptions) cost:cost];
+    }
+    // 新数据取代尚未写入的编码结果
+    LOCK(self.pendingStoresLock);
+    [self cancelPendingStore:self.pendingStores[key]];
+    UNLOCK(self.pendingStoresLock);
+    dispatch_async(self.ioQueue, ^{
+        @autoreleasepool {
+            // 移动文件之前数据一直映射着文件
+            if (![self _moveImageFileAtURL:fileURL length:imageData.length forKey:key]) {
+                [self _storeImageDataToDisk:imageData forKey:key encoded:NO];
+            }
+        }
+        
+        if (completionBlock) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock();
+            });
+        }
+    });
+}
+
+// 一定要通过调用方调用表单io队列。
+- (BOOL)_moveImageFileAtURL:(nonnull NSURL *)fileURL length:(NSUInteger)length forKey:(nonnull NSString *)key {
+    if (![self.fileManager fileExistsAtPath:_diskCachePath]) {
+        [self.fileManager createDirectoryAtPath:_diskCachePath withIntermediateDirectories:YES attributes:nil error:NULL];
+    }
+    NSURL *cacheURL = [NSURL fileURLWithPath:[self defaultCachePathForKey:key]];
+    // rename(2) 原子地替换已存在的文件，读取看到的是旧文件或新文件
+    if (rename(fileURL.fileSystemRepresentation, cacheURL.fileSystemRepresentation) != 0) {
+        return NO;
+    }
+    self.movedFileCount++;
+    self.movedFileBytes += length;
+    
+    // 禁用iCloud备份
+    if (self.config.shouldDisableiCloud) {
+        [cacheURL setResourceValue:@YES forKey:NSURLIsExcludedFromBackupKey error:nil];
+    }
+    return YES;
+}
+
 - (void)storeImageDataToDisk:(nullable NSData *)imageData forKey:(nullable NSString *)key {
     if (!imageData || !key) {
         return;
@@ -313,6 +595,11 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 
 // 一定要通过调用方调用表单io队列。
 - (void)_storeImageDataToDisk:(nullable NSData *)imageData forKey:(nullable NSString *)key {
+    [self _storeImageDataToDisk:imageData forKey:key encoded:NO];
+}
+
+// 一定要通过调用方调用表单io队列。
+- (void)_storeImageDataToDisk:(nullable NSData *)imageData forKey:(nullable NSString *)key encoded:(BOOL)encoded {
     if (!imageData || !key) {
         return;
     }
@@ -326,7 +613,19 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     // 变换NSUrl
     NSURL *fileURL = [NSURL fileURLWithPath:cachePathForKey];
     
-    [imageData writeToURL:fileURL options:self.config.diskCacheWritingOptions error:nil];
+    BOOL overwrite = [self.fileManager fileExistsAtPath:cachePathForKey];
+    if (![imageData writeToURL:fileURL options:self.config.diskCacheWritingOptions error:nil]) {
+        return;
+    }
+    self.diskWriteCount++;
+    self.diskWriteBytes += imageData.length;
+    if (encoded) {
+        self.encodedWriteCount++;
+        self.encodedWriteBytes += imageData.length;
+    }
+    if (overwrite) {
+        self.overwrittenBytes += imageData.length;
+    }
     
     // 禁用iCloud备份
     if (self.config.shouldDisableiCloud) {
@@ -364,7 +663,8 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     if (!key) {
         return NO;
     }
-    BOOL exists = [self.fileManager fileExistsAtPath:[self defaultCachePathForKey:key]];
+    // 等待编码的存储也算作存在
+    BOOL exists = [self hasPendingStoreForKey:key] || [self.fileManager fileExistsAtPath:[self defaultCachePathForKey:key]];
     
     //由于https://github.com/rs/SDWebImage/pull/976，它增加了磁盘文件名的扩展名。
     //检查钥匙是否有延期。
@@ -402,8 +702,14 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 }
 
 - (nullable NSData *)diskImageDataBySearchingAllPathsForKey:(nullable NSString *)key {
+    // 尚未写入磁盘的存储
+    NSData *data = [self pendingStoreDataForKey:key];
+    if (data) {
+        return data;
+    }
+
     NSString *defaultPath = [self defaultCachePathForKey:key];
-    NSData *data = [NSData dataWithContentsOfFile:defaultPath options:self.config.diskCacheReadingOptions error:nil];
+    data = [NSData dataWithContentsOfFile:defaultPath options:self.config.diskCacheReadingOptions error:nil];
     if (data) {
         return data;
     }
@@ -435,6 +741,10 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 }
 
 - (nullable UIImage *)diskImageForKey:(nullable NSString *)key {
+    UIImage *pendingImage = [self pendingStoreImageForKey:key];
+    if (pendingImage) {
+        return pendingImage;
+    }
     NSData *data = [self diskImageDataBySearchingAllPathsForKey:key];
     return [self diskImageForKey:key data:data];
 }
@@ -444,12 +754,16 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 }
 
 - (nullable UIImage *)diskImageForKey:(nullable NSString *)key data:(nullable NSData *)data options:(SDImageCacheOptions)options {
+    return [self diskImageForKey:key data:data options:options decodeOptions:nil];
+}
+
+- (nullable UIImage *)diskImageForKey:(nullable NSString *)key data:(nullable NSData *)data options:(SDImageCacheOptions)options decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions {
     if (data) {
-        UIImage *image = [[SDWebImageCodersManager sharedInstance] decodedImageWithData:data];
+        UIImage *image = [[SDWebImageCodersManager sharedInstance] decodedImageWithData:data options:decodeOptions];
         image = [self scaledImageForKey:key image:image];
         if (self.config.shouldDecompressImages) {
             BOOL shouldScaleDown = options & SDImageCacheScaleDownLargeImages;
-            image = [[SDWebImageCodersManager sharedInstance] decompressedImageWithImage:image data:&data options:@{SDWebImageCoderScaleDownLargeImagesKey: @(shouldScaleDown)}];
+            image = [[SDWebImageCodersManager sharedInstance] decompressedImageWithImage:image data:&data options:[SDWebImageCoderHelper decompressionOptionsWithDecodeOptions:decodeOptions scaleDownLargeImages:shouldScaleDown]];
         }
         return image;
     } else {
@@ -466,6 +780,10 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 }
 
 - (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key options:(SDImageCacheOptions)options done:(nullable SDCacheQueryCompletedBlock)doneBlock {
+    return [self queryCacheOperationForKey:key options:options decodeOptions:nil done:doneBlock];
+}
+
+- (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key options:(SDImageCacheOptions)options decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions done:(nullable SDCacheQueryCompletedBlock)doneBlock {
     if (!key) {
         if (doneBlock) {
             doneBlock(nil, nil, SDImageCacheTypeNone);
@@ -473,8 +791,9 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         return nil;
     }
     
+    NSString *memoryKey = SDImageKeyForDecodeOptions(key, decodeOptions);
     // First check the in-memory cache...
-    UIImage *image = [self imageFromMemoryCacheForKey:key];
+    UIImage *image = [self imageFromMemoryCacheForKey:memoryKey];
     BOOL shouldQueryMemoryOnly = (image && !(options & SDImageCacheQueryDataWhenInMemory));
     if (shouldQueryMemoryOnly) {
         if (doneBlock) {
@@ -491,19 +810,48 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         }
         
         @autoreleasepool {
-            NSData *diskData = [self diskImageDataBySearchingAllPathsForKey:key];
+            // 还在编码的存储不必等待编码和解码，它的图像就是结果
+            UIImage *pendingImage = (!image && [memoryKey isEqualToString:key]) ? [self pendingStoreImageForKey:key] : nil;
+            if (pendingImage) {
+                if (self.config.shouldCacheImagesInMemory) {
+                    NSUInteger cost = SDCacheCostForImage(pendingImage);
+                    [self.memCache setObject:pendingImage forKey:memoryKey cost:cost];
+                }
+                if (doneBlock) {
+                    if (options & SDImageCacheQueryDiskSync) {
+                        doneBlock(pendingImage, nil, SDImageCacheTypeDisk);
+                    } else {
+                        dispatch_async(dispatch_get_main_queue(), ^{
+                            doneBlock(pendingImage, nil, SDImageCacheTypeDisk);
+                        });
+                    }
+                }
+                return;
+            }
+            NSData *diskData;
+            if (![memoryKey isEqualToString:key]) {
+                // 没有原始数据时，缩小后的图像存储在包含目标尺寸的键下
+                diskData = [self diskImageDataBySearchingAllPathsForKey:memoryKey];
+            }
+            if (!diskData) {
+                diskData = [self diskImageDataBySearchingAllPathsForKey:key];
+            }
             UIImage *diskImage;
             SDImageCacheType cacheType = SDImageCacheTypeDisk;
             if (image) {
                 // 图像来自内存中的缓存。
                 diskImage = image;
                 cacheType = SDImageCacheTypeMemory;
+            } else if (diskData && !(options & SDImageCacheQueryDiskSync)) {
+                // 异步查询在共享的解码调度器中解码，不阻塞IO队列
+                [self scheduleDecodeForKey:key memoryKey:memoryKey data:diskData options:options decodeOptions:decodeOptions operation:operation done:doneBlock];
+                return;
             } else if (diskData) {
                 // 只有在内存缓存丢失时才解码图像数据。
-                diskImage = [self diskImageForKey:key data:diskData options:options];
+                diskImage = [self diskImageForKey:key data:diskData options:options decodeOptions:decodeOptions];
                 if (diskImage && self.config.shouldCacheImagesInMemory) {
                     NSUInteger cost = SDCacheCostForImage(diskImage);
-                    [self.memCache setObject:diskImage forKey:key cost:cost];
+                    [self.memCache setObject:diskImage forKey:memoryKey cost:cost];
                 }
             }
             
@@ -528,6 +876,32 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     return operation;
 }
 
+- (void)scheduleDecodeForKey:(nonnull NSString *)key memoryKey:(nonnull NSString *)memoryKey data:(nonnull NSData *)data options:(SDImageCacheOptions)options decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions operation:(nonnull NSOperation *)operation done:(nullable SDCacheQueryCompletedBlock)doneBlock {
+    SDWebImageDecodePriority priority = SDWebImageDecodePriorityDefault;
+    if (options & SDImageCacheHighPriority) {
+        priority = SDWebImageDecodePriorityHigh;
+    } else if (options & SDImageCacheLowPriority) {
+        priority = SDWebImageDecodePriorityLow;
+    }
+    NSUInteger estimatedBytes = [SDWebImageDecodeScheduler estimatedDecodedBytesForData:data options:decodeOptions];
+    [[SDWebImageDecodeScheduler sharedScheduler] scheduleDecodeWithEstimatedBytes:estimatedBytes priority:priority block:^{
+        if (operation.isCancelled) {
+            // do not call the completion if cancelled
+            return;
+        }
+        UIImage *diskImage = [self diskImageForKey:key data:data options:options decodeOptions:decodeOptions];
+        if (diskImage && self.config.shouldCacheImagesInMemory) {
+            NSUInteger cost = SDCacheCostForImage(diskImage);
+            [self.memCache setObject:diskImage forKey:memoryKey cost:cost];
+        }
+        if (doneBlock) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                doneBlock(diskImage, data, SDImageCacheTypeDisk);
+            });
+        }
+    }];
+}
+
 #pragma mark - Remove Ops
 
 - (void)removeImageForKey:(nullable NSString *)key withCompletion:(nullable SDWebImageNoParamsBlock)completion {
@@ -544,6 +918,9 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     }
 
     if (fromDisk) {
+        LOCK(self.pendingStoresLock);
+        [self cancelPendingStore:self.pendingStores[key]];
+        UNLOCK(self.pendingStoresLock);
         dispatch_async(self.ioQueue, ^{
             [self.fileManager removeItemAtPath:[self defaultCachePathForKey:key] error:nil];
             
@@ -584,8 +961,20 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 }
 
 - (void)clearDiskOnCompletion:(nullable SDWebImageNoParamsBlock)completion {
+    LOCK(self.pendingStoresLock);
+    for (SDImageCachePendingStore *pendingStore in self.pendingStores.allValues) {
+        [self cancelPendingStore:pendingStore];
+    }
+    UNLOCK(self.pendingStoresLock);
     dispatch_async(self.ioQueue, ^{
-        [self.fileManager removeItemAtPath:self.diskCachePath error:nil];
+        // 正在进行的下载还在写入 `downloadingDiskCachePath`，留给过期清理处理
+        NSString *downloadingDirectoryName = self.downloadingDiskCachePath.lastPathComponent;
+        for (NSString *fileName in [self.fileManager contentsOfDirectoryAtPath:self.diskCachePath error:nil]) {
+            if ([fileName isEqualToString:downloadingDirectoryName]) {
+                continue;
+            }
+            [self.fileManager removeItemAtPath:[self.diskCachePath stringByAppendingPathComponent:fileName] error:nil];
+        }
         [self.fileManager createDirectoryAtPath:self.diskCachePath
                 withIntermediateDirectories:YES
                                  attributes:nil
@@ -607,6 +996,16 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     dispatch_async(self.ioQueue, ^{
         NSURL *diskCacheURL = [NSURL fileURLWithPath:self.diskCachePath isDirectory:YES];
         NSArray<NSString *> *resourceKeys = @[NSURLIsDirectoryKey, NSURLContentModificationDateKey, NSURLTotalFileAllocatedSizeKey];
+        
+        // 崩溃遗留的下载，正在进行的下载会持续写入
+        NSDate *downloadExpirationDate = [NSDate dateWithTimeIntervalSinceNow:-self.config.maxCacheAge];
+        for (NSURL *fileURL in [self.fileManager contentsOfDirectoryAtURL:[NSURL fileURLWithPath:self.downloadingDiskCachePath isDirectory:YES] includingPropertiesForKeys:@[NSURLContentModificationDateKey] options:0 error:nil]) {
+            NSDate *modificationDate;
+            [fileURL getResourceValue:&modificationDate forKey:NSURLContentModificationDateKey error:nil];
+            if ([modificationDate compare:downloadExpirationDate] == NSOrderedAscending) {
+                [self.fileManager removeItemAtURL:fileURL error:nil];
+            }
+        }
 
         // 这个枚举器为我们的缓存文件预取有用的属性。
         NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtURL:diskCacheURL
@@ -709,11 +1108,15 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 - (NSUInteger)getSize {
     __block NSUInteger size = 0;
     dispatch_sync(self.ioQueue, ^{
-        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtPath:self.diskCachePath];
-        for (NSString *fileName in fileEnumerator) {
-            NSString *filePath = [self.diskCachePath stringByAppendingPathComponent:fileName];
-            NSDictionary<NSString *, id> *attrs = [self.fileManager attributesOfItemAtPath:filePath error:nil];
-            size += [attrs fileSize];
+        // 与过期清理一样，跳过隐藏的进行中的下载
+        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtURL:[NSURL fileURLWithPath:self.diskCachePath isDirectory:YES]
+                                                       includingPropertiesForKeys:@[NSURLFileSizeKey]
+                                                                          options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                     errorHandler:NULL];
+        for (NSURL *fileURL in fileEnumerator) {
+            NSNumber *fileSize;
+            [fileURL getResourceValue:&fileSize forKey:NSURLFileSizeKey error:NULL];
+            size += fileSize.unsignedIntegerValue;
         }
     });
     return size;
@@ -722,7 +1125,10 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 - (NSUInteger)getDiskCount {
     __block NSUInteger count = 0;
     dispatch_sync(self.ioQueue, ^{
-        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtPath:self.diskCachePath];
+        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtURL:[NSURL fileURLWithPath:self.diskCachePath isDirectory:YES]
+                                                       includingPropertiesForKeys:@[]
+                                                                          options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                     errorHandler:NULL];
         count = fileEnumerator.allObjects.count;
     });
     return count;
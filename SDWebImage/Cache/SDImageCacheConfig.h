@@ -49,4 +49,16 @@
  */
 @property (assign, nonatomic) NSUInteger maxCacheSize;
 
+/**
+ * 没有图像数据时，存储到磁盘前编码图像的最大并发数。编码在独立的队列中进行，不会阻塞磁盘读取。
+ * 默认为活动处理器数量的一半，至少为1。
+ */
+@property (assign, nonatomic) NSInteger maxConcurrentEncodes;
+
+/**
+ * 等待编码的存储的最大数量。超过时，优先级最低且最早提交的存储被丢弃，图像仍保留在内存缓存中。
+ * 默认为32。0表示不限制。
+ */
+@property (assign, nonatomic) NSUInteger maxPendingEncodes;
+
 @end
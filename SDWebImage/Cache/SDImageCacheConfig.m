@@ -9,6 +9,7 @@
 #import "SDImageCacheConfig.h"
 
 static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
+static const NSUInteger kDefaultCacheMaxPendingEncodes = 32;
 
 @implementation SDImageCacheConfig
 
@@ -21,6 +22,8 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
         _diskCacheWritingOptions = NSDataWritingAtomic;
         _maxCacheAge = kDefaultCacheMaxCacheAge;
         _maxCacheSize = 0;
+        _maxConcurrentEncodes = MAX([NSProcessInfo processInfo].activeProcessorCount / 2, 1);
+        _maxPendingEncodes = kDefaultCacheMaxPendingEncodes;
     }
     return self;
 }
@@ -9,6 +9,8 @@
 #import "SDWebImageCompat.h"
 #import "NSData+ImageContentType.h"
 
+@class SDWebImageFrame;
+
 @interface UIImage (MultiFormat)
 
 /**
@@ -23,6 +25,19 @@
  */
 @property (nonatomic, assign) NSUInteger sd_imageLoopCount;
 
+/**
+ * 动图的帧时间线：每个不同的帧和它的时长，没有重复。
+ * 由 `SDWebImageCoderHelper animatedImageWithFrames:` 设置。UIKit的 `images` 数组为了播放会重复帧，而这个属性保存精确的帧和时长，用于缓存开销计算和重新编码。
+ * 静态图像或者不是由SDWebImage创建的动图为nil。
+ */
+@property (nonatomic, copy, nullable) NSArray<SDWebImageFrame *> *sd_imageFrames;
+
+/**
+ * 图像位图占用的内存字节数，即每个不同帧的CGImage的每行字节数乘以高度之和。
+ * 反映解码时选择的像素格式（8位灰度、16位或32位），内存缓存用它计算开销。按需解码帧的动图只计算第一帧。
+ */
+@property (nonatomic, assign, readonly) NSUInteger sd_memoryCost;
+
 + (nullable UIImage *)sd_imageWithData:(nullable NSData *)data;
 - (nullable NSData *)sd_imageData;
 - (nullable NSData *)sd_imageDataAsFormat:(SDImageFormat)imageFormat;
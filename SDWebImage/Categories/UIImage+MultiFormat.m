@@ -10,6 +10,15 @@
 
 #import "objc/runtime.h"
 #import "SDWebImageCodersManager.h"
+#import "SDWebImageFrame.h"
+#import "NSImage+WebCache.h"
+
+static NSUInteger SDMemoryCostForCGImage(CGImageRef imageRef) {
+    if (!imageRef) {
+        return 0;
+    }
+    return CGImageGetBytesPerRow(imageRef) * CGImageGetHeight(imageRef);
+}
 
 @implementation UIImage (MultiFormat)
 
@@ -53,6 +62,36 @@
 }
 #endif
 
+- (NSArray<SDWebImageFrame *> *)sd_imageFrames {
+    return objc_getAssociatedObject(self, @selector(sd_imageFrames));
+}
+
+- (void)setSd_imageFrames:(NSArray<SDWebImageFrame *> *)sd_imageFrames {
+    objc_setAssociatedObject(self, @selector(sd_imageFrames), sd_imageFrames, OBJC_ASSOCIATION_COPY_NONATOMIC);
+}
+
+- (NSUInteger)sd_memoryCost {
+    // Only the distinct frames own a bitmap, the repeated entries of `images` share them
+    NSArray<SDWebImageFrame *> *frames = self.sd_imageFrames;
+    if (frames.count > 0) {
+        NSUInteger cost = 0;
+        for (SDWebImageFrame *frame in frames) {
+            cost += SDMemoryCostForCGImage(frame.image.CGImage);
+        }
+        return cost;
+    }
+    NSUInteger cost = SDMemoryCostForCGImage(self.CGImage);
+#if SD_UIKIT || SD_WATCH
+    if (self.images.count > 1) {
+        cost = 0;
+        for (UIImage *image in [NSSet setWithArray:self.images]) {
+            cost += SDMemoryCostForCGImage(image.CGImage);
+        }
+    }
+#endif
+    return cost;
+}
+
 + (nullable UIImage *)sd_imageWithData:(nullable NSData *)data {
     return [[SDWebImageCodersManager sharedInstance] decodedImageWithData:data];
 }
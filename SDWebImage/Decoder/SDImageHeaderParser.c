@@ -0,0 +1,501 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#include "SDImageHeaderParser.h"
+#include <string.h>
+
+// All the readers expect the caller to have checked that the bytes are available
+
+static inline uint16_t SDReadBE16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t SDReadBE32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint16_t SDReadLE16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint32_t SDReadLE24(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+}
+
+static inline uint32_t SDReadLE32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// True if `count` bytes are available at `pos`, without overflowing
+static inline bool SDHasBytes(size_t length, size_t pos, size_t count) {
+    return pos <= length && length - pos >= count;
+}
+
+static bool SDIsHEIFBrand(const uint8_t *brand) {
+    static const char *brands[] = {"heic", "heix", "hevc", "hevx", "heim", "heis", "mif1", "msf1"};
+    for (size_t i = 0; i < sizeof(brands) / sizeof(brands[0]); i++) {
+        if (memcmp(brand, brands[i], 4) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+SDImageHeaderFormat SDImageHeaderGetFormat(const uint8_t *bytes, size_t length) {
+    if (!bytes) {
+        return SDImageHeaderFormatUnknown;
+    }
+    if (length >= 3 && bytes[0] == 0xFF && bytes[1] == 0xD8 && bytes[2] == 0xFF) {
+        return SDImageHeaderFormatJPEG;
+    }
+    if (length >= 8 && memcmp(bytes, "\x89PNG\r\n\x1A\n", 8) == 0) {
+        return SDImageHeaderFormatPNG;
+    }
+    if (length >= 6 && (memcmp(bytes, "GIF87a", 6) == 0 || memcmp(bytes, "GIF89a", 6) == 0)) {
+        return SDImageHeaderFormatGIF;
+    }
+    if (length >= 12 && memcmp(bytes, "RIFF", 4) == 0 && memcmp(bytes + 8, "WEBP", 4) == 0) {
+        return SDImageHeaderFormatWebP;
+    }
+    if (length >= 12 && memcmp(bytes + 4, "ftyp", 4) == 0 && SDIsHEIFBrand(bytes + 8)) {
+        return SDImageHeaderFormatHEIF;
+    }
+    return SDImageHeaderFormatUnknown;
+}
+
+#pragma mark - EXIF
+
+// Read the orientation tag of the first IFD of a TIFF structure, the payload of EXIF blocks. Truncated or malformed structures give 1.
+static uint8_t SDParseTIFFOrientation(const uint8_t *tiff, size_t length) {
+    if (length < 8) {
+        return 1;
+    }
+    bool bigEndian;
+    if (tiff[0] == 'M' && tiff[1] == 'M') {
+        bigEndian = true;
+    } else if (tiff[0] == 'I' && tiff[1] == 'I') {
+        bigEndian = false;
+    } else {
+        return 1;
+    }
+    uint16_t magic = bigEndian ? SDReadBE16(tiff + 2) : SDReadLE16(tiff + 2);
+    if (magic != 42) {
+        return 1;
+    }
+    size_t ifd = bigEndian ? SDReadBE32(tiff + 4) : SDReadLE32(tiff + 4);
+    if (!SDHasBytes(length, ifd, 2)) {
+        return 1;
+    }
+    uint16_t entryCount = bigEndian ? SDReadBE16(tiff + ifd) : SDReadLE16(tiff + ifd);
+    for (uint16_t i = 0; i < entryCount; i++) {
+        size_t entry = ifd + 2 + (size_t)i * 12;
+        if (!SDHasBytes(length, entry, 12)) {
+            break;
+        }
+        uint16_t tag = bigEndian ? SDReadBE16(tiff + entry) : SDReadLE16(tiff + entry);
+        if (tag != 0x0112) {
+            continue;
+        }
+        // A SHORT stored in the first bytes of the value field
+        uint16_t orientation = bigEndian ? SDReadBE16(tiff + entry + 8) : SDReadLE16(tiff + entry + 8);
+        return (orientation >= 1 && orientation <= 8) ? (uint8_t)orientation : 1;
+    }
+    return 1;
+}
+
+// EXIF blocks of JPEG APP1 start with this identifier, WebP and PNG blocks usually not
+static uint8_t SDParseEXIFOrientation(const uint8_t *exif, size_t length) {
+    if (length >= 6 && memcmp(exif, "Exif\0\0", 6) == 0) {
+        exif += 6;
+        length -= 6;
+    }
+    return SDParseTIFFOrientation(exif, length);
+}
+
+#pragma mark - JPEG
+
+static SDImageHeaderStatus SDParseJPEG(const uint8_t *bytes, size_t length, SDImageHeaderInfo *info) {
+    size_t pos = 2;
+    bool foundEXIF = false;
+    while (true) {
+        // Markers can be preceded by fill bytes
+        while (pos < length && bytes[pos] == 0xFF && pos + 1 < length && bytes[pos + 1] == 0xFF) {
+            pos++;
+        }
+        if (!SDHasBytes(length, pos, 2)) {
+            return SDImageHeaderStatusNeedMoreData;
+        }
+        if (bytes[pos] != 0xFF) {
+            return SDImageHeaderStatusUnsupported;
+        }
+        uint8_t marker = bytes[pos + 1];
+        pos += 2;
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+            // Standalone markers
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA) {
+            // End of image or start of scan before any frame header
+            return SDImageHeaderStatusUnsupported;
+        }
+        if (!SDHasBytes(length, pos, 2)) {
+            return SDImageHeaderStatusNeedMoreData;
+        }
+        size_t segmentLength = SDReadBE16(bytes + pos);
+        if (segmentLength < 2) {
+            return SDImageHeaderStatusUnsupported;
+        }
+        const uint8_t *segment = bytes + pos + 2;
+        size_t available = length - pos - 2;
+        size_t segmentDataLength = segmentLength - 2;
+        if (marker == 0xE1 && !foundEXIF) {
+            // APP1 also holds XMP packets, only the first EXIF block has the orientation. It is in the first IFD, before the thumbnail, so a truncated segment is usually enough
+            size_t exifLength = segmentDataLength < available ? segmentDataLength : available;
+            if (exifLength >= 6 && memcmp(segment, "Exif\0\0", 6) == 0) {
+                info->orientation = SDParseTIFFOrientation(segment + 6, exifLength - 6);
+                foundEXIF = true;
+            }
+        } else if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            // Start of frame, all but the huffman table, arithmetic coding conditioning and the extension markers
+            if (available < 6) {
+                return SDImageHeaderStatusNeedMoreData;
+            }
+            info->height = SDReadBE16(segment + 1);
+            info->width = SDReadBE16(segment + 3);
+            info->isGray = segment[5] == 1;
+            info->isProgressive = marker == 0xC2 || marker == 0xC6 || marker == 0xCA || marker == 0xCE;
+            return (info->width > 0 && info->height > 0) ? SDImageHeaderStatusOK : SDImageHeaderStatusUnsupported;
+        }
+        pos += segmentLength;
+    }
+}
+
+#pragma mark - PNG
+
+static SDImageHeaderStatus SDParsePNG(const uint8_t *bytes, size_t length, SDImageHeaderInfo *info) {
+    // Signature, then the IHDR chunk: length, type, width, height, bit depth, color type, compression, filter, interlace
+    if (length < 8 + 8 + 13) {
+        return SDImageHeaderStatusNeedMoreData;
+    }
+    if (memcmp(bytes + 12, "IHDR", 4) != 0) {
+        return SDImageHeaderStatusUnsupported;
+    }
+    info->width = SDReadBE32(bytes + 16);
+    info->height = SDReadBE32(bytes + 20);
+    uint8_t colorType = bytes[25];
+    info->hasAlpha = colorType == 4 || colorType == 6;
+    info->isGray = colorType == 0 || colorType == 4;
+    info->isProgressive = bytes[28] == 1;
+    if (info->width == 0 || info->height == 0) {
+        return SDImageHeaderStatusUnsupported;
+    }
+
+    // The ancillary chunks we need come before the image data
+    size_t pos = 8 + 12 + 13;
+    while (SDHasBytes(length, pos, 8)) {
+        size_t chunkLength = SDReadBE32(bytes + pos);
+        const uint8_t *type = bytes + pos + 4;
+        const uint8_t *data = bytes + pos + 8;
+        size_t available = length - pos - 8;
+        if (memcmp(type, "IDAT", 4) == 0) {
+            break;
+        }
+        if (memcmp(type, "tRNS", 4) == 0) {
+            info->hasAlpha = true;
+        } else if (memcmp(type, "acTL", 4) == 0 && available >= 4) {
+            info->frameCount = SDReadBE32(data);
+        } else if (memcmp(type, "eXIf", 4) == 0) {
+            info->orientation = SDParseEXIFOrientation(data, chunkLength < available ? chunkLength : available);
+        }
+        if (chunkLength > length) {
+            break;
+        }
+        pos += 12 + chunkLength;
+    }
+    if (info->frameCount == 0) {
+        info->frameCount = 1;
+    }
+    return SDImageHeaderStatusOK;
+}
+
+#pragma mark - GIF
+
+// Skip a sequence of data sub-blocks, return the position after the terminator or `length` if truncated
+static size_t SDSkipGIFSubBlocks(const uint8_t *bytes, size_t length, size_t pos) {
+    while (pos < length) {
+        uint8_t size = bytes[pos];
+        pos += 1 + size;
+        if (size == 0) {
+            return pos;
+        }
+    }
+    return length;
+}
+
+static SDImageHeaderStatus SDParseGIF(const uint8_t *bytes, size_t length, SDImageHeaderInfo *info) {
+    // Signature, then the logical screen descriptor: width, height, flags, background color, aspect ratio
+    if (length < 13) {
+        return SDImageHeaderStatusNeedMoreData;
+    }
+    info->width = SDReadLE16(bytes + 6);
+    info->height = SDReadLE16(bytes + 8);
+    if (info->width == 0 || info->height == 0) {
+        return SDImageHeaderStatusUnsupported;
+    }
+    uint8_t flags = bytes[10];
+    size_t pos = 13;
+    if (flags & 0x80) {
+        pos += 3 * ((size_t)1 << ((flags & 0x07) + 1));
+    }
+
+    // Count the image descriptors
+    uint32_t frameCount = 0;
+    while (pos < length) {
+        uint8_t introducer = bytes[pos];
+        if (introducer == 0x21) {
+            if (!SDHasBytes(length, pos, 2)) {
+                break;
+            }
+            // A graphic control extension with the transparent color flag
+            if (bytes[pos + 1] == 0xF9 && SDHasBytes(length, pos, 4) && (bytes[pos + 3] & 0x01)) {
+                info->hasAlpha = true;
+            }
+            pos = SDSkipGIFSubBlocks(bytes, length, pos + 2);
+        } else if (introducer == 0x2C) {
+            // Image descriptor: left, top, width, height, flags, then the local color table and the LZW code size
+            if (!SDHasBytes(length, pos, 10)) {
+                break;
+            }
+            uint8_t imageFlags = bytes[pos + 9];
+            if (frameCount == 0) {
+                info->isProgressive = (imageFlags & 0x40) != 0;
+            }
+            frameCount++;
+            pos += 10;
+            if (imageFlags & 0x80) {
+                pos += 3 * ((size_t)1 << ((imageFlags & 0x07) + 1));
+            }
+            pos = SDSkipGIFSubBlocks(bytes, length, pos + 1);
+        } else {
+            // Trailer or garbage
+            break;
+        }
+    }
+    info->frameCount = frameCount > 0 ? frameCount : 1;
+    return SDImageHeaderStatusOK;
+}
+
+#pragma mark - WebP
+
+static SDImageHeaderStatus SDParseWebP(const uint8_t *bytes, size_t length, SDImageHeaderInfo *info) {
+    // RIFF header, then the first chunk: fourcc, size, data
+    if (length < 12 + 8) {
+        return SDImageHeaderStatusNeedMoreData;
+    }
+    const uint8_t *type = bytes + 12;
+    const uint8_t *data = bytes + 20;
+    size_t available = length - 20;
+    if (memcmp(type, "VP8 ", 4) == 0) {
+        // Frame tag, start code, then the 14-bit sizes with 2 bits of scaling
+        if (available < 10) {
+            return SDImageHeaderStatusNeedMoreData;
+        }
+        if (data[3] != 0x9D || data[4] != 0x01 || data[5] != 0x2A) {
+            return SDImageHeaderStatusUnsupported;
+        }
+        info->width = SDReadLE16(data + 6) & 0x3FFF;
+        info->height = SDReadLE16(data + 8) & 0x3FFF;
+    } else if (memcmp(type, "VP8L", 4) == 0) {
+        // Signature, then 14 bits of width - 1, 14 bits of height - 1 and the alpha hint
+        if (available < 5) {
+            return SDImageHeaderStatusNeedMoreData;
+        }
+        if (data[0] != 0x2F) {
+            return SDImageHeaderStatusUnsupported;
+        }
+        uint32_t bits = SDReadLE32(data + 1);
+        info->width = (bits & 0x3FFF) + 1;
+        info->height = ((bits >> 14) & 0x3FFF) + 1;
+        info->hasAlpha = (bits >> 28) & 0x01;
+    } else if (memcmp(type, "VP8X", 4) == 0) {
+        // Flags, reserved bytes, then the 24-bit canvas width - 1 and height - 1
+        if (available < 10) {
+            return SDImageHeaderStatusNeedMoreData;
+        }
+        uint8_t flags = data[0];
+        info->hasAlpha = (flags & 0x10) != 0;
+        info->width = SDReadLE24(data + 4) + 1;
+        info->height = SDReadLE24(data + 7) + 1;
+        bool animated = (flags & 0x02) != 0;
+        bool hasEXIF = (flags & 0x08) != 0;
+        if (animated || hasEXIF) {
+            // Walk the chunks, the EXIF chunk comes after the image data
+            uint32_t frameCount = 0;
+            size_t pos = 12;
+            while (SDHasBytes(length, pos, 8)) {
+                size_t chunkLength = SDReadLE32(bytes + pos + 4);
+                if (memcmp(bytes + pos, "ANMF", 4) == 0) {
+                    frameCount++;
+                } else if (memcmp(bytes + pos, "EXIF", 4) == 0) {
+                    size_t chunkAvailable = length - pos - 8;
+                    info->orientation = SDParseEXIFOrientation(bytes + pos + 8, chunkLength < chunkAvailable ? chunkLength : chunkAvailable);
+                }
+                if (chunkLength > length) {
+                    break;
+                }
+                // Chunks are padded to an even size
+                pos += 8 + chunkLength + (chunkLength & 1);
+            }
+            if (animated && frameCount > 0) {
+                info->frameCount = frameCount;
+            }
+        }
+    } else {
+        return SDImageHeaderStatusUnsupported;
+    }
+    return (info->width > 0 && info->height > 0) ? SDImageHeaderStatusOK : SDImageHeaderStatusUnsupported;
+}
+
+#pragma mark - HEIF
+
+// Find the first box of `type` in [pos, end), return its payload range. `truncated` is set when the box may be after the `length` bytes passed.
+static bool SDFindBox(const uint8_t *bytes, size_t length, size_t pos, size_t end, const char *type, size_t *payload, size_t *payloadEnd, bool *truncated) {
+    while (SDHasBytes(end, pos, 8)) {
+        uint64_t size = SDReadBE32(bytes + pos);
+        size_t header = 8;
+        if (size == 1) {
+            if (!SDHasBytes(end, pos, 16)) {
+                break;
+            }
+            size = (uint64_t)SDReadBE32(bytes + pos + 8) << 32 | SDReadBE32(bytes + pos + 12);
+            header = 16;
+        } else if (size == 0) {
+            // The box extends to the end of the file
+            size = end - pos;
+        }
+        if (size < header) {
+            return false;
+        }
+        if (memcmp(bytes + pos + 4, type, 4) == 0) {
+            *payload = pos + header;
+            if (size > end - pos) {
+                *payloadEnd = end;
+                *truncated = true;
+            } else {
+                *payloadEnd = pos + (size_t)size;
+            }
+            return true;
+        }
+        if (size > end - pos) {
+            break;
+        }
+        pos += (size_t)size;
+    }
+    *truncated = end == length;
+    return false;
+}
+
+static SDImageHeaderStatus SDParseHEIF(const uint8_t *bytes, size_t length, SDImageHeaderInfo *info) {
+    // meta is a full box (version and flags), iprp and ipco are plain containers
+    size_t metaStart, metaEnd, iprpStart, iprpEnd, ipcoStart, ipcoEnd;
+    bool truncated = false;
+    if (!SDFindBox(bytes, length, 0, length, "meta", &metaStart, &metaEnd, &truncated) ||
+        !SDFindBox(bytes, length, metaStart + 4, metaEnd, "iprp", &iprpStart, &iprpEnd, &truncated) ||
+        !SDFindBox(bytes, length, iprpStart, iprpEnd, "ipco", &ipcoStart, &ipcoEnd, &truncated)) {
+        return truncated ? SDImageHeaderStatusNeedMoreData : SDImageHeaderStatusUnsupported;
+    }
+
+    // The property container holds the properties of all the items (primary image, thumbnails, alpha plane), the primary image is the largest
+    uint64_t largestArea = 0;
+    size_t pos = ipcoStart;
+    while (SDHasBytes(ipcoEnd, pos, 8)) {
+        size_t size = SDReadBE32(bytes + pos);
+        if (size < 8) {
+            break;
+        }
+        const uint8_t *type = bytes + pos + 4;
+        const uint8_t *payload = bytes + pos + 8;
+        size_t available = ipcoEnd - pos - 8;
+        if (memcmp(type, "ispe", 4) == 0 && available >= 12) {
+            uint32_t width = SDReadBE32(payload + 4);
+            uint32_t height = SDReadBE32(payload + 8);
+            if ((uint64_t)width * height > largestArea) {
+                largestArea = (uint64_t)width * height;
+                info->width = width;
+                info->height = height;
+            }
+        } else if (memcmp(type, "irot", 4) == 0 && available >= 1) {
+            // Anti-clockwise rotation in steps of 90 degrees, as EXIF orientations
+            static const uint8_t orientations[] = {1, 8, 3, 6};
+            info->orientation = orientations[payload[0] & 0x03];
+        } else if (memcmp(type, "pixi", 4) == 0 && available >= 5) {
+            info->isGray = payload[4] == 1;
+        } else if (memcmp(type, "auxC", 4) == 0 && available > 4) {
+            // The auxiliary type is a URN, the alpha planes end with "alpha" (HEVC uses "auxid:1")
+            const uint8_t *urn = payload + 4;
+            // The URN is NUL terminated, or ends with the property
+            const uint8_t *urnEnd = memchr(urn, 0, available - 4);
+            size_t urnLength = urnEnd ? (size_t)(urnEnd - urn) : available - 4;
+            if ((urnLength >= 5 && memcmp(urn + urnLength - 5, "alpha", 5) == 0) ||
+                (urnLength >= 7 && memcmp(urn + urnLength - 7, "auxid:1", 7) == 0)) {
+                info->hasAlpha = true;
+            }
+        }
+        if (size > ipcoEnd - pos) {
+            break;
+        }
+        pos += size;
+    }
+    if (info->width == 0 || info->height == 0) {
+        return truncated ? SDImageHeaderStatusNeedMoreData : SDImageHeaderStatusUnsupported;
+    }
+    return SDImageHeaderStatusOK;
+}
+
+#pragma mark - Parse
+
+SDImageHeaderStatus SDImageHeaderParse(const uint8_t *bytes, size_t length, SDImageHeaderInfo *info) {
+    if (!info) {
+        return SDImageHeaderStatusUnsupported;
+    }
+    memset(info, 0, sizeof(*info));
+    info->orientation = 1;
+    info->frameCount = 1;
+    info->format = SDImageHeaderGetFormat(bytes, length);
+
+    SDImageHeaderStatus status;
+    switch (info->format) {
+        case SDImageHeaderFormatJPEG:
+            status = SDParseJPEG(bytes, length, info);
+            break;
+        case SDImageHeaderFormatPNG:
+            info->frameCount = 0;
+            status = SDParsePNG(bytes, length, info);
+            break;
+        case SDImageHeaderFormatGIF:
+            status = SDParseGIF(bytes, length, info);
+            break;
+        case SDImageHeaderFormatWebP:
+            status = SDParseWebP(bytes, length, info);
+            break;
+        case SDImageHeaderFormatHEIF:
+            status = SDParseHEIF(bytes, length, info);
+            break;
+        default:
+            // Too short to tell, or another format
+            return length < 12 ? SDImageHeaderStatusNeedMoreData : SDImageHeaderStatusUnsupported;
+    }
+    if (status != SDImageHeaderStatusOK) {
+        SDImageHeaderFormat format = info->format;
+        memset(info, 0, sizeof(*info));
+        info->format = format;
+        info->orientation = 1;
+        info->frameCount = 1;
+    }
+    return status;
+}
@@ -0,0 +1,84 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#ifndef SDImageHeaderParser_h
+#define SDImageHeaderParser_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ A portable parser for the headers of JPEG, PNG, GIF, WebP and HEIF images.
+ It reads the image size and the few properties needed before decoding straight from the bytes, without allocating and without ImageIO, so it can run on the first bytes of a download. This file is plain C and does not depend on Core Graphics.
+ */
+
+typedef enum SDImageHeaderFormat {
+    SDImageHeaderFormatUnknown = 0,
+    SDImageHeaderFormatJPEG,
+    SDImageHeaderFormatPNG,
+    SDImageHeaderFormatGIF,
+    SDImageHeaderFormatWebP,
+    SDImageHeaderFormatHEIF,
+} SDImageHeaderFormat;
+
+typedef enum SDImageHeaderStatus {
+    /** The size was found. The other properties are read from the bytes available, see `SDImageHeaderInfo`. */
+    SDImageHeaderStatusOK = 0,
+    /** The format is supported but the bytes end before the size. Parse again with more data. */
+    SDImageHeaderStatusNeedMoreData,
+    /** The format is not supported or the header is malformed. */
+    SDImageHeaderStatusUnsupported,
+} SDImageHeaderStatus;
+
+typedef struct SDImageHeaderInfo {
+    SDImageHeaderFormat format;
+    /** The pixel size, before the orientation is applied */
+    uint32_t width;
+    uint32_t height;
+    /** The EXIF orientation, from 1 to 8. 1 if the image has none. HEIF rotations are converted, mirroring is ignored. */
+    uint8_t orientation;
+    /** Whether the image has an alpha channel or a transparent color */
+    bool hasAlpha;
+    /** Whether the image is stored as grayscale */
+    bool isGray;
+    /** Progressive JPEG, or interlaced PNG and GIF */
+    bool isProgressive;
+    /** The number of frames. Animated GIF and WebP are counted by walking their blocks, so the count only covers the bytes passed. */
+    uint32_t frameCount;
+} SDImageHeaderInfo;
+
+/**
+ Return the format of the image from its signature.
+
+ @param bytes The first bytes of the image, 12 bytes are enough
+ @param length The number of bytes
+ @return The format, or `SDImageHeaderFormatUnknown`
+ */
+SDImageHeaderFormat SDImageHeaderGetFormat(const uint8_t *bytes, size_t length);
+
+/**
+ Parse the header of an image.
+ The size is in the first few hundred bytes for most files. JPEG needs the metadata segments before the frame header, which are usually a few KB, and the EXIF orientation comes with them. The orientation of WebP and the frame counts of GIF and WebP are only known when the whole file is passed.
+
+ @param bytes The image bytes, can be a prefix of the file
+ @param length The number of bytes
+ @param info The parsed properties. Filled with the defaults (orientation 1, 1 frame) when the status is not OK.
+ @return The parsing status
+ */
+SDImageHeaderStatus SDImageHeaderParse(const uint8_t *bytes, size_t length, SDImageHeaderInfo *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SDImageHeaderParser_h */
@@ -0,0 +1,352 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#include "SDImagePixelConverter.h"
+#include <pthread.h>
+#include <string.h>
+
+// Define SD_PIXEL_CONVERTER_SCALAR to force the scalar kernels, for example to compare the SIMD output in tests
+#if !defined(SD_PIXEL_CONVERTER_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define SD_PIXEL_CONVERTER_NEON 1
+#include <arm_neon.h>
+#elif !defined(SD_PIXEL_CONVERTER_SCALAR) && (defined(__SSE2__) || defined(_M_X64))
+#define SD_PIXEL_CONVERTER_SSE2 1
+#include <emmintrin.h>
+#if defined(__SSSE3__)
+#define SD_PIXEL_CONVERTER_SSSE3 1
+#include <tmmintrin.h>
+#endif
+#endif
+
+// Exact round(x * a / 255) for x, a in [0, 255]
+static inline uint8_t SDMultiplyAlpha(uint8_t x, uint8_t a) {
+    uint32_t t = (uint32_t)x * a + 128;
+    return (uint8_t)((t + (t >> 8)) >> 8);
+}
+
+#pragma mark - Swap red and blue
+
+void SDPixelSwapRedBlue(const uint8_t *src, size_t srcBytesPerRow,
+                        uint8_t *dst, size_t dstBytesPerRow,
+                        size_t width, size_t height) {
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t *s = src + y * srcBytesPerRow;
+        uint8_t *d = dst + y * dstBytesPerRow;
+        size_t x = 0;
+#if SD_PIXEL_CONVERTER_NEON
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x4_t p = vld4q_u8(s + x * 4);
+            uint8x16_t r = p.val[0];
+            p.val[0] = p.val[2];
+            p.val[2] = r;
+            vst4q_u8(d + x * 4, p);
+        }
+#elif SD_PIXEL_CONVERTER_SSSE3
+        const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        for (; x + 4 <= width; x += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(s + x * 4));
+            _mm_storeu_si128((__m128i *)(d + x * 4), _mm_shuffle_epi8(p, shuffle));
+        }
+#elif SD_PIXEL_CONVERTER_SSE2
+        const __m128i greenAlpha = _mm_set1_epi32((int)0xFF00FF00);
+        const __m128i low = _mm_set1_epi32(0x000000FF);
+        for (; x + 4 <= width; x += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(s + x * 4));
+            __m128i ga = _mm_and_si128(p, greenAlpha);
+            __m128i r = _mm_slli_epi32(_mm_and_si128(p, low), 16);
+            __m128i b = _mm_and_si128(_mm_srli_epi32(p, 16), low);
+            _mm_storeu_si128((__m128i *)(d + x * 4), _mm_or_si128(ga, _mm_or_si128(r, b)));
+        }
+#endif
+        for (; x < width; x++) {
+            uint8_t r = s[x * 4];
+            d[x * 4] = s[x * 4 + 2];
+            d[x * 4 + 1] = s[x * 4 + 1];
+            d[x * 4 + 2] = r;
+            d[x * 4 + 3] = s[x * 4 + 3];
+        }
+    }
+}
+
+#pragma mark - RGB to RGBX
+
+void SDPixelConvertRGBToRGBX(const uint8_t *src, size_t srcBytesPerRow,
+                             uint8_t *dst, size_t dstBytesPerRow,
+                             size_t width, size_t height, bool swapRedBlue) {
+    size_t first = swapRedBlue ? 2 : 0;
+    size_t last = swapRedBlue ? 0 : 2;
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t *s = src + y * srcBytesPerRow;
+        uint8_t *d = dst + y * dstBytesPerRow;
+        size_t x = 0;
+#if SD_PIXEL_CONVERTER_NEON
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x3_t p = vld3q_u8(s + x * 3);
+            uint8x16x4_t q;
+            q.val[0] = p.val[first];
+            q.val[1] = p.val[1];
+            q.val[2] = p.val[last];
+            q.val[3] = vdupq_n_u8(0xFF);
+            vst4q_u8(d + x * 4, q);
+        }
+#elif SD_PIXEL_CONVERTER_SSSE3
+        // 4 pixels read 12 bytes, so the 16 byte load needs 4 more readable bytes
+        const __m128i shuffle = swapRedBlue ? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+                                            : _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+        for (; x + 6 <= width; x += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(s + x * 3));
+            _mm_storeu_si128((__m128i *)(d + x * 4), _mm_or_si128(_mm_shuffle_epi8(p, shuffle), alpha));
+        }
+#endif
+        for (; x < width; x++) {
+            d[x * 4] = s[x * 3 + first];
+            d[x * 4 + 1] = s[x * 3 + 1];
+            d[x * 4 + 2] = s[x * 3 + last];
+            d[x * 4 + 3] = 0xFF;
+        }
+    }
+}
+
+#pragma mark - RGBX to RGB
+
+void SDPixelConvertRGBXToRGB(const uint8_t *src, size_t srcBytesPerRow,
+                             uint8_t *dst, size_t dstBytesPerRow,
+                             size_t width, size_t height) {
+    // Rows and pixels are processed forwards, the output never overtakes the input when converting in place
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t *s = src + y * srcBytesPerRow;
+        uint8_t *d = dst + y * dstBytesPerRow;
+        size_t x = 0;
+#if SD_PIXEL_CONVERTER_NEON
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x4_t p = vld4q_u8(s + x * 4);
+            uint8x16x3_t q = {{p.val[0], p.val[1], p.val[2]}};
+            vst3q_u8(d + x * 3, q);
+        }
+#elif SD_PIXEL_CONVERTER_SSSE3
+        // 4 pixels write 12 bytes, so the 16 byte store needs 4 more writable bytes
+        const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        for (; x + 6 <= width; x += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(s + x * 4));
+            _mm_storeu_si128((__m128i *)(d + x * 3), _mm_shuffle_epi8(p, shuffle));
+        }
+#endif
+        for (; x < width; x++) {
+            d[x * 3] = s[x * 4];
+            d[x * 3 + 1] = s[x * 4 + 1];
+            d[x * 3 + 2] = s[x * 4 + 2];
+        }
+    }
+}
+
+#pragma mark - RGBX to xRGB1555
+
+#if SD_PIXEL_CONVERTER_SSE2
+// Pack 4 pixels into the low 15 bits of their 32-bit lanes
+static inline __m128i SDPackXRGB1555(__m128i p, bool swapRedBlue) {
+    __m128i r = swapRedBlue ? _mm_srli_epi32(p, 9) : _mm_slli_epi32(p, 7);
+    __m128i g = _mm_srli_epi32(p, 6);
+    __m128i b = swapRedBlue ? _mm_srli_epi32(p, 3) : _mm_srli_epi32(p, 19);
+    r = _mm_and_si128(r, _mm_set1_epi32(0x7C00));
+    g = _mm_and_si128(g, _mm_set1_epi32(0x03E0));
+    b = _mm_and_si128(b, _mm_set1_epi32(0x001F));
+    return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+#endif
+
+void SDPixelConvertRGBXToXRGB1555(const uint8_t *src, size_t srcBytesPerRow,
+                                  uint8_t *dst, size_t dstBytesPerRow,
+                                  size_t width, size_t height, bool swapRedBlue) {
+    size_t first = swapRedBlue ? 2 : 0;
+    size_t last = swapRedBlue ? 0 : 2;
+    // Rows and pixels are processed forwards, the output never overtakes the input when converting in place
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t *s = src + y * srcBytesPerRow;
+        uint8_t *d = dst + y * dstBytesPerRow;
+        size_t x = 0;
+#if SD_PIXEL_CONVERTER_NEON
+        for (; x + 8 <= width; x += 8) {
+            uint8x8x4_t p = vld4_u8(s + x * 4);
+            uint16x8_t v = vshlq_n_u16(vmovl_u8(vshr_n_u8(p.val[first], 3)), 10);
+            v = vorrq_u16(v, vshlq_n_u16(vmovl_u8(vshr_n_u8(p.val[1], 3)), 5));
+            v = vorrq_u16(v, vmovl_u8(vshr_n_u8(p.val[last], 3)));
+            vst1q_u8(d + x * 2, vreinterpretq_u8_u16(v));
+        }
+#elif SD_PIXEL_CONVERTER_SSE2
+        for (; x + 8 <= width; x += 8) {
+            __m128i lo = SDPackXRGB1555(_mm_loadu_si128((const __m128i *)(s + x * 4)), swapRedBlue);
+            __m128i hi = SDPackXRGB1555(_mm_loadu_si128((const __m128i *)(s + x * 4 + 16)), swapRedBlue);
+            // The values fit in 15 bits, so the signed saturation never clamps
+            _mm_storeu_si128((__m128i *)(d + x * 2), _mm_packs_epi32(lo, hi));
+        }
+#endif
+        for (; x < width; x++) {
+            uint16_t v = (uint16_t)((s[x * 4 + first] >> 3) << 10 | (s[x * 4 + 1] >> 3) << 5 | (s[x * 4 + last] >> 3));
+            d[x * 2] = (uint8_t)v;
+            d[x * 2 + 1] = (uint8_t)(v >> 8);
+        }
+    }
+}
+
+#pragma mark - Gray to RGBX
+
+void SDPixelConvertGrayToRGBX(const uint8_t *src, size_t srcBytesPerRow,
+                              uint8_t *dst, size_t dstBytesPerRow,
+                              size_t width, size_t height) {
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t *s = src + y * srcBytesPerRow;
+        uint8_t *d = dst + y * dstBytesPerRow;
+        size_t x = 0;
+#if SD_PIXEL_CONVERTER_NEON
+        for (; x + 16 <= width; x += 16) {
+            uint8x16_t g = vld1q_u8(s + x);
+            uint8x16x4_t q = {{g, g, g, vdupq_n_u8(0xFF)}};
+            vst4q_u8(d + x * 4, q);
+        }
+#elif SD_PIXEL_CONVERTER_SSE2
+        const __m128i alpha = _mm_set1_epi8((char)0xFF);
+        for (; x + 16 <= width; x += 16) {
+            __m128i g = _mm_loadu_si128((const __m128i *)(s + x));
+            __m128i gg = _mm_unpacklo_epi8(g, g);
+            __m128i ga = _mm_unpacklo_epi8(g, alpha);
+            _mm_storeu_si128((__m128i *)(d + x * 4), _mm_unpacklo_epi16(gg, ga));
+            _mm_storeu_si128((__m128i *)(d + x * 4 + 16), _mm_unpackhi_epi16(gg, ga));
+            gg = _mm_unpackhi_epi8(g, g);
+            ga = _mm_unpackhi_epi8(g, alpha);
+            _mm_storeu_si128((__m128i *)(d + x * 4 + 32), _mm_unpacklo_epi16(gg, ga));
+            _mm_storeu_si128((__m128i *)(d + x * 4 + 48), _mm_unpackhi_epi16(gg, ga));
+        }
+#endif
+        for (; x < width; x++) {
+            uint8_t g = s[x];
+            d[x * 4] = g;
+            d[x * 4 + 1] = g;
+            d[x * 4 + 2] = g;
+            d[x * 4 + 3] = 0xFF;
+        }
+    }
+}
+
+#pragma mark - Premultiply
+
+void SDPixelPremultiply(const uint8_t *src, size_t srcBytesPerRow,
+                        uint8_t *dst, size_t dstBytesPerRow,
+                        size_t width, size_t height, bool swapRedBlue) {
+    size_t first = swapRedBlue ? 2 : 0;
+    size_t last = swapRedBlue ? 0 : 2;
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t *s = src + y * srcBytesPerRow;
+        uint8_t *d = dst + y * dstBytesPerRow;
+        size_t x = 0;
+#if SD_PIXEL_CONVERTER_NEON
+        for (; x + 8 <= width; x += 8) {
+            uint8x8x4_t p = vld4_u8(s + x * 4);
+            uint8x8_t a = p.val[3];
+            uint8x8x4_t q;
+            for (int c = 0; c < 3; c++) {
+                uint16x8_t t = vmull_u8(p.val[c], a);
+                // round(t / 255) = (t + ((t + 128) >> 8) + 128) >> 8
+                q.val[c] = vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8);
+            }
+            if (swapRedBlue) {
+                uint8x8_t r = q.val[0];
+                q.val[0] = q.val[2];
+                q.val[2] = r;
+            }
+            q.val[3] = a;
+            vst4_u8(d + x * 4, q);
+        }
+#elif SD_PIXEL_CONVERTER_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i half = _mm_set1_epi16(128);
+        const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+        for (; x + 4 <= width; x += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(s + x * 4));
+            // Two pixels per register as 16-bit lanes, with the alpha broadcast to all the lanes of its pixel
+            __m128i lo = _mm_unpacklo_epi8(p, zero);
+            __m128i hi = _mm_unpackhi_epi8(p, zero);
+            __m128i loAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            __m128i hiAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            lo = _mm_add_epi16(_mm_mullo_epi16(lo, loAlpha), half);
+            hi = _mm_add_epi16(_mm_mullo_epi16(hi, hiAlpha), half);
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+            if (swapRedBlue) {
+                lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+                hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+            }
+            __m128i q = _mm_packus_epi16(lo, hi);
+            // Keep the original alpha
+            q = _mm_or_si128(_mm_andnot_si128(alphaMask, q), _mm_and_si128(alphaMask, p));
+            _mm_storeu_si128((__m128i *)(d + x * 4), q);
+        }
+#endif
+        for (; x < width; x++) {
+            uint8_t a = s[x * 4 + 3];
+            uint8_t r = SDMultiplyAlpha(s[x * 4 + first], a);
+            uint8_t g = SDMultiplyAlpha(s[x * 4 + 1], a);
+            uint8_t b = SDMultiplyAlpha(s[x * 4 + last], a);
+            d[x * 4] = r;
+            d[x * 4 + 1] = g;
+            d[x * 4 + 2] = b;
+            d[x * 4 + 3] = a;
+        }
+    }
+}
+
+#pragma mark - Unpremultiply
+
+// round(255 * 65536 / a), there is no SIMD division or gather on SSE2/NEON, so unpremultiply is table driven
+static uint32_t SDUnpremultiplyFactors[256];
+static pthread_once_t SDUnpremultiplyFactorsOnce = PTHREAD_ONCE_INIT;
+
+static void SDInitializeUnpremultiplyFactors(void) {
+    SDUnpremultiplyFactors[0] = 0;
+    for (uint32_t a = 1; a < 256; a++) {
+        SDUnpremultiplyFactors[a] = (255u * 65536u + a / 2) / a;
+    }
+}
+
+static const uint32_t *SDUnpremultiplyTable(void) {
+    pthread_once(&SDUnpremultiplyFactorsOnce, SDInitializeUnpremultiplyFactors);
+    return SDUnpremultiplyFactors;
+}
+
+static inline uint8_t SDDivideAlpha(uint8_t x, uint32_t factor) {
+    uint32_t v = (x * factor + 32768) >> 16;
+    return v > 255 ? 255 : (uint8_t)v;
+}
+
+void SDPixelUnpremultiply(const uint8_t *src, size_t srcBytesPerRow,
+                          uint8_t *dst, size_t dstBytesPerRow,
+                          size_t width, size_t height, bool swapRedBlue) {
+    const uint32_t *table = SDUnpremultiplyTable();
+    size_t first = swapRedBlue ? 2 : 0;
+    size_t last = swapRedBlue ? 0 : 2;
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t *s = src + y * srcBytesPerRow;
+        uint8_t *d = dst + y * dstBytesPerRow;
+        for (size_t x = 0; x < width; x++) {
+            uint8_t a = s[x * 4 + 3];
+            uint8_t r = s[x * 4 + first];
+            uint8_t g = s[x * 4 + 1];
+            uint8_t b = s[x * 4 + last];
+            if (a != 255) {
+                uint32_t factor = table[a];
+                r = SDDivideAlpha(r, factor);
+                g = SDDivideAlpha(g, factor);
+                b = SDDivideAlpha(b, factor);
+            }
+            d[x * 4] = r;
+            d[x * 4 + 1] = g;
+            d[x * 4 + 2] = b;
+            d[x * 4 + 3] = a;
+        }
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#ifndef SDImagePixelConverter_h
+#define SDImagePixelConverter_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ Portable pixel format conversion kernels for 8-bit bitmaps.
+ 4 byte pixels are either RGBA or BGRA in memory, with alpha (or the padding byte) last. BGRA is the display-native order of `kCGBitmapByteOrder32Host | kCGImageAlphaPremultipliedFirst` on little-endian hosts.
+ The kernels use NEON on ARM, SSE2/SSSE3 on x86 and a scalar fallback elsewhere. `src` and `dst` can be the same buffer when the pixel size does not grow.
+ */
+
+/**
+ Swap the red and blue bytes of 4 byte pixels, converting RGBA to BGRA and back.
+ */
+void SDPixelSwapRedBlue(const uint8_t *src, size_t srcBytesPerRow,
+                        uint8_t *dst, size_t dstBytesPerRow,
+                        size_t width, size_t height);
+
+/**
+ Expand 3 byte RGB pixels to 4 byte pixels with an opaque last byte.
+
+ @param swapRedBlue Pass true to produce BGRX, false to produce RGBX
+ */
+void SDPixelConvertRGBToRGBX(const uint8_t *src, size_t srcBytesPerRow,
+                             uint8_t *dst, size_t dstBytesPerRow,
+                             size_t width, size_t height, bool swapRedBlue);
+
+/**
+ Drop the last byte of 4 byte pixels, converting RGBX to RGB (or BGRX to BGR). `src` and `dst` can be the same buffer.
+ */
+void SDPixelConvertRGBXToRGB(const uint8_t *src, size_t srcBytesPerRow,
+                             uint8_t *dst, size_t dstBytesPerRow,
+                             size_t width, size_t height);
+
+/**
+ Pack 4 byte pixels into 2 byte little-endian xRGB1555 pixels, 5 bits per component with the top bit unused, dropping the last byte. This is the 16-bit layout of `kCGBitmapByteOrder16Little | kCGImageAlphaNoneSkipFirst` with 5 bits per component.
+ The low bits of each component are truncated. `src` and `dst` can be the same buffer.
+
+ @param swapRedBlue Pass true when the source is BGRX, false when it is RGBX
+ */
+void SDPixelConvertRGBXToXRGB1555(const uint8_t *src, size_t srcBytesPerRow,
+                                  uint8_t *dst, size_t dstBytesPerRow,
+                                  size_t width, size_t height, bool swapRedBlue);
+
+/**
+ Expand 1 byte gray pixels to opaque 4 byte pixels. The output is valid both as RGBA and BGRA.
+ */
+void SDPixelConvertGrayToRGBX(const uint8_t *src, size_t srcBytesPerRow,
+                              uint8_t *dst, size_t dstBytesPerRow,
+                              size_t width, size_t height);
+
+/**
+ Multiply the color bytes of 4 byte pixels by their alpha, optionally swapping red and blue in the same pass.
+ */
+void SDPixelPremultiply(const uint8_t *src, size_t srcBytesPerRow,
+                        uint8_t *dst, size_t dstBytesPerRow,
+                        size_t width, size_t height, bool swapRedBlue);
+
+/**
+ Divide the color bytes of premultiplied 4 byte pixels by their alpha, optionally swapping red and blue in the same pass.
+ Fully transparent pixels become 0.
+ */
+void SDPixelUnpremultiply(const uint8_t *src, size_t srcBytesPerRow,
+                          uint8_t *dst, size_t dstBytesPerRow,
+                          size_t width, size_t height, bool swapRedBlue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SDImagePixelConverter_h */
@@ -0,0 +1,403 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#include "SDImageResampler.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// M_PI is not part of standard C, strict C modes leave it out of math.h
+#define SD_PI 3.14159265358979323846
+
+// Define SD_RESAMPLER_SCALAR to force the scalar kernels, for example to compare the SIMD output in tests
+#if !defined(SD_RESAMPLER_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define SD_RESAMPLER_NEON 1
+#include <arm_neon.h>
+#elif !defined(SD_RESAMPLER_SCALAR) && (defined(__SSE2__) || defined(_M_X64))
+#define SD_RESAMPLER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#pragma mark - Pixel vector
+
+// One 4 channel pixel held as 4 floats, which is exactly one SIMD register
+#if SD_RESAMPLER_NEON
+
+typedef float32x4_t sd_pixel;
+
+static inline sd_pixel sd_pixel_zero(void) {
+    return vdupq_n_f32(0);
+}
+
+static inline sd_pixel sd_pixel_load_u8(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    uint16x8_t h = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(v)));
+    return vcvtq_f32_u32(vmovl_u16(vget_low_u16(h)));
+}
+
+static inline sd_pixel sd_pixel_load(const float *p) {
+    return vld1q_f32(p);
+}
+
+static inline sd_pixel sd_pixel_madd(sd_pixel acc, sd_pixel a, float w) {
+    return vmlaq_n_f32(acc, a, w);
+}
+
+static inline void sd_pixel_store(float *p, sd_pixel v) {
+    vst1q_f32(p, v);
+}
+
+static inline void sd_pixel_store_u8(uint8_t *p, sd_pixel v) {
+    v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0)), vdupq_n_f32(255));
+    uint32x4_t w = vcvtq_u32_f32(vaddq_f32(v, vdupq_n_f32(0.5f)));
+    uint16x4_t h = vmovn_u32(w);
+    uint8x8_t b = vmovn_u16(vcombine_u16(h, h));
+    uint32_t out = vget_lane_u32(vreinterpret_u32_u8(b), 0);
+    memcpy(p, &out, 4);
+}
+
+#elif SD_RESAMPLER_SSE2
+
+typedef __m128 sd_pixel;
+
+static inline sd_pixel sd_pixel_zero(void) {
+    return _mm_setzero_ps();
+}
+
+static inline sd_pixel sd_pixel_load_u8(const uint8_t *p) {
+    int v;
+    memcpy(&v, p, 4);
+    __m128i zero = _mm_setzero_si128();
+    __m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(b, zero));
+}
+
+static inline sd_pixel sd_pixel_load(const float *p) {
+    return _mm_loadu_ps(p);
+}
+
+static inline sd_pixel sd_pixel_madd(sd_pixel acc, sd_pixel a, float w) {
+    return _mm_add_ps(acc, _mm_mul_ps(a, _mm_set1_ps(w)));
+}
+
+static inline void sd_pixel_store(float *p, sd_pixel v) {
+    _mm_storeu_ps(p, v);
+}
+
+static inline void sd_pixel_store_u8(uint8_t *p, sd_pixel v) {
+    // Round to nearest, the saturating packs clamp to [0, 255]
+    __m128i i = _mm_cvtps_epi32(v);
+    i = _mm_packs_epi32(i, i);
+    i = _mm_packus_epi16(i, i);
+    int out = _mm_cvtsi128_si32(i);
+    memcpy(p, &out, 4);
+}
+
+#else
+
+typedef struct {
+    float v[4];
+} sd_pixel;
+
+static inline sd_pixel sd_pixel_zero(void) {
+    sd_pixel r = {{0, 0, 0, 0}};
+    return r;
+}
+
+static inline sd_pixel sd_pixel_load_u8(const uint8_t *p) {
+    sd_pixel r = {{p[0], p[1], p[2], p[3]}};
+    return r;
+}
+
+static inline sd_pixel sd_pixel_load(const float *p) {
+    sd_pixel r = {{p[0], p[1], p[2], p[3]}};
+    return r;
+}
+
+static inline sd_pixel sd_pixel_madd(sd_pixel acc, sd_pixel a, float w) {
+    for (int c = 0; c < 4; c++) {
+        acc.v[c] += a.v[c] * w;
+    }
+    return acc;
+}
+
+static inline void sd_pixel_store(float *p, sd_pixel v) {
+    memcpy(p, v.v, sizeof(v.v));
+}
+
+static inline void sd_pixel_store_u8(uint8_t *p, sd_pixel v) {
+    for (int c = 0; c < 4; c++) {
+        float f = v.v[c];
+        f = f < 0 ? 0 : (f > 255 ? 255 : f);
+        p[c] = (uint8_t)(f + 0.5f);
+    }
+}
+
+#endif
+
+#pragma mark - Filters
+
+static double SDBoxFilter(double x) {
+    return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+}
+
+static double SDTriangleFilter(double x) {
+    x = fabs(x);
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+static double SDSinc(double x) {
+    if (x == 0.0) {
+        return 1.0;
+    }
+    x *= SD_PI;
+    return sin(x) / x;
+}
+
+static double SDLanczos3Filter(double x) {
+    if (x > -3.0 && x < 3.0) {
+        return SDSinc(x) * SDSinc(x / 3.0);
+    }
+    return 0.0;
+}
+
+typedef double (*SDResamplingFilterFunction)(double x);
+
+static void SDResamplingFilterGet(SDImageResamplingFilter filter, SDResamplingFilterFunction *function, double *support) {
+    switch (filter) {
+        case SDImageResamplingFilterBox:
+            *function = SDBoxFilter;
+            *support = 0.5;
+            break;
+        case SDImageResamplingFilterLanczos3:
+            *function = SDLanczos3Filter;
+            *support = 3.0;
+            break;
+        case SDImageResamplingFilterBilinear:
+        default:
+            *function = SDTriangleFilter;
+            *support = 1.0;
+            break;
+    }
+}
+
+#pragma mark - Coefficients
+
+// The precomputed coefficients of one axis. Output pixel i reads `bounds[2i + 1]` input pixels from `bounds[2i]`, weighted by `weights[i * taps]...`
+typedef struct {
+    size_t *bounds;
+    float *weights;
+    size_t taps;
+} SDResamplingAxis;
+
+static void SDResamplingAxisFree(SDResamplingAxis *axis) {
+    free(axis->bounds);
+    free(axis->weights);
+    axis->bounds = NULL;
+    axis->weights = NULL;
+}
+
+static int SDResamplingAxisInit(SDResamplingAxis *axis, size_t inSize, size_t outSize, SDImageResamplingFilter filter) {
+    SDResamplingFilterFunction function;
+    double filterSupport;
+    SDResamplingFilterGet(filter, &function, &filterSupport);
+
+    double scale = (double)inSize / outSize;
+    // When scaling down, stretch the filter over the input pixels covered by one output pixel
+    double filterScale = scale > 1.0 ? scale : 1.0;
+    double support = filterSupport * filterScale;
+    size_t taps = (size_t)ceil(support) * 2 + 1;
+
+    axis->taps = taps;
+    axis->bounds = malloc(outSize * 2 * sizeof(size_t));
+    axis->weights = calloc(outSize * taps, sizeof(float));
+    if (!axis->bounds || !axis->weights) {
+        SDResamplingAxisFree(axis);
+        return -1;
+    }
+
+    for (size_t i = 0; i < outSize; i++) {
+        double center = (i + 0.5) * scale;
+        double lower = center - support + 0.5;
+        double upper = center + support + 0.5;
+        size_t min = lower > 0 ? (size_t)lower : 0;
+        size_t max = upper < inSize ? (size_t)upper : inSize;
+        size_t count = max > min ? max - min : 0;
+        if (count > taps) {
+            count = taps;
+        }
+        float *weights = axis->weights + i * taps;
+        double sum = 0;
+        for (size_t j = 0; j < count; j++) {
+            double w = function((j + min - center + 0.5) / filterScale);
+            weights[j] = (float)w;
+            sum += w;
+        }
+        if (sum == 0) {
+            // Degenerated kernel, use the nearest pixel
+            min = center < inSize ? (size_t)center : inSize - 1;
+            count = 1;
+            weights[0] = 1;
+        } else {
+            for (size_t j = 0; j < count; j++) {
+                weights[j] = (float)(weights[j] / sum);
+            }
+        }
+        axis->bounds[i * 2] = min;
+        axis->bounds[i * 2 + 1] = count;
+    }
+    return 0;
+}
+
+#pragma mark - Resampler
+
+struct SDImageResampler {
+    size_t srcWidth;
+    size_t srcHeight;
+    size_t dstWidth;
+    size_t dstHeight;
+    SDResamplingAxis horizontal;
+    SDResamplingAxis vertical;
+};
+
+SDImageResampler * SDImageResamplerCreate(size_t srcWidth, size_t srcHeight, size_t dstWidth, size_t dstHeight, SDImageResamplingFilter filter) {
+    if (srcWidth == 0 || srcHeight == 0 || dstWidth == 0 || dstHeight == 0) {
+        return NULL;
+    }
+    SDImageResampler *resampler = calloc(1, sizeof(SDImageResampler));
+    if (!resampler) {
+        return NULL;
+    }
+    resampler->srcWidth = srcWidth;
+    resampler->srcHeight = srcHeight;
+    resampler->dstWidth = dstWidth;
+    resampler->dstHeight = dstHeight;
+    if (SDResamplingAxisInit(&resampler->horizontal, srcWidth, dstWidth, filter) != 0 ||
+        SDResamplingAxisInit(&resampler->vertical, srcHeight, dstHeight, filter) != 0) {
+        SDImageResamplerRelease(resampler);
+        return NULL;
+    }
+    return resampler;
+}
+
+void SDImageResamplerRelease(SDImageResampler *resampler) {
+    if (!resampler) {
+        return;
+    }
+    SDResamplingAxisFree(&resampler->horizontal);
+    SDResamplingAxisFree(&resampler->vertical);
+    free(resampler);
+}
+
+void SDImageResamplerGetSourceRows(const SDImageResampler *resampler, size_t dstY, size_t dstRows, size_t *srcY, size_t *srcRows) {
+    if (!resampler || dstRows == 0 || dstY >= resampler->dstHeight) {
+        *srcY = 0;
+        *srcRows = 0;
+        return;
+    }
+    if (dstRows > resampler->dstHeight - dstY) {
+        dstRows = resampler->dstHeight - dstY;
+    }
+    // The bounds are monotonic, so the first and last rows give the range
+    const size_t *bounds = resampler->vertical.bounds;
+    size_t first = dstY;
+    size_t last = dstY + dstRows - 1;
+    *srcY = bounds[first * 2];
+    *srcRows = bounds[last * 2] + bounds[last * 2 + 1] - *srcY;
+}
+
+static void SDResampleRowHorizontal(const SDResamplingAxis *axis, size_t dstWidth, const uint8_t *src, float *dst) {
+    for (size_t x = 0; x < dstWidth; x++) {
+        size_t min = axis->bounds[x * 2];
+        size_t count = axis->bounds[x * 2 + 1];
+        const float *weights = axis->weights + x * axis->taps;
+        const uint8_t *p = src + min * 4;
+        sd_pixel acc = sd_pixel_zero();
+        for (size_t k = 0; k < count; k++) {
+            acc = sd_pixel_madd(acc, sd_pixel_load_u8(p + k * 4), weights[k]);
+        }
+        sd_pixel_store(dst + x * 4, acc);
+    }
+}
+
+static void SDResampleRowVertical(const float * const *rows, const float *weights, size_t count, size_t dstWidth, uint8_t *dst) {
+    for (size_t x = 0; x < dstWidth; x++) {
+        sd_pixel acc = sd_pixel_zero();
+        for (size_t k = 0; k < count; k++) {
+            acc = sd_pixel_madd(acc, sd_pixel_load(rows[k] + x * 4), weights[k]);
+        }
+        sd_pixel_store_u8(dst + x * 4, acc);
+    }
+}
+
+int SDImageResamplerResampleRows(const SDImageResampler *resampler,
+                                 const uint8_t *src, size_t srcY, size_t srcRows, size_t srcBytesPerRow,
+                                 uint8_t *dst, size_t dstY, size_t dstRows, size_t dstBytesPerRow) {
+    if (!resampler || !src || !dst || dstY + dstRows > resampler->dstHeight) {
+        return -1;
+    }
+    if (dstRows == 0) {
+        return 0;
+    }
+    size_t neededY, neededRows;
+    SDImageResamplerGetSourceRows(resampler, dstY, dstRows, &neededY, &neededRows);
+    if (neededY < srcY || neededY + neededRows > srcY + srcRows) {
+        return -1;
+    }
+
+    // The horizontally resampled source rows, kept in a ring because consecutive output rows share most of their input rows
+    size_t dstWidth = resampler->dstWidth;
+    size_t ringSize = resampler->vertical.taps;
+    float *ring = malloc(ringSize * dstWidth * 4 * sizeof(float));
+    size_t *ringRows = malloc(ringSize * sizeof(size_t));
+    const float **rows = malloc(ringSize * sizeof(float *));
+    if (!ring || !ringRows || !rows) {
+        free(ring);
+        free(ringRows);
+        free(rows);
+        return -1;
+    }
+    for (size_t i = 0; i < ringSize; i++) {
+        ringRows[i] = SIZE_MAX;
+    }
+
+    for (size_t y = 0; y < dstRows; y++) {
+        size_t min = resampler->vertical.bounds[(dstY + y) * 2];
+        size_t count = resampler->vertical.bounds[(dstY + y) * 2 + 1];
+        const float *weights = resampler->vertical.weights + (dstY + y) * resampler->vertical.taps;
+        for (size_t k = 0; k < count; k++) {
+            size_t row = min + k;
+            size_t slot = row % ringSize;
+            float *slotData = ring + slot * dstWidth * 4;
+            if (ringRows[slot] != row) {
+                SDResampleRowHorizontal(&resampler->horizontal, dstWidth, src + (row - srcY) * srcBytesPerRow, slotData);
+                ringRows[slot] = row;
+            }
+            rows[k] = slotData;
+        }
+        SDResampleRowVertical(rows, weights, count, dstWidth, dst + y * dstBytesPerRow);
+    }
+
+    free(ring);
+    free(ringRows);
+    free(rows);
+    return 0;
+}
+
+int SDImageResample(const uint8_t *src, size_t srcWidth, size_t srcHeight, size_t srcBytesPerRow,
+                    uint8_t *dst, size_t dstWidth, size_t dstHeight, size_t dstBytesPerRow,
+                    SDImageResamplingFilter filter) {
+    SDImageResampler *resampler = SDImageResamplerCreate(srcWidth, srcHeight, dstWidth, dstHeight, filter);
+    if (!resampler) {
+        return -1;
+    }
+    int result = SDImageResamplerResampleRows(resampler, src, 0, srcHeight, srcBytesPerRow, dst, 0, dstHeight, dstBytesPerRow);
+    SDImageResamplerRelease(resampler);
+    return result;
+}
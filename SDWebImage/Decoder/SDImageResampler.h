@@ -0,0 +1,97 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#ifndef SDImageResampler_h
+#define SDImageResampler_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ A portable separable resampler for 8-bit, 4 channel bitmaps (RGBA, BGRA, ARGB...).
+ All the channels are filtered the same way, so the channel order does not matter. Use premultiplied alpha to avoid color bleeding from transparent pixels.
+ The kernels use NEON on ARM, SSE2 on x86 and a scalar fallback elsewhere. This file is plain C and does not depend on Core Graphics.
+ */
+
+typedef enum SDImageResamplingFilter {
+    /** Average of the source pixels covered by each destination pixel. Fastest. */
+    SDImageResamplingFilterBox = 0,
+    /** Triangle filter, bilinear interpolation when scaling up, area weighted when scaling down. */
+    SDImageResamplingFilterBilinear,
+    /** Windowed sinc filter with 3 lobes. Sharpest, slowest. */
+    SDImageResamplingFilterLanczos3,
+} SDImageResamplingFilter;
+
+typedef struct SDImageResampler SDImageResampler;
+
+/**
+ Create a resampler with the coefficients precomputed for the given sizes. The resampler is immutable and can be used from multiple threads.
+
+ @param srcWidth The source width in pixels
+ @param srcHeight The source height in pixels
+ @param dstWidth The destination width in pixels
+ @param dstHeight The destination height in pixels
+ @param filter The resampling filter
+ @return The resampler, or NULL if a size is 0 or out of memory. Release it with `SDImageResamplerRelease`.
+ */
+SDImageResampler * SDImageResamplerCreate(size_t srcWidth, size_t srcHeight, size_t dstWidth, size_t dstHeight, SDImageResamplingFilter filter);
+
+/**
+ Release a resampler created by `SDImageResamplerCreate`. Passing NULL does nothing.
+ */
+void SDImageResamplerRelease(SDImageResampler *resampler);
+
+/**
+ Return the range of source rows needed to produce the destination rows [dstY, dstY + dstRows).
+ This includes the rows under the filter support on both sides, so bands resampled separately join without seams.
+
+ @param resampler The resampler
+ @param dstY The first destination row
+ @param dstRows The number of destination rows
+ @param srcY The first source row needed
+ @param srcRows The number of source rows needed
+ */
+void SDImageResamplerGetSourceRows(const SDImageResampler *resampler, size_t dstY, size_t dstRows, size_t *srcY, size_t *srcRows);
+
+/**
+ Resample the destination rows [dstY, dstY + dstRows) from a band of source rows.
+ Calls for disjoint destination rows can run concurrently.
+
+ @param resampler The resampler
+ @param src The pixels of source row `srcY`
+ @param srcY The index of the first row of `src` in the source image
+ @param srcRows The number of rows available in `src`, must cover `SDImageResamplerGetSourceRows`
+ @param srcBytesPerRow The source row stride
+ @param dst The pixels of destination row `dstY`
+ @param dstY The index of the first row of `dst` in the destination image
+ @param dstRows The number of destination rows to produce
+ @param dstBytesPerRow The destination row stride
+ @return 0 on success, -1 if the source band is too small or out of memory
+ */
+int SDImageResamplerResampleRows(const SDImageResampler *resampler,
+                                 const uint8_t *src, size_t srcY, size_t srcRows, size_t srcBytesPerRow,
+                                 uint8_t *dst, size_t dstY, size_t dstRows, size_t dstBytesPerRow);
+
+/**
+ Resample a whole bitmap. Convenience for creating a resampler, resampling all rows and releasing it.
+
+ @return 0 on success, -1 on invalid sizes or out of memory
+ */
+int SDImageResample(const uint8_t *src, size_t srcWidth, size_t srcHeight, size_t srcBytesPerRow,
+                    uint8_t *dst, size_t dstWidth, size_t dstHeight, size_t dstBytesPerRow,
+                    SDImageResamplingFilter filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SDImageResampler_h */
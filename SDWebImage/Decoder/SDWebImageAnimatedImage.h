@@ -0,0 +1,85 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+#import "SDWebImageCoder.h"
+
+/**
+ An animated image backed by its compressed data, which decodes the frames on demand.
+ The image itself is the first frame (the poster), so it can be displayed as a static image anywhere. Frame count, durations and loop count are available without decoding.
+ Decoded frames are kept in a ring buffer sized by `maxBufferSize`. When a frame is requested, the following frames are decoded ahead on a background queue until the buffer is full, so a player which requests the frames in order mostly hits the buffer.
+ @note A `UIImageView` only shows the poster, use the frame API to drive the animation.
+ */
+@interface SDWebImageAnimatedImage : UIImage
+
+/**
+ Create an animated image from data, using the first coder in `SDWebImageCodersManager` which can decode the data and conforms to `SDWebImageAnimatedCoder`.
+
+ @param data The animated image data
+ @param optionsDict The decoding options, see `SDWebImageCoder`
+ @return The animated image, or nil if the data is not an animated image or no coder supports it
+ */
+- (nullable instancetype)initWithData:(nullable NSData *)data options:(nullable NSDictionary<NSString*, NSObject*>*)optionsDict;
+
+/**
+ Create an animated image with an animated coder instance. The coder should not be used by anyone else afterwards.
+
+ @param coder The animated coder
+ @return The animated image, or nil if the coder is nil or the first frame can not be decoded
+ */
+- (nullable instancetype)initWithAnimatedCoder:(nullable id<SDWebImageAnimatedCoder>)coder;
+
+/**
+ The compressed data of the animated image
+ */
+@property (nonatomic, copy, readonly, nullable) NSData *animatedImageData;
+
+/**
+ The number of frames
+ */
+@property (nonatomic, assign, readonly) NSUInteger animatedImageFrameCount;
+
+/**
+ The loop count, 0 means infinite looping
+ */
+@property (nonatomic, assign, readonly) NSUInteger animatedImageLoopCount;
+
+/**
+ The maximum memory in bytes used by the decoded frames. At least 1 frame is kept.
+ Defaults to 0, which means 1% of the physical memory.
+ */
+@property (nonatomic, assign) NSUInteger maxBufferSize;
+
+/**
+ The number of decoded frames currently in the buffer
+ */
+@property (nonatomic, assign, readonly) NSUInteger bufferedFrameCount;
+
+/**
+ Return the frame at index, decoding it synchronously if it is not in the buffer, and start decoding the following frames in the background.
+
+ @param index The frame index
+ @return The frame image, or nil if the index is out of bounds or decoding failed
+ */
+- (nullable UIImage *)animatedImageFrameAtIndex:(NSUInteger)index;
+
+/**
+ Return the duration of the frame at index in seconds, without decoding it.
+
+ @param index The frame index
+ @return The duration, or 0 if the index is out of bounds
+ */
+- (NSTimeInterval)animatedImageDurationAtIndex:(NSUInteger)index;
+
+/**
+ Remove all the decoded frames from the buffer. This is done automatically on memory warnings.
+ */
+- (void)clearFrameBuffer;
+
+@end
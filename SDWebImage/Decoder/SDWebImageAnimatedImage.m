@@ -0,0 +1,235 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDWebImageAnimatedImage.h"
+#import "SDWebImageCodersManager.h"
+#import "NSImage+WebCache.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+@implementation SDWebImageAnimatedImage {
+    id<SDWebImageAnimatedCoder> _coder;
+    // Coders keep a decoding context, so the frames are decoded one at a time
+    dispatch_semaphore_t _coderLock;
+    dispatch_semaphore_t _bufferLock;
+    NSUInteger _frameBytes;
+    // The buffered frames by index, at most `_bufferCapacity` of them. When it is full, the frame furthest ahead of the displayed one makes room
+    NSUInteger _bufferCapacity;
+    NSMutableDictionary<NSNumber *, UIImage *> *_bufferFrames;
+    NSUInteger _displayIndex;
+    BOOL _prefetching;
+    dispatch_queue_t _prefetchQueue;
+}
+
+- (void)dealloc {
+#if SD_UIKIT
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+#endif
+}
+
+- (instancetype)initWithData:(NSData *)data options:(NSDictionary<NSString *,NSObject *> *)optionsDict {
+    id<SDWebImageCoder> decodingCoder = [[SDWebImageCodersManager sharedInstance] coderForDecodingData:data format:NULL];
+    id<SDWebImageAnimatedCoder> coder;
+    if ([decodingCoder conformsToProtocol:@protocol(SDWebImageAnimatedCoder)]) {
+        coder = [[[decodingCoder class] alloc] initWithAnimatedImageData:data options:optionsDict];
+    }
+    return [self initWithAnimatedCoder:coder];
+}
+
+- (instancetype)initWithAnimatedCoder:(id<SDWebImageAnimatedCoder>)coder {
+    if (!coder || coder.animatedImageFrameCount == 0) {
+        return nil;
+    }
+    UIImage *posterImage = [coder animatedImageFrameAtIndex:0];
+    CGImageRef posterImageRef = posterImage.CGImage;
+    if (!posterImageRef) {
+        return nil;
+    }
+#if SD_MAC
+    self = [super initWithCGImage:posterImageRef size:NSZeroSize];
+#else
+    self = [super initWithCGImage:posterImageRef scale:1 orientation:UIImageOrientationUp];
+#endif
+    if (self) {
+        _coder = coder;
+        _coderLock = dispatch_semaphore_create(1);
+        _bufferLock = dispatch_semaphore_create(1);
+        _frameBytes = CGImageGetBytesPerRow(posterImageRef) * CGImageGetHeight(posterImageRef);
+        _prefetchQueue = dispatch_queue_create("com.hackemist.SDWebImageAnimatedImagePrefetchQueue", DISPATCH_QUEUE_SERIAL);
+        [self sd_resetFrameBuffer];
+        [self sd_bufferFrame:posterImage atIndex:0];
+#if SD_UIKIT
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(didReceiveMemoryWarning:)
+                                                     name:UIApplicationDidReceiveMemoryWarningNotification
+                                                   object:nil];
+#endif
+    }
+    return self;
+}
+
+#if SD_UIKIT
+- (void)didReceiveMemoryWarning:(NSNotification *)notification {
+    [self clearFrameBuffer];
+}
+#endif
+
+#pragma mark - Animated Image
+
+- (NSData *)animatedImageData {
+    return _coder.animatedImageData;
+}
+
+- (NSUInteger)animatedImageFrameCount {
+    return _coder.animatedImageFrameCount;
+}
+
+- (NSUInteger)animatedImageLoopCount {
+    return _coder.animatedImageLoopCount;
+}
+
+- (NSTimeInterval)animatedImageDurationAtIndex:(NSUInteger)index {
+    return [_coder animatedImageDurationAtIndex:index];
+}
+
+- (UIImage *)animatedImageFrameAtIndex:(NSUInteger)index {
+    if (index >= self.animatedImageFrameCount) {
+        return nil;
+    }
+    LOCK(_bufferLock);
+    _displayIndex = index;
+    UIImage *frame = _bufferFrames[@(index)];
+    UNLOCK(_bufferLock);
+    if (!frame) {
+        frame = [self sd_decodedFrameAtIndex:index];
+        LOCK(_bufferLock);
+        [self sd_bufferFrame:frame atIndex:index];
+        UNLOCK(_bufferLock);
+    }
+    [self sd_prefetchFramesAfterIndex:index];
+    return frame;
+}
+
+#pragma mark - Frame Buffer
+
+- (void)setMaxBufferSize:(NSUInteger)maxBufferSize {
+    LOCK(_bufferLock);
+    _maxBufferSize = maxBufferSize;
+    [self sd_resetFrameBuffer];
+    UNLOCK(_bufferLock);
+}
+
+- (NSUInteger)bufferedFrameCount {
+    LOCK(_bufferLock);
+    NSUInteger count = _bufferFrames.count;
+    UNLOCK(_bufferLock);
+    return count;
+}
+
+- (void)clearFrameBuffer {
+    LOCK(_bufferLock);
+    [_bufferFrames removeAllObjects];
+    UNLOCK(_bufferLock);
+}
+
+// Must be called with the buffer lock held, or from init
+- (void)sd_resetFrameBuffer {
+    NSUInteger frameCount = self.animatedImageFrameCount;
+    NSUInteger maxBufferSize = _maxBufferSize > 0 ? _maxBufferSize : (NSUInteger)([NSProcessInfo processInfo].physicalMemory / 100);
+    NSUInteger capacity = _frameBytes > 0 ? maxBufferSize / _frameBytes : frameCount;
+    _bufferCapacity = MIN(MAX(capacity, 1), frameCount);
+    _bufferFrames = [NSMutableDictionary dictionaryWithCapacity:_bufferCapacity];
+}
+
+// Must be called with the buffer lock held, or from init
+- (void)sd_bufferFrame:(nullable UIImage *)frame atIndex:(NSUInteger)index {
+    if (!frame) {
+        return;
+    }
+    if (!_bufferFrames[@(index)] && _bufferFrames.count >= _bufferCapacity) {
+        // The look-ahead window holds fewer frames than the buffer, so a frame outside it goes first
+        NSUInteger frameCount = self.animatedImageFrameCount;
+        NSNumber *evictedIndex;
+        NSUInteger evictedDistance = 0;
+        for (NSNumber *bufferedIndex in _bufferFrames) {
+            NSUInteger distance = (bufferedIndex.unsignedIntegerValue + frameCount - _displayIndex) % frameCount;
+            if (!evictedIndex || distance > evictedDistance) {
+                evictedIndex = bufferedIndex;
+                evictedDistance = distance;
+            }
+        }
+        [_bufferFrames removeObjectForKey:evictedIndex];
+    }
+    _bufferFrames[@(index)] = frame;
+}
+
+- (nullable UIImage *)sd_decodedFrameAtIndex:(NSUInteger)index {
+    LOCK(_coderLock);
+    UIImage *frame = [_coder animatedImageFrameAtIndex:index];
+    UNLOCK(_coderLock);
+    return frame;
+}
+
+// Decode the frames following the displayed one in the background until the buffer is full
+- (void)sd_prefetchFramesAfterIndex:(NSUInteger)index {
+    LOCK(_bufferLock);
+    BOOL shouldPrefetch = !_prefetching && _bufferCapacity > 1;
+    if (shouldPrefetch) {
+        _prefetching = YES;
+    }
+    UNLOCK(_bufferLock);
+    if (!shouldPrefetch) {
+        return;
+    }
+    __weak __typeof__(self) wself = self;
+    dispatch_async(_prefetchQueue, ^{
+        __strong __typeof__(wself) sself = wself;
+        [sself sd_prefetchFrames];
+    });
+}
+
+- (void)sd_prefetchFrames {
+    NSUInteger frameCount = self.animatedImageFrameCount;
+    while (YES) {
+        // The look-ahead window is the frames after the displayed one which fit in the buffer besides it
+        NSUInteger nextIndex = NSNotFound;
+        LOCK(_bufferLock);
+        for (NSUInteger i = 1; i < _bufferCapacity; i++) {
+            NSUInteger index = (_displayIndex + i) % frameCount;
+            if (!_bufferFrames[@(index)]) {
+                nextIndex = index;
+                break;
+            }
+        }
+        if (nextIndex == NSNotFound) {
+            _prefetching = NO;
+        }
+        UNLOCK(_bufferLock);
+        if (nextIndex == NSNotFound) {
+            return;
+        }
+
+        @autoreleasepool {
+            UIImage *frame = [self sd_decodedFrameAtIndex:nextIndex];
+            LOCK(_bufferLock);
+            if (frame) {
+                [self sd_bufferFrame:frame atIndex:nextIndex];
+            } else {
+                // Do not retry a broken frame forever, the next request will start over
+                _prefetching = NO;
+            }
+            UNLOCK(_bufferLock);
+            if (!frame) {
+                return;
+            }
+        }
+    }
+}
+
+@end
@@ -15,6 +15,111 @@
  */
 FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderScaleDownLargeImagesKey;
 
+/**
+ 缩小大型图像时同时解码的最大分块数。(NSNumber)，默认为0，表示不超过4个且不超过活动处理器的数量
+ 每个正在解码的分块约占20MB内存，设置为1则按顺序解码。
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderScaleDownMaxConcurrentTilesKey;
+
+/**
+ 解码时的目标像素尺寸。(NSValue，包装CGSize，单位为像素)
+ 设置后，编码器会直接以缩小后的分辨率解码(ImageIO缩略图、WebP `use_scaling`)，而不是先完整解码再缩小。图像永远不会被放大。
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderDecodeTargetPixelSizeKey;
+
+/**
+ 目标像素尺寸的内容模式。(NSNumber，`SDWebImageCoderContentMode`)，默认为 `SDWebImageCoderContentModeAspectFit`
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderDecodeTargetContentModeKey;
+
+/**
+ 一个布尔值，指示动图是否按需解码帧。(NSNumber)，默认为NO
+ 设置后，支持 `SDWebImageAnimatedCoder` 的编码器返回 `SDWebImageAnimatedImage`，它只持有压缩数据，在显示时才解码帧，而不是一次解码所有帧。
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderDecodeLazyFramesKey;
+
+/**
+ 解码后位图的像素格式策略。(NSNumber，`SDWebImageCoderPixelFormat`)，默认为 `SDWebImageCoderPixelFormatAutomatic`
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderDecodePixelFormatKey;
+
+/**
+ 编码的压缩质量。(NSNumber，0到1之间)，默认为1
+ 有损编码时，越小文件越小、质量越低；无损编码时表示压缩力度，越大文件越小、编码越慢。
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderEncodeCompressionQualityKey;
+
+/**
+ 编码方法，在速度和文件大小之间取舍。(NSNumber，WebP为0到6之间)，默认为4
+ 0最快，6最慢但文件最小。
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderEncodeMethodKey;
+
+/**
+ 一个布尔值，指示是否使用无损编码。(NSNumber)，默认为NO
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderEncodeLosslessKey;
+
+/**
+ 编码的目标大小，单位为字节。(NSNumber)，默认为0，表示不限制
+ 设置后，编码器会多次尝试调整质量以接近目标大小，编码会更慢。对于动图，这是每一帧的目标大小。
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderEncodeTargetSizeKey;
+
+/**
+ 单帧编码内部的多线程级别。(NSNumber)，默认为0，表示不使用多线程
+ 大于0时，编码器在编码一帧时使用额外的线程，代价是更多的内存。
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderEncodeThreadLevelKey;
+
+/**
+ 动图同时编码的最大帧数。(NSNumber)，默认为0，表示活动处理器的数量
+ 每个正在编码的帧都持有一份像素拷贝，减小此值可以限制编码时的内存峰值。设置为1则按顺序编码。
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderEncodeMaxConcurrentFramesKey;
+
+/**
+ 一个布尔值，指示编码动图时是否把与前一帧完全相同的帧合并到前一帧，延长其持续时间。(NSNumber)，默认为NO
+ 合并后显示效果不变，但帧数会减少。
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderEncodeMergeIdenticalFramesKey;
+
+typedef NS_ENUM(NSUInteger, SDWebImageCoderContentMode) {
+    /**
+     * 解码后的图像完整放入目标尺寸内，保持宽高比。
+     */
+    SDWebImageCoderContentModeAspectFit = 0,
+    /**
+     * 解码后的图像填满目标尺寸，保持宽高比，可能超出目标尺寸的一边。
+     */
+    SDWebImageCoderContentModeAspectFill
+};
+
+typedef NS_ENUM(NSUInteger, SDWebImageCoderPixelFormat) {
+    /**
+     * 灰度且不透明的图像解码为8位灰度，其他图像解码为32位BGRA，不透明的图像不保存alpha通道。
+     */
+    SDWebImageCoderPixelFormatAutomatic = 0,
+    /**
+     * 总是解码为32位BGRA，与灰度和不透明无关。
+     */
+    SDWebImageCoderPixelFormat32Bit,
+    /**
+     * 与自动相同，但不透明的彩色图像解码为16位（每个分量5位），内存减半，颜色精度降低。适合缩略图。
+     */
+    SDWebImageCoderPixelFormatAllow16Bit
+};
+
+/**
+ 返回附加了解码选项中目标像素尺寸、内容模式、按需解码帧和像素格式的键。如果选项不影响解码结果，返回原始键。
+ 用于区分同一个URL以不同尺寸解码出的图像，例如内存缓存的键。
+
+ @param key 原始键，通常是图像绝对URL
+ @param decodeOptions 解码选项
+ @return 包含目标尺寸的键
+ */
+FOUNDATION_EXPORT NSString * _Nullable SDImageKeyForDecodeOptions(NSString * _Nullable key, NSDictionary<NSString*, NSObject*> * _Nullable decodeOptions);
+
 /**
  返回使用CGColorSpaceCreateDeviceRGB创建的共享设备依赖的RGB颜色空间。
 
@@ -22,6 +127,13 @@ FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageCoderScaleDownLargeImagesK
  */
 CG_EXTERN CGColorSpaceRef _Nonnull SDCGColorSpaceGetDeviceRGB(void);
 
+/**
+ 返回使用CGColorSpaceCreateDeviceGray创建的共享设备依赖的灰度颜色空间。
+
+ @return The device-dependent gray color space
+ */
+CG_EXTERN CGColorSpaceRef _Nonnull SDCGColorSpaceGetDeviceGray(void);
+
 /**
  检查CGImageRef是否包含alpha通道。
 
@@ -81,6 +193,47 @@ CG_EXTERN BOOL SDCGImageRefContainsAlpha(_Nullable CGImageRef imageRef);
  */
 - (nullable NSData *)encodedDataWithImage:(nullable UIImage *)image format:(SDImageFormat)format;
 
+@optional
+#pragma mark - Decoding Options
+
+/**
+ 使用解码选项将图像数据解码为图像。
+ 如果选项包含 `SDWebImageCoderDecodeTargetPixelSizeKey`，应该直接以缩小后的分辨率解码。没有实现此方法的编码器会忽略选项，调用 `decodedImageWithData:`。
+
+ @param data 图像数据
+ @param optionsDict 包含解码选项的字典
+ @return 解码后的图像
+ */
+- (nullable UIImage *)decodedImageWithData:(nullable NSData *)data
+                                   options:(nullable NSDictionary<NSString*, NSObject*>*)optionsDict;
+
+#pragma mark - Format Dispatch
+
+/**
+ 返回YES，如果这个编码器可以解码该格式的数据。
+ 实现此方法后，`SDWebImageCodersManager` 会把结果缓存到格式->编码器的分发表中，不再对每个数据缓冲区调用 `canDecodeFromData:` 重复嗅探文件头。
+ 只有当结论完全由格式决定时才实现此方法；如果需要查看数据内容才能判断，请不要实现，管理器会回退到 `canDecodeFromData:`。
+
+ @param format 已嗅探出的图像格式，可能为 `SDImageFormatUndefined`
+ @return 如果这个编码器可以解码该格式的数据，则为YES
+ */
+- (BOOL)canDecodeFromFormat:(SDImageFormat)format;
+
+#pragma mark - Encoding Options
+
+/**
+ 使用编码选项将图像编码为图像数据。
+ 没有实现此方法的编码器会忽略选项，调用 `encodedDataWithImage:format:`。
+
+ @param image 被编码的图像
+ @param format 编码的图像格式
+ @param optionsDict 包含编码选项的字典，见 `SDWebImageCoderEncodeCompressionQualityKey` 等
+ @return 已编码的图像数据
+ */
+- (nullable NSData *)encodedDataWithImage:(nullable UIImage *)image
+                                   format:(SDImageFormat)format
+                                  options:(nullable NSDictionary<NSString*, NSObject*>*)optionsDict;
+
 @end
 
 
@@ -110,4 +263,74 @@ CG_EXTERN BOOL SDCGImageRefContainsAlpha(_Nullable CGImageRef imageRef);
  */
 - (nullable UIImage *)incrementallyDecodedImageWithData:(nullable NSData *)data finished:(BOOL)finished;
 
+@optional
+/**
+ 返回YES，如果这个编码器可以增量解码该格式的数据。语义与 `canDecodeFromFormat:` 相同，用于渐进式编码器的分发表。
+
+ @param format 已嗅探出的图像格式
+ @return 如果这个编码器可以增量解码该格式的数据，则为YES
+ */
+- (BOOL)canIncrementallyDecodeFromFormat:(SDImageFormat)format;
+
+/**
+ 增量解码新追加的图像数据。与 `incrementallyDecodedImageWithData:finished:` 不同，每次只传入上次调用之后新收到的字节，编码器自己保存之前的数据。
+ 实现此方法后，下载操作不再为每个数据块复制全部已下载的数据，渐进式下载的总复制量为O(n)。同一个实例只会使用这两个方法中的一个。
+
+ @param data 新追加的图像数据
+ @param finished 下载是否完成
+ @return 从目前所有数据中解码出的图像
+ */
+- (nullable UIImage *)incrementallyDecodedImageWithAppendedData:(nullable NSData *)data finished:(BOOL)finished;
+
+@end
+
+
+/**
+ 这是动图编码器协议，提供按需解码动图帧。
+ 一个实例对应一张动图，持有压缩数据和解码上下文。帧数、时长和循环次数在初始化时读取，不需要解码帧。
+ 注意，这些方法不是从主队列调用的，而且同一个实例不会被并发调用。
+ */
+@protocol SDWebImageAnimatedCoder <SDWebImageCoder>
+
+@required
+/**
+ 用动图数据创建编码器实例。
+
+ @param data 动图数据
+ @param optionsDict 解码选项，例如 `SDWebImageCoderDecodeTargetPixelSizeKey`
+ @return 编码器实例，如果数据不是动图或者无法解码，返回nil
+ */
+- (nullable instancetype)initWithAnimatedImageData:(nullable NSData *)data options:(nullable NSDictionary<NSString*, NSObject*>*)optionsDict;
+
+/**
+ 动图数据
+ */
+@property (nonatomic, copy, readonly, nullable) NSData *animatedImageData;
+
+/**
+ 帧数
+ */
+@property (nonatomic, assign, readonly) NSUInteger animatedImageFrameCount;
+
+/**
+ 循环次数，0表示无限循环
+ */
+@property (nonatomic, assign, readonly) NSUInteger animatedImageLoopCount;
+
+/**
+ 解码指定的帧。按顺序请求帧最快。
+
+ @param index 帧索引
+ @return 该帧的图像，如果索引越界或者解码失败，返回nil
+ */
+- (nullable UIImage *)animatedImageFrameAtIndex:(NSUInteger)index;
+
+/**
+ 返回指定帧的显示时长，单位为秒。不需要解码帧。
+
+ @param index 帧索引
+ @return 显示时长，如果索引越界，返回0
+ */
+- (NSTimeInterval)animatedImageDurationAtIndex:(NSUInteger)index;
+
 @end
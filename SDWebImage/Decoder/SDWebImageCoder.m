@@ -7,8 +7,41 @@
  */
 
 #import "SDWebImageCoder.h"
+#import "SDWebImageCoderHelper.h"
 
 NSString * const SDWebImageCoderScaleDownLargeImagesKey = @"scaleDownLargeImages";
+NSString * const SDWebImageCoderScaleDownMaxConcurrentTilesKey = @"scaleDownMaxConcurrentTiles";
+NSString * const SDWebImageCoderDecodeTargetPixelSizeKey = @"decodeTargetPixelSize";
+NSString * const SDWebImageCoderDecodeTargetContentModeKey = @"decodeTargetContentMode";
+NSString * const SDWebImageCoderDecodeLazyFramesKey = @"decodeLazyFrames";
+NSString * const SDWebImageCoderDecodePixelFormatKey = @"decodePixelFormat";
+NSString * const SDWebImageCoderEncodeCompressionQualityKey = @"encodeCompressionQuality";
+NSString * const SDWebImageCoderEncodeMethodKey = @"encodeMethod";
+NSString * const SDWebImageCoderEncodeLosslessKey = @"encodeLossless";
+NSString * const SDWebImageCoderEncodeTargetSizeKey = @"encodeTargetSize";
+NSString * const SDWebImageCoderEncodeThreadLevelKey = @"encodeThreadLevel";
+NSString * const SDWebImageCoderEncodeMaxConcurrentFramesKey = @"encodeMaxConcurrentFrames";
+NSString * const SDWebImageCoderEncodeMergeIdenticalFramesKey = @"encodeMergeIdenticalFrames";
+
+NSString * SDImageKeyForDecodeOptions(NSString * _Nullable key, NSDictionary<NSString*, NSObject*> * _Nullable decodeOptions) {
+    if (!key) {
+        return nil;
+    }
+    CGSize targetPixelSize = [SDWebImageCoderHelper targetPixelSizeFromOptions:decodeOptions];
+    if (!CGSizeEqualToSize(targetPixelSize, CGSizeZero)) {
+        BOOL fill = [SDWebImageCoderHelper targetContentModeFromOptions:decodeOptions] == SDWebImageCoderContentModeAspectFill;
+        key = [key stringByAppendingFormat:@"-SDTargetPixelSize(%dx%d,%@)", (int)targetPixelSize.width, (int)targetPixelSize.height, fill ? @"fill" : @"fit"];
+    }
+    NSNumber *lazyFrames = (NSNumber *)decodeOptions[SDWebImageCoderDecodeLazyFramesKey];
+    if ([lazyFrames isKindOfClass:[NSNumber class]] && lazyFrames.boolValue) {
+        key = [key stringByAppendingString:@"-SDLazyFrames"];
+    }
+    SDWebImageCoderPixelFormat pixelFormat = [SDWebImageCoderHelper pixelFormatFromOptions:decodeOptions];
+    if (pixelFormat != SDWebImageCoderPixelFormatAutomatic) {
+        key = [key stringByAppendingFormat:@"-SDPixelFormat(%@)", pixelFormat == SDWebImageCoderPixelFormat32Bit ? @"32" : @"16"];
+    }
+    return key;
+}
 
 CGColorSpaceRef SDCGColorSpaceGetDeviceRGB(void) {
     static CGColorSpaceRef colorSpace;
@@ -19,6 +52,15 @@ CGColorSpaceRef SDCGColorSpaceGetDeviceRGB(void) {
     return colorSpace;
 }
 
+CGColorSpaceRef SDCGColorSpaceGetDeviceGray(void) {
+    static CGColorSpaceRef colorSpace;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        colorSpace = CGColorSpaceCreateDeviceGray();
+    });
+    return colorSpace;
+}
+
 BOOL SDCGImageRefContainsAlpha(CGImageRef imageRef) {
     if (!imageRef) {
         return NO;
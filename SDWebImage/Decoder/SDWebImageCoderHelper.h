@@ -9,12 +9,14 @@
 #import <Foundation/Foundation.h>
 #import "SDWebImageCompat.h"
 #import "SDWebImageFrame.h"
+#import "SDWebImageCoder.h"
 
 @interface SDWebImageCoderHelper : NSObject
 
 /**
  Return an animated image with frames array.
- For UIKit, this will apply the patch and then create animated UIImage. The patch is because that `+[UIImage animatedImageWithImages:duration:]` just use the average of duration for each image. So it will not work if different frame has different duration. Therefore we repeat the specify frame for specify times to let it work.
+ For UIKit, this will apply the patch and then create animated UIImage. The patch is because that `+[UIImage animatedImageWithImages:duration:]` just use the average of duration for each image. So it will not work if different frame has different duration. Therefore we repeat the specify frame for specify times to let it work. The repeats are bounded to a few per frame, so very uneven durations are approximated for `UIImageView` playback.
+ The exact frames are kept in `sd_imageFrames` of the returned image, so `framesFromAnimatedImage:`, the cache cost and the encoders use them without duplicates.
  For AppKit, NSImage does not support animates other than GIF. This will try to encode the frames to GIF format and then create an animated NSImage for rendering. Attention the animated image may loss some detail if the input frames contain full alpha channel because GIF only supports 1 bit alpha channel. (For 1 pixel, either transparent or not)
 
  @param frames The frames array. If no frames or frames is empty, return nil
@@ -24,6 +26,7 @@
 
 /**
  Return frames array from an animated image.
+ If the image has `sd_imageFrames`, they are returned directly.
  For UIKit, this will unapply the patch for the description above and then create frames array. This will also work for normal animated UIImage.
  For AppKit, NSImage does not support animates other than GIF. This will try to decode the GIF imageRep and then create frames array.
 
@@ -32,6 +35,50 @@
  */
 + (NSArray<SDWebImageFrame *> * _Nullable)framesFromAnimatedImage:(UIImage * _Nullable)animatedImage;
 
+/**
+ Return the target pixel size from the decoding options (`SDWebImageCoderDecodeTargetPixelSizeKey`).
+
+ @param optionsDict The decoding options
+ @return The target pixel size, or CGSizeZero if the options do not contain a valid one
+ */
++ (CGSize)targetPixelSizeFromOptions:(NSDictionary<NSString*, NSObject*> * _Nullable)optionsDict;
+
+/**
+ Return the target content mode from the decoding options (`SDWebImageCoderDecodeTargetContentModeKey`).
+
+ @param optionsDict The decoding options
+ @return The content mode, default is `SDWebImageCoderContentModeAspectFit`
+ */
++ (SDWebImageCoderContentMode)targetContentModeFromOptions:(NSDictionary<NSString*, NSObject*> * _Nullable)optionsDict;
+
+/**
+ Return the pixel format policy from the decoding options (`SDWebImageCoderDecodePixelFormatKey`).
+
+ @param optionsDict The decoding options
+ @return The pixel format policy, default is `SDWebImageCoderPixelFormatAutomatic`
+ */
++ (SDWebImageCoderPixelFormat)pixelFormatFromOptions:(NSDictionary<NSString*, NSObject*> * _Nullable)optionsDict;
+
+/**
+ Return the options for `decompressedImageWithImage:data:options:`, which are the decoding options with `SDWebImageCoderScaleDownLargeImagesKey` set.
+
+ @param decodeOptions The decoding options the image was decoded with
+ @param scaleDownLargeImages Whether large images should be scaled down
+ @return The decompression options
+ */
++ (NSDictionary<NSString*, NSObject*> * _Nonnull)decompressionOptionsWithDecodeOptions:(NSDictionary<NSString*, NSObject*> * _Nullable)decodeOptions scaleDownLargeImages:(BOOL)scaleDownLargeImages;
+
+/**
+ Return the pixel size an image should be decoded at to match the target pixel size.
+ Images are never scaled up, so if the image is already small enough, the image size is returned.
+
+ @param imageSize The pixel size of the image
+ @param targetPixelSize The target pixel size
+ @param contentMode How the image fits in the target pixel size
+ @return The scaled pixel size, rounded and at least 1x1
+ */
++ (CGSize)scaledPixelSizeWithImageSize:(CGSize)imageSize targetPixelSize:(CGSize)targetPixelSize contentMode:(SDWebImageCoderContentMode)contentMode;
+
 #if SD_UIKIT || SD_WATCH
 /**
  Convert an EXIF image orientation to an iOS one.
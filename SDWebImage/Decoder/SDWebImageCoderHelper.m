@@ -13,6 +13,11 @@
 #import <ImageIO/ImageIO.h>
 #import "SDAnimatedImageRep.h"
 
+#if SD_UIKIT || SD_WATCH
+// UIImage shows all its images for the same duration, so a frame is repeated to last longer. The repeats are bounded per frame, otherwise mixed timings (10ms and 2s) would explode into hundreds of images
+static const NSUInteger kMaxAnimatedImageRepeatsPerFrame = 4;
+#endif
+
 @implementation SDWebImageCoderHelper
 
 + (UIImage *)animatedImageWithFrames:(NSArray<SDWebImageFrame *> *)frames {
@@ -24,29 +29,40 @@
     UIImage *animatedImage;
     
 #if SD_UIKIT || SD_WATCH
-    NSUInteger durations[frameCount];
+    // The frame count comes from the image data, keep the durations off the stack
+    NSUInteger *durations = malloc(frameCount * sizeof(NSUInteger));
+    if (!durations) {
+        return nil;
+    }
+    NSUInteger totalDuration = 0;
     for (size_t i = 0; i < frameCount; i++) {
         durations[i] = frames[i].duration * 1000;
+        totalDuration += durations[i];
     }
-    NSUInteger const gcd = gcdArray(frameCount, durations);
-    __block NSUInteger totalDuration = 0;
     NSMutableArray<UIImage *> *animatedImages = [NSMutableArray arrayWithCapacity:frameCount];
-    [frames enumerateObjectsUsingBlock:^(SDWebImageFrame * _Nonnull frame, NSUInteger idx, BOOL * _Nonnull stop) {
-        UIImage *image = frame.image;
-        NSUInteger duration = frame.duration * 1000;
-        totalDuration += duration;
-        NSUInteger repeatCount;
-        if (gcd) {
-            repeatCount = duration / gcd;
-        } else {
-            repeatCount = 1;
+    if (totalDuration == 0) {
+        // No timing at all, one image per frame and UIKit's default duration
+        for (size_t i = 0; i < frameCount; i++) {
+            [animatedImages addObject:frames[i].image];
         }
-        for (size_t i = 0; i < repeatCount; ++i) {
-            [animatedImages addObject:image];
+        animatedImage = [UIImage animatedImageWithImages:animatedImages duration:0];
+    } else {
+        // The GCD of the durations is exact, use a coarser time unit if it needs too many repeats
+        NSUInteger unit = gcdArray(frameCount, durations);
+        NSUInteger maxImageCount = frameCount * kMaxAnimatedImageRepeatsPerFrame;
+        if (unit == 0 || totalDuration / unit > maxImageCount) {
+            unit = MAX(1, totalDuration / maxImageCount);
         }
-    }];
-    
-    animatedImage = [UIImage animatedImageWithImages:animatedImages duration:totalDuration / 1000.f];
+        for (size_t i = 0; i < frameCount; i++) {
+            UIImage *image = frames[i].image;
+            NSUInteger repeatCount = MAX(1, (durations[i] + unit / 2) / unit);
+            for (size_t j = 0; j < repeatCount; ++j) {
+                [animatedImages addObject:image];
+            }
+        }
+        animatedImage = [UIImage animatedImageWithImages:animatedImages duration:animatedImages.count * unit / 1000.f];
+    }
+    free(durations);
     
 #else
     
@@ -80,6 +96,9 @@
     [animatedImage addRepresentation:imageRep];
 #endif
     
+    // The exact frames and durations, so they never need to be reconstructed from the images
+    animatedImage.sd_imageFrames = frames;
+    
     return animatedImage;
 }
 
@@ -87,6 +106,10 @@
     if (!animatedImage) {
         return nil;
     }
+    NSArray<SDWebImageFrame *> *imageFrames = animatedImage.sd_imageFrames;
+    if (imageFrames.count > 0) {
+        return imageFrames;
+    }
     
     NSMutableArray<SDWebImageFrame *> *frames = [NSMutableArray array];
     NSUInteger frameCount = 0;
@@ -159,6 +182,61 @@
     return frames;
 }
 
++ (CGSize)targetPixelSizeFromOptions:(NSDictionary<NSString*, NSObject*> *)optionsDict {
+    NSValue *sizeValue = (NSValue *)optionsDict[SDWebImageCoderDecodeTargetPixelSizeKey];
+    if (![sizeValue isKindOfClass:[NSValue class]] || strcmp(sizeValue.objCType, @encode(CGSize)) != 0) {
+        return CGSizeZero;
+    }
+    CGSize targetPixelSize = CGSizeZero;
+    [sizeValue getValue:&targetPixelSize];
+    if (targetPixelSize.width <= 0 || targetPixelSize.height <= 0) {
+        return CGSizeZero;
+    }
+    return targetPixelSize;
+}
+
++ (SDWebImageCoderContentMode)targetContentModeFromOptions:(NSDictionary<NSString*, NSObject*> *)optionsDict {
+    NSNumber *contentMode = (NSNumber *)optionsDict[SDWebImageCoderDecodeTargetContentModeKey];
+    if ([contentMode isKindOfClass:[NSNumber class]] && contentMode.unsignedIntegerValue == SDWebImageCoderContentModeAspectFill) {
+        return SDWebImageCoderContentModeAspectFill;
+    }
+    return SDWebImageCoderContentModeAspectFit;
+}
+
++ (SDWebImageCoderPixelFormat)pixelFormatFromOptions:(NSDictionary<NSString*, NSObject*> *)optionsDict {
+    NSNumber *pixelFormat = (NSNumber *)optionsDict[SDWebImageCoderDecodePixelFormatKey];
+    if (![pixelFormat isKindOfClass:[NSNumber class]] || pixelFormat.unsignedIntegerValue > SDWebImageCoderPixelFormatAllow16Bit) {
+        return SDWebImageCoderPixelFormatAutomatic;
+    }
+    return pixelFormat.unsignedIntegerValue;
+}
+
++ (NSDictionary<NSString*, NSObject*> *)decompressionOptionsWithDecodeOptions:(NSDictionary<NSString*, NSObject*> *)decodeOptions scaleDownLargeImages:(BOOL)scaleDownLargeImages {
+    if (decodeOptions.count == 0) {
+        return @{SDWebImageCoderScaleDownLargeImagesKey: @(scaleDownLargeImages)};
+    }
+    NSMutableDictionary<NSString*, NSObject*> *options = [decodeOptions mutableCopy];
+    options[SDWebImageCoderScaleDownLargeImagesKey] = @(scaleDownLargeImages);
+    return [options copy];
+}
+
++ (CGSize)scaledPixelSizeWithImageSize:(CGSize)imageSize targetPixelSize:(CGSize)targetPixelSize contentMode:(SDWebImageCoderContentMode)contentMode {
+    if (imageSize.width <= 0 || imageSize.height <= 0 || targetPixelSize.width <= 0 || targetPixelSize.height <= 0) {
+        return imageSize;
+    }
+    CGFloat xScale = targetPixelSize.width / imageSize.width;
+    CGFloat yScale = targetPixelSize.height / imageSize.height;
+    CGFloat scale = contentMode == SDWebImageCoderContentModeAspectFill ? MAX(xScale, yScale) : MIN(xScale, yScale);
+    if (scale >= 1) {
+        // Do not scale up
+        return imageSize;
+    }
+    CGSize scaledSize;
+    scaledSize.width = MAX(1, round(imageSize.width * scale));
+    scaledSize.height = MAX(1, round(imageSize.height * scale));
+    return scaledSize;
+}
+
 #if SD_UIKIT || SD_WATCH
 // Convert an EXIF image orientation to an iOS one.
 + (UIImageOrientation)imageOrientationFromEXIFOrientation:(NSInteger)exifOrientation {
@@ -28,6 +28,11 @@
  Conformance is important because that way, they will implement `canDecodeFromData` or `canEncodeToFormat`
  Those methods are called on each coder in the array (using the priority order) until one of them returns YES.
  That means that coder can decode that data / encode to that format
+
+ Dispatch
+ ------
+ The manager sniffs the image format once per buffer and looks the coder up in a format -> coder table. The table is rebuilt only when the coders change (`addCoder:`, `removeCoder:` or setting `coders`) and is published as an immutable snapshot, so lookups do not take a lock.
+ Coders which implement the optional `canDecodeFromFormat:` / `canIncrementallyDecodeFromFormat:` are resolved through the table. For a coder that does not implement them, the formats it may handle fall back to calling `canDecodeFromData:` on each coder.
  */
 @interface SDWebImageCodersManager : NSObject<SDWebImageCoder>
 
@@ -55,4 +60,24 @@
  */
 - (void)removeCoder:(nonnull id<SDWebImageCoder>)coder;
 
+/**
+ Return the coder which will be used to decode the data, together with the sniffed image format.
+ The data header is sniffed only once. Use the returned format instead of calling `sd_imageFormatForImageData:` again.
+
+ @param data The image data
+ @param format On return, the image format of the data. Pass NULL if you don't need it
+ @return The coder with the highest priority which can decode the data, or nil if no coder can
+ */
+- (nullable id<SDWebImageCoder>)coderForDecodingData:(nullable NSData *)data format:(nullable SDImageFormat *)format;
+
+/**
+ Return the progressive coder which can incrementally decode the data, together with the sniffed image format.
+ The returned coder is the shared instance in the coders array, callers which keep a decoding context should create a new instance of its class.
+
+ @param data The image data downloaded so far
+ @param format On return, the image format of the data. Pass NULL if you don't need it
+ @return The progressive coder with the highest priority which can incrementally decode the data, or nil if no coder can
+ */
+- (nullable id<SDWebImageProgressiveCoder>)progressiveCoderForData:(nullable NSData *)data format:(nullable SDImageFormat *)format;
+
 @end
@@ -16,9 +16,96 @@
 #define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
 #define UNLOCK(lock) dispatch_semaphore_signal(lock);
 
+// All the formats which can be returned by `sd_imageFormatForImageData:`, used to build the dispatch tables
+static const SDImageFormat kSDImageFormats[] = {
+    SDImageFormatUndefined,
+    SDImageFormatJPEG,
+    SDImageFormatPNG,
+    SDImageFormatGIF,
+    SDImageFormatTIFF,
+    SDImageFormatWebP,
+    SDImageFormatHEIC
+};
+static const size_t kSDImageFormatsCount = sizeof(kSDImageFormats) / sizeof(kSDImageFormats[0]);
+
+// An immutable snapshot of the coders array and the format -> coder tables built from it.
+// In the tables, `NSNull` means no coder can handle the format, a missing key means the format can only be resolved from the data.
+@interface SDWebImageCodersDispatchTable : NSObject
+
+@property (nonatomic, copy, readonly, nonnull) NSArray<id<SDWebImageCoder>> *coders;
+@property (nonatomic, copy, readonly, nonnull) NSDictionary<NSNumber *, id> *decodingCoders;
+@property (nonatomic, copy, readonly, nonnull) NSDictionary<NSNumber *, id> *progressiveCoders;
+@property (nonatomic, copy, readonly, nonnull) NSDictionary<NSNumber *, id> *encodingCoders;
+
+- (nonnull instancetype)initWithCoders:(nullable NSArray<id<SDWebImageCoder>> *)coders;
+
+@end
+
+@implementation SDWebImageCodersDispatchTable
+
+- (instancetype)initWithCoders:(NSArray<id<SDWebImageCoder>> *)coders {
+    if (self = [super init]) {
+        _coders = coders ? [coders copy] : @[];
+        NSMutableDictionary<NSNumber *, id> *decodingCoders = [NSMutableDictionary dictionaryWithCapacity:kSDImageFormatsCount];
+        NSMutableDictionary<NSNumber *, id> *progressiveCoders = [NSMutableDictionary dictionaryWithCapacity:kSDImageFormatsCount];
+        NSMutableDictionary<NSNumber *, id> *encodingCoders = [NSMutableDictionary dictionaryWithCapacity:kSDImageFormatsCount];
+        for (size_t i = 0; i < kSDImageFormatsCount; i++) {
+            SDImageFormat format = kSDImageFormats[i];
+            id decodingCoder = [self decodingCoderForFormat:format progressive:NO];
+            if (decodingCoder) {
+                decodingCoders[@(format)] = decodingCoder;
+            }
+            id progressiveCoder = [self decodingCoderForFormat:format progressive:YES];
+            if (progressiveCoder) {
+                progressiveCoders[@(format)] = progressiveCoder;
+            }
+            id encodingCoder = [NSNull null];
+            for (id<SDWebImageCoder> coder in _coders.reverseObjectEnumerator) {
+                if ([coder canEncodeToFormat:format]) {
+                    encodingCoder = coder;
+                    break;
+                }
+            }
+            encodingCoders[@(format)] = encodingCoder;
+        }
+        _decodingCoders = [decodingCoders copy];
+        _progressiveCoders = [progressiveCoders copy];
+        _encodingCoders = [encodingCoders copy];
+    }
+    return self;
+}
+
+// Return the coder for format, `NSNull` if no coder can decode it, or nil if a coder with higher priority can only answer from the data
+- (nullable id)decodingCoderForFormat:(SDImageFormat)format progressive:(BOOL)progressive {
+    for (id<SDWebImageCoder> coder in self.coders.reverseObjectEnumerator) {
+        if (progressive) {
+            if (![coder conformsToProtocol:@protocol(SDWebImageProgressiveCoder)]) {
+                continue;
+            }
+            if (![coder respondsToSelector:@selector(canIncrementallyDecodeFromFormat:)]) {
+                return nil;
+            }
+            if ([(id<SDWebImageProgressiveCoder>)coder canIncrementallyDecodeFromFormat:format]) {
+                return coder;
+            }
+        } else {
+            if (![coder respondsToSelector:@selector(canDecodeFromFormat:)]) {
+                return nil;
+            }
+            if ([coder canDecodeFromFormat:format]) {
+                return coder;
+            }
+        }
+    }
+    return [NSNull null];
+}
+
+@end
+
 @interface SDWebImageCodersManager ()
 
-@property (nonatomic, strong, nonnull) dispatch_semaphore_t codersLock;
+@property (nonatomic, strong, nonnull) dispatch_semaphore_t codersLock; // a lock to serialize the writers of `dispatchTable`
+@property (atomic, strong, nonnull) SDWebImageCodersDispatchTable *dispatchTable; // copy-on-write, readers do not take the lock
 
 @end
 
@@ -40,7 +127,7 @@
 #ifdef SD_WEBP
         [mutableCoders addObject:[SDWebImageWebPCoder sharedCoder]];
 #endif
-        _coders = [mutableCoders copy];
+        _dispatchTable = [[SDWebImageCodersDispatchTable alloc] initWithCoders:mutableCoders];
         _codersLock = dispatch_semaphore_create(1);
     }
     return self;
@@ -48,17 +135,24 @@
 
 #pragma mark - Coder IO operations
 
+- (NSArray<id<SDWebImageCoder>> *)coders {
+    return self.dispatchTable.coders;
+}
+
+- (void)setCoders:(NSArray<id<SDWebImageCoder>> *)coders {
+    LOCK(self.codersLock);
+    self.dispatchTable = [[SDWebImageCodersDispatchTable alloc] initWithCoders:coders];
+    UNLOCK(self.codersLock);
+}
+
 - (void)addCoder:(nonnull id<SDWebImageCoder>)coder {
     if (![coder conformsToProtocol:@protocol(SDWebImageCoder)]) {
         return;
     }
     LOCK(self.codersLock);
-    NSMutableArray<id<SDWebImageCoder>> *mutableCoders = [self.coders mutableCopy];
-    if (!mutableCoders) {
-        mutableCoders = [NSMutableArray array];
-    }
+    NSMutableArray<id<SDWebImageCoder>> *mutableCoders = [self.dispatchTable.coders mutableCopy];
     [mutableCoders addObject:coder];
-    self.coders = [mutableCoders copy];
+    self.dispatchTable = [[SDWebImageCodersDispatchTable alloc] initWithCoders:mutableCoders];
     UNLOCK(self.codersLock);
 }
 
@@ -67,79 +161,115 @@
         return;
     }
     LOCK(self.codersLock);
-    NSMutableArray<id<SDWebImageCoder>> *mutableCoders = [self.coders mutableCopy];
+    NSMutableArray<id<SDWebImageCoder>> *mutableCoders = [self.dispatchTable.coders mutableCopy];
     [mutableCoders removeObject:coder];
-    self.coders = [mutableCoders copy];
+    self.dispatchTable = [[SDWebImageCodersDispatchTable alloc] initWithCoders:mutableCoders];
     UNLOCK(self.codersLock);
 }
 
-#pragma mark - SDWebImageCoder
-- (BOOL)canDecodeFromData:(NSData *)data {
-    LOCK(self.codersLock);
-    NSArray<id<SDWebImageCoder>> *coders = self.coders;
-    UNLOCK(self.codersLock);
-    for (id<SDWebImageCoder> coder in coders.reverseObjectEnumerator) {
-        if ([coder canDecodeFromData:data]) {
-            return YES;
+#pragma mark - Coder lookup
+
+- (nullable id<SDWebImageCoder>)coderForDecodingData:(nullable NSData *)data format:(nullable SDImageFormat *)format {
+    SDImageFormat imageFormat = [NSData sd_imageFormatForImageData:data];
+    if (format) {
+        *format = imageFormat;
+    }
+    SDWebImageCodersDispatchTable *table = self.dispatchTable;
+    id coder = table.decodingCoders[@(imageFormat)];
+    if (coder) {
+        return coder == [NSNull null] ? nil : coder;
+    }
+    // Some coder with higher priority can only answer from the data
+    for (id<SDWebImageCoder> candidate in table.coders.reverseObjectEnumerator) {
+        if ([candidate canDecodeFromData:data]) {
+            return candidate;
         }
     }
-    return NO;
+    return nil;
 }
 
-- (BOOL)canEncodeToFormat:(SDImageFormat)format {
-    LOCK(self.codersLock);
-    NSArray<id<SDWebImageCoder>> *coders = self.coders;
-    UNLOCK(self.codersLock);
-    for (id<SDWebImageCoder> coder in coders.reverseObjectEnumerator) {
-        if ([coder canEncodeToFormat:format]) {
-            return YES;
+- (nullable id<SDWebImageProgressiveCoder>)progressiveCoderForData:(nullable NSData *)data format:(nullable SDImageFormat *)format {
+    SDImageFormat imageFormat = [NSData sd_imageFormatForImageData:data];
+    if (format) {
+        *format = imageFormat;
+    }
+    SDWebImageCodersDispatchTable *table = self.dispatchTable;
+    id coder = table.progressiveCoders[@(imageFormat)];
+    if (coder) {
+        return coder == [NSNull null] ? nil : coder;
+    }
+    for (id<SDWebImageCoder> candidate in table.coders.reverseObjectEnumerator) {
+        if ([candidate conformsToProtocol:@protocol(SDWebImageProgressiveCoder)] &&
+            [(id<SDWebImageProgressiveCoder>)candidate canIncrementallyDecodeFromData:data]) {
+            return (id<SDWebImageProgressiveCoder>)candidate;
         }
     }
-    return NO;
+    return nil;
 }
 
-- (UIImage *)decodedImageWithData:(NSData *)data {
-    LOCK(self.codersLock);
-    NSArray<id<SDWebImageCoder>> *coders = self.coders;
-    UNLOCK(self.codersLock);
-    for (id<SDWebImageCoder> coder in coders.reverseObjectEnumerator) {
-        if ([coder canDecodeFromData:data]) {
-            return [coder decodedImageWithData:data];
+- (nullable id<SDWebImageCoder>)coderForEncodingToFormat:(SDImageFormat)format {
+    id coder = self.dispatchTable.encodingCoders[@(format)];
+    if (coder) {
+        return coder == [NSNull null] ? nil : coder;
+    }
+    // Custom format which is not in the table
+    for (id<SDWebImageCoder> candidate in self.dispatchTable.coders.reverseObjectEnumerator) {
+        if ([candidate canEncodeToFormat:format]) {
+            return candidate;
         }
     }
     return nil;
 }
 
+#pragma mark - SDWebImageCoder
+- (BOOL)canDecodeFromData:(NSData *)data {
+    return [self coderForDecodingData:data format:NULL] != nil;
+}
+
+- (BOOL)canEncodeToFormat:(SDImageFormat)format {
+    return [self coderForEncodingToFormat:format] != nil;
+}
+
+- (UIImage *)decodedImageWithData:(NSData *)data {
+    id<SDWebImageCoder> coder = [self coderForDecodingData:data format:NULL];
+    return [coder decodedImageWithData:data];
+}
+
+- (UIImage *)decodedImageWithData:(NSData *)data options:(nullable NSDictionary<NSString*, NSObject*>*)optionsDict {
+    id<SDWebImageCoder> coder = [self coderForDecodingData:data format:NULL];
+    if (optionsDict && [coder respondsToSelector:@selector(decodedImageWithData:options:)]) {
+        return [coder decodedImageWithData:data options:optionsDict];
+    }
+    return [coder decodedImageWithData:data];
+}
+
 - (UIImage *)decompressedImageWithImage:(UIImage *)image
                                    data:(NSData *__autoreleasing  _Nullable *)data
                                 options:(nullable NSDictionary<NSString*, NSObject*>*)optionsDict {
     if (!image) {
         return nil;
     }
-    LOCK(self.codersLock);
-    NSArray<id<SDWebImageCoder>> *coders = self.coders;
-    UNLOCK(self.codersLock);
-    for (id<SDWebImageCoder> coder in coders.reverseObjectEnumerator) {
-        if ([coder canDecodeFromData:*data]) {
-            return [coder decompressedImageWithImage:image data:data options:optionsDict];
-        }
-    }
-    return nil;
+    id<SDWebImageCoder> coder = [self coderForDecodingData:*data format:NULL];
+    return [coder decompressedImageWithImage:image data:data options:optionsDict];
 }
 
 - (NSData *)encodedDataWithImage:(UIImage *)image format:(SDImageFormat)format {
     if (!image) {
         return nil;
     }
-    LOCK(self.codersLock);
-    NSArray<id<SDWebImageCoder>> *coders = self.coders;
-    UNLOCK(self.codersLock);
-    for (id<SDWebImageCoder> coder in coders.reverseObjectEnumerator) {
-        if ([coder canEncodeToFormat:format]) {
-            return [coder encodedDataWithImage:image format:format];
-        }
+    id<SDWebImageCoder> coder = [self coderForEncodingToFormat:format];
+    return [coder encodedDataWithImage:image format:format];
+}
+
+- (NSData *)encodedDataWithImage:(UIImage *)image format:(SDImageFormat)format options:(NSDictionary<NSString *,NSObject *> *)optionsDict {
+    if (!image) {
+        return nil;
     }
-    return nil;
+    id<SDWebImageCoder> coder = [self coderForEncodingToFormat:format];
+    if (optionsDict && [coder respondsToSelector:@selector(encodedDataWithImage:format:options:)]) {
+        return [coder encodedDataWithImage:image format:format options:optionsDict];
+    }
+    return [coder encodedDataWithImage:image format:format];
 }
 
 @end
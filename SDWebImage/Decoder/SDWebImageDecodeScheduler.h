@@ -0,0 +1,80 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+typedef NS_ENUM(NSInteger, SDWebImageDecodePriority) {
+    SDWebImageDecodePriorityLow = -1,
+    SDWebImageDecodePriorityDefault = 0,
+    SDWebImageDecodePriorityHigh = 1
+};
+
+/**
+ A shared scheduler for the full image decodes of the downloader and the cache.
+ Decodes run on a worker pool limited to `maxConcurrentDecodes`, and are admitted by their estimated decoded size, so the bitmaps being decoded at the same time stay under `maxDecodingBytes`.
+ Pending decodes start in priority order, first in first out within a priority. A decode does not start before the ones waiting ahead of it, so large images are not starved by small ones.
+ */
+@interface SDWebImageDecodeScheduler : NSObject
+
++ (nonnull instancetype)sharedScheduler;
+
+/**
+ The maximum number of decodes running at the same time. Defaults to the number of active processors.
+ */
+@property (nonatomic, assign) NSUInteger maxConcurrentDecodes;
+
+/**
+ The memory budget in bytes of the decodes running at the same time. A decode larger than the budget runs alone.
+ Defaults to 1/8 of the physical memory, 0 means no budget.
+ */
+@property (nonatomic, assign) NSUInteger maxDecodingBytes;
+
+/**
+ The estimated bytes of the decodes currently running
+ */
+@property (nonatomic, assign, readonly) NSUInteger decodingBytes;
+
+/**
+ The number of decodes currently running
+ */
+@property (nonatomic, assign, readonly) NSUInteger decodingCount;
+
+/**
+ The number of decodes waiting to start
+ */
+@property (nonatomic, assign, readonly) NSUInteger pendingDecodeCount;
+
+/**
+ Schedule a decode. The block runs on a worker queue once the decode is admitted.
+
+ @param estimatedBytes The estimated memory of the decoded image, see `estimatedDecodedBytesForData:options:`
+ @param priority The priority of the decode
+ @param block The decoding work
+ */
+- (void)scheduleDecodeWithEstimatedBytes:(NSUInteger)estimatedBytes priority:(SDWebImageDecodePriority)priority block:(nonnull dispatch_block_t)block;
+
+/**
+ Estimate the memory of the decoded image from the header of the image data, without decoding it.
+ The decoding target pixel size and pixel format are taken into account, and animated images which are not decoded lazily count all their frames. If the header can not be read, a typical compression ratio is assumed.
+
+ @param data The image data, can be partial as long as the header is complete
+ @param optionsDict The decoding options, see `SDWebImageCoder`
+ @return The estimated bytes of the decoded image, or 0 if there is no data
+ */
++ (NSUInteger)estimatedDecodedBytesForData:(nullable NSData *)data options:(nullable NSDictionary<NSString*, NSObject*>*)optionsDict;
+
+/**
+ Estimate the memory of the decoded image from the size of its data alone, with a typical compression ratio. Use it when the header has not been received yet.
+
+ @param length The size of the image data, the expected size for a download
+ @return The estimated bytes of the decoded image
+ */
++ (NSUInteger)estimatedDecodedBytesForDataLength:(NSUInteger)length;
+
+@end
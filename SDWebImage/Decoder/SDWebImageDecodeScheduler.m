@@ -0,0 +1,225 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDWebImageDecodeScheduler.h"
+#import "SDWebImageCoder.h"
+#import "SDWebImageCoderHelper.h"
+#import <ImageIO/ImageIO.h>
+#import "SDImageHeaderParser.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+// Used when the header can not be read, compressed images are usually about 10 times smaller than their bitmap
+static const NSUInteger kSDDecodeUnknownCompressionRatio = 10;
+
+// The sizes and frame counts come from the file, which can claim anything, so the estimate saturates instead of wrapping around to a small value
+static inline NSUInteger SDSaturatingMultiply(NSUInteger a, NSUInteger b) {
+    NSUInteger result;
+    return __builtin_mul_overflow(a, b, &result) ? NSUIntegerMax : result;
+}
+
+@interface SDWebImageDecodeTask : NSObject
+
+@property (nonatomic, assign) NSUInteger estimatedBytes;
+@property (nonatomic, copy, nonnull) dispatch_block_t block;
+
+@end
+
+@implementation SDWebImageDecodeTask
+@end
+
+@implementation SDWebImageDecodeScheduler {
+    dispatch_semaphore_t _lock;
+    dispatch_queue_t _workerQueue;
+    // The pending tasks of each priority, from high to low
+    NSArray<NSMutableArray<SDWebImageDecodeTask *> *> *_pendingTasks;
+}
+
+@synthesize decodingBytes = _decodingBytes;
+@synthesize decodingCount = _decodingCount;
+
++ (nonnull instancetype)sharedScheduler {
+    static dispatch_once_t once;
+    static id instance;
+    dispatch_once(&once, ^{
+        instance = [self new];
+    });
+    return instance;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lock = dispatch_semaphore_create(1);
+        _workerQueue = dispatch_queue_create("com.hackemist.SDWebImageDecodeScheduler", DISPATCH_QUEUE_CONCURRENT);
+        _pendingTasks = @[[NSMutableArray array], [NSMutableArray array], [NSMutableArray array]];
+        _maxConcurrentDecodes = [NSProcessInfo processInfo].activeProcessorCount;
+        _maxDecodingBytes = (NSUInteger)([NSProcessInfo processInfo].physicalMemory / 8);
+    }
+    return self;
+}
+
+#pragma mark - Properties
+
+- (void)setMaxConcurrentDecodes:(NSUInteger)maxConcurrentDecodes {
+    LOCK(_lock);
+    _maxConcurrentDecodes = maxConcurrentDecodes;
+    [self sd_startPendingTasks];
+    UNLOCK(_lock);
+}
+
+- (void)setMaxDecodingBytes:(NSUInteger)maxDecodingBytes {
+    LOCK(_lock);
+    _maxDecodingBytes = maxDecodingBytes;
+    [self sd_startPendingTasks];
+    UNLOCK(_lock);
+}
+
+- (NSUInteger)decodingBytes {
+    LOCK(_lock);
+    NSUInteger decodingBytes = _decodingBytes;
+    UNLOCK(_lock);
+    return decodingBytes;
+}
+
+- (NSUInteger)decodingCount {
+    LOCK(_lock);
+    NSUInteger decodingCount = _decodingCount;
+    UNLOCK(_lock);
+    return decodingCount;
+}
+
+- (NSUInteger)pendingDecodeCount {
+    LOCK(_lock);
+    NSUInteger count = 0;
+    for (NSMutableArray<SDWebImageDecodeTask *> *tasks in _pendingTasks) {
+        count += tasks.count;
+    }
+    UNLOCK(_lock);
+    return count;
+}
+
+#pragma mark - Scheduling
+
+- (void)scheduleDecodeWithEstimatedBytes:(NSUInteger)estimatedBytes priority:(SDWebImageDecodePriority)priority block:(dispatch_block_t)block {
+    if (!block) {
+        return;
+    }
+    SDWebImageDecodeTask *task = [SDWebImageDecodeTask new];
+    task.estimatedBytes = estimatedBytes;
+    task.block = block;
+    NSUInteger index;
+    if (priority > SDWebImageDecodePriorityDefault) {
+        index = 0;
+    } else if (priority < SDWebImageDecodePriorityDefault) {
+        index = 2;
+    } else {
+        index = 1;
+    }
+    LOCK(_lock);
+    [_pendingTasks[index] addObject:task];
+    [self sd_startPendingTasks];
+    UNLOCK(_lock);
+}
+
+// Must be called with the lock held
+- (void)sd_startPendingTasks {
+    while (_decodingCount < MAX(_maxConcurrentDecodes, 1)) {
+        NSMutableArray<SDWebImageDecodeTask *> *tasks;
+        for (NSMutableArray<SDWebImageDecodeTask *> *priorityTasks in _pendingTasks) {
+            if (priorityTasks.count > 0) {
+                tasks = priorityTasks;
+                break;
+            }
+        }
+        SDWebImageDecodeTask *task = tasks.firstObject;
+        if (!task) {
+            return;
+        }
+        // Wait for memory to be released, a decode larger than the budget only runs alone
+        if (_maxDecodingBytes > 0 && _decodingCount > 0 && (_decodingBytes >= _maxDecodingBytes || task.estimatedBytes > _maxDecodingBytes - _decodingBytes)) {
+            return;
+        }
+        [tasks removeObjectAtIndex:0];
+        _decodingCount++;
+        _decodingBytes += task.estimatedBytes;
+        dispatch_async(_workerQueue, ^{
+            @autoreleasepool {
+                task.block();
+            }
+            LOCK(self->_lock);
+            self->_decodingCount--;
+            self->_decodingBytes -= task.estimatedBytes;
+            [self sd_startPendingTasks];
+            UNLOCK(self->_lock);
+        });
+    }
+}
+
+#pragma mark - Estimation
+
++ (NSUInteger)estimatedDecodedBytesForData:(NSData *)data options:(NSDictionary<NSString *,NSObject *> *)optionsDict {
+    if (data.length == 0) {
+        return 0;
+    }
+    CGSize pixelSize = CGSizeZero;
+    size_t frameCount = 1;
+    BOOL hasAlpha = NO;
+    BOOL isGray = NO;
+    SDImageHeaderInfo headerInfo;
+    if (SDImageHeaderParse(data.bytes, data.length, &headerInfo) == SDImageHeaderStatusOK) {
+        pixelSize = CGSizeMake(headerInfo.width, headerInfo.height);
+        frameCount = headerInfo.frameCount;
+        hasAlpha = headerInfo.hasAlpha;
+        isGray = headerInfo.isGray;
+    } else {
+        // Formats the header parser does not know
+        CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data, NULL);
+        if (source) {
+            NSDictionary *properties = (__bridge_transfer NSDictionary *)CGImageSourceCopyPropertiesAtIndex(source, 0, (__bridge CFDictionaryRef)@{(__bridge NSString *)kCGImageSourceShouldCache : @NO});
+            frameCount = CGImageSourceGetCount(source);
+            CFRelease(source);
+            pixelSize = CGSizeMake([properties[(__bridge NSString *)kCGImagePropertyPixelWidth] doubleValue], [properties[(__bridge NSString *)kCGImagePropertyPixelHeight] doubleValue]);
+            hasAlpha = [properties[(__bridge NSString *)kCGImagePropertyHasAlpha] boolValue];
+            isGray = [properties[(__bridge NSString *)kCGImagePropertyColorModel] isEqual:(__bridge NSString *)kCGImagePropertyColorModelGray];
+        }
+    }
+    NSUInteger bytes = 0;
+    if (pixelSize.width > 0 && pixelSize.height > 0) {
+        CGSize targetPixelSize = [SDWebImageCoderHelper targetPixelSizeFromOptions:optionsDict];
+        SDWebImageCoderContentMode contentMode = [SDWebImageCoderHelper targetContentModeFromOptions:optionsDict];
+        pixelSize = [SDWebImageCoderHelper scaledPixelSizeWithImageSize:pixelSize targetPixelSize:targetPixelSize contentMode:contentMode];
+        // Static opaque images may be decompressed to 8-bit gray or 16-bit, see `SDWebImageCoderDecodePixelFormatKey`
+        size_t bytesPerPixel = 4;
+        SDWebImageCoderPixelFormat pixelFormat = [SDWebImageCoderHelper pixelFormatFromOptions:optionsDict];
+        if (frameCount <= 1 && pixelFormat != SDWebImageCoderPixelFormat32Bit && !hasAlpha) {
+            if (isGray) {
+                bytesPerPixel = 1;
+            } else if (pixelFormat == SDWebImageCoderPixelFormatAllow16Bit) {
+                bytesPerPixel = 2;
+            }
+        }
+        bytes = SDSaturatingMultiply(SDSaturatingMultiply((NSUInteger)ceil(pixelSize.width), (NSUInteger)ceil(pixelSize.height)), bytesPerPixel);
+        NSNumber *lazyFrames = (NSNumber *)optionsDict[SDWebImageCoderDecodeLazyFramesKey];
+        BOOL lazy = [lazyFrames isKindOfClass:[NSNumber class]] && lazyFrames.boolValue;
+        if (frameCount > 1 && !lazy) {
+            bytes = SDSaturatingMultiply(bytes, frameCount);
+        }
+    }
+    if (bytes == 0) {
+        bytes = [self estimatedDecodedBytesForDataLength:data.length];
+    }
+    return bytes;
+}
+
++ (NSUInteger)estimatedDecodedBytesForDataLength:(NSUInteger)length {
+    return SDSaturatingMultiply(length, kSDDecodeUnknownCompressionRatio);
+}
+
+@end
@@ -15,8 +15,9 @@
  @note Use `SDWebImageGIFCoder` for fully animated GIFs - less performant than `FLAnimatedImage`
  @note If you decide to make all `UIImageView`(including `FLAnimatedImageView`) instance support GIF. You should add this coder to `SDWebImageCodersManager` and make sure that it has a higher priority than `SDWebImageIOCoder`
  @note The recommended approach for animated GIFs is using `FLAnimatedImage`. It's more performant than `UIImageView` for GIF displaying
+ @note Pass `SDWebImageCoderDecodeLazyFramesKey` to get a `SDWebImageAnimatedImage`, which decodes the frames on demand instead of all at once
  */
-@interface SDWebImageGIFCoder : NSObject <SDWebImageCoder>
+@interface SDWebImageGIFCoder : NSObject <SDWebImageCoder, SDWebImageAnimatedCoder>
 
 + (nonnull instancetype)sharedCoder;
 
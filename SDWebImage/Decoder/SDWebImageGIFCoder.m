@@ -13,8 +13,26 @@
 #import "UIImage+MultiFormat.h"
 #import "SDWebImageCoderHelper.h"
 #import "SDAnimatedImageRep.h"
+#import "SDWebImageAnimatedImage.h"
+#import "SDImageHeaderParser.h"
 
-@implementation SDWebImageGIFCoder
+@implementation SDWebImageGIFCoder {
+    // Animated coder context, ImageIO composes the GIF frames itself
+    CGImageSourceRef _imageSource;
+    NSDictionary *_frameOptions;
+    NSArray<NSNumber *> *_frameDurations;
+}
+
+@synthesize animatedImageData = _animatedImageData;
+@synthesize animatedImageFrameCount = _animatedImageFrameCount;
+@synthesize animatedImageLoopCount = _animatedImageLoopCount;
+
+- (void)dealloc {
+    if (_imageSource) {
+        CFRelease(_imageSource);
+        _imageSource = NULL;
+    }
+}
 
 + (instancetype)sharedCoder {
     static SDWebImageGIFCoder *coder;
@@ -27,14 +45,31 @@
 
 #pragma mark - Decode
 - (BOOL)canDecodeFromData:(nullable NSData *)data {
-    return ([NSData sd_imageFormatForImageData:data] == SDImageFormatGIF);
+    return [self canDecodeFromFormat:[NSData sd_imageFormatForImageData:data]];
+}
+
+- (BOOL)canDecodeFromFormat:(SDImageFormat)format {
+    return (format == SDImageFormatGIF);
 }
 
 - (UIImage *)decodedImageWithData:(NSData *)data {
+    return [self decodedImageWithData:data options:nil];
+}
+
+- (UIImage *)decodedImageWithData:(NSData *)data options:(nullable NSDictionary<NSString*, NSObject*>*)optionsDict {
     if (!data) {
         return nil;
     }
     
+    NSNumber *lazyFrames = (NSNumber *)optionsDict[SDWebImageCoderDecodeLazyFramesKey];
+    if ([lazyFrames isKindOfClass:[NSNumber class]] && lazyFrames.boolValue) {
+        // Keep the compressed data and decode the frames on demand, static GIFs fall through
+        SDWebImageGIFCoder *animatedCoder = [[SDWebImageGIFCoder alloc] initWithAnimatedImageData:data options:optionsDict];
+        if (animatedCoder) {
+            return [[SDWebImageAnimatedImage alloc] initWithAnimatedCoder:animatedCoder];
+        }
+    }
+    
 #if SD_MAC
     SDAnimatedImageRep *imageRep = [[SDAnimatedImageRep alloc] initWithData:data];
     NSImage *animatedImage = [[NSImage alloc] initWithSize:imageRep.size];
@@ -47,16 +82,24 @@
         return nil;
     }
     size_t count = CGImageSourceGetCount(source);
+    NSDictionary *thumbnailOptions = [self sd_thumbnailOptionsWithData:data source:source options:optionsDict];
     
     UIImage *animatedImage;
     
-    if (count <= 1) {
+    if (count <= 1 && !thumbnailOptions) {
         animatedImage = [[UIImage alloc] initWithData:data];
+    } else if (count <= 1) {
+        CGImageRef imageRef = CGImageSourceCreateThumbnailAtIndex(source, 0, (__bridge CFDictionaryRef)thumbnailOptions);
+        if (imageRef) {
+            animatedImage = [[UIImage alloc] initWithCGImage:imageRef];
+            CGImageRelease(imageRef);
+        }
     } else {
         NSMutableArray<SDWebImageFrame *> *frames = [NSMutableArray array];
         
         for (size_t i = 0; i < count; i++) {
-            CGImageRef imageRef = CGImageSourceCreateImageAtIndex(source, i, NULL);
+            // Decode each frame directly at the target size if needed
+            CGImageRef imageRef = thumbnailOptions ? CGImageSourceCreateThumbnailAtIndex(source, i, (__bridge CFDictionaryRef)thumbnailOptions) : CGImageSourceCreateImageAtIndex(source, i, NULL);
             if (!imageRef) {
                 continue;
             }
@@ -69,18 +112,8 @@
             [frames addObject:frame];
         }
         
-        NSUInteger loopCount = 1;
-        NSDictionary *imageProperties = (__bridge_transfer NSDictionary *)CGImageSourceCopyProperties(source, nil);
-        NSDictionary *gifProperties = [imageProperties valueForKey:(__bridge_transfer NSString *)kCGImagePropertyGIFDictionary];
-        if (gifProperties) {
-            NSNumber *gifLoopCount = [gifProperties valueForKey:(__bridge_transfer NSString *)kCGImagePropertyGIFLoopCount];
-            if (gifLoopCount != nil) {
-                loopCount = gifLoopCount.unsignedIntegerValue;
-            }
-        }
-        
         animatedImage = [SDWebImageCoderHelper animatedImageWithFrames:frames];
-        animatedImage.sd_imageLoopCount = loopCount;
+        animatedImage.sd_imageLoopCount = [self sd_imageLoopCountWithSource:source];
     }
     
     CFRelease(source);
@@ -89,6 +122,53 @@
 #endif
 }
 
+// Return the ImageIO thumbnail options for the target pixel size, or nil if the image should be decoded at full size
+- (nullable NSDictionary *)sd_thumbnailOptionsWithData:(NSData *)data source:(CGImageSourceRef)source options:(nullable NSDictionary<NSString*, NSObject*>*)optionsDict {
+    CGSize targetPixelSize = [SDWebImageCoderHelper targetPixelSizeFromOptions:optionsDict];
+    if (CGSizeEqualToSize(targetPixelSize, CGSizeZero)) {
+        return nil;
+    }
+    size_t width = 0;
+    size_t height = 0;
+    // The size is in the logical screen descriptor, only ask ImageIO if the header can not be parsed
+    SDImageHeaderInfo headerInfo;
+    CFDictionaryRef properties = NULL;
+    if (SDImageHeaderParse(data.bytes, data.length, &headerInfo) == SDImageHeaderStatusOK) {
+        width = headerInfo.width;
+        height = headerInfo.height;
+    } else {
+        properties = CGImageSourceCopyPropertiesAtIndex(source, 0, NULL);
+    }
+    if (properties) {
+        CFTypeRef val = CFDictionaryGetValue(properties, kCGImagePropertyPixelWidth);
+        if (val) CFNumberGetValue(val, kCFNumberLongType, &width);
+        val = CFDictionaryGetValue(properties, kCGImagePropertyPixelHeight);
+        if (val) CFNumberGetValue(val, kCFNumberLongType, &height);
+        CFRelease(properties);
+    }
+    SDWebImageCoderContentMode contentMode = [SDWebImageCoderHelper targetContentModeFromOptions:optionsDict];
+    CGSize scaledSize = [SDWebImageCoderHelper scaledPixelSizeWithImageSize:CGSizeMake(width, height) targetPixelSize:targetPixelSize contentMode:contentMode];
+    if (width == 0 || height == 0 || (scaledSize.width >= width && scaledSize.height >= height)) {
+        return nil;
+    }
+    return @{(__bridge NSString *)kCGImageSourceCreateThumbnailFromImageAlways : @YES,
+             (__bridge NSString *)kCGImageSourceThumbnailMaxPixelSize : @(MAX(scaledSize.width, scaledSize.height)),
+             (__bridge NSString *)kCGImageSourceShouldCacheImmediately : @YES};
+}
+
+- (NSUInteger)sd_imageLoopCountWithSource:(CGImageSourceRef)source {
+    NSUInteger loopCount = 1;
+    NSDictionary *imageProperties = (__bridge_transfer NSDictionary *)CGImageSourceCopyProperties(source, nil);
+    NSDictionary *gifProperties = [imageProperties valueForKey:(__bridge_transfer NSString *)kCGImagePropertyGIFDictionary];
+    if (gifProperties) {
+        NSNumber *gifLoopCount = [gifProperties valueForKey:(__bridge_transfer NSString *)kCGImagePropertyGIFLoopCount];
+        if (gifLoopCount != nil) {
+            loopCount = gifLoopCount.unsignedIntegerValue;
+        }
+    }
+    return loopCount;
+}
+
 - (float)sd_frameDurationAtIndex:(NSUInteger)index source:(CGImageSourceRef)source {
     float frameDuration = 0.1f;
     CFDictionaryRef cfFrameProperties = CGImageSourceCopyPropertiesAtIndex(source, index, nil);
@@ -128,6 +208,64 @@
     return image;
 }
 
+#pragma mark - SDWebImageAnimatedCoder
+- (instancetype)initWithAnimatedImageData:(NSData *)data options:(NSDictionary<NSString *,NSObject *> *)optionsDict {
+    if (!data) {
+        return nil;
+    }
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    _animatedImageData = [data copy];
+    _imageSource = CGImageSourceCreateWithData((__bridge CFDataRef)_animatedImageData, NULL);
+    if (!_imageSource) {
+        return nil;
+    }
+    size_t count = CGImageSourceGetCount(_imageSource);
+    if (count <= 1) {
+        return nil;
+    }
+    
+    // Only the frame properties are read here, no frame is decoded
+    NSMutableArray<NSNumber *> *frameDurations = [NSMutableArray arrayWithCapacity:count];
+    for (size_t i = 0; i < count; i++) {
+        [frameDurations addObject:@([self sd_frameDurationAtIndex:i source:_imageSource])];
+    }
+    _frameDurations = [frameDurations copy];
+    _animatedImageFrameCount = count;
+    _animatedImageLoopCount = [self sd_imageLoopCountWithSource:_imageSource];
+    // Decode when the frame is created rather than when it is first drawn on the main queue
+    _frameOptions = [self sd_thumbnailOptionsWithData:_animatedImageData source:_imageSource options:optionsDict] ?: @{(__bridge NSString *)kCGImageSourceShouldCacheImmediately : @YES};
+    
+    return self;
+}
+
+- (NSTimeInterval)animatedImageDurationAtIndex:(NSUInteger)index {
+    if (index >= _frameDurations.count) {
+        return 0;
+    }
+    return _frameDurations[index].doubleValue;
+}
+
+- (UIImage *)animatedImageFrameAtIndex:(NSUInteger)index {
+    if (!_imageSource || index >= _animatedImageFrameCount) {
+        return nil;
+    }
+    BOOL thumbnail = _frameOptions[(__bridge NSString *)kCGImageSourceThumbnailMaxPixelSize] != nil;
+    CGImageRef imageRef = thumbnail ? CGImageSourceCreateThumbnailAtIndex(_imageSource, index, (__bridge CFDictionaryRef)_frameOptions) : CGImageSourceCreateImageAtIndex(_imageSource, index, (__bridge CFDictionaryRef)_frameOptions);
+    if (!imageRef) {
+        return nil;
+    }
+#if SD_UIKIT || SD_WATCH
+    UIImage *image = [[UIImage alloc] initWithCGImage:imageRef];
+#else
+    UIImage *image = [[UIImage alloc] initWithCGImage:imageRef size:NSZeroSize];
+#endif
+    CGImageRelease(imageRef);
+    return image;
+}
+
 #pragma mark - Encode
 - (BOOL)canEncodeToFormat:(SDImageFormat)format {
     return (format == SDImageFormatGIF);
@@ -11,6 +11,8 @@
 #import "NSImage+WebCache.h"
 #import <ImageIO/ImageIO.h>
 #import "NSData+ImageContentType.h"
+#import "SDImageResampler.h"
+#import "SDImageHeaderParser.h"
 
 #if SD_UIKIT || SD_WATCH
 static const size_t kBytesPerPixel = 4;
@@ -37,15 +39,123 @@ static const CGFloat kPixelsPerMB = kBytesPerMB / kBytesPerPixel;
 static const CGFloat kDestTotalPixels = kDestImageSizeMB * kPixelsPerMB;
 static const CGFloat kTileTotalPixels = kSourceImageTileSizeMB * kPixelsPerMB;
 
-static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to overlap the seems where tiles meet.
+/*
+ * Defines the filter used to resample the tiles when the flag `SDWebImageScaleDownLargeImages` is set
+ */
+static const SDImageResamplingFilter kScaleDownResamplingFilter = SDImageResamplingFilterBilinear;
+
+/*
+ * Defines the maximum number of source tiles decoded at the same time when the flag `SDWebImageScaleDownLargeImages` is set
+ * The peak memory used by the tiles is about kSourceImageTileSizeMB * kMaxConcurrentTiles, the actual count is also limited by the active processor count.
+ * `SDWebImageCoderScaleDownMaxConcurrentTilesKey` overrides it.
+ */
+static const NSUInteger kMaxConcurrentTiles = 4;
 #endif
 
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+// An append-only list of immutable data chunks. ImageIO reads it through a data provider, so the downloaded bytes are never copied into one growing buffer.
+@interface SDWebImageDataSegments : NSObject
+
+@property (nonatomic, assign, readonly) size_t length;
+
+- (void)appendData:(nonnull NSData *)data;
+- (size_t)getBytes:(nonnull void *)buffer atPosition:(size_t)position count:(size_t)count;
+
+@end
+
+@implementation SDWebImageDataSegments {
+    NSMutableArray<NSData *> *_segments;
+    // The start position of each segment, for binary search
+    size_t *_offsets;
+    size_t _offsetsCapacity;
+    dispatch_semaphore_t _lock;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _segments = [NSMutableArray array];
+        _lock = dispatch_semaphore_create(1);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(_offsets);
+}
+
+- (void)appendData:(NSData *)data {
+    if (data.length == 0) {
+        return;
+    }
+    LOCK(_lock);
+    NSUInteger count = _segments.count;
+    if (count == _offsetsCapacity) {
+        size_t capacity = MAX(16, _offsetsCapacity * 2);
+        size_t *offsets = realloc(_offsets, capacity * sizeof(size_t));
+        if (!offsets) {
+            UNLOCK(_lock);
+            return;
+        }
+        _offsets = offsets;
+        _offsetsCapacity = capacity;
+    }
+    _offsets[count] = _length;
+    // NSURLSession hands over immutable chunks, so `copy` only retains them
+    [_segments addObject:[data copy]];
+    _length += data.length;
+    UNLOCK(_lock);
+}
+
+- (size_t)getBytes:(void *)buffer atPosition:(size_t)position count:(size_t)count {
+    size_t copied = 0;
+    LOCK(_lock);
+    NSUInteger segmentCount = _segments.count;
+    // Find the last segment starting at or before position
+    NSUInteger low = 0, high = segmentCount;
+    while (high - low > 1) {
+        NSUInteger mid = (low + high) / 2;
+        if (_offsets[mid] <= position) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    for (NSUInteger i = low; i < segmentCount && copied < count; i++) {
+        NSData *segment = _segments[i];
+        size_t start = position + copied - _offsets[i];
+        if (start >= segment.length) {
+            continue;
+        }
+        size_t length = MIN(segment.length - start, count - copied);
+        memcpy((uint8_t *)buffer + copied, (const uint8_t *)segment.bytes + start, length);
+        copied += length;
+    }
+    UNLOCK(_lock);
+    return copied;
+}
+
+@end
+
+static size_t SDDataSegmentsGetBytesAtPosition(void *info, void *buffer, off_t position, size_t count) {
+    SDWebImageDataSegments *segments = (__bridge SDWebImageDataSegments *)info;
+    return [segments getBytes:buffer atPosition:(size_t)position count:count];
+}
+
+static void SDDataSegmentsReleaseInfo(void *info) {
+    CFRelease(info);
+}
+
 @implementation SDWebImageImageIOCoder {
         size_t _width, _height;
 #if SD_UIKIT || SD_WATCH
         UIImageOrientation _orientation;
 #endif
         CGImageSourceRef _imageSource;
+        SDWebImageDataSegments *_segments;
+        CGContextRef _progressiveContext;
 }
 
 - (void)dealloc {
@@ -53,6 +163,7 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
         CFRelease(_imageSource);
         _imageSource = NULL;
     }
+    CGContextRelease(_progressiveContext);
 }
 
 + (instancetype)sharedCoder {
@@ -66,7 +177,11 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
 
 #pragma mark - Decode
 - (BOOL)canDecodeFromData:(nullable NSData *)data {
-    switch ([NSData sd_imageFormatForImageData:data]) {
+    return [self canDecodeFromFormat:[NSData sd_imageFormatForImageData:data]];
+}
+
+- (BOOL)canDecodeFromFormat:(SDImageFormat)format {
+    switch (format) {
         case SDImageFormatWebP:
             // Do not support WebP decoding
             return NO;
@@ -79,7 +194,11 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
 }
 
 - (BOOL)canIncrementallyDecodeFromData:(NSData *)data {
-    switch ([NSData sd_imageFormatForImageData:data]) {
+    return [self canIncrementallyDecodeFromFormat:[NSData sd_imageFormatForImageData:data]];
+}
+
+- (BOOL)canIncrementallyDecodeFromFormat:(SDImageFormat)format {
+    switch (format) {
         case SDImageFormatWebP:
             // Do not support WebP progressive decoding
             return NO;
@@ -114,11 +233,78 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
 #endif
 }
 
+- (UIImage *)decodedImageWithData:(NSData *)data options:(nullable NSDictionary<NSString*, NSObject*>*)optionsDict {
+    CGSize targetPixelSize = [SDWebImageCoderHelper targetPixelSizeFromOptions:optionsDict];
+    if (!data || CGSizeEqualToSize(targetPixelSize, CGSizeZero)) {
+        return [self decodedImageWithData:data];
+    }
+    
+    CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data, NULL);
+    if (!source) {
+        return nil;
+    }
+    size_t width = 0;
+    size_t height = 0;
+    NSInteger exifOrientation = 1;
+    // Read the size and orientation from the header, only the formats the parser does not know need the properties from ImageIO
+    SDImageHeaderInfo headerInfo;
+    CFDictionaryRef properties = NULL;
+    if (SDImageHeaderParse(data.bytes, data.length, &headerInfo) == SDImageHeaderStatusOK) {
+        width = headerInfo.width;
+        height = headerInfo.height;
+        exifOrientation = headerInfo.orientation;
+    } else {
+        properties = CGImageSourceCopyPropertiesAtIndex(source, 0, NULL);
+    }
+    if (properties) {
+        CFTypeRef val = CFDictionaryGetValue(properties, kCGImagePropertyPixelWidth);
+        if (val) CFNumberGetValue(val, kCFNumberLongType, &width);
+        val = CFDictionaryGetValue(properties, kCGImagePropertyPixelHeight);
+        if (val) CFNumberGetValue(val, kCFNumberLongType, &height);
+        val = CFDictionaryGetValue(properties, kCGImagePropertyOrientation);
+        if (val) CFNumberGetValue(val, kCFNumberNSIntegerType, &exifOrientation);
+        CFRelease(properties);
+    }
+    
+    // The target size is in display orientation, but the pixels are stored before the EXIF transform
+    if (exifOrientation >= 5 && exifOrientation <= 8) {
+        targetPixelSize = CGSizeMake(targetPixelSize.height, targetPixelSize.width);
+    }
+    SDWebImageCoderContentMode contentMode = [SDWebImageCoderHelper targetContentModeFromOptions:optionsDict];
+    CGSize scaledSize = [SDWebImageCoderHelper scaledPixelSizeWithImageSize:CGSizeMake(width, height) targetPixelSize:targetPixelSize contentMode:contentMode];
+    if (width == 0 || height == 0 || (scaledSize.width >= width && scaledSize.height >= height)) {
+        // Unknown size or already small enough, decode at full size
+        CFRelease(source);
+        return [self decodedImageWithData:data];
+    }
+    
+    // Creating a thumbnail lets ImageIO decode JPEG at a reduced DCT scale and subsample the other formats, so the full size bitmap is never allocated.
+    // Keep the EXIF orientation in the UIImage instead of applying the transform, same as the full size decoding.
+    NSDictionary *thumbnailOptions = @{(__bridge NSString *)kCGImageSourceCreateThumbnailFromImageAlways : @YES,
+                                       (__bridge NSString *)kCGImageSourceThumbnailMaxPixelSize : @(MAX(scaledSize.width, scaledSize.height)),
+                                       (__bridge NSString *)kCGImageSourceCreateThumbnailWithTransform : @NO,
+                                       (__bridge NSString *)kCGImageSourceShouldCacheImmediately : @YES};
+    CGImageRef imageRef = CGImageSourceCreateThumbnailAtIndex(source, 0, (__bridge CFDictionaryRef)thumbnailOptions);
+    CFRelease(source);
+    if (!imageRef) {
+        return nil;
+    }
+    
+#if SD_UIKIT || SD_WATCH
+    UIImageOrientation orientation = [SDWebImageCoderHelper imageOrientationFromEXIFOrientation:exifOrientation];
+    UIImage *image = [[UIImage alloc] initWithCGImage:imageRef scale:1 orientation:orientation];
+#elif SD_MAC
+    UIImage *image = [[UIImage alloc] initWithCGImage:imageRef size:NSZeroSize];
+#endif
+    CGImageRelease(imageRef);
+    
+    return image;
+}
+
 - (UIImage *)incrementallyDecodedImageWithData:(NSData *)data finished:(BOOL)finished {
     if (!_imageSource) {
         _imageSource = CGImageSourceCreateIncremental(NULL);
     }
-    UIImage *image;
     
     // The following code is from http://www.cocoaintheshell.com/2011/05/progressive-images-download-imageio/
     // Thanks to the author @Nyx0uf
@@ -126,6 +312,39 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
     // Update the data source, we must pass ALL the data, not just the new bytes
     CGImageSourceUpdateData(_imageSource, (__bridge CFDataRef)data, finished);
     
+    return [self sd_incrementallyDecodedImageFinished:finished];
+}
+
+- (UIImage *)incrementallyDecodedImageWithAppendedData:(NSData *)data finished:(BOOL)finished {
+    if (!_imageSource) {
+        _imageSource = CGImageSourceCreateIncremental(NULL);
+        _segments = [SDWebImageDataSegments new];
+    }
+    if (data) {
+        [_segments appendData:data];
+    }
+    
+    // ImageIO still wants ALL the data, give it a provider reading the segments in place
+    CGDataProviderDirectCallbacks callbacks = {
+        .version = 0,
+        .getBytePointer = NULL,
+        .releaseBytePointer = NULL,
+        .getBytesAtPosition = SDDataSegmentsGetBytesAtPosition,
+        .releaseInfo = SDDataSegmentsReleaseInfo
+    };
+    CGDataProviderRef provider = CGDataProviderCreateDirect((__bridge_retained void *)_segments, _segments.length, &callbacks);
+    if (provider) {
+        CGImageSourceUpdateDataProvider(_imageSource, provider, finished);
+        CGDataProviderRelease(provider);
+    }
+    
+    return [self sd_incrementallyDecodedImageFinished:finished];
+}
+
+// Create the partial image from the incremental image source
+- (UIImage *)sd_incrementallyDecodedImageFinished:(BOOL)finished {
+    UIImage *image;
+    
     if (_width + _height == 0) {
         CFDictionaryRef properties = CGImageSourceCopyPropertiesAtIndex(_imageSource, 0, NULL);
         if (properties) {
@@ -156,13 +375,16 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
         // Workaround for iOS anamorphic image
         if (partialImageRef) {
             const size_t partialHeight = CGImageGetHeight(partialImageRef);
-            CGColorSpaceRef colorSpace = SDCGColorSpaceGetDeviceRGB();
-            CGContextRef bmContext = CGBitmapContextCreate(NULL, _width, _height, 8, 0, colorSpace, kCGBitmapByteOrderDefault | kCGImageAlphaPremultipliedFirst);
-            if (bmContext) {
-                CGContextDrawImage(bmContext, (CGRect){.origin.x = 0.0f, .origin.y = 0.0f, .size.width = _width, .size.height = partialHeight}, partialImageRef);
+            // One canvas is reused by all the partial decodes of the image, the previous snapshot keeps its pixels by copy-on-write
+            if (!_progressiveContext) {
+                CGColorSpaceRef colorSpace = SDCGColorSpaceGetDeviceRGB();
+                _progressiveContext = CGBitmapContextCreate(NULL, _width, _height, 8, 0, colorSpace, kCGBitmapByteOrderDefault | kCGImageAlphaPremultipliedFirst);
+            }
+            if (_progressiveContext) {
+                CGContextClearRect(_progressiveContext, CGRectMake(0, 0, _width, _height));
+                CGContextDrawImage(_progressiveContext, (CGRect){.origin.x = 0.0f, .origin.y = 0.0f, .size.width = _width, .size.height = partialHeight}, partialImageRef);
                 CGImageRelease(partialImageRef);
-                partialImageRef = CGBitmapContextCreateImage(bmContext);
-                CGContextRelease(bmContext);
+                partialImageRef = CGBitmapContextCreateImage(_progressiveContext);
             }
             else {
                 CGImageRelease(partialImageRef);
@@ -186,6 +408,9 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
             CFRelease(_imageSource);
             _imageSource = NULL;
         }
+        _segments = nil;
+        CGContextRelease(_progressiveContext);
+        _progressiveContext = NULL;
     }
     
     return image;
@@ -208,10 +433,15 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
             shouldScaleDown = [scaleDownLargeImagesOption boolValue];
         }
     }
+    SDWebImageCoderPixelFormat pixelFormat = [SDWebImageCoderHelper pixelFormatFromOptions:optionsDict];
     if (!shouldScaleDown) {
-        return [self sd_decompressedImageWithImage:image];
+        return [self sd_decompressedImageWithImage:image pixelFormat:pixelFormat];
     } else {
-        UIImage *scaledDownImage = [self sd_decompressedAndScaledDownImageWithImage:image];
+        NSUInteger maxConcurrentTiles = 0;
+        if ([optionsDict[SDWebImageCoderScaleDownMaxConcurrentTilesKey] isKindOfClass:[NSNumber class]]) {
+            maxConcurrentTiles = ((NSNumber *)optionsDict[SDWebImageCoderScaleDownMaxConcurrentTilesKey]).unsignedIntegerValue;
+        }
+        UIImage *scaledDownImage = [self sd_decompressedAndScaledDownImageWithImage:image pixelFormat:pixelFormat maxConcurrentTiles:maxConcurrentTiles];
         if (scaledDownImage && !CGSizeEqualToSize(scaledDownImage.size, image.size)) {
             // if the image is scaled down, need to modify the data pointer as well
             SDImageFormat format = [NSData sd_imageFormatForImageData:*data];
@@ -226,7 +456,31 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
 }
 
 #if SD_UIKIT || SD_WATCH
-- (nullable UIImage *)sd_decompressedImageWithImage:(nullable UIImage *)image {
+// Create the context an image is decompressed into, in the smallest layout the pixel format policy allows for it.
+// Opaque gray images become 8-bit gray. With `SDWebImageCoderPixelFormatAllow16Bit`, other opaque images become xRGB1555, which is the 16-bit RGB layout Core Graphics can render into. Everything else is BGRA8888/BGRX8888.
+static CGContextRef SDCreateDecompressionContext(CGImageRef imageRef, size_t width, size_t height, SDWebImageCoderPixelFormat pixelFormat) {
+    BOOL hasAlpha = SDCGImageRefContainsAlpha(imageRef);
+    if (!hasAlpha && pixelFormat != SDWebImageCoderPixelFormat32Bit) {
+        CGContextRef context = NULL;
+        if (CGColorSpaceGetModel(CGImageGetColorSpace(imageRef)) == kCGColorSpaceModelMonochrome) {
+            context = CGBitmapContextCreate(NULL, width, height, kBitsPerComponent, 0, SDCGColorSpaceGetDeviceGray(), kCGImageAlphaNone);
+        } else if (pixelFormat == SDWebImageCoderPixelFormatAllow16Bit) {
+            context = CGBitmapContextCreate(NULL, width, height, 5, 0, SDCGColorSpaceGetDeviceRGB(), kCGBitmapByteOrder16Host | kCGImageAlphaNoneSkipFirst);
+        }
+        if (context) {
+            return context;
+        }
+    }
+    // iOS display alpha info (BRGA8888/BGRX8888)
+    CGBitmapInfo bitmapInfo = kCGBitmapByteOrder32Host;
+    bitmapInfo |= hasAlpha ? kCGImageAlphaPremultipliedFirst : kCGImageAlphaNoneSkipFirst;
+    // kCGImageAlphaNone is not supported in CGBitmapContextCreate for RGB.
+    // Since the original image here has no alpha info, use kCGImageAlphaNoneSkipFirst
+    // to create bitmap graphics contexts without alpha info.
+    return CGBitmapContextCreate(NULL, width, height, kBitsPerComponent, 0, SDCGColorSpaceGetDeviceRGB(), bitmapInfo);
+}
+
+- (nullable UIImage *)sd_decompressedImageWithImage:(nullable UIImage *)image pixelFormat:(SDWebImageCoderPixelFormat)pixelFormat {
     if (![[self class] shouldDecodeImage:image]) {
         return image;
     }
@@ -236,26 +490,10 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
     @autoreleasepool{
         
         CGImageRef imageRef = image.CGImage;
-        // device color space
-        CGColorSpaceRef colorspaceRef = SDCGColorSpaceGetDeviceRGB();
-        BOOL hasAlpha = SDCGImageRefContainsAlpha(imageRef);
-        // iOS display alpha info (BRGA8888/BGRX8888)
-        CGBitmapInfo bitmapInfo = kCGBitmapByteOrder32Host;
-        bitmapInfo |= hasAlpha ? kCGImageAlphaPremultipliedFirst : kCGImageAlphaNoneSkipFirst;
-        
         size_t width = CGImageGetWidth(imageRef);
         size_t height = CGImageGetHeight(imageRef);
         
-        // kCGImageAlphaNone is not supported in CGBitmapContextCreate.
-        // Since the original image here has no alpha info, use kCGImageAlphaNoneSkipLast
-        // to create bitmap graphics contexts without alpha info.
-        CGContextRef context = CGBitmapContextCreate(NULL,
-                                                     width,
-                                                     height,
-                                                     kBitsPerComponent,
-                                                     0,
-                                                     colorspaceRef,
-                                                     bitmapInfo);
+        CGContextRef context = SDCreateDecompressionContext(imageRef, width, height, pixelFormat);
         if (context == NULL) {
             return image;
         }
@@ -271,13 +509,14 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
     }
 }
 
-- (nullable UIImage *)sd_decompressedAndScaledDownImageWithImage:(nullable UIImage *)image {
+// The tiles are resampled in BGRA8888/BGRX8888, so only images which do not need scaling down honour the pixel format. 0 concurrent tiles means the default.
+- (nullable UIImage *)sd_decompressedAndScaledDownImageWithImage:(nullable UIImage *)image pixelFormat:(SDWebImageCoderPixelFormat)pixelFormat maxConcurrentTiles:(NSUInteger)maxConcurrentTiles {
     if (![[self class] shouldDecodeImage:image]) {
         return image;
     }
     
     if (![[self class] shouldScaleDownImage:image]) {
-        return [self sd_decompressedImageWithImage:image];
+        return [self sd_decompressedImageWithImage:image pixelFormat:pixelFormat];
     }
     
     CGContextRef destContext;
@@ -320,7 +559,12 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
         if (destContext == NULL) {
             return image;
         }
-        CGContextSetInterpolationQuality(destContext, kCGInterpolationHigh);
+        void *destData = CGBitmapContextGetData(destContext);
+        size_t destBytesPerRow = CGBitmapContextGetBytesPerRow(destContext);
+        if (destData == NULL) {
+            CGContextRelease(destContext);
+            return image;
+        }
         
         // Now define the size of the rectangle to be used for the
         // incremental blits from the input image to the output image.
@@ -331,50 +575,75 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
         // band. Therefore we fully utilize all of the pixel data that results
         // from a decoding opertion by achnoring our tile size to the full
         // width of the input image.
-        CGRect sourceTile = CGRectZero;
-        sourceTile.size.width = sourceResolution.width;
         // The source tile height is dynamic. Since we specified the size
         // of the source tile in MB, see how many rows of pixels high it
         // can be given the input image width.
-        sourceTile.size.height = (int)(kTileTotalPixels / sourceTile.size.width );
-        sourceTile.origin.x = 0.0f;
+        size_t sourceTileHeight = MAX(1, (size_t)(kTileTotalPixels / sourceResolution.width));
         // The output tile is the same proportions as the input tile, but
-        // scaled to image scale.
-        CGRect destTile;
-        destTile.size.width = destResolution.width;
-        destTile.size.height = sourceTile.size.height * imageScale;
-        destTile.origin.x = 0.0f;
-        // The source seem overlap is proportionate to the destination seem overlap.
-        // this is the amount of pixels to overlap each tile as we assemble the ouput image.
-        float sourceSeemOverlap = (int)((kDestSeemOverlap/destResolution.height)*sourceResolution.height);
-        CGImageRef sourceTileImageRef;
-        // calculate the number of read/write operations required to assemble the
-        // output image.
-        int iterations = (int)( sourceResolution.height / sourceTile.size.height );
-        // If tile height doesn't divide the image height evenly, add another iteration
-        // to account for the remaining pixels.
-        int remainder = (int)sourceResolution.height % (int)sourceTile.size.height;
-        if(remainder) {
-            iterations++;
+        // scaled to image scale. Each output tile owns a disjoint range of
+        // destination rows, so the tiles can be resampled concurrently.
+        size_t destWidth = (size_t)destResolution.width;
+        size_t destHeight = (size_t)destResolution.height;
+        size_t destTileHeight = MAX(1, (size_t)(sourceTileHeight * imageScale));
+        size_t iterations = (destHeight + destTileHeight - 1) / destTileHeight;
+        // The resampler knows which source rows each output tile reads,
+        // including the rows under the filter support past the tile edges,
+        // so the tiles join without seems.
+        SDImageResampler *resampler = SDImageResamplerCreate(sourceResolution.width, sourceResolution.height, destWidth, destHeight, kScaleDownResamplingFilter);
+        if (!resampler) {
+            CGContextRelease(destContext);
+            return image;
         }
-        // Add seem overlaps to the tiles, but save the original tile height for y coordinate calculations.
-        float sourceTileHeightMinusOverlap = sourceTile.size.height;
-        sourceTile.size.height += sourceSeemOverlap;
-        destTile.size.height += kDestSeemOverlap;
-        for( int y = 0; y < iterations; ++y ) {
-            @autoreleasepool {
-                sourceTile.origin.y = y * sourceTileHeightMinusOverlap + sourceSeemOverlap;
-                destTile.origin.y = destResolution.height - (( y + 1 ) * sourceTileHeightMinusOverlap * imageScale + kDestSeemOverlap);
-                sourceTileImageRef = CGImageCreateWithImageInRect( sourceImageRef, sourceTile );
-                if( y == iterations - 1 && remainder ) {
-                    float dify = destTile.size.height;
-                    destTile.size.height = CGImageGetHeight( sourceTileImageRef ) * imageScale;
-                    dify -= destTile.size.height;
-                    destTile.origin.y += dify;
+        
+        // Bound the number of tiles in flight to cap the peak memory
+        if (maxConcurrentTiles == 0) {
+            maxConcurrentTiles = MAX(1, MIN(kMaxConcurrentTiles, [NSProcessInfo processInfo].activeProcessorCount));
+        }
+        dispatch_semaphore_t tileSemaphore = dispatch_semaphore_create(maxConcurrentTiles);
+        dispatch_group_t tileGroup = dispatch_group_create();
+        dispatch_queue_t tileQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+        __block BOOL failed = NO;
+        for (size_t y = 0; y < iterations; ++y) {
+            dispatch_semaphore_wait(tileSemaphore, DISPATCH_TIME_FOREVER);
+            dispatch_group_async(tileGroup, tileQueue, ^{
+                @autoreleasepool {
+                    // Destination rows of this tile, from top to bottom
+                    size_t destTileTop = y * destTileHeight;
+                    size_t destTileRows = MIN(destTileHeight, destHeight - destTileTop);
+                    size_t sourceTileTop, sourceTileRows;
+                    SDImageResamplerGetSourceRows(resampler, destTileTop, destTileRows, &sourceTileTop, &sourceTileRows);
+                    // Decode the full width source band at its original size, in the same pixel format as the destination
+                    CGRect sourceTile = CGRectMake(0, sourceTileTop, sourceResolution.width, sourceTileRows);
+                    CGImageRef sourceTileImageRef = CGImageCreateWithImageInRect(sourceImageRef, sourceTile);
+                    CGContextRef sourceTileContext = CGBitmapContextCreate(NULL,
+                                                                           sourceResolution.width,
+                                                                           sourceTileRows,
+                                                                           kBitsPerComponent,
+                                                                           0,
+                                                                           colorspaceRef,
+                                                                           bitmapInfo);
+                    int result = -1;
+                    if (sourceTileImageRef && sourceTileContext) {
+                        CGContextDrawImage(sourceTileContext, CGRectMake(0, 0, sourceResolution.width, sourceTileRows), sourceTileImageRef);
+                        // Each tile writes a disjoint range of rows of the destination buffer
+                        result = SDImageResamplerResampleRows(resampler,
+                                                              CGBitmapContextGetData(sourceTileContext), sourceTileTop, sourceTileRows, CGBitmapContextGetBytesPerRow(sourceTileContext),
+                                                              (uint8_t *)destData + destTileTop * destBytesPerRow, destTileTop, destTileRows, destBytesPerRow);
+                    }
+                    if (result != 0) {
+                        failed = YES;
+                    }
+                    CGContextRelease(sourceTileContext);
+                    CGImageRelease(sourceTileImageRef);
                 }
-                CGContextDrawImage( destContext, destTile, sourceTileImageRef );
-                CGImageRelease( sourceTileImageRef );
-            }
+                dispatch_semaphore_signal(tileSemaphore);
+            });
+        }
+        dispatch_group_wait(tileGroup, DISPATCH_TIME_FOREVER);
+        SDImageResamplerRelease(resampler);
+        if (failed) {
+            CGContextRelease(destContext);
+            return image;
         }
         
         CGImageRef destImageRef = CGBitmapContextCreateImage(destContext);
@@ -519,6 +788,11 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
 #if SD_UIKIT || SD_WATCH
 #pragma mark EXIF orientation tag converter
 + (UIImageOrientation)sd_imageOrientationFromImageData:(nonnull NSData *)imageData {
+    // The header parser reads the tag in place, creating a second image source and copying its properties is only needed for the other formats (TIFF, BMP...)
+    SDImageHeaderInfo headerInfo;
+    if (SDImageHeaderParse(imageData.bytes, imageData.length, &headerInfo) == SDImageHeaderStatusOK) {
+        return [SDWebImageCoderHelper imageOrientationFromEXIFOrientation:headerInfo.orientation];
+    }
     UIImageOrientation result = UIImageOrientationUp;
     CGImageSourceRef imageSource = CGImageSourceCreateWithData((__bridge CFDataRef)imageData, NULL);
     if (imageSource) {
@@ -13,8 +13,10 @@
 
 /**
  Built in coder that supports WebP and animated WebP
+ Animated WebP frames can also be decoded on demand, see `SDWebImageAnimatedCoder`
+ Encoding takes the quality, method, lossless, target size and thread level options from `SDWebImageCoder.h`. Animated WebP frames are encoded concurrently, then assembled in order. Frames of the same size only store the rectangle which changed since the previous frame.
  */
-@interface SDWebImageWebPCoder : NSObject <SDWebImageProgressiveCoder>
+@interface SDWebImageWebPCoder : NSObject <SDWebImageProgressiveCoder, SDWebImageAnimatedCoder>
 
 + (nonnull instancetype)sharedCoder;
 
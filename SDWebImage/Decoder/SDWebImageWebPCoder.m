@@ -12,6 +12,9 @@
 #import "SDWebImageCoderHelper.h"
 #import "NSImage+WebCache.h"
 #import "UIImage+MultiFormat.h"
+#import "SDImageResampler.h"
+#import "SDImagePixelConverter.h"
+#import "SDWebImageAnimatedImage.h"
 #if __has_include(<webp/decode.h>) && __has_include(<webp/encode.h>) && __has_include(<webp/demux.h>) && __has_include(<webp/mux.h>)
 #import <webp/decode.h>
 #import <webp/encode.h>
@@ -24,8 +27,121 @@
 #import "webp/mux.h"
 #endif
 
+// The bitmap info of libwebp MODE_bgrA / MODE_BGRA output, which is the display-native format
+static inline CGBitmapInfo SDWebPBitmapInfo(BOOL hasAlpha) {
+    return kCGBitmapByteOrder32Little | (hasAlpha ? kCGImageAlphaPremultipliedFirst : kCGImageAlphaNoneSkipFirst);
+}
+
+// The row stride of the decoded bitmaps. Core Animation can display 64 bytes aligned rows without copying them.
+static inline size_t SDWebPBytesPerRow(size_t width) {
+    return (width * 4 + 63) & ~(size_t)63;
+}
+
+// Decode a WebP bitstream straight into `buffer` with libwebp external memory output, scaled to `width` x `height` if it differs from the bitstream size
+static BOOL SDWebPDecodeIntoBuffer(WebPData webpData, uint8_t *buffer, size_t bytesPerRow, int width, int height, BOOL * _Nullable hasAlpha) {
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) {
+        return NO;
+    }
+    if (WebPGetFeatures(webpData.bytes, webpData.size, &config.input) != VP8_STATUS_OK) {
+        return NO;
+    }
+    if (hasAlpha) {
+        *hasAlpha = config.input.has_alpha;
+    }
+    
+    // Decode straight into display-native premultiplied BGRA (BGRX for opaque images)
+    config.output.colorspace = config.input.has_alpha ? MODE_bgrA : MODE_BGRA;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = buffer;
+    config.output.u.RGBA.stride = (int)bytesPerRow;
+    config.output.u.RGBA.size = bytesPerRow * (height - 1) + width * 4;
+    config.options.use_threads = 1;
+    if (width != config.input.width || height != config.input.height) {
+        // libwebp scales during decoding, so the full size bitmap is never allocated
+        config.options.use_scaling = 1;
+        config.options.scaled_width = width;
+        config.options.scaled_height = height;
+    }
+    
+    BOOL success = WebPDecode(webpData.bytes, webpData.size, &config) == VP8_STATUS_OK;
+    WebPFreeDecBuffer(&config.output);
+    return success;
+}
+
+static void FreeImageData(void *info, const void *data, size_t size);
+static uint8_t * SDWebPCreateRGBAPixels(CGImageRef imageRef, BOOL * _Nullable hasAlpha);
+static NSData * SDWebPEncodeRGBA(const uint8_t *rgba, size_t bytesPerRow, size_t width, size_t height, BOOL hasAlpha, const WebPConfig *config);
+static BOOL SDWebPChangedRect(const uint8_t *pixels, const uint8_t *previousPixels, size_t bytesPerRow, size_t width, size_t height, size_t *x, size_t *y, size_t *w, size_t *h);
+
+// Fill an encoder config from the encoding options. The defaults (quality 100, method 4, lossy) match `WebPEncodeRGBA`.
+static BOOL SDWebPEncoderConfigWithOptions(WebPConfig *config, NSDictionary<NSString*, NSObject*> * _Nullable options) {
+    float quality = 100;
+    NSNumber *compressionQuality = (NSNumber *)options[SDWebImageCoderEncodeCompressionQualityKey];
+    if ([compressionQuality isKindOfClass:[NSNumber class]]) {
+        quality = MIN(MAX(compressionQuality.doubleValue, 0), 1) * 100;
+    }
+    if (!WebPConfigPreset(config, WEBP_PRESET_DEFAULT, quality)) {
+        return NO;
+    }
+    NSNumber *method = (NSNumber *)options[SDWebImageCoderEncodeMethodKey];
+    if ([method isKindOfClass:[NSNumber class]]) {
+        config->method = MIN(MAX(method.intValue, 0), 6);
+    }
+    NSNumber *lossless = (NSNumber *)options[SDWebImageCoderEncodeLosslessKey];
+    if ([lossless isKindOfClass:[NSNumber class]]) {
+        config->lossless = lossless.boolValue;
+    }
+    NSNumber *targetSize = (NSNumber *)options[SDWebImageCoderEncodeTargetSizeKey];
+    if ([targetSize isKindOfClass:[NSNumber class]]) {
+        config->target_size = MAX(targetSize.intValue, 0);
+    }
+    NSNumber *threadLevel = (NSNumber *)options[SDWebImageCoderEncodeThreadLevelKey];
+    if ([threadLevel isKindOfClass:[NSNumber class]]) {
+        config->thread_level = MAX(threadLevel.intValue, 0);
+    }
+    return WebPValidateConfig(config);
+}
+
+static NSUInteger SDWebPMaxConcurrentFramesWithOptions(NSDictionary<NSString*, NSObject*> * _Nullable options) {
+    NSNumber *maxConcurrentFrames = (NSNumber *)options[SDWebImageCoderEncodeMaxConcurrentFramesKey];
+    if ([maxConcurrentFrames isKindOfClass:[NSNumber class]] && maxConcurrentFrames.unsignedIntegerValue > 0) {
+        return maxConcurrentFrames.unsignedIntegerValue;
+    }
+    return [NSProcessInfo processInfo].activeProcessorCount;
+}
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+// An encoded animation frame, the bitstream covers the rectangle of the canvas at (x, y)
+@interface SDWebPEncodedFrame : NSObject
+
+@property (nonatomic, strong) NSData *bitstream;
+@property (nonatomic, assign) size_t x;
+@property (nonatomic, assign) size_t y;
+@property (nonatomic, assign) NSTimeInterval duration;
+// The frame has the same pixels as the previous one
+@property (nonatomic, assign) BOOL identical;
+
+@end
+
+@implementation SDWebPEncodedFrame
+@end
+
 @implementation SDWebImageWebPCoder {
     WebPIDecoder *_idec;
+    // Animated coder context, the canvas keeps the frames blended so far
+    WebPDemuxer *_demux;
+    NSArray<NSNumber *> *_frameDurations;
+    NSIndexSet *_keyFrameIndexes;
+    CGContextRef _canvas;
+    uint8_t *_canvasData;
+    NSMutableData *_fragmentBuffer;
+    SDImageResampler *_resampler;
+    CGSize _scaledSize;
+    NSUInteger _currentFrameIndex;
+    dispatch_semaphore_t _lock;
 }
 
 - (void)dealloc {
@@ -33,6 +149,13 @@
         WebPIDelete(_idec);
         _idec = NULL;
     }
+    if (_demux) {
+        WebPDemuxDelete(_demux);
+        _demux = NULL;
+    }
+    CGContextRelease(_canvas);
+    free(_canvasData);
+    SDImageResamplerRelease(_resampler);
 }
 
 + (instancetype)sharedCoder {
@@ -46,14 +169,26 @@
 
 #pragma mark - Decode
 - (BOOL)canDecodeFromData:(nullable NSData *)data {
-    return ([NSData sd_imageFormatForImageData:data] == SDImageFormatWebP);
+    return [self canDecodeFromFormat:[NSData sd_imageFormatForImageData:data]];
+}
+
+- (BOOL)canDecodeFromFormat:(SDImageFormat)format {
+    return (format == SDImageFormatWebP);
 }
 
 - (BOOL)canIncrementallyDecodeFromData:(NSData *)data {
-    return ([NSData sd_imageFormatForImageData:data] == SDImageFormatWebP);
+    return [self canIncrementallyDecodeFromFormat:[NSData sd_imageFormatForImageData:data]];
+}
+
+- (BOOL)canIncrementallyDecodeFromFormat:(SDImageFormat)format {
+    return (format == SDImageFormatWebP);
 }
 
 - (UIImage *)decodedImageWithData:(NSData *)data {
+    return [self decodedImageWithData:data options:nil];
+}
+
+- (UIImage *)decodedImageWithData:(NSData *)data options:(nullable NSDictionary<NSString*, NSObject*>*)optionsDict {
     if (!data) {
         return nil;
     }
@@ -71,38 +206,54 @@
     int loopCount = WebPDemuxGetI(demuxer, WEBP_FF_LOOP_COUNT);
     int canvasWidth = WebPDemuxGetI(demuxer, WEBP_FF_CANVAS_WIDTH);
     int canvasHeight = WebPDemuxGetI(demuxer, WEBP_FF_CANVAS_HEIGHT);
-    CGBitmapInfo bitmapInfo;
-    if (!(flags & ALPHA_FLAG)) {
-        bitmapInfo = kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipLast;
-    } else {
-        bitmapInfo = kCGBitmapByteOrder32Big | kCGImageAlphaPremultipliedLast;
-    }
-    CGContextRef canvas = CGBitmapContextCreate(NULL, canvasWidth, canvasHeight, 8, 0, SDCGColorSpaceGetDeviceRGB(), bitmapInfo);
-    if (!canvas) {
+    // Display-native BGRA, so the frames need no conversion when drawn
+    CGBitmapInfo bitmapInfo = SDWebPBitmapInfo(flags & ALPHA_FLAG);
+    CGSize targetPixelSize = [SDWebImageCoderHelper targetPixelSizeFromOptions:optionsDict];
+    SDWebImageCoderContentMode contentMode = [SDWebImageCoderHelper targetContentModeFromOptions:optionsDict];
+    CGSize scaledSize = [SDWebImageCoderHelper scaledPixelSizeWithImageSize:CGSizeMake(canvasWidth, canvasHeight) targetPixelSize:targetPixelSize contentMode:contentMode];
+    
+    NSNumber *lazyFrames = (NSNumber *)optionsDict[SDWebImageCoderDecodeLazyFramesKey];
+    if ((flags & ANIMATION_FLAG) && [lazyFrames isKindOfClass:[NSNumber class]] && lazyFrames.boolValue) {
+        // Keep the compressed data and decode the frames on demand
         WebPDemuxDelete(demuxer);
-        return nil;
+        SDWebImageWebPCoder *animatedCoder = [[SDWebImageWebPCoder alloc] initWithAnimatedImageData:data options:optionsDict];
+        return [[SDWebImageAnimatedImage alloc] initWithAnimatedCoder:animatedCoder];
     }
     
     if (!(flags & ANIMATION_FLAG)) {
-        // for static single webp image
-        UIImage *staticImage = [self sd_rawWebpImageWithData:webpData];
-        if (staticImage) {
-            // draw on CGBitmapContext can reduce memory usage
-            CGImageRef imageRef = staticImage.CGImage;
-            size_t width = CGImageGetWidth(imageRef);
-            size_t height = CGImageGetHeight(imageRef);
-            CGContextDrawImage(canvas, CGRectMake(0, 0, width, height), imageRef);
-            CGImageRef newImageRef = CGBitmapContextCreateImage(canvas);
-#if SD_UIKIT || SD_WATCH
-            staticImage = [[UIImage alloc] initWithCGImage:newImageRef];
-#else
-            staticImage = [[UIImage alloc] initWithCGImage:newImageRef size:NSZeroSize];
-#endif
-            CGImageRelease(newImageRef);
+        // for static single webp image, libwebp decodes (and scales) into the only buffer of the image, no need to redraw it
+        WebPDemuxDelete(demuxer);
+        size_t width = scaledSize.width;
+        size_t height = scaledSize.height;
+        size_t bytesPerRow = SDWebPBytesPerRow(width);
+        uint8_t *buffer = malloc(bytesPerRow * height);
+        if (!buffer) {
+            return nil;
+        }
+        BOOL hasAlpha = NO;
+        if (!SDWebPDecodeIntoBuffer(webpData, buffer, bytesPerRow, (int)width, (int)height, &hasAlpha)) {
+            free(buffer);
+            return nil;
+        }
+        if (!hasAlpha && [SDWebImageCoderHelper pixelFormatFromOptions:optionsDict] == SDWebImageCoderPixelFormatAllow16Bit) {
+            return [self sd_16BitImageWithBuffer:buffer width:width height:height bytesPerRow:bytesPerRow];
         }
+        return [self sd_imageWithBuffer:buffer width:width height:height bytesPerRow:bytesPerRow hasAlpha:hasAlpha];
+    }
+    
+    // Animated frames are decoded into the canvas buffer at their offsets, then each frame is copied (or resampled to the target size) into its own image.
+    size_t canvasBytesPerRow = SDWebPBytesPerRow(canvasWidth);
+    uint8_t *canvasData = calloc(canvasHeight, canvasBytesPerRow);
+    if (!canvasData) {
         WebPDemuxDelete(demuxer);
-        CGContextRelease(canvas);
-        return staticImage;
+        return nil;
+    }
+    // The context shares the canvas buffer, it is only used to blend frames and never snapshotted
+    CGContextRef canvas = CGBitmapContextCreate(canvasData, canvasWidth, canvasHeight, 8, canvasBytesPerRow, SDCGColorSpaceGetDeviceRGB(), bitmapInfo);
+    if (!canvas) {
+        free(canvasData);
+        WebPDemuxDelete(demuxer);
+        return nil;
     }
     
     // for animated webp image
@@ -111,14 +262,23 @@
         WebPDemuxReleaseIterator(&iter);
         WebPDemuxDelete(demuxer);
         CGContextRelease(canvas);
+        free(canvasData);
         return nil;
     }
     
+    // Frames are resampled from the full canvas to the target size
+    SDImageResampler *resampler = NULL;
+    if (scaledSize.width < canvasWidth || scaledSize.height < canvasHeight) {
+        resampler = SDImageResamplerCreate(canvasWidth, canvasHeight, scaledSize.width, scaledSize.height, SDImageResamplingFilterLanczos3);
+    }
+    // Reused by the frames blended over the canvas
+    NSMutableData *fragmentBuffer = [NSMutableData data];
+    
     NSMutableArray<SDWebImageFrame *> *frames = [NSMutableArray array];
     
     do {
         @autoreleasepool {
-            UIImage *image = [self sd_drawnWebpImageWithCanvas:canvas iterator:iter];
+            UIImage *image = [self sd_drawnWebpImageWithCanvas:canvas iterator:iter fragmentBuffer:fragmentBuffer resampler:resampler scaledSize:scaledSize];
             if (!image) {
                 continue;
             }
@@ -138,6 +298,8 @@
     WebPDemuxReleaseIterator(&iter);
     WebPDemuxDelete(demuxer);
     CGContextRelease(canvas);
+    free(canvasData);
+    SDImageResamplerRelease(resampler);
     
     UIImage *animatedImage = [SDWebImageCoderHelper animatedImageWithFrames:frames];
     animatedImage.sd_imageLoopCount = loopCount;
@@ -147,20 +309,42 @@
 
 - (UIImage *)incrementallyDecodedImageWithData:(NSData *)data finished:(BOOL)finished {
     if (!_idec) {
-        // Progressive images need transparent, so always use premultiplied RGBA
-        _idec = WebPINewRGB(MODE_rgbA, NULL, 0, 0);
+        // Progressive images need transparent, so always use premultiplied BGRA, which is display-native
+        _idec = WebPINewRGB(MODE_bgrA, NULL, 0, 0);
         if (!_idec) {
             return nil;
         }
     }
     
-    UIImage *image;
-    
     VP8StatusCode status = WebPIUpdate(_idec, data.bytes, data.length);
     if (status != VP8_STATUS_OK && status != VP8_STATUS_SUSPENDED) {
         return nil;
     }
     
+    return [self sd_incrementallyDecodedImageFinished:finished];
+}
+
+- (UIImage *)incrementallyDecodedImageWithAppendedData:(NSData *)data finished:(BOOL)finished {
+    if (!_idec) {
+        _idec = WebPINewRGB(MODE_bgrA, NULL, 0, 0);
+        if (!_idec) {
+            return nil;
+        }
+    }
+    
+    // libwebp keeps the bytes appended so far, only the new bytes are passed
+    VP8StatusCode status = WebPIAppend(_idec, data.bytes, data.length);
+    if (status != VP8_STATUS_OK && status != VP8_STATUS_SUSPENDED) {
+        return nil;
+    }
+    
+    return [self sd_incrementallyDecodedImageFinished:finished];
+}
+
+// Create the partial image from the rows decoded so far
+- (UIImage *)sd_incrementallyDecodedImageFinished:(BOOL)finished {
+    UIImage *image;
+    
     int width = 0;
     int height = 0;
     int last_y = 0;
@@ -168,51 +352,34 @@
     uint8_t *rgba = WebPIDecGetRGB(_idec, &last_y, &width, &height, &stride);
     // last_y may be 0, means no enough bitmap data to decode, ignore this
     if (width + height > 0 && last_y > 0 && height >= last_y) {
-        // Construct a UIImage from the decoded RGBA value array
-        size_t rgbaSize = last_y * stride;
-        CGDataProviderRef provider =
-        CGDataProviderCreateWithData(NULL, rgba, rgbaSize, NULL);
-        CGColorSpaceRef colorSpaceRef = SDCGColorSpaceGetDeviceRGB();
-        
-        CGBitmapInfo bitmapInfo = kCGBitmapByteOrder32Big | kCGImageAlphaPremultipliedLast;
-        size_t components = 4;
-        CGColorRenderingIntent renderingIntent = kCGRenderingIntentDefault;
         // Why to use last_y for image height is because of libwebp's bug (https://bugs.chromium.org/p/webp/issues/detail?id=362)
         // It will not keep memory barrier safe on x86 architechure (macOS & iPhone simulator) but on ARM architecture (iPhone & iPad & tv & watch) it works great
         // If different threads use WebPIDecGetRGB to grab rgba bitmap, it will contain the previous decoded bitmap data
         // So this will cause our drawed image looks strange(above is the current part but below is the previous part)
-        // We only grab the last_y height and draw the last_y heigh instead of total height image
-        // Besides fix, this can enhance performance since we do not need to create extra bitmap
-        CGImageRef imageRef = CGImageCreate(width, last_y, 8, components * 8, components * width, colorSpaceRef, bitmapInfo, provider, NULL, NO, renderingIntent);
-        
-        CGDataProviderRelease(provider);
-        
-        if (!imageRef) {
+        // We only copy the last_y rows and keep remains transparent, instead of drawing the total height image
+        size_t bytesPerRow = width * 4;
+        uint8_t *bgra = malloc(bytesPerRow * height);
+        if (!bgra) {
             return nil;
         }
-        
-        CGContextRef canvas = CGBitmapContextCreate(NULL, width, height, 8, 0, SDCGColorSpaceGetDeviceRGB(), bitmapInfo);
-        if (!canvas) {
-            CGImageRelease(imageRef);
-            return nil;
+        for (int y = 0; y < last_y; y++) {
+            memcpy(bgra + y * bytesPerRow, rgba + y * stride, bytesPerRow);
         }
+        memset(bgra + last_y * bytesPerRow, 0, (height - last_y) * bytesPerRow);
         
-        // Only draw the last_y image height, keep remains transparent, in Core Graphics coordinate system
-        CGContextDrawImage(canvas, CGRectMake(0, height - last_y, width, last_y), imageRef);
-        CGImageRef newImageRef = CGBitmapContextCreateImage(canvas);
-        CGImageRelease(imageRef);
-        if (!newImageRef) {
-            CGContextRelease(canvas);
+        CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, bgra, bytesPerRow * height, FreeImageData);
+        CGImageRef imageRef = CGImageCreate(width, height, 8, 32, bytesPerRow, SDCGColorSpaceGetDeviceRGB(), SDWebPBitmapInfo(YES), provider, NULL, NO, kCGRenderingIntentDefault);
+        CGDataProviderRelease(provider);
+        if (!imageRef) {
             return nil;
         }
         
 #if SD_UIKIT || SD_WATCH
-        image = [[UIImage alloc] initWithCGImage:newImageRef];
+        image = [[UIImage alloc] initWithCGImage:imageRef];
 #else
-        image = [[UIImage alloc] initWithCGImage:newImageRef size:NSZeroSize];
+        image = [[UIImage alloc] initWithCGImage:imageRef size:NSZeroSize];
 #endif
-        CGImageRelease(newImageRef);
-        CGContextRelease(canvas);
+        CGImageRelease(imageRef);
     }
     
     if (finished) {
@@ -232,77 +399,141 @@
     return image;
 }
 
-- (nullable UIImage *)sd_drawnWebpImageWithCanvas:(CGContextRef)canvas iterator:(WebPIterator)iter {
-    UIImage *image = [self sd_rawWebpImageWithData:iter.fragment];
-    if (!image) {
+// Decode the frame into the canvas and return a copy of the canvas, resampled to `scaledSize` if a resampler is passed
+- (nullable UIImage *)sd_drawnWebpImageWithCanvas:(CGContextRef)canvas iterator:(WebPIterator)iter fragmentBuffer:(NSMutableData *)fragmentBuffer resampler:(nullable const SDImageResampler *)resampler scaledSize:(CGSize)scaledSize {
+    if (![self sd_drawWebpFrameWithCanvas:canvas iterator:iter fragmentBuffer:fragmentBuffer]) {
         return nil;
     }
-    
+    UIImage *image = [self sd_imageWithCanvas:canvas resampler:resampler scaledSize:scaledSize];
+    [self sd_disposeWebpFrameWithCanvas:canvas iterator:iter];
+    return image;
+}
+
+// Decode the frame into the canvas at its offset, blending it over the canvas if needed
+- (BOOL)sd_drawWebpFrameWithCanvas:(CGContextRef)canvas iterator:(WebPIterator)iter fragmentBuffer:(NSMutableData *)fragmentBuffer {
+    uint8_t *canvasData = CGBitmapContextGetData(canvas);
     size_t canvasWidth = CGBitmapContextGetWidth(canvas);
     size_t canvasHeight = CGBitmapContextGetHeight(canvas);
-    CGSize size = CGSizeMake(canvasWidth, canvasHeight);
-    CGFloat tmpX = iter.x_offset;
-    CGFloat tmpY = size.height - iter.height - iter.y_offset;
-    CGRect imageRect = CGRectMake(tmpX, tmpY, iter.width, iter.height);
-    BOOL shouldBlend = iter.blend_method == WEBP_MUX_BLEND;
+    size_t canvasBytesPerRow = CGBitmapContextGetBytesPerRow(canvas);
+    if (iter.x_offset + iter.width > canvasWidth || iter.y_offset + iter.height > canvasHeight) {
+        return NO;
+    }
+    BOOL shouldBlend = iter.blend_method == WEBP_MUX_BLEND && iter.has_alpha;
     
-    // If not blend, cover the target image rect. (firstly clear then draw)
     if (!shouldBlend) {
-        CGContextClearRect(canvas, imageRect);
+        // The frame covers its rect, decode it in place
+        uint8_t *frameOrigin = canvasData + iter.y_offset * canvasBytesPerRow + iter.x_offset * 4;
+        return SDWebPDecodeIntoBuffer(iter.fragment, frameOrigin, canvasBytesPerRow, iter.width, iter.height, NULL);
     }
-    CGContextDrawImage(canvas, imageRect, image.CGImage);
-    CGImageRef newImageRef = CGBitmapContextCreateImage(canvas);
     
-#if SD_UIKIT || SD_WATCH
-    image = [[UIImage alloc] initWithCGImage:newImageRef];
-#elif SD_MAC
-    image = [[UIImage alloc] initWithCGImage:newImageRef size:NSZeroSize];
-#endif
-    
-    CGImageRelease(newImageRef);
-    
-    if (iter.dispose_method == WEBP_MUX_DISPOSE_BACKGROUND) {
-        CGContextClearRect(canvas, imageRect);
+    // Decode into the reused fragment buffer, then blend it over the canvas
+    size_t fragmentBytesPerRow = iter.width * 4;
+    if (fragmentBuffer.length < fragmentBytesPerRow * iter.height) {
+        fragmentBuffer.length = fragmentBytesPerRow * iter.height;
     }
-    
-    return image;
+    if (!SDWebPDecodeIntoBuffer(iter.fragment, fragmentBuffer.mutableBytes, fragmentBytesPerRow, iter.width, iter.height, NULL)) {
+        return NO;
+    }
+    CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, fragmentBuffer.mutableBytes, fragmentBytesPerRow * iter.height, NULL);
+    CGImageRef fragmentImageRef = CGImageCreate(iter.width, iter.height, 8, 32, fragmentBytesPerRow, SDCGColorSpaceGetDeviceRGB(), SDWebPBitmapInfo(YES), provider, NULL, NO, kCGRenderingIntentDefault);
+    CGDataProviderRelease(provider);
+    if (!fragmentImageRef) {
+        return NO;
+    }
+    CGFloat tmpX = iter.x_offset;
+    CGFloat tmpY = canvasHeight - iter.height - iter.y_offset;
+    CGContextDrawImage(canvas, CGRectMake(tmpX, tmpY, iter.width, iter.height), fragmentImageRef);
+    CGImageRelease(fragmentImageRef);
+    return YES;
 }
 
-- (nullable UIImage *)sd_rawWebpImageWithData:(WebPData)webpData {
-    WebPDecoderConfig config;
-    if (!WebPInitDecoderConfig(&config)) {
+// Each frame owns a copy of the canvas, the canvas buffer keeps changing
+- (nullable UIImage *)sd_imageWithCanvas:(CGContextRef)canvas resampler:(nullable const SDImageResampler *)resampler scaledSize:(CGSize)scaledSize {
+    uint8_t *canvasData = CGBitmapContextGetData(canvas);
+    size_t canvasHeight = CGBitmapContextGetHeight(canvas);
+    size_t canvasBytesPerRow = CGBitmapContextGetBytesPerRow(canvas);
+    BOOL hasAlpha = CGBitmapContextGetAlphaInfo(canvas) == kCGImageAlphaPremultipliedFirst;
+    size_t width = CGBitmapContextGetWidth(canvas);
+    size_t height = canvasHeight;
+    size_t bytesPerRow = canvasBytesPerRow;
+    if (resampler) {
+        width = scaledSize.width;
+        height = scaledSize.height;
+        bytesPerRow = SDWebPBytesPerRow(width);
+    }
+    uint8_t *buffer = malloc(bytesPerRow * height);
+    if (!buffer) {
         return nil;
     }
-    
-    if (WebPGetFeatures(webpData.bytes, webpData.size, &config.input) != VP8_STATUS_OK) {
+    if (!resampler) {
+        memcpy(buffer, canvasData, bytesPerRow * height);
+    } else if (SDImageResamplerResampleRows(resampler, canvasData, 0, canvasHeight, canvasBytesPerRow, buffer, 0, height, bytesPerRow) != 0) {
+        free(buffer);
         return nil;
     }
-    
-    config.output.colorspace = config.input.has_alpha ? MODE_rgbA : MODE_RGB;
-    config.options.use_threads = 1;
-    
-    // Decode the WebP image data into a RGBA value array
-    if (WebPDecode(webpData.bytes, webpData.size, &config) != VP8_STATUS_OK) {
+    return [self sd_imageWithBuffer:buffer width:width height:height bytesPerRow:bytesPerRow hasAlpha:hasAlpha];
+}
+
+- (void)sd_disposeWebpFrameWithCanvas:(CGContextRef)canvas iterator:(WebPIterator)iter {
+    if (iter.dispose_method != WEBP_MUX_DISPOSE_BACKGROUND) {
+        return;
+    }
+    uint8_t *canvasData = CGBitmapContextGetData(canvas);
+    size_t canvasBytesPerRow = CGBitmapContextGetBytesPerRow(canvas);
+    uint8_t *frameOrigin = canvasData + iter.y_offset * canvasBytesPerRow + iter.x_offset * 4;
+    for (int y = 0; y < iter.height; y++) {
+        memset(frameOrigin + y * canvasBytesPerRow, 0, iter.width * 4);
+    }
+}
+
+// Create an xRGB1555 image taking the ownership of a malloc'd opaque BGRX buffer, which is packed into a 64 bytes aligned buffer of half its size
+- (nullable UIImage *)sd_16BitImageWithBuffer:(uint8_t *)buffer width:(size_t)width height:(size_t)height bytesPerRow:(size_t)bytesPerRow {
+    size_t packedBytesPerRow = (width * 2 + 63) & ~(size_t)63;
+    void *packedBuffer = NULL;
+    if (posix_memalign(&packedBuffer, 64, packedBytesPerRow * height) == 0) {
+        SDPixelConvertRGBXToXRGB1555(buffer, bytesPerRow, packedBuffer, packedBytesPerRow, width, height, true);
+        free(buffer);
+        buffer = packedBuffer;
+    } else {
+        // Pack in place, the rows stay aligned to the stride but the buffer keeps its size
+        SDPixelConvertRGBXToXRGB1555(buffer, bytesPerRow, buffer, packedBytesPerRow, width, height, true);
+    }
+    CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, buffer, packedBytesPerRow * height, FreeImageData);
+    if (!provider) {
+        free(buffer);
         return nil;
     }
-    
-    int width = config.input.width;
-    int height = config.input.height;
-    if (config.options.use_scaling) {
-        width = config.options.scaled_width;
-        height = config.options.scaled_height;
+    CGImageRef imageRef = CGImageCreate(width, height, 5, 16, packedBytesPerRow, SDCGColorSpaceGetDeviceRGB(), kCGBitmapByteOrder16Little | kCGImageAlphaNoneSkipFirst, provider, NULL, NO, kCGRenderingIntentDefault);
+    CGDataProviderRelease(provider);
+    if (!imageRef) {
+        return nil;
     }
     
-    // Construct a UIImage from the decoded RGBA value array
-    CGDataProviderRef provider =
-    CGDataProviderCreateWithData(NULL, config.output.u.RGBA.rgba, config.output.u.RGBA.size, FreeImageData);
+#if SD_UIKIT || SD_WATCH
+    UIImage *image = [[UIImage alloc] initWithCGImage:imageRef];
+#else
+    UIImage *image = [[UIImage alloc] initWithCGImage:imageRef size:NSZeroSize];
+#endif
+    CGImageRelease(imageRef);
+    
+    return image;
+}
+
+// Create an image taking the ownership of a malloc'd BGRA buffer
+- (nullable UIImage *)sd_imageWithBuffer:(uint8_t *)buffer width:(size_t)width height:(size_t)height bytesPerRow:(size_t)bytesPerRow hasAlpha:(BOOL)hasAlpha {
+    CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, buffer, bytesPerRow * height, FreeImageData);
+    if (!provider) {
+        free(buffer);
+        return nil;
+    }
     CGColorSpaceRef colorSpaceRef = SDCGColorSpaceGetDeviceRGB();
-    CGBitmapInfo bitmapInfo = config.input.has_alpha ? kCGBitmapByteOrder32Big | kCGImageAlphaPremultipliedLast : kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipLast;
-    size_t components = config.input.has_alpha ? 4 : 3;
+    CGBitmapInfo bitmapInfo = SDWebPBitmapInfo(hasAlpha);
     CGColorRenderingIntent renderingIntent = kCGRenderingIntentDefault;
-    CGImageRef imageRef = CGImageCreate(width, height, 8, components * 8, components * width, colorSpaceRef, bitmapInfo, provider, NULL, NO, renderingIntent);
-    
+    CGImageRef imageRef = CGImageCreate(width, height, 8, 32, bytesPerRow, colorSpaceRef, bitmapInfo, provider, NULL, NO, renderingIntent);
     CGDataProviderRelease(provider);
+    if (!imageRef) {
+        return nil;
+    }
     
 #if SD_UIKIT || SD_WATCH
     UIImage *image = [[UIImage alloc] initWithCGImage:imageRef];
@@ -314,37 +545,208 @@
     return image;
 }
 
+#pragma mark - SDWebImageAnimatedCoder
+@synthesize animatedImageData = _animatedImageData;
+@synthesize animatedImageFrameCount = _animatedImageFrameCount;
+@synthesize animatedImageLoopCount = _animatedImageLoopCount;
+
+- (instancetype)initWithAnimatedImageData:(NSData *)data options:(NSDictionary<NSString *,NSObject *> *)optionsDict {
+    if (!data) {
+        return nil;
+    }
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+    // The demuxer references the bytes, so keep an immutable copy
+    _animatedImageData = [data copy];
+    WebPData webpData;
+    WebPDataInit(&webpData);
+    webpData.bytes = _animatedImageData.bytes;
+    webpData.size = _animatedImageData.length;
+    _demux = WebPDemux(&webpData);
+    if (!_demux) {
+        return nil;
+    }
+    uint32_t flags = WebPDemuxGetI(_demux, WEBP_FF_FORMAT_FLAGS);
+    if (!(flags & ANIMATION_FLAG)) {
+        return nil;
+    }
+    
+    // Only the frame headers are parsed here, no frame is decoded
+    WebPIterator iter;
+    if (!WebPDemuxGetFrame(_demux, 1, &iter)) {
+        WebPDemuxReleaseIterator(&iter);
+        return nil;
+    }
+    int canvasWidth = WebPDemuxGetI(_demux, WEBP_FF_CANVAS_WIDTH);
+    int canvasHeight = WebPDemuxGetI(_demux, WEBP_FF_CANVAS_HEIGHT);
+    NSMutableArray<NSNumber *> *frameDurations = [NSMutableArray arrayWithCapacity:iter.num_frames];
+    NSMutableIndexSet *keyFrameIndexes = [NSMutableIndexSet indexSet];
+    BOOL previousClearsCanvas = NO;
+    do {
+        int duration = iter.duration;
+        if (duration <= 10) {
+            // Same as `decodedImageWithData:`, use 100ms for 0 duration frames
+            duration = 100;
+        }
+        [frameDurations addObject:@(duration / 1000.0)];
+        
+        // A key frame does not depend on the canvas left by the previous frames, same rules as libwebp's `WebPAnimDecoder`
+        BOOL isFullFrame = iter.width == canvasWidth && iter.height == canvasHeight;
+        BOOL isKeyFrame = iter.frame_num == 1
+            || (isFullFrame && (!iter.has_alpha || iter.blend_method == WEBP_MUX_NO_BLEND))
+            || previousClearsCanvas;
+        if (isKeyFrame) {
+            [keyFrameIndexes addIndex:iter.frame_num - 1];
+        }
+        // Disposing a frame drawn over a cleared canvas, or covering it, leaves a cleared canvas
+        previousClearsCanvas = iter.dispose_method == WEBP_MUX_DISPOSE_BACKGROUND && (isKeyFrame || isFullFrame);
+    } while (WebPDemuxNextFrame(&iter));
+    WebPDemuxReleaseIterator(&iter);
+    _frameDurations = [frameDurations copy];
+    _keyFrameIndexes = [keyFrameIndexes copy];
+    _animatedImageFrameCount = _frameDurations.count;
+    _animatedImageLoopCount = WebPDemuxGetI(_demux, WEBP_FF_LOOP_COUNT);
+    
+    size_t canvasBytesPerRow = SDWebPBytesPerRow(canvasWidth);
+    _canvasData = calloc(canvasHeight, canvasBytesPerRow);
+    if (!_canvasData) {
+        return nil;
+    }
+    _canvas = CGBitmapContextCreate(_canvasData, canvasWidth, canvasHeight, 8, canvasBytesPerRow, SDCGColorSpaceGetDeviceRGB(), SDWebPBitmapInfo(flags & ALPHA_FLAG));
+    if (!_canvas) {
+        return nil;
+    }
+    CGSize targetPixelSize = [SDWebImageCoderHelper targetPixelSizeFromOptions:optionsDict];
+    SDWebImageCoderContentMode contentMode = [SDWebImageCoderHelper targetContentModeFromOptions:optionsDict];
+    _scaledSize = [SDWebImageCoderHelper scaledPixelSizeWithImageSize:CGSizeMake(canvasWidth, canvasHeight) targetPixelSize:targetPixelSize contentMode:contentMode];
+    if (_scaledSize.width < canvasWidth || _scaledSize.height < canvasHeight) {
+        _resampler = SDImageResamplerCreate(canvasWidth, canvasHeight, _scaledSize.width, _scaledSize.height, SDImageResamplingFilterLanczos3);
+    }
+    _fragmentBuffer = [NSMutableData data];
+    _currentFrameIndex = NSNotFound;
+    _lock = dispatch_semaphore_create(1);
+    
+    return self;
+}
+
+- (NSTimeInterval)animatedImageDurationAtIndex:(NSUInteger)index {
+    if (index >= _frameDurations.count) {
+        return 0;
+    }
+    return _frameDurations[index].doubleValue;
+}
+
+- (UIImage *)animatedImageFrameAtIndex:(NSUInteger)index {
+    if (!_demux || index >= _animatedImageFrameCount) {
+        return nil;
+    }
+    LOCK(_lock);
+    // Frames are blended over the previous ones, so continue from the canvas when going forward, or restart from the nearest key frame
+    NSUInteger startIndex = _currentFrameIndex + 1;
+    NSUInteger keyFrameIndex = [_keyFrameIndexes indexLessThanOrEqualToIndex:index];
+    if (_currentFrameIndex == NSNotFound || index <= _currentFrameIndex || keyFrameIndex > startIndex) {
+        memset(_canvasData, 0, CGBitmapContextGetBytesPerRow(_canvas) * CGBitmapContextGetHeight(_canvas));
+        startIndex = keyFrameIndex;
+    }
+    _currentFrameIndex = NSNotFound;
+    
+    UIImage *image;
+    WebPIterator iter;
+    if (WebPDemuxGetFrame(_demux, (int)startIndex + 1, &iter)) {
+        for (NSUInteger i = startIndex; i <= index; i++) {
+            if (![self sd_drawWebpFrameWithCanvas:_canvas iterator:iter fragmentBuffer:_fragmentBuffer]) {
+                break;
+            }
+            if (i == index) {
+                image = [self sd_imageWithCanvas:_canvas resampler:_resampler scaledSize:_scaledSize];
+            }
+            [self sd_disposeWebpFrameWithCanvas:_canvas iterator:iter];
+            if (i == index) {
+                _currentFrameIndex = index;
+            } else if (!WebPDemuxNextFrame(&iter)) {
+                break;
+            }
+        }
+    }
+    WebPDemuxReleaseIterator(&iter);
+    UNLOCK(_lock);
+    
+    return image;
+}
+
 #pragma mark - Encode
 - (BOOL)canEncodeToFormat:(SDImageFormat)format {
     return (format == SDImageFormatWebP);
 }
 
 - (NSData *)encodedDataWithImage:(UIImage *)image format:(SDImageFormat)format {
+    return [self encodedDataWithImage:image format:format options:nil];
+}
+
+- (NSData *)encodedDataWithImage:(UIImage *)image format:(SDImageFormat)format options:(NSDictionary<NSString *,NSObject *> *)optionsDict {
     if (!image) {
         return nil;
     }
     
+    WebPConfig config;
+    if (!SDWebPEncoderConfigWithOptions(&config, optionsDict)) {
+        return nil;
+    }
+    
     NSData *data;
     
     NSArray<SDWebImageFrame *> *frames = [SDWebImageCoderHelper framesFromAnimatedImage:image];
     if (frames.count == 0) {
         // for static single webp image
-        data = [self sd_encodedWebpDataWithImage:image];
+        data = [self sd_encodedWebpDataWithImage:image config:&config];
     } else {
         // for animated webp image
+        // Frames of the same size are encoded as the rectangle which changed since the previous frame, drawn over it
+        BOOL delta = YES;
+        CGImageRef firstImageRef = frames.firstObject.image.CGImage;
+        for (SDWebImageFrame *frame in frames) {
+            CGImageRef imageRef = frame.image.CGImage;
+            if (CGImageGetWidth(imageRef) != CGImageGetWidth(firstImageRef) || CGImageGetHeight(imageRef) != CGImageGetHeight(firstImageRef)) {
+                delta = NO;
+                break;
+            }
+        }
+        NSArray<SDWebPEncodedFrame *> *encodedFrames = [self sd_encodedWebpFramesWithFrames:frames config:config delta:delta maxConcurrentFrames:SDWebPMaxConcurrentFramesWithOptions(optionsDict)];
+        if (!encodedFrames) {
+            return nil;
+        }
+        NSNumber *mergeIdenticalFrames = (NSNumber *)optionsDict[SDWebImageCoderEncodeMergeIdenticalFramesKey];
+        BOOL merge = [mergeIdenticalFrames isKindOfClass:[NSNumber class]] && mergeIdenticalFrames.boolValue;
+        
+        // Identical frames only extend the duration of the previous frame when merging, so the frames are pushed once their duration is known
+        NSMutableArray<SDWebPEncodedFrame *> *muxFrames = [NSMutableArray arrayWithCapacity:encodedFrames.count];
+        for (size_t i = 0; i < encodedFrames.count; i++) {
+            SDWebPEncodedFrame *encodedFrame = encodedFrames[i];
+            encodedFrame.duration = frames[i].duration;
+            if (merge && encodedFrame.identical && muxFrames.count > 0) {
+                muxFrames.lastObject.duration += encodedFrame.duration;
+            } else {
+                [muxFrames addObject:encodedFrame];
+            }
+        }
+        
         WebPMux *mux = WebPMuxNew();
         if (!mux) {
             return nil;
         }
-        for (size_t i = 0; i < frames.count; i++) {
-            SDWebImageFrame *currentFrame = frames[i];
-            NSData *webpData = [self sd_encodedWebpDataWithImage:currentFrame.image];
-            int duration = currentFrame.duration * 1000;
-            WebPMuxFrameInfo frame = { .bitstream.bytes = webpData.bytes,
-                .bitstream.size = webpData.length,
+        for (SDWebPEncodedFrame *encodedFrame in muxFrames) {
+            int duration = encodedFrame.duration * 1000;
+            WebPMuxFrameInfo frame = { .bitstream.bytes = encodedFrame.bitstream.bytes,
+                .bitstream.size = encodedFrame.bitstream.length,
+                .x_offset = (int)encodedFrame.x,
+                .y_offset = (int)encodedFrame.y,
                 .duration = duration,
                 .id = WEBP_CHUNK_ANMF,
-                .dispose_method = WEBP_MUX_DISPOSE_BACKGROUND, // each frame will clear canvas
+                // delta frames keep the previous frame around them, full frames clear the canvas
+                .dispose_method = delta ? WEBP_MUX_DISPOSE_NONE : WEBP_MUX_DISPOSE_BACKGROUND,
+                // the rectangle holds the exact pixels of the frame, including transparent ones
                 .blend_method = WEBP_MUX_NO_BLEND
             };
             if (WebPMuxPushFrame(mux, &frame, 0) != WEBP_MUX_OK) {
@@ -375,48 +777,260 @@
     return data;
 }
 
-- (nullable NSData *)sd_encodedWebpDataWithImage:(nullable UIImage *)image {
+// Encode the frames concurrently, the encoded frames are returned in frame order. Returns nil if any frame fails.
+- (nullable NSArray<SDWebPEncodedFrame *> *)sd_encodedWebpFramesWithFrames:(nonnull NSArray<SDWebImageFrame *> *)frames config:(WebPConfig)config delta:(BOOL)delta maxConcurrentFrames:(NSUInteger)maxConcurrentFrames {
+    NSUInteger frameCount = frames.count;
+    NSMutableArray *encodedFrames = [NSMutableArray arrayWithCapacity:frameCount];
+    for (NSUInteger i = 0; i < frameCount; i++) {
+        [encodedFrames addObject:[NSNull null]];
+    }
+    dispatch_semaphore_t lock = dispatch_semaphore_create(1);
+    __block BOOL failed = NO;
+    
+    // Each worker takes every `workerCount`-th frame, so at most `workerCount` frames are held unpremultiplied at once.
+    // A delta frame converts its previous frame again rather than waiting for it, which keeps the frames independent.
+    size_t workerCount = MIN(MAX(maxConcurrentFrames, 1), frameCount);
+    dispatch_apply(workerCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t worker) {
+        for (size_t i = worker; i < frameCount; i += workerCount) {
+            @autoreleasepool {
+                LOCK(lock);
+                BOOL stop = failed;
+                UNLOCK(lock);
+                if (stop) {
+                    return;
+                }
+                WebPConfig frameConfig = config;
+                UIImage *previousImage = delta && i > 0 ? frames[i - 1].image : nil;
+                SDWebPEncodedFrame *encodedFrame = [self sd_encodedWebpFrameWithImage:frames[i].image previousImage:previousImage config:&frameConfig];
+                LOCK(lock);
+                if (encodedFrame) {
+                    encodedFrames[i] = encodedFrame;
+                } else {
+                    failed = YES;
+                }
+                UNLOCK(lock);
+            }
+        }
+    });
+    
+    return failed ? nil : [encodedFrames copy];
+}
+
+// Encode the part of `image` which differs from `previousImage`, or the whole image if there is no previous image
+- (nullable SDWebPEncodedFrame *)sd_encodedWebpFrameWithImage:(nullable UIImage *)image previousImage:(nullable UIImage *)previousImage config:(nonnull const WebPConfig *)config {
+    CGImageRef imageRef = image.CGImage;
+    size_t width = CGImageGetWidth(imageRef);
+    size_t height = CGImageGetHeight(imageRef);
+    BOOL hasAlpha;
+    uint8_t *rgba = SDWebPCreateRGBAPixels(imageRef, &hasAlpha);
+    if (!rgba) {
+        return nil;
+    }
+    size_t bytesPerRow = width * 4;
+    
+    SDWebPEncodedFrame *encodedFrame = [SDWebPEncodedFrame new];
+    size_t x = 0, y = 0, w = width, h = height;
+    if (previousImage) {
+        CGImageRef previousImageRef = previousImage.CGImage;
+        uint8_t *previousRGBA = previousImageRef == imageRef ? NULL : SDWebPCreateRGBAPixels(previousImageRef, NULL);
+        if (previousImageRef == imageRef || (previousRGBA && !SDWebPChangedRect(rgba, previousRGBA, bytesPerRow, width, height, &x, &y, &w, &h))) {
+            // A frame needs some pixels, a single unchanged one will do
+            encodedFrame.identical = YES;
+            x = 0;
+            y = 0;
+            w = 1;
+            h = 1;
+        }
+        free(previousRGBA);
+    }
+    
+    encodedFrame.x = x;
+    encodedFrame.y = y;
+    encodedFrame.bitstream = SDWebPEncodeRGBA(rgba + y * bytesPerRow + x * 4, bytesPerRow, w, h, hasAlpha, config);
+    free(rgba);
+    
+    return encodedFrame.bitstream ? encodedFrame : nil;
+}
+
+- (nullable NSData *)sd_encodedWebpDataWithImage:(nullable UIImage *)image config:(nonnull const WebPConfig *)config {
     if (!image) {
         return nil;
     }
     
-    NSData *webpData;
     CGImageRef imageRef = image.CGImage;
+    BOOL hasAlpha;
+    uint8_t *rgba = SDWebPCreateRGBAPixels(imageRef, &hasAlpha);
+    if (!rgba) {
+        return nil;
+    }
+    size_t width = CGImageGetWidth(imageRef);
+    size_t height = CGImageGetHeight(imageRef);
+    NSData *webpData = SDWebPEncodeRGBA(rgba, width * 4, width, height, hasAlpha, config);
+    free(rgba);
     
+    return webpData;
+}
+
+// Copy the pixels of an image as straight RGBA rows of `width * 4` bytes. The alpha byte of opaque images is set to 255, so equal pixels always have equal bytes.
+static uint8_t * SDWebPCreateRGBAPixels(CGImageRef imageRef, BOOL * _Nullable hasAlpha) {
     size_t width = CGImageGetWidth(imageRef);
     size_t height = CGImageGetHeight(imageRef);
     if (width == 0 || width > WEBP_MAX_DIMENSION) {
-        return nil;
+        return NULL;
     }
     if (height == 0 || height > WEBP_MAX_DIMENSION) {
-        return nil;
+        return NULL;
     }
     
-    size_t bytesPerRow = CGImageGetBytesPerRow(imageRef);
-    CGDataProviderRef dataProvider = CGImageGetDataProvider(imageRef);
-    if (!dataProvider) {
-        return nil;
+    // libwebp wants straight RGBA. Find out where the channels of the CGImage are in memory.
+    CGBitmapInfo bitmapInfo = CGImageGetBitmapInfo(imageRef);
+    CGImageAlphaInfo alphaInfo = bitmapInfo & kCGBitmapAlphaInfoMask;
+    CGBitmapInfo byteOrder = bitmapInfo & kCGBitmapByteOrderMask;
+    BOOL is8888 = CGImageGetBitsPerComponent(imageRef) == 8 && CGImageGetBitsPerPixel(imageRef) == 32 && !(bitmapInfo & kCGBitmapFloatComponents);
+    BOOL alphaFirst = alphaInfo == kCGImageAlphaPremultipliedFirst || alphaInfo == kCGImageAlphaFirst || alphaInfo == kCGImageAlphaNoneSkipFirst;
+    BOOL alphaLast = alphaInfo == kCGImageAlphaPremultipliedLast || alphaInfo == kCGImageAlphaLast || alphaInfo == kCGImageAlphaNoneSkipLast;
+    // BGRA in memory: ARGB words stored little-endian. RGBA in memory: RGBA words stored big-endian (the default).
+    BOOL isBGRA = is8888 && alphaFirst && byteOrder == kCGBitmapByteOrder32Little;
+    BOOL isRGBA = is8888 && alphaLast && (byteOrder == kCGBitmapByteOrder32Big || byteOrder == kCGBitmapByteOrderDefault);
+    
+    CFDataRef dataRef = NULL;
+    const uint8_t *pixels = NULL;
+    size_t bytesPerRow = 0;
+    if (isBGRA || isRGBA) {
+        CGDataProviderRef dataProvider = CGImageGetDataProvider(imageRef);
+        dataRef = dataProvider ? CGDataProviderCopyData(dataProvider) : NULL;
+        pixels = dataRef ? CFDataGetBytePtr(dataRef) : NULL;
+        bytesPerRow = CGImageGetBytesPerRow(imageRef);
+    } else {
+        // Other formats are drawn once into a display-native BGRA bitmap
+        BOOL containsAlpha = SDCGImageRefContainsAlpha(imageRef);
+        CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, SDCGColorSpaceGetDeviceRGB(), SDWebPBitmapInfo(containsAlpha));
+        if (context) {
+            CGContextDrawImage(context, CGRectMake(0, 0, width, height), imageRef);
+            CGImageRef drawnImageRef = CGBitmapContextCreateImage(context);
+            CGContextRelease(context);
+            if (drawnImageRef) {
+                dataRef = CGDataProviderCopyData(CGImageGetDataProvider(drawnImageRef));
+                bytesPerRow = CGImageGetBytesPerRow(drawnImageRef);
+                CGImageRelease(drawnImageRef);
+            }
+        }
+        pixels = dataRef ? CFDataGetBytePtr(dataRef) : NULL;
+        isBGRA = YES;
+        alphaInfo = containsAlpha ? kCGImageAlphaPremultipliedFirst : kCGImageAlphaNoneSkipFirst;
+    }
+    if (!pixels) {
+        if (dataRef) {
+            CFRelease(dataRef);
+        }
+        return NULL;
     }
-    CFDataRef dataRef = CGDataProviderCopyData(dataProvider);
-    uint8_t *rgba = (uint8_t *)CFDataGetBytePtr(dataRef);
     
-    uint8_t *data = NULL;
-    float quality = 100.0;
-    size_t size = WebPEncodeRGBA(rgba, (int)width, (int)height, (int)bytesPerRow, quality, &data);
+    // Swap the channels and unpremultiply in one pass
+    size_t rgbaBytesPerRow = width * 4;
+    uint8_t *rgba = malloc(rgbaBytesPerRow * height);
+    if (!rgba) {
+        CFRelease(dataRef);
+        return NULL;
+    }
+    if (alphaInfo == kCGImageAlphaPremultipliedFirst || alphaInfo == kCGImageAlphaPremultipliedLast) {
+        SDPixelUnpremultiply(pixels, bytesPerRow, rgba, rgbaBytesPerRow, width, height, isBGRA);
+    } else if (isBGRA) {
+        SDPixelSwapRedBlue(pixels, bytesPerRow, rgba, rgbaBytesPerRow, width, height);
+    } else {
+        for (size_t y = 0; y < height; y++) {
+            memcpy(rgba + y * rgbaBytesPerRow, pixels + y * bytesPerRow, rgbaBytesPerRow);
+        }
+    }
     CFRelease(dataRef);
-    rgba = NULL;
     
-    if (size) {
-        // success
-        webpData = [NSData dataWithBytes:data length:size];
+    BOOL opaque = alphaInfo == kCGImageAlphaNoneSkipFirst || alphaInfo == kCGImageAlphaNoneSkipLast;
+    if (opaque) {
+        // The padding byte is undefined
+        for (size_t i = 3; i < rgbaBytesPerRow * height; i += 4) {
+            rgba[i] = 255;
+        }
+    }
+    if (hasAlpha) {
+        *hasAlpha = !opaque;
+    }
+    return rgba;
+}
+
+// Encode `width` x `height` straight RGBA pixels, the alpha bytes are ignored when `hasAlpha` is NO
+static NSData * SDWebPEncodeRGBA(const uint8_t *rgba, size_t bytesPerRow, size_t width, size_t height, BOOL hasAlpha, const WebPConfig *config) {
+    WebPPicture picture;
+    if (!WebPPictureInit(&picture)) {
+        return nil;
     }
-    if (data) {
-        WebPFree(data);
+    picture.width = (int)width;
+    picture.height = (int)height;
+    // The lossless encoder works on ARGB and the lossy one on YUV, import straight into the one in use
+    picture.use_argb = config->lossless;
+    int imported;
+    if (hasAlpha) {
+        imported = WebPPictureImportRGBA(&picture, rgba, (int)bytesPerRow);
+    } else {
+        imported = WebPPictureImportRGBX(&picture, rgba, (int)bytesPerRow);
+    }
+    if (!imported) {
+        WebPPictureFree(&picture);
+        return nil;
     }
     
+    NSData *webpData;
+    WebPMemoryWriter writer;
+    WebPMemoryWriterInit(&writer);
+    picture.writer = WebPMemoryWrite;
+    picture.custom_ptr = &writer;
+    if (WebPEncode(config, &picture)) {
+        // success
+        webpData = [NSData dataWithBytes:writer.mem length:writer.size];
+    }
+    WebPPictureFree(&picture);
+    WebPMemoryWriterClear(&writer);
+    
     return webpData;
 }
 
+// The bounding rectangle of the pixels which differ between two RGBA bitmaps of the same size, with an even origin as WebP frame offsets require. Returns NO if the bitmaps are identical.
+static BOOL SDWebPChangedRect(const uint8_t *pixels, const uint8_t *previousPixels, size_t bytesPerRow, size_t width, size_t height, size_t *x, size_t *y, size_t *w, size_t *h) {
+    size_t rowBytes = width * 4;
+    size_t top = 0;
+    while (top < height && memcmp(pixels + top * bytesPerRow, previousPixels + top * bytesPerRow, rowBytes) == 0) {
+        top++;
+    }
+    if (top == height) {
+        return NO;
+    }
+    size_t bottom = height - 1;
+    while (bottom > top && memcmp(pixels + bottom * bytesPerRow, previousPixels + bottom * bytesPerRow, rowBytes) == 0) {
+        bottom--;
+    }
+    // Each row only needs scanning up to the columns found so far
+    size_t left = width, right = 0;
+    for (size_t row = top; row <= bottom; row++) {
+        const uint32_t *a = (const uint32_t *)(pixels + row * bytesPerRow);
+        const uint32_t *b = (const uint32_t *)(previousPixels + row * bytesPerRow);
+        size_t first = 0;
+        while (first < left && a[first] == b[first]) {
+            first++;
+        }
+        left = MIN(left, first);
+        size_t last = width - 1;
+        while (last > right && a[last] == b[last]) {
+            last--;
+        }
+        right = MAX(right, last);
+    }
+    
+    *x = left & ~(size_t)1;
+    *y = top & ~(size_t)1;
+    *w = right + 1 - *x;
+    *h = bottom + 1 - *y;
+    return YES;
+}
+
 static void FreeImageData(void *info, const void *data, size_t size) {
     free((void *)data);
 }
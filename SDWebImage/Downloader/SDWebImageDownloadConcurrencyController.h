@@ -0,0 +1,115 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+typedef NS_ENUM(NSInteger, SDWebImageDownloadConcurrencyState) {
+    /** The limit grows while the goodput grows with it */
+    SDWebImageDownloadConcurrencyStateIncrease = 0,
+    /** A step did not pay off, the limit stays until the next probe */
+    SDWebImageDownloadConcurrencyStateHold,
+    /** The limit was cut because the time to first byte rose above the baseline or downloads failed, or it is stepping down while the goodput holds */
+    SDWebImageDownloadConcurrencyStateDecrease
+};
+
+/**
+ Adjusts the number of concurrent downloads from the completed ones, within `minimumLimit` and `maximumLimit`.
+ The samples are grouped in windows of `limit` downloads, at least 4. At the end of each window:
+ - If a download failed with a network error, or the average time to first byte is more than `latencyTolerance` times the baseline, the limit is multiplied by `decreaseFactor`. Requests waiting in the server or network queues are a sign of congestion, and they delay the visible images.
+ - Otherwise the limit moves one step at a time. A step up is kept if the goodput grew by at least 5%, a step down is kept if the goodput lost less than that. When a step is undone the limit holds, and every 4 windows it is probed again, down and up in turns. So the limit settles where one more download stops paying for itself, which also finds a lower limit when the first baseline was measured on a congested network.
+ The goodput is the bytes per second of the downloads times the average number of downloads in flight. Windows in which fewer downloads than the limit were in flight do not change the limit, they say nothing about a higher one.
+ The baseline is the lowest window time to first byte, which creeps up towards higher ones so it follows a change of network.
+ */
+@interface SDWebImageDownloadConcurrencyController : NSObject
+
+/**
+ Create a controller.
+
+ @param limit The initial limit, clamped to the bounds
+ @param minimumLimit The lowest limit, at least 1
+ @param maximumLimit The highest limit
+ @return The controller
+ */
+- (nonnull instancetype)initWithLimit:(NSUInteger)limit minimumLimit:(NSUInteger)minimumLimit maximumLimit:(NSUInteger)maximumLimit NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ The number of downloads which should run at the same time
+ */
+@property (nonatomic, assign, readonly) NSUInteger limit;
+
+/**
+ The state after the last window
+ */
+@property (nonatomic, assign, readonly) SDWebImageDownloadConcurrencyState state;
+
+/**
+ The lowest limit. Defaults to the value passed to the initializer.
+ */
+@property (nonatomic, assign) NSUInteger minimumLimit;
+
+/**
+ The highest limit. Defaults to the value passed to the initializer.
+ */
+@property (nonatomic, assign) NSUInteger maximumLimit;
+
+/**
+ How many times the baseline the time to first byte can be before the limit is cut. Defaults to 2.
+ */
+@property (nonatomic, assign) double latencyTolerance;
+
+/**
+ The factor applied to the limit when it is cut. Defaults to 0.7.
+ */
+@property (nonatomic, assign) double decreaseFactor;
+
+/**
+ Whether the limit changes and state transitions are logged with `NSLog`. Defaults to NO.
+ */
+@property (nonatomic, assign) BOOL logsTransitions;
+
+/**
+ The baseline time to first byte in seconds, 0 before the first window
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval baselineTimeToFirstByte;
+
+/**
+ The average time to first byte in seconds of the last window
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval timeToFirstByte;
+
+/**
+ The goodput in bytes per second of the last window
+ */
+@property (nonatomic, assign, readonly) double goodput;
+
+/**
+ Record a completed download.
+
+ @param timeToFirstByte The time in seconds from sending the request to receiving the response
+ @param bytes The bytes received
+ @param duration The time in seconds the download took
+ @param inFlight The number of downloads in flight, including this one
+ */
+- (void)recordDownloadWithTimeToFirstByte:(NSTimeInterval)timeToFirstByte bytes:(NSUInteger)bytes duration:(NSTimeInterval)duration inFlight:(NSUInteger)inFlight;
+
+/**
+ Record a download which failed with a network error, such as a timeout. Cancelled downloads should not be recorded.
+ */
+- (void)recordFailure;
+
+/**
+ Start over from a limit, forgetting the baseline, for example after a change of network.
+
+ @param limit The limit, clamped to the bounds
+ */
+- (void)resetWithLimit:(NSUInteger)limit;
+
+@end
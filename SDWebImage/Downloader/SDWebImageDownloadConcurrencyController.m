@@ -0,0 +1,288 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDWebImageDownloadConcurrencyController.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+// A window has at least this many samples, so a low limit does not react to a single download
+static const NSUInteger kSDConcurrencyMinimumWindowSamples = 4;
+// The goodput growth which makes one more download worth keeping
+static const double kSDConcurrencyMinimumGain = 0.05;
+// The number of windows a held limit waits before it is probed
+static const NSUInteger kSDConcurrencyProbeInterval = 4;
+// How fast the baseline follows higher times to first byte
+static const double kSDConcurrencyBaselineDrift = 0.05;
+
+static NSString *SDConcurrencyStateName(SDWebImageDownloadConcurrencyState state) {
+    switch (state) {
+        case SDWebImageDownloadConcurrencyStateIncrease:
+            return @"increase";
+        case SDWebImageDownloadConcurrencyStateHold:
+            return @"hold";
+        case SDWebImageDownloadConcurrencyStateDecrease:
+            return @"decrease";
+    }
+    return @"unknown";
+}
+
+@implementation SDWebImageDownloadConcurrencyController {
+    dispatch_semaphore_t _lock;
+    // The goodput at the limit before the last step up or down
+    double _previousGoodput;
+    NSUInteger _holdWindows;
+    // Whether the limit is being lowered to find the smallest one with the same goodput, rather than cut for congestion
+    BOOL _probingDown;
+    BOOL _probeDownNext;
+    // The samples of the current window
+    NSUInteger _windowSamples;
+    NSUInteger _windowFailures;
+    NSUInteger _windowDownloads;
+    NSTimeInterval _windowTimeToFirstByte;
+    NSTimeInterval _windowDuration;
+    double _windowBytes;
+    NSUInteger _windowInFlight;
+    NSUInteger _windowMaxInFlight;
+}
+
+@synthesize limit = _limit;
+@synthesize state = _state;
+@synthesize baselineTimeToFirstByte = _baselineTimeToFirstByte;
+@synthesize timeToFirstByte = _timeToFirstByte;
+@synthesize goodput = _goodput;
+
+- (instancetype)initWithLimit:(NSUInteger)limit minimumLimit:(NSUInteger)minimumLimit maximumLimit:(NSUInteger)maximumLimit {
+    self = [super init];
+    if (self) {
+        _lock = dispatch_semaphore_create(1);
+        _minimumLimit = MAX(minimumLimit, 1);
+        _maximumLimit = MAX(maximumLimit, _minimumLimit);
+        _limit = MIN(MAX(limit, _minimumLimit), _maximumLimit);
+        _latencyTolerance = 2;
+        _decreaseFactor = 0.7;
+        _probeDownNext = YES;
+    }
+    return self;
+}
+
+#pragma mark - Properties
+
+- (NSUInteger)limit {
+    LOCK(_lock);
+    NSUInteger limit = _limit;
+    UNLOCK(_lock);
+    return limit;
+}
+
+- (SDWebImageDownloadConcurrencyState)state {
+    LOCK(_lock);
+    SDWebImageDownloadConcurrencyState state = _state;
+    UNLOCK(_lock);
+    return state;
+}
+
+- (NSTimeInterval)baselineTimeToFirstByte {
+    LOCK(_lock);
+    NSTimeInterval baselineTimeToFirstByte = _baselineTimeToFirstByte;
+    UNLOCK(_lock);
+    return baselineTimeToFirstByte;
+}
+
+- (NSTimeInterval)timeToFirstByte {
+    LOCK(_lock);
+    NSTimeInterval timeToFirstByte = _timeToFirstByte;
+    UNLOCK(_lock);
+    return timeToFirstByte;
+}
+
+- (double)goodput {
+    LOCK(_lock);
+    double goodput = _goodput;
+    UNLOCK(_lock);
+    return goodput;
+}
+
+- (void)setMinimumLimit:(NSUInteger)minimumLimit {
+    LOCK(_lock);
+    _minimumLimit = MAX(minimumLimit, 1);
+    _maximumLimit = MAX(_maximumLimit, _minimumLimit);
+    _limit = MIN(MAX(_limit, _minimumLimit), _maximumLimit);
+    UNLOCK(_lock);
+}
+
+- (void)setMaximumLimit:(NSUInteger)maximumLimit {
+    LOCK(_lock);
+    _maximumLimit = MAX(maximumLimit, _minimumLimit);
+    _limit = MIN(_limit, _maximumLimit);
+    UNLOCK(_lock);
+}
+
+#pragma mark - Samples
+
+- (void)recordDownloadWithTimeToFirstByte:(NSTimeInterval)timeToFirstByte bytes:(NSUInteger)bytes duration:(NSTimeInterval)duration inFlight:(NSUInteger)inFlight {
+    LOCK(_lock);
+    _windowSamples++;
+    _windowDownloads++;
+    _windowTimeToFirstByte += MAX(timeToFirstByte, 0);
+    _windowDuration += MAX(duration, 0);
+    _windowBytes += bytes;
+    _windowInFlight += inFlight;
+    _windowMaxInFlight = MAX(_windowMaxInFlight, inFlight);
+    NSString *transition = [self sd_endWindowIfNeeded];
+    UNLOCK(_lock);
+    if (transition) {
+        NSLog(@"%@", transition);
+    }
+}
+
+- (void)recordFailure {
+    LOCK(_lock);
+    _windowSamples++;
+    _windowFailures++;
+    NSString *transition = [self sd_endWindowIfNeeded];
+    UNLOCK(_lock);
+    if (transition) {
+        NSLog(@"%@", transition);
+    }
+}
+
+- (void)resetWithLimit:(NSUInteger)limit {
+    LOCK(_lock);
+    _limit = MIN(MAX(limit, _minimumLimit), _maximumLimit);
+    _state = SDWebImageDownloadConcurrencyStateIncrease;
+    _baselineTimeToFirstByte = 0;
+    _timeToFirstByte = 0;
+    _goodput = 0;
+    _previousGoodput = 0;
+    _holdWindows = 0;
+    _probingDown = NO;
+    _probeDownNext = YES;
+    [self sd_resetWindow];
+    UNLOCK(_lock);
+}
+
+#pragma mark - Control
+
+// Must be called with the lock held
+- (void)sd_resetWindow {
+    _windowSamples = 0;
+    _windowFailures = 0;
+    _windowDownloads = 0;
+    _windowTimeToFirstByte = 0;
+    _windowDuration = 0;
+    _windowBytes = 0;
+    _windowInFlight = 0;
+    _windowMaxInFlight = 0;
+}
+
+// Adjust the limit when the window is full. Return the message to log if the limit or the state changed and transitions are logged. Must be called with the lock held
+- (NSString *)sd_endWindowIfNeeded {
+    if (_windowSamples < MAX(_limit, kSDConcurrencyMinimumWindowSamples)) {
+        return nil;
+    }
+    NSUInteger previousLimit = _limit;
+    SDWebImageDownloadConcurrencyState previousState = _state;
+    double goodput = 0;
+    if (_windowDownloads > 0) {
+        _timeToFirstByte = _windowTimeToFirstByte / _windowDownloads;
+        if (_windowDuration > 0) {
+            goodput = _windowBytes / _windowDuration * ((double)_windowInFlight / _windowDownloads);
+        }
+        _goodput = goodput;
+    }
+
+    BOOL congested = _windowFailures > 0 || (_windowDownloads > 0 && _baselineTimeToFirstByte > 0 && _timeToFirstByte > _baselineTimeToFirstByte * _latencyTolerance);
+    BOOL saturated = _windowMaxInFlight >= _limit;
+    if (congested) {
+        _limit = MAX((NSUInteger)floor(_limit * _decreaseFactor), _minimumLimit);
+        _state = SDWebImageDownloadConcurrencyStateDecrease;
+        _probingDown = NO;
+    } else if (saturated) {
+        switch (_state) {
+            case SDWebImageDownloadConcurrencyStateIncrease:
+                if (_previousGoodput == 0 || goodput >= _previousGoodput * (1 + kSDConcurrencyMinimumGain)) {
+                    [self sd_increaseWithGoodput:goodput];
+                } else {
+                    // The last download added did not pay for itself
+                    _limit = MAX(_limit - 1, _minimumLimit);
+                    [self sd_hold];
+                }
+                break;
+            case SDWebImageDownloadConcurrencyStateHold:
+                if (++_holdWindows >= kSDConcurrencyProbeInterval) {
+                    // Probe up and down in turns, the limit settles where one more download adds less than the minimum gain
+                    if (_probeDownNext && _limit > _minimumLimit) {
+                        _previousGoodput = goodput;
+                        _limit--;
+                        _state = SDWebImageDownloadConcurrencyStateDecrease;
+                        _probingDown = YES;
+                    } else {
+                        [self sd_increaseWithGoodput:goodput];
+                    }
+                    _probeDownNext = !_probeDownNext;
+                }
+                break;
+            case SDWebImageDownloadConcurrencyStateDecrease:
+                if (!_probingDown) {
+                    // The cut cleared the congestion, grow again
+                    [self sd_increaseWithGoodput:goodput];
+                } else if (goodput * (1 + kSDConcurrencyMinimumGain) > _previousGoodput) {
+                    // The download removed was not worth its latency
+                    _previousGoodput = goodput;
+                    if (_limit > _minimumLimit) {
+                        _limit--;
+                    } else {
+                        [self sd_hold];
+                    }
+                } else {
+                    _limit = MIN(_limit + 1, _maximumLimit);
+                    [self sd_hold];
+                }
+                break;
+        }
+    }
+
+    if (_windowDownloads > 0) {
+        if (_baselineTimeToFirstByte == 0 || _timeToFirstByte < _baselineTimeToFirstByte) {
+            _baselineTimeToFirstByte = _timeToFirstByte;
+        } else {
+            _baselineTimeToFirstByte += (_timeToFirstByte - _baselineTimeToFirstByte) * kSDConcurrencyBaselineDrift;
+        }
+    }
+    NSUInteger failures = _windowFailures;
+    [self sd_resetWindow];
+
+    if (!_logsTransitions || (_limit == previousLimit && _state == previousState)) {
+        return nil;
+    }
+    return [NSString stringWithFormat:@"SDWebImageDownloader concurrency %lu -> %lu, %@ -> %@, time to first byte %.0fms, baseline %.0fms, goodput %.0fKB/s, %lu failures",
+            (unsigned long)previousLimit, (unsigned long)_limit, SDConcurrencyStateName(previousState), SDConcurrencyStateName(_state),
+            _timeToFirstByte * 1000, _baselineTimeToFirstByte * 1000, goodput / 1024, (unsigned long)failures];
+}
+
+// Must be called with the lock held
+- (void)sd_increaseWithGoodput:(double)goodput {
+    if (_limit >= _maximumLimit) {
+        [self sd_hold];
+        return;
+    }
+    _previousGoodput = goodput;
+    _limit++;
+    _state = SDWebImageDownloadConcurrencyStateIncrease;
+    _probingDown = NO;
+}
+
+// Must be called with the lock held
+- (void)sd_hold {
+    _state = SDWebImageDownloadConcurrencyStateHold;
+    _holdWindows = 0;
+    _probingDown = NO;
+}
+
+@end
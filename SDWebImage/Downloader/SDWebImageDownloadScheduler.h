@@ -0,0 +1,130 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ A snapshot of the downloads of one host
+ */
+@interface SDWebImageDownloadHostStatistics : NSObject
+
+@property (nonatomic, copy, readonly, nonnull) NSString *host;
+/**
+ The number of downloads waiting for a slot
+ */
+@property (nonatomic, assign, readonly) NSUInteger pendingCount;
+/**
+ The number of downloads holding a slot
+ */
+@property (nonatomic, assign, readonly) NSUInteger runningCount;
+/**
+ The number of finished downloads
+ */
+@property (nonatomic, assign, readonly) NSUInteger finishedCount;
+/**
+ The moving average of the time in seconds from getting a slot to finishing, 0 before the first download finishes
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval averageLatency;
+/**
+ The moving average of the time in seconds spent waiting for a slot
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval averageWaitTime;
+
+@end
+
+/**
+ Decides when the downloads of an operation queue run, keeping a queue per host.
+ The operations are added to the operation queue at once, so they can be cancelled and found as usual, but each one depends on a gate which the scheduler opens when it gives the download a slot. A download gets a slot when fewer than `maxConcurrentDownloads` downloads hold one, and fewer than the limit of its host.
+ When a slot frees up, the highest priority among the pending downloads goes first. Among the hosts with a download of that priority, the one using the smallest share of its weight goes first, in turns when the shares are equal. Within a host, downloads go first in first out, or last in first out.
+ A slow host can only hold its own slots, so the other hosts keep downloading.
+ */
+@interface SDWebImageDownloadScheduler : NSObject
+
+/**
+ Create a scheduler for the operations of a queue.
+
+ @param operationQueue The queue the operations are added to
+ @return The scheduler
+ */
+- (nonnull instancetype)initWithOperationQueue:(nonnull NSOperationQueue *)operationQueue NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ The maximum number of downloads holding a slot at the same time. Defaults to 6.
+ */
+@property (nonatomic, assign) NSUInteger maxConcurrentDownloads;
+
+/**
+ The maximum number of downloads of one host holding a slot at the same time, unless the host has its own limit. 0 means only `maxConcurrentDownloads` applies. Defaults to 4.
+ */
+@property (nonatomic, assign) NSUInteger maxConcurrentDownloadsPerHost;
+
+/**
+ Whether the downloads of a host go last in first out. Defaults to NO.
+ */
+@property (nonatomic, assign) BOOL lastInFirstOut;
+
+/**
+ The number of downloads holding a slot
+ */
+@property (nonatomic, assign, readonly) NSUInteger runningDownloadCount;
+
+/**
+ Set the limit of a host, which replaces `maxConcurrentDownloadsPerHost`.
+
+ @param maxConcurrentDownloads The maximum number of downloads of the host holding a slot, 0 to use `maxConcurrentDownloadsPerHost` again
+ @param host The host
+ */
+- (void)setMaxConcurrentDownloads:(NSUInteger)maxConcurrentDownloads forHost:(nonnull NSString *)host;
+
+/**
+ Set the weight of a host. A host with weight 2 gets twice the slots of a host with weight 1 when both have pending downloads. Defaults to 1.
+
+ @param weight The weight, at least 1
+ @param host The host
+ */
+- (void)setWeight:(NSUInteger)weight forHost:(nonnull NSString *)host;
+
+/**
+ Add an operation to the operation queue, it starts when it gets a slot. Its `queuePriority` is read now.
+
+ @param operation The operation
+ @param host The host of the download, nil is a host of its own
+ */
+- (void)addOperation:(nonnull NSOperation *)operation host:(nullable NSString *)host;
+
+/**
+ Read the `queuePriority` of an operation again after it changed. A pending download moves to the downloads of its new priority, as the newest one; a download holding a slot is left as it is.
+
+ @param operation The operation
+ */
+- (void)updatePriorityOfOperation:(nonnull NSOperation *)operation;
+
+/**
+ Tell the scheduler an operation finished, or was cancelled before it got a slot, so its slot goes to the next download.
+
+ @param operation The operation
+ */
+- (void)operationDidFinish:(nonnull NSOperation *)operation;
+
+/**
+ The statistics of a host. A host is forgotten once it has no pending or running download, its counts and averages start over with its next download.
+
+ @param host The host
+ @return The statistics, or nil if the host has no pending or running download
+ */
+- (nullable SDWebImageDownloadHostStatistics *)statisticsForHost:(nonnull NSString *)host;
+
+/**
+ The statistics of all the hosts with pending or running downloads, by host
+ */
+@property (nonatomic, copy, readonly, nonnull) NSDictionary<NSString *, SDWebImageDownloadHostStatistics *> *hostStatistics;
+
+@end
@@ -0,0 +1,364 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDWebImageDownloadScheduler.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+// The weight of the last sample in the moving averages
+static const double kSDDownloadAverageSmoothing = 0.2;
+
+static NSTimeInterval SDMovingAverage(NSTimeInterval average, NSTimeInterval sample, NSUInteger sampleCount) {
+    return sampleCount <= 1 ? sample : average + (sample - average) * kSDDownloadAverageSmoothing;
+}
+
+// The index of the pending entries of a queue priority, from high to low
+static NSUInteger SDPriorityIndex(NSOperationQueuePriority queuePriority) {
+    if (queuePriority > NSOperationQueuePriorityNormal) {
+        return 0;
+    } else if (queuePriority < NSOperationQueuePriorityNormal) {
+        return 2;
+    }
+    return 1;
+}
+
+@interface SDWebImageDownloadHostStatistics ()
+
+@property (nonatomic, copy, readwrite, nonnull) NSString *host;
+@property (nonatomic, assign, readwrite) NSUInteger pendingCount;
+@property (nonatomic, assign, readwrite) NSUInteger runningCount;
+@property (nonatomic, assign, readwrite) NSUInteger finishedCount;
+@property (nonatomic, assign, readwrite) NSTimeInterval averageLatency;
+@property (nonatomic, assign, readwrite) NSTimeInterval averageWaitTime;
+
+@end
+
+@implementation SDWebImageDownloadHostStatistics
+@end
+
+@class SDWebImageDownloadHost;
+
+@interface SDWebImageDownloadEntry : NSObject
+
+@property (nonatomic, strong, nonnull) NSOperation *operation;
+@property (nonatomic, strong, nonnull) NSOperation *gate;
+@property (nonatomic, weak, nullable) SDWebImageDownloadHost *host;
+@property (nonatomic, assign) NSUInteger priorityIndex;
+@property (nonatomic, assign) CFAbsoluteTime addTime;
+@property (nonatomic, assign) CFAbsoluteTime startTime; // 0 until the entry gets a slot
+
+@end
+
+@implementation SDWebImageDownloadEntry
+@end
+
+@interface SDWebImageDownloadHost : NSObject
+
+@property (nonatomic, copy, nonnull) NSString *host;
+// The pending entries of each priority, from high to low
+@property (nonatomic, strong, nonnull) NSArray<NSMutableArray<SDWebImageDownloadEntry *> *> *pendingEntries;
+@property (nonatomic, assign) NSUInteger runningCount;
+@property (nonatomic, assign) NSUInteger finishedCount;
+@property (nonatomic, assign) NSUInteger startedCount;
+@property (nonatomic, assign) NSUInteger maxConcurrentDownloads; // 0 to use the scheduler's `maxConcurrentDownloadsPerHost`
+@property (nonatomic, assign) NSUInteger weight;
+@property (nonatomic, assign) NSTimeInterval averageLatency;
+@property (nonatomic, assign) NSTimeInterval averageWaitTime;
+
+@end
+
+@implementation SDWebImageDownloadHost
+@end
+
+@implementation SDWebImageDownloadScheduler {
+    dispatch_semaphore_t _lock;
+    NSOperationQueue *_operationQueue;
+    // The hosts with pending or running downloads, and the same hosts in the order they take turns. A host is dropped once it has neither
+    NSMutableDictionary<NSString *, SDWebImageDownloadHost *> *_hosts;
+    NSMutableArray<SDWebImageDownloadHost *> *_hostOrder;
+    // The limits and weights set for hosts, applied whenever the host has downloads
+    NSMutableDictionary<NSString *, NSNumber *> *_hostLimits;
+    NSMutableDictionary<NSString *, NSNumber *> *_hostWeights;
+    NSUInteger _nextHostIndex;
+    NSMapTable<NSOperation *, SDWebImageDownloadEntry *> *_entries;
+    NSUInteger _runningCount;
+    BOOL _lastInFirstOut;
+}
+
+- (instancetype)initWithOperationQueue:(NSOperationQueue *)operationQueue {
+    self = [super init];
+    if (self) {
+        _lock = dispatch_semaphore_create(1);
+        _operationQueue = operationQueue;
+        _hosts = [NSMutableDictionary dictionary];
+        _hostOrder = [NSMutableArray array];
+        _hostLimits = [NSMutableDictionary dictionary];
+        _hostWeights = [NSMutableDictionary dictionary];
+        _entries = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality valueOptions:NSPointerFunctionsStrongMemory];
+        _maxConcurrentDownloads = 6;
+        _maxConcurrentDownloadsPerHost = 4;
+    }
+    return self;
+}
+
+#pragma mark - Properties
+
+- (void)setMaxConcurrentDownloads:(NSUInteger)maxConcurrentDownloads {
+    LOCK(_lock);
+    _maxConcurrentDownloads = maxConcurrentDownloads;
+    NSArray<NSOperation *> *gates = [self sd_startPendingDownloads];
+    UNLOCK(_lock);
+    [self sd_openGates:gates];
+}
+
+- (void)setMaxConcurrentDownloadsPerHost:(NSUInteger)maxConcurrentDownloadsPerHost {
+    LOCK(_lock);
+    _maxConcurrentDownloadsPerHost = maxConcurrentDownloadsPerHost;
+    NSArray<NSOperation *> *gates = [self sd_startPendingDownloads];
+    UNLOCK(_lock);
+    [self sd_openGates:gates];
+}
+
+- (BOOL)lastInFirstOut {
+    LOCK(_lock);
+    BOOL lastInFirstOut = _lastInFirstOut;
+    UNLOCK(_lock);
+    return lastInFirstOut;
+}
+
+- (void)setLastInFirstOut:(BOOL)lastInFirstOut {
+    LOCK(_lock);
+    _lastInFirstOut = lastInFirstOut;
+    UNLOCK(_lock);
+}
+
+- (void)setMaxConcurrentDownloads:(NSUInteger)maxConcurrentDownloads forHost:(NSString *)host {
+    NSString *name = host.lowercaseString;
+    LOCK(_lock);
+    _hostLimits[name] = maxConcurrentDownloads > 0 ? @(maxConcurrentDownloads) : nil;
+    _hosts[name].maxConcurrentDownloads = maxConcurrentDownloads;
+    NSArray<NSOperation *> *gates = [self sd_startPendingDownloads];
+    UNLOCK(_lock);
+    [self sd_openGates:gates];
+}
+
+- (NSUInteger)runningDownloadCount {
+    LOCK(_lock);
+    NSUInteger runningCount = _runningCount;
+    UNLOCK(_lock);
+    return runningCount;
+}
+
+- (void)setWeight:(NSUInteger)weight forHost:(NSString *)host {
+    NSString *name = host.lowercaseString;
+    weight = MAX(weight, 1);
+    LOCK(_lock);
+    _hostWeights[name] = weight > 1 ? @(weight) : nil;
+    _hosts[name].weight = weight;
+    UNLOCK(_lock);
+}
+
+- (SDWebImageDownloadHostStatistics *)statisticsForHost:(NSString *)host {
+    LOCK(_lock);
+    SDWebImageDownloadHost *downloadHost = _hosts[host.lowercaseString];
+    SDWebImageDownloadHostStatistics *statistics = downloadHost ? [self sd_statisticsForHost:downloadHost] : nil;
+    UNLOCK(_lock);
+    return statistics;
+}
+
+- (NSDictionary<NSString *,SDWebImageDownloadHostStatistics *> *)hostStatistics {
+    NSMutableDictionary<NSString *, SDWebImageDownloadHostStatistics *> *hostStatistics = [NSMutableDictionary dictionary];
+    LOCK(_lock);
+    for (SDWebImageDownloadHost *downloadHost in _hostOrder) {
+        hostStatistics[downloadHost.host] = [self sd_statisticsForHost:downloadHost];
+    }
+    UNLOCK(_lock);
+    return [hostStatistics copy];
+}
+
+// Must be called with the lock held
+- (SDWebImageDownloadHostStatistics *)sd_statisticsForHost:(SDWebImageDownloadHost *)downloadHost {
+    SDWebImageDownloadHostStatistics *statistics = [SDWebImageDownloadHostStatistics new];
+    statistics.host = downloadHost.host;
+    statistics.pendingCount = [self sd_pendingCountOfHost:downloadHost];
+    statistics.runningCount = downloadHost.runningCount;
+    statistics.finishedCount = downloadHost.finishedCount;
+    statistics.averageLatency = downloadHost.averageLatency;
+    statistics.averageWaitTime = downloadHost.averageWaitTime;
+    return statistics;
+}
+
+// Must be called with the lock held
+- (NSUInteger)sd_pendingCountOfHost:(SDWebImageDownloadHost *)downloadHost {
+    NSUInteger pendingCount = 0;
+    for (NSMutableArray<SDWebImageDownloadEntry *> *entries in downloadHost.pendingEntries) {
+        pendingCount += entries.count;
+    }
+    return pendingCount;
+}
+
+// The host of a name, which starts taking turns if it is new. Must be called with the lock held
+- (SDWebImageDownloadHost *)sd_hostWithName:(NSString *)name {
+    name = name.lowercaseString ?: @"";
+    SDWebImageDownloadHost *downloadHost = _hosts[name];
+    if (!downloadHost) {
+        downloadHost = [SDWebImageDownloadHost new];
+        downloadHost.host = name;
+        downloadHost.pendingEntries = @[[NSMutableArray array], [NSMutableArray array], [NSMutableArray array]];
+        downloadHost.maxConcurrentDownloads = _hostLimits[name].unsignedIntegerValue;
+        downloadHost.weight = _hostWeights[name].unsignedIntegerValue ?: 1;
+        _hosts[name] = downloadHost;
+        [_hostOrder addObject:downloadHost];
+    }
+    return downloadHost;
+}
+
+// Drop a host once it has no download left, so only the hosts with downloads are scanned. Must be called with the lock held
+- (void)sd_removeHostIfIdle:(SDWebImageDownloadHost *)downloadHost {
+    if (!downloadHost || downloadHost.runningCount > 0 || [self sd_pendingCountOfHost:downloadHost] > 0) {
+        return;
+    }
+    NSUInteger index = [_hostOrder indexOfObjectIdenticalTo:downloadHost];
+    [_hostOrder removeObjectAtIndex:index];
+    // Keep the turn on the host which was next
+    if (index < _nextHostIndex) {
+        _nextHostIndex--;
+    }
+    if (_nextHostIndex >= _hostOrder.count) {
+        _nextHostIndex = 0;
+    }
+    [_hosts removeObjectForKey:downloadHost.host];
+}
+
+#pragma mark - Scheduling
+
+- (void)addOperation:(NSOperation *)operation host:(NSString *)host {
+    SDWebImageDownloadEntry *entry = [SDWebImageDownloadEntry new];
+    entry.operation = operation;
+    // Cancelled operations ignore their dependencies, so a download cancelled while pending still finishes
+    entry.gate = [NSOperation new];
+    [operation addDependency:entry.gate];
+    entry.priorityIndex = SDPriorityIndex(operation.queuePriority);
+    entry.addTime = CFAbsoluteTimeGetCurrent();
+
+    LOCK(_lock);
+    SDWebImageDownloadHost *downloadHost = [self sd_hostWithName:host];
+    entry.host = downloadHost;
+    [downloadHost.pendingEntries[entry.priorityIndex] addObject:entry];
+    [_entries setObject:entry forKey:operation];
+    NSArray<NSOperation *> *gates = [self sd_startPendingDownloads];
+    UNLOCK(_lock);
+
+    [_operationQueue addOperation:operation];
+    [self sd_openGates:gates];
+}
+
+- (void)updatePriorityOfOperation:(NSOperation *)operation {
+    NSUInteger priorityIndex = SDPriorityIndex(operation.queuePriority);
+    LOCK(_lock);
+    SDWebImageDownloadEntry *entry = [_entries objectForKey:operation];
+    // A download holding a slot keeps it, its task priority is up to the operation
+    if (!entry || entry.startTime > 0 || entry.priorityIndex == priorityIndex) {
+        UNLOCK(_lock);
+        return;
+    }
+    SDWebImageDownloadHost *downloadHost = entry.host;
+    [downloadHost.pendingEntries[entry.priorityIndex] removeObjectIdenticalTo:entry];
+    entry.priorityIndex = priorityIndex;
+    [downloadHost.pendingEntries[priorityIndex] addObject:entry];
+    UNLOCK(_lock);
+}
+
+- (void)operationDidFinish:(NSOperation *)operation {
+    LOCK(_lock);
+    SDWebImageDownloadEntry *entry = [_entries objectForKey:operation];
+    if (!entry) {
+        UNLOCK(_lock);
+        return;
+    }
+    [_entries removeObjectForKey:operation];
+    SDWebImageDownloadHost *downloadHost = entry.host;
+    if (entry.startTime > 0) {
+        _runningCount--;
+        downloadHost.runningCount--;
+        downloadHost.finishedCount++;
+        downloadHost.averageLatency = SDMovingAverage(downloadHost.averageLatency, CFAbsoluteTimeGetCurrent() - entry.startTime, downloadHost.finishedCount);
+    } else {
+        [downloadHost.pendingEntries[entry.priorityIndex] removeObjectIdenticalTo:entry];
+    }
+    [self sd_removeHostIfIdle:downloadHost];
+    NSArray<NSOperation *> *gates = [self sd_startPendingDownloads];
+    UNLOCK(_lock);
+    [self sd_openGates:gates];
+}
+
+// Give the free slots to the next downloads and return their gates, which are opened once the lock is released. Must be called with the lock held
+- (NSArray<NSOperation *> *)sd_startPendingDownloads {
+    NSMutableArray<NSOperation *> *gates;
+    while (_runningCount < MAX(_maxConcurrentDownloads, 1)) {
+        SDWebImageDownloadEntry *entry = [self sd_nextEntry];
+        if (!entry) {
+            break;
+        }
+        SDWebImageDownloadHost *downloadHost = entry.host;
+        [downloadHost.pendingEntries[entry.priorityIndex] removeObjectIdenticalTo:entry];
+        _runningCount++;
+        downloadHost.runningCount++;
+        downloadHost.startedCount++;
+        entry.startTime = CFAbsoluteTimeGetCurrent();
+        downloadHost.averageWaitTime = SDMovingAverage(downloadHost.averageWaitTime, entry.startTime - entry.addTime, downloadHost.startedCount);
+        if (!gates) {
+            gates = [NSMutableArray array];
+        }
+        [gates addObject:entry.gate];
+    }
+    return gates;
+}
+
+// The next download to get a slot, nil if every host with pending downloads is at its limit. Must be called with the lock held
+- (SDWebImageDownloadEntry *)sd_nextEntry {
+    NSUInteger hostCount = _hostOrder.count;
+    for (NSUInteger priorityIndex = 0; priorityIndex < 3; priorityIndex++) {
+        SDWebImageDownloadHost *bestHost;
+        NSUInteger bestIndex = 0;
+        double bestShare = 0;
+        // Start from the host after the last one served, so hosts with equal shares take turns
+        for (NSUInteger i = 0; i < hostCount; i++) {
+            NSUInteger index = (_nextHostIndex + i) % hostCount;
+            SDWebImageDownloadHost *downloadHost = _hostOrder[index];
+            if (downloadHost.pendingEntries[priorityIndex].count == 0) {
+                continue;
+            }
+            NSUInteger limit = downloadHost.maxConcurrentDownloads ?: _maxConcurrentDownloadsPerHost;
+            if (limit > 0 && downloadHost.runningCount >= limit) {
+                continue;
+            }
+            double share = (double)downloadHost.runningCount / downloadHost.weight;
+            if (!bestHost || share < bestShare) {
+                bestHost = downloadHost;
+                bestIndex = index;
+                bestShare = share;
+            }
+        }
+        if (bestHost) {
+            _nextHostIndex = (bestIndex + 1) % hostCount;
+            NSMutableArray<SDWebImageDownloadEntry *> *entries = bestHost.pendingEntries[priorityIndex];
+            return _lastInFirstOut ? entries.lastObject : entries.firstObject;
+        }
+    }
+    return nil;
+}
+
+- (void)sd_openGates:(NSArray<NSOperation *> *)gates {
+    for (NSOperation *gate in gates) {
+        [gate start];
+    }
+}
+
+@end
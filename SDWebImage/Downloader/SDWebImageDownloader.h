@@ -9,6 +9,8 @@
 #import <Foundation/Foundation.h>
 #import "SDWebImageCompat.h"
 #import "SDWebImageOperation.h"
+#import "SDWebImageDownloadScheduler.h"
+#import "SDWebImageDownloadConcurrencyController.h"
 
 typedef NS_OPTIONS(NSUInteger, SDWebImageDownloaderOptions) {
     /**
@@ -60,6 +62,19 @@ typedef NS_OPTIONS(NSUInteger, SDWebImageDownloaderOptions) {
      * 缩小图片
      */
     SDWebImageDownloaderScaleDownLargeImages = 1 << 8,
+    
+    /**
+     * 将收到的数据直接写入 `streamToDiskDirectory` 中的临时文件，而不是保存在内存中，完成后从文件映射(mmap)数据进行解码，适合大图像。
+     * 完成回调中的数据由文件映射，`SDWebImageDownloaderOperation fileURLForDownloadedData:` 返回这个文件，可以直接移动到磁盘缓存中而不用再写一次。数据释放时没有被移动的文件会被删除。
+     * 这个选项下不支持渐进式下载。
+     */
+    SDWebImageDownloaderStreamToDisk = 1 << 9,
+    
+    /**
+     * 下载失败或取消时，把已收到的数据和响应的ETag或Last-Modified保存在 `streamToDiskDirectory` 中，下次下载同一个URL时用 `Range` 和 `If-Range` 请求剩下的数据，收到206响应时拼接在一起。
+     * 图像在服务器上改变时服务器返回完整的数据，保存的数据被丢弃。保存的数据总量不超过 `maxPartialDownloadsSize`。
+     */
+    SDWebImageDownloaderResumeIncompleteDownloads = 1 << 10,
 };
 
 typedef NS_ENUM(NSInteger, SDWebImageDownloaderExecutionOrder) {
@@ -74,6 +89,23 @@ typedef NS_ENUM(NSInteger, SDWebImageDownloaderExecutionOrder) {
     SDWebImageDownloaderLIFOExecutionOrder
 };
 
+typedef NS_ENUM(NSInteger, SDWebImageDownloaderPriority) {
+    /**
+     * 低优先级，与 `SDWebImageDownloaderLowPriority` 相同。
+     */
+    SDWebImageDownloaderPriorityLow = -1,
+    
+    /**
+     * 默认优先级。
+     */
+    SDWebImageDownloaderPriorityDefault = 0,
+    
+    /**
+     * 高优先级，与 `SDWebImageDownloaderHighPriority` 相同。
+     */
+    SDWebImageDownloaderPriorityHigh = 1
+};
+
 FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadStartNotification;
 FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadStopNotification;
 
@@ -101,6 +133,12 @@ typedef SDHTTPHeadersDictionary * _Nullable (^SDWebImageDownloaderHeadersFilterB
  */
 @property (nonatomic, strong, nullable) id downloadOperationCancelToken;
 
+/**
+ * 下载的优先级，初始值来自 `SDWebImageDownloaderHighPriority` 和 `SDWebImageDownloaderLowPriority` 选项。可以随时修改，比如滚动时提高刚出现在屏幕上的图像的优先级，降低移出屏幕的图像的优先级。
+ * 等待中的下载按新的优先级排队，成为这个优先级中最新加入的下载；正在进行的下载会修改 `NSURLSessionTask` 的优先级。多个token共享一个下载时，下载使用其中最高的优先级。
+ */
+@property (nonatomic, assign) SDWebImageDownloaderPriority priority;
+
 @end
 
 
@@ -116,10 +154,72 @@ typedef SDHTTPHeadersDictionary * _Nullable (^SDWebImageDownloaderHeadersFilterB
 @property (assign, nonatomic) BOOL shouldDecompressImages;
 
 /**
- * 并发下载的最大数量。
+ * 渐进式下载时两次部分解码之间至少需要新收到的字节数，传给每个下载操作。默认为 `SDWebImageProgressiveDecodeDefaultMinimumBytes`。
+ */
+@property (assign, nonatomic) NSUInteger progressiveDecodeMinimumBytes;
+
+/**
+ * 两次部分解码之间的最短间隔(秒)，传给每个下载操作。默认为 `SDWebImageProgressiveDecodeDefaultMinimumInterval`。
+ */
+@property (assign, nonatomic) NSTimeInterval progressiveDecodeMinimumInterval;
+
+/**
+ * 超过这个间隔(秒)后，即使新收到的字节数不够也会部分解码，传给每个下载操作。默认为 `SDWebImageProgressiveDecodeDefaultMaximumInterval`。
+ */
+@property (assign, nonatomic) NSTimeInterval progressiveDecodeMaximumInterval;
+
+/**
+ * `SDWebImageDownloaderStreamToDisk` 下载时临时文件和 `SDWebImageDownloaderResumeIncompleteDownloads` 保存的未完成下载所在的目录，传给每个下载操作。应该与磁盘缓存在同一个卷上，这样完成的文件可以直接移动到缓存中。
+ * `SDWebImageManager` 初始化时如果没有设置，会设置为其图像缓存的 `downloadingDiskCachePath`。默认为nil，表示使用临时目录。
+ */
+@property (copy, nonatomic, nullable) NSString *streamToDiskDirectory;
+
+/**
+ * `SDWebImageDownloaderResumeIncompleteDownloads` 保存的未完成下载的最大总字节数，超过时删除最早保存的，传给每个下载操作。默认为 `SDWebImageDownloaderDefaultMaxPartialDownloadsSize`。
+ */
+@property (assign, nonatomic) NSUInteger maxPartialDownloadsSize;
+
+/**
+ * 图像允许的最大像素数，传给每个下载操作，见 `SDWebImageDownloaderOperation maxImagePixels`。默认为0，表示不限制。
+ */
+@property (assign, nonatomic) NSUInteger maxImagePixels;
+
+/**
+ * 解码后的图像允许占用的最大字节数，传给每个下载操作，见 `SDWebImageDownloaderOperation maxImageBytes`。默认为0，表示不限制。
+ */
+@property (assign, nonatomic) NSUInteger maxImageBytes;
+
+/**
+ * 动图允许的最大帧数，传给每个下载操作，见 `SDWebImageDownloaderOperation maxImageFrameCount`。默认为0，表示不限制。
+ */
+@property (assign, nonatomic) NSUInteger maxImageFrameCount;
+
+/**
+ * 并发下载的最大数量。开启 `adaptiveConcurrentDownloads` 时为自动调整的初始值。
  */
 @property (assign, nonatomic) NSInteger maxConcurrentDownloads;
 
+/**
+ * 是否根据完成的下载自动调整并发下载的数量。开启后 `concurrencyController` 按首字节时间和有效吞吐量在它的 `minimumLimit` 和 `maximumLimit` 之间调整，代替 `maxConcurrentDownloads`。
+ * Wi-Fi等快速网络上会超过固定的数量，拥塞的蜂窝网络上会减少，以免可见图像的延迟变长。默认为NO。
+ */
+@property (assign, nonatomic) BOOL adaptiveConcurrentDownloads;
+
+/**
+ * `adaptiveConcurrentDownloads` 使用的控制器，可以设置它的范围，或开启 `logsTransitions` 记录状态变化。默认范围为2到16。
+ */
+@property (readonly, nonatomic, nonnull) SDWebImageDownloadConcurrencyController *concurrencyController;
+
+/**
+ * 同一主机并发下载的最大数量，没有单独设置的主机都使用这个值，这样一个慢的主机不会占满所有的下载。0表示只受 `maxConcurrentDownloads` 限制。默认为4。
+ */
+@property (assign, nonatomic) NSUInteger maxConcurrentDownloadsPerHost;
+
+/**
+ * 所有有下载的主机的统计，键为主机名。
+ */
+@property (readonly, nonatomic, nonnull) NSDictionary<NSString *, SDWebImageDownloadHostStatistics *> *hostStatistics;
+
 /**
  * 显示仍然需要下载的当前下载数量。
  */
@@ -197,6 +297,31 @@ typedef SDHTTPHeadersDictionary * _Nullable (^SDWebImageDownloaderHeadersFilterB
  */
 - (void)setOperationClass:(nullable Class)operationClass;
 
+/**
+ * 设置一个主机并发下载的最大数量，代替 `maxConcurrentDownloadsPerHost`。
+ *
+ * @param maxConcurrentDownloads 最大数量，0表示恢复使用 `maxConcurrentDownloadsPerHost`
+ * @param host 主机名
+ */
+- (void)setMaxConcurrentDownloads:(NSUInteger)maxConcurrentDownloads forHost:(nonnull NSString *)host;
+
+/**
+ * 设置一个主机的权重。多个主机都有等待的下载时，空出的下载按权重分给各个主机，权重为2的主机得到的下载数是权重为1的两倍。默认为1。
+ * 高优先级的下载总是先于其他优先级开始，同一主机内按 `executionOrder` 的顺序开始。
+ *
+ * @param weight 权重，至少为1
+ * @param host 主机名
+ */
+- (void)setDownloadWeight:(NSUInteger)weight forHost:(nonnull NSString *)host;
+
+/**
+ * 返回一个主机的统计：等待和正在进行的下载数，以及平均下载时间和平均等待时间。
+ *
+ * @param host 主机名
+ * @return 统计，没有这个主机的下载时为nil
+ */
+- (nullable SDWebImageDownloadHostStatistics *)statisticsForHost:(nonnull NSString *)host;
+
 /**
  * 创建一个带有给定URL的SDWebImageDownloader实例。
  *
@@ -208,6 +333,19 @@ typedef SDHTTPHeadersDictionary * _Nullable (^SDWebImageDownloaderHeadersFilterB
                                                   progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                                  completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock;
 
+/**
+ * 创建一个带有给定URL和解码选项的SDWebImageDownloader实例。
+ * 下载完成后图像按解码选项解码，例如直接以 `SDWebImageCoderDecodeTargetPixelSizeKey` 指定的尺寸解码。
+ * 相同URL但目标尺寸不同的请求不会共享同一个下载操作。
+ *
+ * @param decodeOptions 解码选项，参见 `SDWebImageCoder.h`
+ */
+- (nullable SDWebImageDownloadToken *)downloadImageWithURL:(nullable NSURL *)url
+                                                   options:(SDWebImageDownloaderOptions)options
+                                             decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions
+                                                  progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                                 completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock;
+
 /**
  * 取消先前排队使用-downloadImageWithURL的下载:选项:进度:完成:
  */
@@ -8,6 +8,7 @@
 
 #import "SDWebImageDownloader.h"
 #import "SDWebImageDownloaderOperation.h"
+#import "SDWebImageCoder.h"
 
 #define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
 #define UNLOCK(lock) dispatch_semaphore_signal(lock);
@@ -15,32 +16,51 @@
 @interface SDWebImageDownloadToken ()
 
 @property (nonatomic, weak, nullable) NSOperation<SDWebImageDownloaderOperationInterface> *downloadOperation;
+// The key of `URLOperations` the token belongs to, the URL itself unless decode options asked for a target size
+@property (nonatomic, strong, nullable) id<NSCopying> operationKey;
+// The scheduler holding the operation back, which requeues it when its priority changes
+@property (nonatomic, weak, nullable) SDWebImageDownloadScheduler *scheduler;
 
 @end
 
 @implementation SDWebImageDownloadToken
 
 - (void)cancel {
-    if (self.downloadOperation) {
+    NSOperation<SDWebImageDownloaderOperationInterface> *operation = self.downloadOperation;
+    if (operation) {
         SDWebImageDownloadToken *cancelToken = self.downloadOperationCancelToken;
-        if (cancelToken) {
-            [self.downloadOperation cancel:cancelToken];
+        if (cancelToken && ![operation cancel:cancelToken]) {
+            // The other tokens keep the download, which may wait at a lower priority now
+            [self.scheduler updatePriorityOfOperation:operation];
         }
     }
 }
 
+- (void)setPriority:(SDWebImageDownloaderPriority)priority {
+    _priority = priority;
+    NSOperation<SDWebImageDownloaderOperationInterface> *operation = self.downloadOperation;
+    id cancelToken = self.downloadOperationCancelToken;
+    if (cancelToken && [operation respondsToSelector:@selector(setPriority:forToken:)]) {
+        [operation setPriority:priority forToken:cancelToken];
+        [self.scheduler updatePriorityOfOperation:operation];
+    }
+}
+
 @end
 
 
 @interface SDWebImageDownloader () <NSURLSessionTaskDelegate, NSURLSessionDataDelegate>
 
 @property (strong, nonatomic, nonnull) NSOperationQueue *downloadQueue;
-@property (weak, nonatomic, nullable) NSOperation *lastAddedOperation;
+@property (strong, nonatomic, nonnull) SDWebImageDownloadScheduler *scheduler; // 按主机排队，决定 `downloadQueue` 中的操作何时开始
 @property (assign, nonatomic, nullable) Class operationClass;
-@property (strong, nonatomic, nonnull) NSMutableDictionary<NSURL *, SDWebImageDownloaderOperation *> *URLOperations;
+@property (strong, nonatomic, nonnull) NSMutableDictionary<id<NSCopying>, SDWebImageDownloaderOperation *> *URLOperations;
 @property (strong, nonatomic, nullable) SDHTTPHeadersMutableDictionary *HTTPHeaders;
 @property (strong, nonatomic, nonnull) dispatch_semaphore_t operationsLock; // a lock to keep the access to `URLOperations` thread-safe
 @property (strong, nonatomic, nonnull) dispatch_semaphore_t headersLock; // a lock to keep the access to `HTTPHeaders` thread-safe
+// The operations running a task by task, filled when an operation creates its task and emptied when the task completes. The operations are weak, a cancelled operation may never see its task complete
+@property (strong, nonatomic, nonnull) NSMapTable<NSURLSessionTask *, NSOperation<SDWebImageDownloaderOperationInterface> *> *taskOperations;
+@property (strong, nonatomic, nonnull) dispatch_semaphore_t taskOperationsLock; // a lock to keep the access to `taskOperations` thread-safe
 
 // The session in which data tasks will run
 @property (strong, nonatomic) NSURLSession *session;
@@ -49,6 +69,8 @@
 
 @implementation SDWebImageDownloader
 
+@synthesize maxConcurrentDownloads = _maxConcurrentDownloads;
+
 + (void)initialize {
     // Bind SDNetworkActivityIndicator if available (download it here: http://github.com/rs/SDNetworkActivityIndicator )
     // To use it, just add #import "SDNetworkActivityIndicator.h" in addition to the SDWebImage import
@@ -89,10 +111,18 @@
     if ((self = [super init])) {
         _operationClass = [SDWebImageDownloaderOperation class];
         _shouldDecompressImages = YES;
+        _progressiveDecodeMinimumBytes = SDWebImageProgressiveDecodeDefaultMinimumBytes;
+        _progressiveDecodeMinimumInterval = SDWebImageProgressiveDecodeDefaultMinimumInterval;
+        _progressiveDecodeMaximumInterval = SDWebImageProgressiveDecodeDefaultMaximumInterval;
+        _maxPartialDownloadsSize = SDWebImageDownloaderDefaultMaxPartialDownloadsSize;
         _executionOrder = SDWebImageDownloaderFIFOExecutionOrder;
+        _maxConcurrentDownloads = 6;
         _downloadQueue = [NSOperationQueue new];
-        _downloadQueue.maxConcurrentOperationCount = 6;
+        _downloadQueue.maxConcurrentOperationCount = _maxConcurrentDownloads;
         _downloadQueue.name = @"com.hackemist.SDWebImageDownloader";
+        _scheduler = [[SDWebImageDownloadScheduler alloc] initWithOperationQueue:_downloadQueue];
+        _scheduler.maxConcurrentDownloads = _maxConcurrentDownloads;
+        _concurrencyController = [[SDWebImageDownloadConcurrencyController alloc] initWithLimit:_maxConcurrentDownloads minimumLimit:2 maximumLimit:16];
         _URLOperations = [NSMutableDictionary new];
 #ifdef SD_WEBP
         _HTTPHeaders = [@{@"Accept": @"image/webp,image/*;q=0.8"} mutableCopy];
@@ -101,6 +131,8 @@
 #endif
         _operationsLock = dispatch_semaphore_create(1);
         _headersLock = dispatch_semaphore_create(1);
+        _taskOperations = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality valueOptions:NSPointerFunctionsWeakMemory];
+        _taskOperationsLock = dispatch_semaphore_create(1);
         _downloadTimeout = 15.0;
 
         [self createNewSessionWithConfiguration:sessionConfiguration];
@@ -170,7 +202,30 @@
 }
 
 - (void)setMaxConcurrentDownloads:(NSInteger)maxConcurrentDownloads {
-    _downloadQueue.maxConcurrentOperationCount = maxConcurrentDownloads;
+    _maxConcurrentDownloads = maxConcurrentDownloads;
+    if (_adaptiveConcurrentDownloads) {
+        [_concurrencyController resetWithLimit:maxConcurrentDownloads > 0 ? (NSUInteger)maxConcurrentDownloads : _concurrencyController.maximumLimit];
+    }
+    [self applyConcurrencyLimit];
+}
+
+- (void)setAdaptiveConcurrentDownloads:(BOOL)adaptiveConcurrentDownloads {
+    if (adaptiveConcurrentDownloads && !_adaptiveConcurrentDownloads) {
+        [_concurrencyController resetWithLimit:_maxConcurrentDownloads > 0 ? (NSUInteger)_maxConcurrentDownloads : _concurrencyController.maximumLimit];
+    }
+    _adaptiveConcurrentDownloads = adaptiveConcurrentDownloads;
+    [self applyConcurrencyLimit];
+}
+
+- (void)applyConcurrencyLimit {
+    if (_adaptiveConcurrentDownloads) {
+        // The scheduler alone holds the downloads back, the queue must not cap a raised limit
+        _downloadQueue.maxConcurrentOperationCount = NSOperationQueueDefaultMaxConcurrentOperationCount;
+        _scheduler.maxConcurrentDownloads = _concurrencyController.limit;
+    } else {
+        _downloadQueue.maxConcurrentOperationCount = _maxConcurrentDownloads;
+        _scheduler.maxConcurrentDownloads = _maxConcurrentDownloads > 0 ? (NSUInteger)_maxConcurrentDownloads : NSUIntegerMax;
+    }
 }
 
 - (NSUInteger)currentDownloadCount {
@@ -178,7 +233,36 @@
 }
 
 - (NSInteger)maxConcurrentDownloads {
-    return _downloadQueue.maxConcurrentOperationCount;
+    return _maxConcurrentDownloads;
+}
+
+- (void)setMaxConcurrentDownloadsPerHost:(NSUInteger)maxConcurrentDownloadsPerHost {
+    _scheduler.maxConcurrentDownloadsPerHost = maxConcurrentDownloadsPerHost;
+}
+
+- (NSUInteger)maxConcurrentDownloadsPerHost {
+    return _scheduler.maxConcurrentDownloadsPerHost;
+}
+
+- (void)setMaxConcurrentDownloads:(NSUInteger)maxConcurrentDownloads forHost:(nonnull NSString *)host {
+    [_scheduler setMaxConcurrentDownloads:maxConcurrentDownloads forHost:host];
+}
+
+- (void)setDownloadWeight:(NSUInteger)weight forHost:(nonnull NSString *)host {
+    [_scheduler setWeight:weight forHost:host];
+}
+
+- (nullable SDWebImageDownloadHostStatistics *)statisticsForHost:(nonnull NSString *)host {
+    return [_scheduler statisticsForHost:host];
+}
+
+- (NSDictionary<NSString *,SDWebImageDownloadHostStatistics *> *)hostStatistics {
+    return _scheduler.hostStatistics;
+}
+
+- (void)setExecutionOrder:(SDWebImageDownloaderExecutionOrder)executionOrder {
+    _executionOrder = executionOrder;
+    _scheduler.lastInFirstOut = executionOrder == SDWebImageDownloaderLIFOExecutionOrder;
 }
 
 - (NSURLSessionConfiguration *)sessionConfiguration {
@@ -197,9 +281,23 @@
                                                    options:(SDWebImageDownloaderOptions)options
                                                   progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                                  completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock {
+    return [self downloadImageWithURL:url options:options decodeOptions:nil progress:progressBlock completed:completedBlock];
+}
+
+- (nullable SDWebImageDownloadToken *)downloadImageWithURL:(nullable NSURL *)url
+                                                   options:(SDWebImageDownloaderOptions)options
+                                             decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions
+                                                  progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                                 completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock {
     __weak SDWebImageDownloader *wself = self;
+    // Downloads decoded at different target sizes produce different images, so they can't share one operation
+    id<NSCopying> operationKey = url;
+    NSString *sizedKey = SDImageKeyForDecodeOptions(url.absoluteString, decodeOptions);
+    if (url && ![sizedKey isEqualToString:url.absoluteString]) {
+        operationKey = sizedKey;
+    }
 
-    return [self addProgressCallback:progressBlock completedBlock:completedBlock forURL:url createCallback:^SDWebImageDownloaderOperation *{
+    SDWebImageDownloadToken *token = [self addProgressCallback:progressBlock completedBlock:completedBlock forURL:url operationKey:operationKey createCallback:^SDWebImageDownloaderOperation *{
         __strong __typeof (wself) sself = wself;
         NSTimeInterval timeoutInterval = sself.downloadTimeout;
         if (timeoutInterval == 0.0) {
@@ -222,6 +320,19 @@
         }
         SDWebImageDownloaderOperation *operation = [[sself.operationClass alloc] initWithRequest:request inSession:sself.session options:options];
         operation.shouldDecompressImages = sself.shouldDecompressImages;
+        if (decodeOptions && [operation respondsToSelector:@selector(setDecodeOptions:)]) {
+            operation.decodeOptions = decodeOptions;
+        }
+        if ([operation isKindOfClass:[SDWebImageDownloaderOperation class]]) {
+            operation.progressiveDecodeMinimumBytes = sself.progressiveDecodeMinimumBytes;
+            operation.progressiveDecodeMinimumInterval = sself.progressiveDecodeMinimumInterval;
+            operation.progressiveDecodeMaximumInterval = sself.progressiveDecodeMaximumInterval;
+            operation.maxImagePixels = sself.maxImagePixels;
+            operation.maxImageBytes = sself.maxImageBytes;
+            operation.maxImageFrameCount = sself.maxImageFrameCount;
+            operation.streamToDiskDirectory = sself.streamToDiskDirectory;
+            operation.maxPartialDownloadsSize = sself.maxPartialDownloadsSize;
+        }
         
         if (sself.urlCredential) {
             operation.credential = sself.urlCredential;
@@ -234,36 +345,45 @@
         } else if (options & SDWebImageDownloaderLowPriority) {
             operation.queuePriority = NSOperationQueuePriorityLow;
         }
-        
-        if (sself.executionOrder == SDWebImageDownloaderLIFOExecutionOrder) {
-            // Emulate LIFO execution order by systematically adding new operations as last operation's dependency
-            [sself.lastAddedOperation addDependency:operation];
-            sself.lastAddedOperation = operation;
-        }
 
         return operation;
     }];
+    // A download shared by several tokens runs at the highest of their priorities
+    if (options & SDWebImageDownloaderHighPriority) {
+        token.priority = SDWebImageDownloaderPriorityHigh;
+    } else if (options & SDWebImageDownloaderLowPriority) {
+        token.priority = SDWebImageDownloaderPriorityLow;
+    } else {
+        token.priority = SDWebImageDownloaderPriorityDefault;
+    }
+    return token;
 }
 
 - (void)cancel:(nullable SDWebImageDownloadToken *)token {
-    NSURL *url = token.url;
-    if (!url) {
+    id<NSCopying> operationKey = token.operationKey ?: token.url;
+    if (!operationKey) {
         return;
     }
     LOCK(self.operationsLock);
-    SDWebImageDownloaderOperation *operation = [self.URLOperations objectForKey:url];
+    SDWebImageDownloaderOperation *operation = [self.URLOperations objectForKey:operationKey];
+    BOOL canceled = NO;
     if (operation) {
-        BOOL canceled = [operation cancel:token.downloadOperationCancelToken];
+        canceled = [operation cancel:token.downloadOperationCancelToken];
         if (canceled) {
-            [self.URLOperations removeObjectForKey:url];
+            [self.URLOperations removeObjectForKey:operationKey];
         }
     }
     UNLOCK(self.operationsLock);
+    if (operation && !canceled) {
+        // The other tokens keep the download, which may wait at a lower priority now
+        [self.scheduler updatePriorityOfOperation:operation];
+    }
 }
 
 - (nullable SDWebImageDownloadToken *)addProgressCallback:(SDWebImageDownloaderProgressBlock)progressBlock
                                            completedBlock:(SDWebImageDownloaderCompletedBlock)completedBlock
                                                    forURL:(nullable NSURL *)url
+                                             operationKey:(nullable id<NSCopying>)operationKey
                                            createCallback:(SDWebImageDownloaderOperation *(^)(void))createCallback {
     // The URL will be used as the key to the callbacks dictionary so it cannot be nil. If it is nil immediately call the completed block with no image or data.
     if (url == nil) {
@@ -273,24 +393,41 @@
         return nil;
     }
     
+    if (!operationKey) {
+        operationKey = url;
+    }
     LOCK(self.operationsLock);
-    SDWebImageDownloaderOperation *operation = [self.URLOperations objectForKey:url];
+    SDWebImageDownloaderOperation *operation = [self.URLOperations objectForKey:operationKey];
     if (!operation) {
         operation = createCallback();
         __weak typeof(self) wself = self;
+        __weak typeof(operation) woperation = operation;
         operation.completionBlock = ^{
             __strong typeof(wself) sself = wself;
             if (!sself) {
                 return;
             }
             LOCK(sself.operationsLock);
-            [sself.URLOperations removeObjectForKey:url];
+            [sself.URLOperations removeObjectForKey:operationKey];
             UNLOCK(sself.operationsLock);
+            // Give the slot to the next download
+            __strong typeof(woperation) soperation = woperation;
+            if (soperation) {
+                [sself.scheduler operationDidFinish:soperation];
+            }
         };
-        [self.URLOperations setObject:operation forKey:url];
+        operation.taskCreatedBlock = ^(NSURLSessionTask *task) {
+            [wself addOperation:woperation forTask:task];
+        };
+        // A custom operation may create its task early
+        if (operation.dataTask) {
+            [self addOperation:operation forTask:operation.dataTask];
+        }
+        [self.URLOperations setObject:operation forKey:operationKey];
         // Add operation to operation queue only after all configuration done according to Apple's doc.
         // `addOperation:` does not synchronously execute the `operation.completionBlock` so this will not cause deadlock.
-        [self.downloadQueue addOperation:operation];
+        // The scheduler holds the operation back until its host has a free slot
+        [self.scheduler addOperation:operation host:url.host];
     }
     UNLOCK(self.operationsLock);
 
@@ -299,7 +436,9 @@
     SDWebImageDownloadToken *token = [SDWebImageDownloadToken new];
     token.downloadOperation = operation;
     token.url = url;
+    token.operationKey = operationKey;
     token.downloadOperationCancelToken = downloadOperationCancelToken;
+    token.scheduler = self.scheduler;
 
     return token;
 }
@@ -315,16 +454,34 @@
 #pragma mark Helper methods
 
 - (SDWebImageDownloaderOperation *)operationWithTask:(NSURLSessionTask *)task {
-    SDWebImageDownloaderOperation *returnOperation = nil;
-    for (SDWebImageDownloaderOperation *operation in self.downloadQueue.operations) {
-        if (operation.dataTask.taskIdentifier == task.taskIdentifier) {
-            returnOperation = operation;
-            break;
-        }
+    if (!task) {
+        return nil;
+    }
+    LOCK(self.taskOperationsLock);
+    SDWebImageDownloaderOperation *returnOperation = [self.taskOperations objectForKey:task];
+    UNLOCK(self.taskOperationsLock);
+    // A task the operation replaced or dropped has nothing left to report
+    if (returnOperation.dataTask != task) {
+        return nil;
     }
     return returnOperation;
 }
 
+- (void)addOperation:(nullable NSOperation<SDWebImageDownloaderOperationInterface> *)operation forTask:(nonnull NSURLSessionTask *)task {
+    if (!operation) {
+        return;
+    }
+    LOCK(self.taskOperationsLock);
+    [self.taskOperations setObject:operation forKey:task];
+    UNLOCK(self.taskOperationsLock);
+}
+
+- (void)removeOperationForTask:(nonnull NSURLSessionTask *)task {
+    LOCK(self.taskOperationsLock);
+    [self.taskOperations removeObjectForKey:task];
+    UNLOCK(self.taskOperationsLock);
+}
+
 #pragma mark NSURLSessionDataDelegate
 
 - (void)URLSession:(NSURLSession *)session
@@ -377,6 +534,37 @@ didReceiveResponse:(NSURLResponse *)response
     if ([dataOperation respondsToSelector:@selector(URLSession:task:didCompleteWithError:)]) {
         [dataOperation URLSession:session task:task didCompleteWithError:error];
     }
+    [self removeOperationForTask:task];
+    
+    // Requests which time out or lose their connection are a sign of congestion
+    if (self.adaptiveConcurrentDownloads && [error.domain isEqualToString:NSURLErrorDomain]
+        && (error.code == NSURLErrorTimedOut || error.code == NSURLErrorNetworkConnectionLost || error.code == NSURLErrorCannotConnectToHost)) {
+        [self.concurrencyController recordFailure];
+        [self applyConcurrencyLimit];
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didFinishCollectingMetrics:(NSURLSessionTaskMetrics *)metrics {
+    
+    // Identify the operation that runs this task and pass it the delegate method
+    SDWebImageDownloaderOperation *dataOperation = [self operationWithTask:task];
+    if ([dataOperation respondsToSelector:@selector(URLSession:task:didFinishCollectingMetrics:)]) {
+        [dataOperation URLSession:session task:task didFinishCollectingMetrics:metrics];
+    }
+    
+    if (!self.adaptiveConcurrentDownloads || task.error.code == NSURLErrorCancelled) {
+        return;
+    }
+    NSURLSessionTaskTransactionMetrics *transaction = metrics.transactionMetrics.lastObject;
+    // Responses from the local cache say nothing about the network
+    if (transaction.resourceFetchType != NSURLSessionTaskMetricsResourceFetchTypeNetworkLoad || !transaction.requestStartDate || !transaction.responseStartDate) {
+        return;
+    }
+    NSTimeInterval timeToFirstByte = [transaction.responseStartDate timeIntervalSinceDate:transaction.requestStartDate];
+    NSUInteger bytes = (NSUInteger)MAX(task.countOfBytesReceived, 0);
+    // The download still holds its slot, so it is counted in flight
+    [self.concurrencyController recordDownloadWithTimeToFirstByte:timeToFirstByte bytes:bytes duration:metrics.taskInterval.duration inFlight:self.scheduler.runningDownloadCount];
+    [self applyConcurrencyLimit];
 }
 
 - (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task willPerformHTTPRedirection:(NSHTTPURLResponse *)response newRequest:(NSURLRequest *)request completionHandler:(void (^)(NSURLRequest * _Nullable))completionHandler {
@@ -14,6 +14,36 @@ FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadStartNotification;
 FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadReceiveResponseNotification;
 FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadStopNotification;
 FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadFinishNotification;
+/**
+ 从下载的前几个字节解析出图像尺寸时在主队列发送，object为下载操作，尺寸见 `imagePixelSize`。
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadReceiveImageSizeNotification;
+
+/**
+ 下载操作在 `SDWebImageErrorDomain` 中返回的错误码。
+ */
+typedef NS_ENUM(NSInteger, SDWebImageDownloaderErrorCode) {
+    /**
+     * 图像的像素数、解码后的字节数或帧数超过了下载操作的限制，下载被取消。
+     */
+    SDWebImageDownloaderErrorCodeImageTooLarge = 1000,
+    /**
+     * 使用 `SDWebImageDownloaderStreamToDisk` 时无法把下载的数据写入磁盘，下载被取消。
+     */
+    SDWebImageDownloaderErrorCodeCannotWriteFile = 1001
+};
+
+/**
+ 渐进式解码调度的默认值：两次解码之间至少新收到32KB，至少间隔50毫秒，最多间隔300毫秒。
+ */
+FOUNDATION_EXPORT const NSUInteger SDWebImageProgressiveDecodeDefaultMinimumBytes;
+FOUNDATION_EXPORT const NSTimeInterval SDWebImageProgressiveDecodeDefaultMinimumInterval;
+FOUNDATION_EXPORT const NSTimeInterval SDWebImageProgressiveDecodeDefaultMaximumInterval;
+
+/**
+ `SDWebImageDownloaderResumeIncompleteDownloads` 保存的未完成下载的默认最大总字节数，50MB。
+ */
+FOUNDATION_EXPORT const NSUInteger SDWebImageDownloaderDefaultMaxPartialDownloadsSize;
 
 
 
@@ -38,6 +68,9 @@ FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadFinishNotification
 
 - (BOOL)cancel:(nullable id)token;
 
+@optional
+- (void)setPriority:(SDWebImageDownloaderPriority)priority forToken:(nullable id)token;
+
 @end
 
 
@@ -53,9 +86,81 @@ FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadFinishNotification
  */
 @property (strong, nonatomic, readonly, nullable) NSURLSessionTask *dataTask;
 
+/**
+ * 操作创建任务后、任务开始前调用，包括续传失败后重新发送的请求。下载器用它记录任务对应的操作。
+ */
+@property (copy, nonatomic, nullable) void (^taskCreatedBlock)(NSURLSessionTask * _Nonnull task);
+
 
 @property (assign, nonatomic) BOOL shouldDecompressImages;
 
+/**
+ * 下载完成后解码图像使用的选项，例如 `SDWebImageCoderDecodeTargetPixelSizeKey`。
+ * 渐进式解码不使用这些选项。
+ */
+@property (copy, nonatomic, nullable) NSDictionary<NSString *, NSObject *> *decodeOptions;
+
+/**
+ * 渐进式下载时，两次部分解码之间至少需要新收到的字节数。默认为 `SDWebImageProgressiveDecodeDefaultMinimumBytes`。
+ * 解码只在编码器队列空闲时调度，网络很快时多余的解码被跳过，而不是排队。下载完成前的最后一块数据总是会解码。
+ */
+@property (assign, nonatomic) NSUInteger progressiveDecodeMinimumBytes;
+
+/**
+ * 两次部分解码之间的最短间隔(秒)。默认为 `SDWebImageProgressiveDecodeDefaultMinimumInterval`。
+ */
+@property (assign, nonatomic) NSTimeInterval progressiveDecodeMinimumInterval;
+
+/**
+ * 超过这个间隔(秒)后，即使新收到的字节数不够也会解码，网络很慢时仍然能更新图像。默认为 `SDWebImageProgressiveDecodeDefaultMaximumInterval`。
+ */
+@property (assign, nonatomic) NSTimeInterval progressiveDecodeMaximumInterval;
+
+/**
+ * 已调度的部分解码次数。
+ */
+@property (assign, atomic, readonly) NSUInteger progressiveDecodeCount;
+
+/**
+ * 被合并跳过的部分解码次数。
+ */
+@property (assign, atomic, readonly) NSUInteger progressiveDecodeSkippedCount;
+
+/**
+ * 图像允许的最大像素数(宽×高)。在下载过程中从数据头部解析出尺寸后检查，超过时取消下载并返回 `SDWebImageDownloaderErrorCodeImageTooLarge` 错误。默认为0，表示不限制。
+ */
+@property (assign, nonatomic) NSUInteger maxImagePixels;
+
+/**
+ * 解码后的图像允许占用的最大字节数，按 `SDWebImageDecodeScheduler estimatedDecodedBytesForData:options:` 估算，会考虑 `decodeOptions`。设置 `SDWebImageDownloaderScaleDownLargeImages` 时静态图像分块缩小解码，不检查这个限制。默认为0，表示不限制。
+ */
+@property (assign, nonatomic) NSUInteger maxImageBytes;
+
+/**
+ * 动图允许的最大帧数。GIF和WebP的帧数在下载完成前只统计已收到的数据，下载完成后会再检查一次。默认为0，表示不限制。
+ */
+@property (assign, nonatomic) NSUInteger maxImageFrameCount;
+
+/**
+ * 从已收到的数据头部解析出的图像像素尺寸，没有应用EXIF方向。解析出来之前为CGSizeZero，解析出来时发送 `SDWebImageDownloadReceiveImageSizeNotification`。
+ */
+@property (assign, atomic, readonly) CGSize imagePixelSize;
+
+/**
+ * `SDWebImageDownloaderStreamToDisk` 下载时临时文件和 `SDWebImageDownloaderResumeIncompleteDownloads` 保存的未完成下载所在的目录。默认为nil，表示使用临时目录。
+ */
+@property (copy, nonatomic, nullable) NSString *streamToDiskDirectory;
+
+/**
+ * 目录中保存的未完成下载的最大总字节数，保存新的未完成下载时删除最早保存的。默认为 `SDWebImageDownloaderDefaultMaxPartialDownloadsSize`。
+ */
+@property (assign, nonatomic) NSUInteger maxPartialDownloadsSize;
+
+/**
+ * 这次下载中复制收到的数据的字节数。收到的数据块拼接时不复制，只在解析数据头部和解码需要连续内存时，数据由多个块组成才会复制。
+ */
+@property (assign, atomic, readonly) NSUInteger receivedDataCopiedBytes;
+
 /**
  *  用于确定URL连接是否应该查询凭证存储以验证连接。
  *  @不赞成使用几个版本。
@@ -111,4 +216,26 @@ FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadFinishNotification
  */
 - (BOOL)cancel:(nullable id)token;
 
+/**
+ *  设置一组回调的优先级。操作使用所有回调中最高的优先级，更新 `queuePriority`，正在进行时也更新 `NSURLSessionTask` 的优先级。
+ *
+ *  @param priority 优先级
+ *  @param token    `addHandlersForProgress:completed:` 返回的token
+ */
+- (void)setPriority:(SDWebImageDownloaderPriority)priority forToken:(nullable id)token;
+
+/**
+ *  操作当前的优先级，为所有回调中最高的优先级。没有设置过优先级的回调使用选项中的优先级。
+ */
+@property (assign, readonly) SDWebImageDownloaderPriority priority;
+
+/**
+ *  返回 `SDWebImageDownloaderStreamToDisk` 下载完成时映射数据的文件。把文件移动到别处(比如磁盘缓存)不影响数据，数据释放时文件如果还在原处会被删除。
+ *
+ *  @param data 完成回调中的图像数据
+ *
+ *  @return 文件URL，数据不是由下载的文件映射时返回nil
+ */
++ (nullable NSURL *)fileURLForDownloadedData:(nullable NSData *)data;
+
 @end
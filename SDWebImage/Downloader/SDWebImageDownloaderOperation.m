@@ -10,6 +10,13 @@
 #import "SDWebImageManager.h"
 #import "NSImage+WebCache.h"
 #import "SDWebImageCodersManager.h"
+#import "SDWebImageCoderHelper.h"
+#import "SDWebImageDecodeScheduler.h"
+#import "SDImageHeaderParser.h"
+#import <CommonCrypto/CommonDigest.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
 #define UNLOCK(lock) dispatch_semaphore_signal(lock);
@@ -25,19 +32,130 @@ NSString *const SDWebImageDownloadStartNotification = @"SDWebImageDownloadStartN
 NSString *const SDWebImageDownloadReceiveResponseNotification = @"SDWebImageDownloadReceiveResponseNotification";
 NSString *const SDWebImageDownloadStopNotification = @"SDWebImageDownloadStopNotification";
 NSString *const SDWebImageDownloadFinishNotification = @"SDWebImageDownloadFinishNotification";
+NSString *const SDWebImageDownloadReceiveImageSizeNotification = @"SDWebImageDownloadReceiveImageSizeNotification";
+
+const NSUInteger SDWebImageProgressiveDecodeDefaultMinimumBytes = 32 * 1024;
+const NSTimeInterval SDWebImageProgressiveDecodeDefaultMinimumInterval = 0.05;
+const NSTimeInterval SDWebImageProgressiveDecodeDefaultMaximumInterval = 0.3;
+const NSUInteger SDWebImageDownloaderDefaultMaxPartialDownloadsSize = 50 * 1024 * 1024;
+
+// Stop looking for the image size if the header is not complete after this many bytes, JPEG metadata segments can be large
+static const NSUInteger kImageHeaderProbeMaxBytes = 1024 * 1024;
 
 static NSString *const kProgressCallbackKey = @"progress";
 static NSString *const kCompletedCallbackKey = @"completed";
+static NSString *const kPriorityCallbackKey = @"priority";
 
 typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
 
+static float SDURLSessionTaskPriority(SDWebImageDownloaderPriority priority) {
+    switch (priority) {
+        case SDWebImageDownloaderPriorityHigh:
+            return NSURLSessionTaskPriorityHigh;
+        case SDWebImageDownloaderPriorityLow:
+            return NSURLSessionTaskPriorityLow;
+        default:
+            return NSURLSessionTaskPriorityDefault;
+    }
+}
+
+// Wrap a received chunk without copying it. The chunks of NSURLSession are usually dispatch data already.
+static dispatch_data_t SDDispatchDataWithData(NSData *data) {
+    if ([data conformsToProtocol:@protocol(OS_dispatch_data)]) {
+        return (dispatch_data_t)data;
+    }
+    return dispatch_data_create(data.bytes, data.length, NULL, ^{
+        // Keep the chunk alive as long as its bytes are referenced
+        (void)data;
+    });
+}
+
+// The data mapped from the files streamed to disk, by data object
+static NSMapTable<NSData *, NSURL *> *SDStreamedDataFileURLs(void) {
+    static NSMapTable *fileURLs;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        fileURLs = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality valueOptions:NSPointerFunctionsStrongMemory];
+    });
+    return fileURLs;
+}
+
+// The partial downloads being resumed or written by an operation, by path
+static NSMutableSet<NSString *> *SDClaimedPartialDownloads(void) {
+    static NSMutableSet *paths;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        paths = [NSMutableSet set];
+    });
+    return paths;
+}
+
+// The partial download file of a URL, its validators are in a plist next to it
+static NSString *SDPartialDownloadPath(NSString *directory, NSURL *url) {
+    const char *str = url.absoluteString.UTF8String ?: "";
+    unsigned char r[CC_MD5_DIGEST_LENGTH];
+    CC_MD5(str, (CC_LONG)strlen(str), r);
+    NSMutableString *filename = [NSMutableString stringWithCapacity:CC_MD5_DIGEST_LENGTH * 2 + 8];
+    for (int i = 0; i < CC_MD5_DIGEST_LENGTH; i++) {
+        [filename appendFormat:@"%02x", r[i]];
+    }
+    [filename appendString:@".partial"];
+    return [directory stringByAppendingPathComponent:filename];
+}
+
+static void SDRemovePartialDownload(NSString *path) {
+    unlink(path.fileSystemRepresentation);
+    unlink([path stringByAppendingPathExtension:@"plist"].fileSystemRepresentation);
+}
+
+// Remove the least recently written partial downloads until the others fit in `maxBytes`, skipping the ones in use
+static void SDTrimPartialDownloads(NSString *directory, NSUInteger maxBytes) {
+    NSArray<NSString *> *resourceKeys = @[NSURLContentModificationDateKey, NSURLFileSizeKey];
+    NSArray<NSURL *> *fileURLs = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:[NSURL fileURLWithPath:directory isDirectory:YES] includingPropertiesForKeys:resourceKeys options:0 error:nil];
+    fileURLs = [fileURLs filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"pathExtension == 'partial'"]];
+    NSMutableDictionary<NSURL *, NSDictionary *> *attributes = [NSMutableDictionary dictionary];
+    for (NSURL *fileURL in fileURLs) {
+        attributes[fileURL] = [fileURL resourceValuesForKeys:resourceKeys error:nil] ?: @{};
+    }
+    fileURLs = [fileURLs sortedArrayUsingComparator:^NSComparisonResult(NSURL *a, NSURL *b) {
+        return [attributes[b][NSURLContentModificationDateKey] compare:attributes[a][NSURLContentModificationDateKey]];
+    }];
+    NSMutableSet<NSString *> *claimedPaths = SDClaimedPartialDownloads();
+    NSUInteger totalBytes = 0;
+    for (NSURL *fileURL in fileURLs) {
+        totalBytes += [attributes[fileURL][NSURLFileSizeKey] unsignedIntegerValue];
+        if (totalBytes <= maxBytes) {
+            continue;
+        }
+        @synchronized (claimedPaths) {
+            if (![claimedPaths containsObject:fileURL.path]) {
+                SDRemovePartialDownload(fileURL.path);
+            }
+        }
+    }
+}
+
+// Return the data as one contiguous region. Only data made of several regions is copied, the copied bytes are added to `copiedBytes`.
+static dispatch_data_t SDDispatchDataCreateContiguous(dispatch_data_t data, NSUInteger *copiedBytes) {
+    __block NSUInteger regionCount = 0;
+    dispatch_data_apply(data, ^bool(dispatch_data_t region, size_t offset, const void *buffer, size_t size) {
+        return ++regionCount < 2;
+    });
+    if (regionCount < 2) {
+        return data;
+    }
+    *copiedBytes += dispatch_data_get_size(data);
+    return dispatch_data_create_map(data, NULL, NULL);
+}
+
 @interface SDWebImageDownloaderOperation ()
 
 @property (strong, nonatomic, nonnull) NSMutableArray<SDCallbacksDictionary *> *callbackBlocks;
 
 @property (assign, nonatomic, getter = isExecuting) BOOL executing;
 @property (assign, nonatomic, getter = isFinished) BOOL finished;
-@property (strong, nonatomic, nullable) NSMutableData *imageData;
+@property (strong, atomic, nullable) dispatch_data_t imageData; // 收到的数据块，拼接时不复制，只在需要连续内存时展开
+@property (assign, atomic, readwrite) NSUInteger receivedDataCopiedBytes;
 @property (copy, nonatomic, nullable) NSData *cachedData; // for `SDWebImageDownloaderIgnoreCachedResponse`
 
 // 这很弱，因为它是由管理这个会话的人注入的。如果这种情况发生，我们将无法运行。
@@ -50,12 +168,33 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
 
 @property (strong, nonatomic, nonnull) dispatch_semaphore_t callbacksLock; // a lock to keep the access to `callbackBlocks` thread-safe
 
-@property (strong, nonatomic, nonnull) dispatch_queue_t coderQueue; // 进行图像解码的队列。
+@property (strong, nonatomic, nonnull) dispatch_queue_t coderQueue; // 保证解码顺序的串行队列，解码本身在共享的解码调度器中进行。
 #if SD_UIKIT
 @property (assign, nonatomic) UIBackgroundTaskIdentifier backgroundTaskId;
 #endif
 
 @property (strong, nonatomic, nullable) id<SDWebImageProgressiveCoder> progressiveCoder;
+@property (assign, nonatomic) NSUInteger progressiveDataOffset; // 已经交给渐进式编码器的字节数
+@property (assign, atomic) BOOL progressiveDecoding; // 编码器队列中是否有渐进式解码
+@property (assign, nonatomic) CFAbsoluteTime lastProgressiveDecodeTime;
+@property (assign, nonatomic) NSUInteger lastProgressiveDecodeSize;
+@property (assign, atomic, readwrite) NSUInteger progressiveDecodeCount;
+@property (assign, atomic, readwrite) NSUInteger progressiveDecodeSkippedCount;
+
+@property (assign, nonatomic) BOOL imageHeaderProbed; // 是否已经解析了数据头部，或者放弃了解析
+@property (assign, nonatomic) NSUInteger imageHeaderProbedLength; // 上一次解析数据头部时的数据长度
+@property (assign, nonatomic) NSUInteger imageEstimatedBytes; // 从数据头部估算的解码后字节数，用于渐进式解码的内存预算
+@property (assign, atomic, readwrite) CGSize imagePixelSize;
+@property (strong, nonatomic, nullable) NSError *cancelError; // 图像超过限制或写入文件失败时取消任务，完成时返回这个错误而不是取消错误
+
+@property (assign, nonatomic) NSUInteger receivedSize;
+@property (copy, nonatomic, nullable) NSString *streamFilePath; // `SDWebImageDownloaderStreamToDisk` 写入的临时文件
+@property (assign, nonatomic) int streamFileDescriptor;
+
+@property (copy, nonatomic, nullable) NSString *partialFilePath; // `SDWebImageDownloaderResumeIncompleteDownloads` 保存未完成数据的文件，下载期间由这个操作独占
+@property (assign, nonatomic) NSUInteger resumeOffset; // 请求中 `Range` 的起始位置，0表示没有续传
+@property (assign, nonatomic) BOOL partialFileStale; // 服务器返回了完整的数据或不匹配的范围，保存的数据不能再用
+@property (copy, nonatomic, nullable) NSString *responseValidator; // 响应的强ETag或Last-Modified，用于续传的 `If-Range`
 
 @end
 
@@ -82,10 +221,33 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
         _unownedSession = session;
         _callbacksLock = dispatch_semaphore_create(1);
         _coderQueue = dispatch_queue_create("com.hackemist.SDWebImageDownloaderOperationCoderQueue", DISPATCH_QUEUE_SERIAL);
+        _progressiveDecodeMinimumBytes = SDWebImageProgressiveDecodeDefaultMinimumBytes;
+        _progressiveDecodeMinimumInterval = SDWebImageProgressiveDecodeDefaultMinimumInterval;
+        _progressiveDecodeMaximumInterval = SDWebImageProgressiveDecodeDefaultMaximumInterval;
+        _streamFileDescriptor = -1;
+        _maxPartialDownloadsSize = SDWebImageDownloaderDefaultMaxPartialDownloadsSize;
     }
     return self;
 }
 
+- (void)setDataTask:(NSURLSessionTask *)dataTask {
+    _dataTask = dataTask;
+    // Let the session delegate find this operation before the task reports anything
+    if (dataTask && self.taskCreatedBlock) {
+        self.taskCreatedBlock(dataTask);
+    }
+}
+
++ (nullable NSURL *)fileURLForDownloadedData:(nullable NSData *)data {
+    if (!data) {
+        return nil;
+    }
+    NSMapTable<NSData *, NSURL *> *fileURLs = SDStreamedDataFileURLs();
+    @synchronized (fileURLs) {
+        return [fileURLs objectForKey:data];
+    }
+}
+
 - (nullable id)addHandlersForProgress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                             completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock {
     SDCallbacksDictionary *callbacks = [NSMutableDictionary new];
@@ -116,10 +278,63 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
     UNLOCK(self.callbacksLock);
     if (shouldCancel) {
         [self cancel];
+    } else {
+        // The token may have held the highest priority
+        [self updatePriority];
     }
     return shouldCancel;
 }
 
+- (void)setPriority:(SDWebImageDownloaderPriority)priority forToken:(nullable id)token {
+    LOCK(self.callbacksLock);
+    NSUInteger index = [self.callbackBlocks indexOfObjectIdenticalTo:token];
+    if (index != NSNotFound) {
+        self.callbackBlocks[index][kPriorityCallbackKey] = @(priority);
+    }
+    UNLOCK(self.callbacksLock);
+    if (index != NSNotFound) {
+        [self updatePriority];
+    }
+}
+
+- (SDWebImageDownloaderPriority)priority {
+    // 没有设置过优先级的回调使用选项中的优先级
+    SDWebImageDownloaderPriority optionsPriority = SDWebImageDownloaderPriorityDefault;
+    if (self.options & SDWebImageDownloaderHighPriority) {
+        optionsPriority = SDWebImageDownloaderPriorityHigh;
+    } else if (self.options & SDWebImageDownloaderLowPriority) {
+        optionsPriority = SDWebImageDownloaderPriorityLow;
+    }
+    BOOL hasCallbacks = NO;
+    SDWebImageDownloaderPriority priority = SDWebImageDownloaderPriorityLow;
+    LOCK(self.callbacksLock);
+    for (SDCallbacksDictionary *callbacks in self.callbackBlocks) {
+        NSNumber *callbacksPriority = callbacks[kPriorityCallbackKey];
+        priority = MAX(priority, callbacksPriority ? callbacksPriority.integerValue : optionsPriority);
+        hasCallbacks = YES;
+    }
+    UNLOCK(self.callbacksLock);
+    return hasCallbacks ? priority : optionsPriority;
+}
+
+- (void)updatePriority {
+    SDWebImageDownloaderPriority priority = self.priority;
+    if (priority == SDWebImageDownloaderPriorityHigh) {
+        self.queuePriority = NSOperationQueuePriorityHigh;
+    } else if (priority == SDWebImageDownloaderPriorityLow) {
+        self.queuePriority = NSOperationQueuePriorityLow;
+    } else {
+        self.queuePriority = NSOperationQueuePriorityNormal;
+    }
+    NSURLSessionTask *dataTask = self.dataTask;
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunguarded-availability"
+    if ([dataTask respondsToSelector:@selector(setPriority:)]) {
+        dataTask.priority = SDURLSessionTaskPriority(priority);
+    }
+#pragma clang diagnostic pop
+}
+
 - (void)start {
     @synchronized (self) {
         if (self.isCancelled) {
@@ -178,7 +393,7 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
             }
         }
         
-        self.dataTask = [session dataTaskWithRequest:self.request];
+        self.dataTask = [session dataTaskWithRequest:[self requestResumingPartialDownload]];
         self.executing = YES;
     }
 
@@ -186,11 +401,8 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunguarded-availability"
         if ([self.dataTask respondsToSelector:@selector(setPriority:)]) {
-            if (self.options & SDWebImageDownloaderHighPriority) {
-                self.dataTask.priority = NSURLSessionTaskPriorityHigh;
-            } else if (self.options & SDWebImageDownloaderLowPriority) {
-                self.dataTask.priority = NSURLSessionTaskPriorityLow;
-            }
+            // 优先级可能在等待期间被token修改过
+            self.dataTask.priority = SDURLSessionTaskPriority(self.priority);
         }
 #pragma clang diagnostic pop
         [self.dataTask resume];
@@ -232,6 +444,8 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
 
     if (self.dataTask) {
         [self.dataTask cancel];
+        // Keep what was received for the next request
+        [self savePartialDownload];
         __weak typeof(self) weakSelf = self;
         dispatch_async(dispatch_get_main_queue(), ^{
             [[NSNotificationCenter defaultCenter] postNotificationName:SDWebImageDownloadStopNotification object:weakSelf];
@@ -257,6 +471,9 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
     [self.callbackBlocks removeAllObjects];
     UNLOCK(self.callbacksLock);
     self.dataTask = nil;
+    // Nothing to keep from a cancelled or failed download, the completed file was already handed to the data
+    [self closeStreamFile];
+    [self releasePartialDownload];
     
     if (self.ownedSession) {
         [self.ownedSession invalidateAndCancel];
@@ -289,10 +506,24 @@ didReceiveResponse:(NSURLResponse *)response
     NSURLSessionResponseDisposition disposition = NSURLSessionResponseAllow;
     NSInteger expected = (NSInteger)response.expectedContentLength;
     expected = expected > 0 ? expected : 0;
-    self.expectedSize = expected;
     self.response = response;
     NSInteger statusCode = [response respondsToSelector:@selector(statusCode)] ? ((NSHTTPURLResponse *)response).statusCode : 200;
     BOOL valid = statusCode < 400;
+    if (self.partialFilePath && ![self resumePartialDownloadWithResponse:response statusCode:statusCode]) {
+        // The saved bytes are stale, ask for the whole image instead of failing
+        if ([self restartDownloadWithoutPartialDataInSession:session]) {
+            if (completionHandler) {
+                completionHandler(NSURLSessionResponseCancel);
+            }
+            return;
+        }
+        valid = NO;
+    }
+    if (self.resumeOffset > 0) {
+        // `expectedContentLength` is what remains
+        expected = expected > 0 ? expected + self.resumeOffset : 0;
+    }
+    self.expectedSize = expected;
     //'304 Not Modified' is an exceptional one. It should be treated as cancelled if no cache data
     //URLSession current behavior will return 200 status code when the server respond 304 and URLCache hit. But this is not a standard behavior and we just add a check
     if (statusCode == 304 && !self.cachedData) {
@@ -301,7 +532,7 @@ didReceiveResponse:(NSURLResponse *)response
     
     if (valid) {
         for (SDWebImageDownloaderProgressBlock progressBlock in [self callbacksForKey:kProgressCallbackKey]) {
-            progressBlock(0, expected, self.request.URL);
+            progressBlock(self.receivedSize, expected, self.request.URL);
         }
     } else {
         // Status code invalid and marked as cancelled. Do not call `[self.dataTask cancel]` which may mass up URLSession life cycle
@@ -319,52 +550,496 @@ didReceiveResponse:(NSURLResponse *)response
 }
 
 - (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
-    if (!self.imageData) {
-        self.imageData = [[NSMutableData alloc] initWithCapacity:self.expectedSize];
+    if (self.cancelError || self.isCancelled || self.isFinished) {
+        // The task is being cancelled, or a late chunk arrived after the operation was done
+        return;
+    }
+    dispatch_data_t chunk = SDDispatchDataWithData(data);
+    self.receivedSize += dispatch_data_get_size(chunk);
+    BOOL streamToDisk = self.options & SDWebImageDownloaderStreamToDisk;
+    if (streamToDisk && ![self writeStreamData:chunk]) {
+        self.cancelError = [NSError errorWithDomain:SDWebImageErrorDomain code:SDWebImageDownloaderErrorCodeCannotWriteFile userInfo:@{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Can not write the download to disk: %s", strerror(errno)]}];
+        [self.dataTask cancel];
+        return;
+    }
+    if (!streamToDisk || !self.imageHeaderProbed) {
+        // Streamed downloads keep the prefix in memory until the header is parsed
+        self.imageData = self.imageData ? dispatch_data_create_concat(self.imageData, chunk) : chunk;
+    }
+    
+    if (!self.imageHeaderProbed) {
+        [self probeImageHeader];
+        if (self.cancelError) {
+            return;
+        }
+        if (streamToDisk && self.imageHeaderProbed) {
+            self.imageData = nil;
+        }
     }
-    [self.imageData appendData:data];
 
-    if ((self.options & SDWebImageDownloaderProgressiveDownload) && self.expectedSize > 0) {
-        // Get the image data
-        __block NSData *imageData = [self.imageData copy];
+    if ((self.options & SDWebImageDownloaderProgressiveDownload) && !streamToDisk && self.expectedSize > 0) {
         // Get the total bytes downloaded
-        const NSInteger totalSize = imageData.length;
+        const NSUInteger totalSize = dispatch_data_get_size(self.imageData);
         // Get the finish status
         BOOL finished = (totalSize >= self.expectedSize);
         
         if (!self.progressiveCoder) {
             // We need to create a new instance for progressive decoding to avoid conflicts
-            for (id<SDWebImageCoder>coder in [SDWebImageCodersManager sharedInstance].coders) {
-                if ([coder conformsToProtocol:@protocol(SDWebImageProgressiveCoder)] &&
-                    [((id<SDWebImageProgressiveCoder>)coder) canIncrementallyDecodeFromData:imageData]) {
-                    self.progressiveCoder = [[[coder class] alloc] init];
-                    break;
-                }
+            id<SDWebImageProgressiveCoder> coder = [[SDWebImageCodersManager sharedInstance] progressiveCoderForData:(NSData *)self.imageData format:NULL];
+            if (coder) {
+                self.progressiveCoder = [[[coder class] alloc] init];
+                self.progressiveDataOffset = 0;
             }
         }
-        
-        // progressive decode the image in coder queue
-        dispatch_async(self.coderQueue, ^{
-            UIImage *image = [self.progressiveCoder incrementallyDecodedImageWithData:imageData finished:finished];
-            if (image) {
-                NSString *key = [[SDWebImageManager sharedManager] cacheKeyForURL:self.request.URL];
-                image = [self scaledImageForKey:key image:image];
-                if (self.shouldDecompressImages) {
-                    image = [[SDWebImageCodersManager sharedInstance] decompressedImageWithImage:image data:&imageData options:@{SDWebImageCoderScaleDownLargeImagesKey: @(NO)}];
+        if (self.progressiveCoder && [self shouldScheduleProgressiveDecodeWithTotalSize:totalSize finished:finished]) {
+            [self scheduleProgressiveDecodeWithData:data totalSize:totalSize finished:finished];
+        }
+    }
+
+    for (SDWebImageDownloaderProgressBlock progressBlock in [self callbacksForKey:kProgressCallbackKey]) {
+        progressBlock(self.receivedSize, self.expectedSize, self.request.URL);
+    }
+}
+
+#pragma mark Resuming Downloads
+
+// Add `Range` and `If-Range` for the bytes saved by a previous request, and claim the partial download so no other operation writes it
+- (NSURLRequest *)requestResumingPartialDownload {
+    if (!(self.options & SDWebImageDownloaderResumeIncompleteDownloads) || !self.request.URL) {
+        return self.request;
+    }
+    NSString *path = SDPartialDownloadPath(self.streamToDiskDirectory ?: NSTemporaryDirectory(), self.request.URL);
+    NSMutableSet<NSString *> *claimedPaths = SDClaimedPartialDownloads();
+    @synchronized (claimedPaths) {
+        if ([claimedPaths containsObject:path]) {
+            // The same URL is downloaded by another operation, with other decode options
+            return self.request;
+        }
+        [claimedPaths addObject:path];
+    }
+    self.partialFilePath = path;
+    
+    NSDictionary *info = [NSDictionary dictionaryWithContentsOfFile:[path stringByAppendingPathExtension:@"plist"]];
+    NSString *validator = info[@"validator"];
+    unsigned long long length = [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil] fileSize];
+    if (![validator isKindOfClass:[NSString class]] || ![info[@"url"] isEqual:self.request.URL.absoluteString] || length == 0) {
+        return self.request;
+    }
+    self.resumeOffset = (NSUInteger)length;
+    NSMutableURLRequest *request = [self.request mutableCopy];
+    [request setValue:[NSString stringWithFormat:@"bytes=%llu-", length] forHTTPHeaderField:@"Range"];
+    [request setValue:validator forHTTPHeaderField:@"If-Range"];
+    // A cached full response would not be spliced
+    request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+    return request;
+}
+
+// Splice the saved bytes in front of a matching 206 response. Return NO if the response is a range which does not continue them, or rejects the range.
+- (BOOL)resumePartialDownloadWithResponse:(NSURLResponse *)response statusCode:(NSInteger)statusCode {
+    NSDictionary *headers = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).allHeaderFields : nil;
+    // `If-Range` needs a strong validator
+    NSString *ETag = headers[@"ETag"];
+    self.responseValidator = (ETag && ![ETag hasPrefix:@"W/"]) ? ETag : headers[@"Last-Modified"];
+    if (self.resumeOffset == 0) {
+        return YES;
+    }
+    
+    unsigned long long rangeStart = 0;
+    NSScanner *scanner = [NSScanner scannerWithString:headers[@"Content-Range"] ?: @""];
+    BOOL continuesPartial = statusCode == 206
+        && [scanner scanString:@"bytes" intoString:NULL]
+        && [scanner scanUnsignedLongLong:&rangeStart]
+        && rangeStart == self.resumeOffset;
+    NSData *partialData = continuesPartial ? [NSData dataWithContentsOfFile:self.partialFilePath options:NSDataReadingMappedIfSafe error:nil] : nil;
+    if (partialData.length != self.resumeOffset) {
+        // The server sent the whole body because the image changed or it ignores ranges, or the saved bytes are gone
+        self.resumeOffset = 0;
+        self.partialFileStale = YES;
+        // 416 answers a range past the end of an image which changed
+        return statusCode != 206 && statusCode != 416;
+    }
+    
+    self.imageData = SDDispatchDataWithData(partialData);
+    self.receivedSize = partialData.length;
+    if (self.options & SDWebImageDownloaderStreamToDisk) {
+        // Keep appending to the partial file, it becomes the completed file
+        @synchronized (self) {
+            int fd = open(self.partialFilePath.fileSystemRepresentation, O_WRONLY | O_APPEND | O_CLOEXEC);
+            if (fd >= 0) {
+                self.streamFilePath = self.partialFilePath;
+                self.streamFileDescriptor = fd;
+            }
+        }
+        if (self.streamFileDescriptor < 0) {
+            self.partialFileStale = YES;
+            return NO;
+        }
+    }
+    return YES;
+}
+
+// Drop the stale partial download and send the request again without `Range`, replacing the task which got the stale response. Return NO if the operation is done or no task could be created.
+- (BOOL)restartDownloadWithoutPartialDataInSession:(NSURLSession *)session {
+    SDRemovePartialDownload(self.partialFilePath);
+    self.partialFileStale = NO;
+    self.resumeOffset = 0;
+    self.receivedSize = 0;
+    self.imageData = nil;
+    self.imageHeaderProbedLength = 0;
+    @synchronized (self) {
+        if (self.isCancelled || !self.dataTask || !session) {
+            return NO;
+        }
+        NSURLSessionTask *dataTask = [session dataTaskWithRequest:self.request];
+        if (!dataTask) {
+            return NO;
+        }
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunguarded-availability"
+        if ([dataTask respondsToSelector:@selector(setPriority:)]) {
+            dataTask.priority = SDURLSessionTaskPriority(self.priority);
+        }
+#pragma clang diagnostic pop
+        self.dataTask = dataTask;
+        [dataTask resume];
+    }
+    return YES;
+}
+
+// Save the bytes received so far with the validator of the response, so the next request for the URL continues them
+- (void)savePartialDownload {
+    NSString *path = self.partialFilePath;
+    if (!path) {
+        return;
+    }
+    NSString *validator = self.responseValidator;
+    if (!validator || self.receivedSize == 0 || self.cancelError) {
+        if (self.partialFileStale || self.cancelError) {
+            SDRemovePartialDownload(path);
+        }
+        return;
+    }
+    NSDictionary *info = @{@"url" : self.request.URL.absoluteString, @"validator" : validator};
+    NSString *directory = path.stringByDeletingLastPathComponent;
+    NSUInteger maxBytes = self.maxPartialDownloadsSize;
+    @synchronized (self) {
+        if (self.streamFileDescriptor >= 0) {
+            // The streamed file already holds the bytes, move it in place
+            close(self.streamFileDescriptor);
+            self.streamFileDescriptor = -1;
+            if (![self.streamFilePath isEqualToString:path]) {
+                rename(self.streamFilePath.fileSystemRepresentation, path.fileSystemRepresentation);
+            }
+            self.streamFilePath = nil;
+            [info writeToFile:[path stringByAppendingPathExtension:@"plist"] atomically:YES];
+            SDTrimPartialDownloads(directory, maxBytes);
+            return;
+        }
+    }
+    
+    // Write the received data off the calling thread, the partial download stays claimed until it is written
+    dispatch_data_t data = self.imageData;
+    if (!data) {
+        return;
+    }
+    self.partialFilePath = nil;
+    NSMutableSet<NSString *> *claimedPaths = SDClaimedPartialDownloads();
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        NSString *temporaryPath = [path stringByAppendingPathExtension:@"saving"];
+        int fd = open(temporaryPath.fileSystemRepresentation, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        __block BOOL success = fd >= 0;
+        if (success) {
+            dispatch_data_apply(data, ^bool(dispatch_data_t region, size_t offset, const void *buffer, size_t size) {
+                success = write(fd, buffer, size) == (ssize_t)size;
+                return success;
+            });
+            close(fd);
+        }
+        // Release the claim with the info written, so a request which finds the info can resume from it
+        @synchronized (claimedPaths) {
+            [claimedPaths removeObject:path];
+            if (success && rename(temporaryPath.fileSystemRepresentation, path.fileSystemRepresentation) == 0) {
+                [info writeToFile:[path stringByAppendingPathExtension:@"plist"] atomically:YES];
+                SDTrimPartialDownloads(directory, maxBytes);
+            } else {
+                unlink(temporaryPath.fileSystemRepresentation);
+            }
+        }
+    });
+}
+
+// The download completed, the saved bytes are part of the image data now
+- (void)removePartialDownload {
+    if (self.partialFilePath) {
+        // A streamed resume was appended to the partial file, which now belongs to the image data
+        if (![self.partialFilePath isEqualToString:self.streamFilePath]) {
+            unlink(self.partialFilePath.fileSystemRepresentation);
+        }
+        unlink([self.partialFilePath stringByAppendingPathExtension:@"plist"].fileSystemRepresentation);
+    }
+}
+
+- (void)releasePartialDownload {
+    NSString *path = self.partialFilePath;
+    if (!path) {
+        return;
+    }
+    self.partialFilePath = nil;
+    NSMutableSet<NSString *> *claimedPaths = SDClaimedPartialDownloads();
+    @synchronized (claimedPaths) {
+        [claimedPaths removeObject:path];
+    }
+}
+
+#pragma mark Stream To Disk
+
+// Append the chunk to the temporary file, creating it on the first chunk
+- (BOOL)writeStreamData:(dispatch_data_t)data {
+    @synchronized (self) {
+        if (self.isCancelled || self.isFinished) {
+            // The file was closed and removed when the operation was cancelled or completed, do not open a new one nothing removes
+            return YES;
+        }
+        if (self.streamFileDescriptor < 0) {
+            NSString *directory = self.streamToDiskDirectory ?: NSTemporaryDirectory();
+            [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+            NSString *path = [directory stringByAppendingPathComponent:[NSString stringWithFormat:@"%@.download", [NSUUID UUID].UUIDString]];
+            int fd = open(path.fileSystemRepresentation, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                return NO;
+            }
+            self.streamFilePath = path;
+            self.streamFileDescriptor = fd;
+        }
+        int fd = self.streamFileDescriptor;
+        __block BOOL success = YES;
+        dispatch_data_apply(data, ^bool(dispatch_data_t region, size_t offset, const void *buffer, size_t size) {
+            while (size > 0) {
+                ssize_t written = write(fd, buffer, size);
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    success = NO;
+                    return false;
                 }
-                
-                // We do not keep the progressive decoding image even when `finished`=YES. Because they are for view rendering but not take full function from downloader options. And some coders implementation may not keep consistent between progressive decoding and normal decoding.
-                
-                [self callCompletionBlocksWithImage:image imageData:nil error:nil finished:NO];
+                buffer = (const uint8_t *)buffer + written;
+                size -= written;
             }
+            return true;
         });
+        return success;
     }
+}
 
-    for (SDWebImageDownloaderProgressBlock progressBlock in [self callbacksForKey:kProgressCallbackKey]) {
-        progressBlock(self.imageData.length, self.expectedSize, self.request.URL);
+// Close and remove the temporary file, if the download did not complete
+- (void)closeStreamFile {
+    @synchronized (self) {
+        if (self.streamFileDescriptor >= 0) {
+            close(self.streamFileDescriptor);
+            self.streamFileDescriptor = -1;
+        }
+        if (self.streamFilePath) {
+            unlink(self.streamFilePath.fileSystemRepresentation);
+            self.streamFilePath = nil;
+        }
+    }
+}
+
+// Close the completed file and map it. The data owns the file from then on, it is removed when the data is released unless it was moved, see `fileURLForDownloadedData:`.
+- (nullable NSData *)finishStreamFile {
+    @synchronized (self) {
+        NSString *path = self.streamFilePath;
+        int fd = self.streamFileDescriptor;
+        if (!path || fd < 0) {
+            return nil;
+        }
+        self.streamFilePath = nil;
+        self.streamFileDescriptor = -1;
+        off_t length = lseek(fd, 0, SEEK_END);
+        void *bytes = length > 0 ? mmap(NULL, (size_t)length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (bytes == MAP_FAILED) {
+            unlink(path.fileSystemRepresentation);
+            return nil;
+        }
+        NSData *data = [[NSData alloc] initWithBytesNoCopy:bytes length:(NSUInteger)length deallocator:^(void *bytes, NSUInteger length) {
+            munmap(bytes, length);
+            // Fails harmlessly when the file was moved into the cache
+            unlink(path.fileSystemRepresentation);
+        }];
+        NSMapTable<NSData *, NSURL *> *fileURLs = SDStreamedDataFileURLs();
+        @synchronized (fileURLs) {
+            [fileURLs setObject:[NSURL fileURLWithPath:path] forKey:data];
+        }
+        return data;
     }
 }
 
+#pragma mark Image Size Limits
+
+// Parse the image size from the first bytes, publish it, and cancel the task before the rest is downloaded if the image is over the limits
+- (void)probeImageHeader {
+    // Only the prefix needs to be contiguous, it is usually the first chunk
+    size_t length = dispatch_data_get_size(self.imageData);
+    // A header spread over many chunks is parsed again only once the data doubled, so the prefix is not flattened for each chunk
+    if (length < kImageHeaderProbeMaxBytes && length < self.imageHeaderProbedLength * 2) {
+        return;
+    }
+    self.imageHeaderProbedLength = length;
+    NSUInteger copiedBytes = 0;
+    NSData *prefix = (NSData *)SDDispatchDataCreateContiguous(dispatch_data_create_subrange(self.imageData, 0, MIN(length, kImageHeaderProbeMaxBytes)), &copiedBytes);
+    self.receivedDataCopiedBytes += copiedBytes;
+    SDImageHeaderInfo headerInfo;
+    SDImageHeaderStatus status = SDImageHeaderParse(prefix.bytes, prefix.length, &headerInfo);
+    if (status == SDImageHeaderStatusNeedMoreData && length < kImageHeaderProbeMaxBytes) {
+        return;
+    }
+    self.imageHeaderProbed = YES;
+    if (status != SDImageHeaderStatusOK) {
+        return;
+    }
+    
+    self.imagePixelSize = CGSizeMake(headerInfo.width, headerInfo.height);
+    self.imageEstimatedBytes = [SDWebImageDecodeScheduler estimatedDecodedBytesForData:prefix options:self.decodeOptions];
+    __weak typeof(self) weakSelf = self;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [[NSNotificationCenter defaultCenter] postNotificationName:SDWebImageDownloadReceiveImageSizeNotification object:weakSelf];
+    });
+    
+    NSError *error = [self imageLimitErrorWithData:prefix headerInfo:headerInfo];
+    if (error) {
+        // `URLSession:task:didCompleteWithError:` reports this error instead of the cancellation
+        self.cancelError = error;
+        [self.dataTask cancel];
+    }
+}
+
+// Return an error if the image is over one of the limits, or nil
+- (nullable NSError *)imageLimitErrorWithData:(nonnull NSData *)data headerInfo:(SDImageHeaderInfo)headerInfo {
+    NSString *reason = nil;
+    uint64_t pixels = (uint64_t)headerInfo.width * headerInfo.height;
+    if (self.maxImagePixels > 0 && pixels > self.maxImagePixels) {
+        reason = [NSString stringWithFormat:@"%ux%u pixels, the limit is %lu pixels", headerInfo.width, headerInfo.height, (unsigned long)self.maxImagePixels];
+    } else if (self.maxImageFrameCount > 0 && headerInfo.frameCount > self.maxImageFrameCount) {
+        reason = [NSString stringWithFormat:@"%u frames, the limit is %lu frames", headerInfo.frameCount, (unsigned long)self.maxImageFrameCount];
+    } else if (self.maxImageBytes > 0 && !(headerInfo.frameCount <= 1 && (self.options & SDWebImageDownloaderScaleDownLargeImages))) {
+        NSUInteger bytes = [SDWebImageDecodeScheduler estimatedDecodedBytesForData:data options:self.decodeOptions];
+        if (bytes > self.maxImageBytes) {
+            reason = [NSString stringWithFormat:@"%lu bytes once decoded, the limit is %lu bytes", (unsigned long)bytes, (unsigned long)self.maxImageBytes];
+        }
+    }
+    if (!reason) {
+        return nil;
+    }
+    NSString *description = [NSString stringWithFormat:@"Image is too large: %@", reason];
+    return [NSError errorWithDomain:SDWebImageErrorDomain code:SDWebImageDownloaderErrorCodeImageTooLarge userInfo:@{NSLocalizedDescriptionKey : description}];
+}
+
+// Check the limits again on the complete data, for the images which could not be probed early and the frames counted since
+- (nullable NSError *)imageLimitErrorWithData:(nonnull NSData *)data {
+    if (self.maxImagePixels == 0 && self.maxImageBytes == 0 && self.maxImageFrameCount == 0) {
+        return nil;
+    }
+    SDImageHeaderInfo headerInfo;
+    if (SDImageHeaderParse(data.bytes, data.length, &headerInfo) != SDImageHeaderStatusOK) {
+        return nil;
+    }
+    return [self imageLimitErrorWithData:data headerInfo:headerInfo];
+}
+
+#pragma mark Progressive Decoding
+
+// Coalesce the partial decodes: decode when enough new bytes arrived or the render deadline passed, and never queue a decode behind a pending one
+- (BOOL)shouldScheduleProgressiveDecodeWithTotalSize:(NSUInteger)totalSize finished:(BOOL)finished {
+    if (finished) {
+        // The last partial image is always rendered
+        return YES;
+    }
+    CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - self.lastProgressiveDecodeTime;
+    NSUInteger newBytes = totalSize - self.lastProgressiveDecodeSize;
+    BOOL shouldDecode = !self.progressiveDecoding
+                        && elapsed >= self.progressiveDecodeMinimumInterval
+                        && (newBytes >= self.progressiveDecodeMinimumBytes || elapsed >= self.progressiveDecodeMaximumInterval);
+    if (!shouldDecode) {
+        self.progressiveDecodeSkippedCount++;
+    }
+    return shouldDecode;
+}
+
+- (void)scheduleProgressiveDecodeWithData:(NSData *)data totalSize:(NSUInteger)totalSize finished:(BOOL)finished {
+    id<SDWebImageProgressiveCoder> progressiveCoder = self.progressiveCoder;
+    self.progressiveDecoding = YES;
+    self.lastProgressiveDecodeTime = CFAbsoluteTimeGetCurrent();
+    self.lastProgressiveDecodeSize = totalSize;
+    self.progressiveDecodeCount++;
+    
+    // Coders which take the appended bytes only get the bytes since the last decode, the others get all the data so far. The received data is immutable, so neither is copied.
+    __block NSData *imageData;
+    if ([progressiveCoder respondsToSelector:@selector(incrementallyDecodedImageWithAppendedData:finished:)]) {
+        NSUInteger offset = self.progressiveDataOffset;
+        if (offset + data.length == totalSize) {
+            imageData = data;
+        } else {
+            // Skipped decodes, or the coder was created after the first chunks
+            imageData = (NSData *)dispatch_data_create_subrange(self.imageData, offset, totalSize - offset);
+        }
+        self.progressiveDataOffset = totalSize;
+    } else {
+        imageData = (NSData *)self.imageData;
+    }
+    
+    // progressive decode the image on the decode scheduler, charged with the estimate of the header, as estimating from the data would flatten it. Until the header is parsed, assume the whole image with a typical compression ratio.
+    NSUInteger estimatedBytes = self.imageEstimatedBytes ?: [SDWebImageDecodeScheduler estimatedDecodedBytesForDataLength:MAX(self.expectedSize, totalSize)];
+    [self scheduleDecodeWithEstimatedBytes:estimatedBytes block:^{
+        UIImage *image;
+        if ([progressiveCoder respondsToSelector:@selector(incrementallyDecodedImageWithAppendedData:finished:)]) {
+            image = [progressiveCoder incrementallyDecodedImageWithAppendedData:imageData finished:finished];
+        } else {
+            image = [progressiveCoder incrementallyDecodedImageWithData:imageData finished:finished];
+        }
+        if (image) {
+            NSString *key = [[SDWebImageManager sharedManager] cacheKeyForURL:self.request.URL];
+            image = [self scaledImageForKey:key image:image];
+            if (self.shouldDecompressImages) {
+                // The progressive coder decoded the image, so it decompresses it too, `imageData` may be only the last chunk
+                image = [progressiveCoder decompressedImageWithImage:image data:&imageData options:[SDWebImageCoderHelper decompressionOptionsWithDecodeOptions:self.decodeOptions scaleDownLargeImages:NO]];
+            }
+            
+            // We do not keep the progressive decoding image even when `finished`=YES. Because they are for view rendering but not take full function from downloader options. And some coders implementation may not keep consistent between progressive decoding and normal decoding.
+            
+            [self callCompletionBlocksWithImage:image imageData:nil error:nil finished:NO];
+        }
+        self.progressiveDecoding = NO;
+    }];
+}
+
+// Run a decode on the shared decode scheduler. The coder queue is suspended until the decode finishes, so the decodes of this operation stay in order and never run at the same time. The decode is skipped if the operation is cancelled before it starts.
+- (void)scheduleDecodeWithEstimatedBytes:(NSUInteger)estimatedBytes block:(dispatch_block_t)block {
+    SDWebImageDecodePriority priority = SDWebImageDecodePriorityDefault;
+    if (self.options & SDWebImageDownloaderHighPriority) {
+        priority = SDWebImageDecodePriorityHigh;
+    } else if (self.options & SDWebImageDownloaderLowPriority) {
+        priority = SDWebImageDecodePriorityLow;
+    }
+    dispatch_queue_t coderQueue = self.coderQueue;
+    dispatch_async(coderQueue, ^{
+        dispatch_suspend(coderQueue);
+        [[SDWebImageDecodeScheduler sharedScheduler] scheduleDecodeWithEstimatedBytes:estimatedBytes priority:priority block:^{
+            if (self.isCancelled) {
+                // Nobody waits for the image anymore. A download cancelled after its task completed is finished here instead of by the decode
+                self.progressiveDecoding = NO;
+                if (!self.isFinished) {
+                    [self done];
+                }
+            } else {
+                block();
+            }
+            dispatch_resume(coderQueue);
+        }];
+    });
+}
+
 - (void)URLSession:(NSURLSession *)session
           dataTask:(NSURLSessionDataTask *)dataTask
  willCacheResponse:(NSCachedURLResponse *)proposedResponse
@@ -385,6 +1060,10 @@ didReceiveResponse:(NSURLResponse *)response
 
 - (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error {
     @synchronized(self) {
+        if (self.dataTask && task != self.dataTask) {
+            // A task replaced after a stale resume, the new one reports the result
+            return;
+        }
         self.dataTask = nil;
         __weak typeof(self) weakSelf = self;
         dispatch_async(dispatch_get_main_queue(), ^{
@@ -395,28 +1074,56 @@ didReceiveResponse:(NSURLResponse *)response
         });
     }
     
+    if (error && self.cancelError) {
+        // The operation cancelled the task itself, report why
+        error = self.cancelError;
+    }
+    
     // make sure to call `[self done]` to mark operation as finished
     if (error) {
+        [self savePartialDownload];
         [self callCompletionBlocksWithError:error];
         [self done];
     } else {
+        [self removePartialDownload];
         if ([self callbacksForKey:kCompletedCallbackKey].count > 0) {
             /**
              *  If you specified to use `NSURLCache`, then the response you get here is what you need.
              */
-            __block NSData *imageData = [self.imageData copy];
+            // The coders need contiguous bytes, flatten the chunks once and share the result with the cache. Streamed downloads are mapped from their file.
+            __block NSData *imageData;
+            if (self.options & SDWebImageDownloaderStreamToDisk) {
+                imageData = [self finishStreamFile];
+            } else if (self.imageData) {
+                NSUInteger copiedBytes = 0;
+                imageData = (NSData *)SDDispatchDataCreateContiguous(self.imageData, &copiedBytes);
+                self.receivedDataCopiedBytes += copiedBytes;
+            }
             if (imageData) {
                 /**  if you specified to only use cached data via `SDWebImageDownloaderIgnoreCachedResponse`,
                  *  then we should check if the cached data is equal to image data
                  */
+                NSError *limitError;
                 if (self.options & SDWebImageDownloaderIgnoreCachedResponse && [self.cachedData isEqualToData:imageData]) {
                     // call completion block with nil
                     [self callCompletionBlocksWithImage:nil imageData:nil error:nil finished:YES];
                     [self done];
+                } else if ((limitError = [self imageLimitErrorWithData:imageData])) {
+                    [self callCompletionBlocksWithError:limitError];
+                    [self done];
                 } else {
-                    // decode the image in coder queue
-                    dispatch_async(self.coderQueue, ^{
-                        UIImage *image = [[SDWebImageCodersManager sharedInstance] decodedImageWithData:imageData];
+                    // decode the image on the decode scheduler
+                    NSUInteger estimatedBytes = [SDWebImageDecodeScheduler estimatedDecodedBytesForData:imageData options:self.decodeOptions];
+                    [self scheduleDecodeWithEstimatedBytes:estimatedBytes block:^{
+                        // Sniff the data only once, and use the chosen coder for both decoding and decompressing
+                        SDImageFormat imageFormat = SDImageFormatUndefined;
+                        id<SDWebImageCoder> coder = [[SDWebImageCodersManager sharedInstance] coderForDecodingData:imageData format:&imageFormat];
+                        UIImage *image;
+                        if (self.decodeOptions && [coder respondsToSelector:@selector(decodedImageWithData:options:)]) {
+                            image = [coder decodedImageWithData:imageData options:self.decodeOptions];
+                        } else {
+                            image = [coder decodedImageWithData:imageData];
+                        }
                         NSString *key = [[SDWebImageManager sharedManager] cacheKeyForURL:self.request.URL];
                         image = [self scaledImageForKey:key image:image];
                         
@@ -426,7 +1133,6 @@ didReceiveResponse:(NSURLResponse *)response
                             shouldDecode = NO;
                         } else {
 #ifdef SD_WEBP
-                            SDImageFormat imageFormat = [NSData sd_imageFormatForImageData:imageData];
                             if (imageFormat == SDImageFormatWebP) {
                                 shouldDecode = NO;
                             }
@@ -436,7 +1142,7 @@ didReceiveResponse:(NSURLResponse *)response
                         if (shouldDecode) {
                             if (self.shouldDecompressImages) {
                                 BOOL shouldScaleDown = self.options & SDWebImageDownloaderScaleDownLargeImages;
-                                image = [[SDWebImageCodersManager sharedInstance] decompressedImageWithImage:image data:&imageData options:@{SDWebImageCoderScaleDownLargeImagesKey: @(shouldScaleDown)}];
+                                image = [coder decompressedImageWithImage:image data:&imageData options:[SDWebImageCoderHelper decompressionOptionsWithDecodeOptions:self.decodeOptions scaleDownLargeImages:shouldScaleDown]];
                             }
                         }
                         CGSize imageSize = image.size;
@@ -446,7 +1152,7 @@ didReceiveResponse:(NSURLResponse *)response
                             [self callCompletionBlocksWithImage:image imageData:imageData error:nil finished:YES];
                         }
                         [self done];
-                    });
+                    }];
                 }
             } else {
                 [self callCompletionBlocksWithError:[NSError errorWithDomain:SDWebImageErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : @"Image data is nil"}]];
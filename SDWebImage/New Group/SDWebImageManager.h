@@ -113,7 +113,18 @@ typedef NS_OPTIONS(NSUInteger, SDWebImageOptions) {
     /**
      *默认情况下，当您使用“SDWebImageTransition”来完成图像加载完成后的一些视图转换时，该转换仅适用于从网络下载的图像。这个掩码可以强制应用视图转换来实现内存和磁盘缓存。
      */
-    SDWebImageForceTransition = 1 << 16
+    SDWebImageForceTransition = 1 << 16,
+    
+    /**
+     * 下载时把数据直接写入磁盘缓存目录中的临时文件，而不是保存在内存中，完成后从文件映射数据解码，并把文件直接移动到磁盘缓存中，不再写一次。适合大图像。
+     * 参见 `SDWebImageDownloaderStreamToDisk`，这个选项下不支持渐进式下载。
+     */
+    SDWebImageStreamToDisk = 1 << 17,
+    
+    /**
+     * 下载失败或取消时保存已收到的数据，下次下载时只请求剩下的部分。参见 `SDWebImageDownloaderResumeIncompleteDownloads`。
+     */
+    SDWebImageResumeIncompleteDownloads = 1 << 18
 };
 
 typedef void(^SDExternalCompletionBlock)(UIImage * _Nullable image, NSError * _Nullable error, SDImageCacheType cacheType, NSURL * _Nullable imageURL);
@@ -240,6 +251,19 @@ SDWebImageManager.sharedManager.cacheKeyFilter = ^(NSURL * _Nullable url) {
                                              progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                             completed:(nullable SDInternalCompletionBlock)completedBlock;
 
+/**
+ * 在给定的URL上下载图像，并按解码选项解码，如果不存在缓存或返回缓存的版本。
+ * 如果解码选项包含 `SDWebImageCoderDecodeTargetPixelSizeKey`，图像直接以目标尺寸解码，不会先解码完整尺寸再缩放。
+ * 内存缓存按目标尺寸分别缓存，磁盘缓存仍然保存原始数据。
+ *
+ * @param decodeOptions 解码选项，参见 `SDWebImageCoder.h`
+ */
+- (nullable id <SDWebImageOperation>)loadImageWithURL:(nullable NSURL *)url
+                                              options:(SDWebImageOptions)options
+                                        decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions
+                                             progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                            completed:(nullable SDInternalCompletionBlock)completedBlock;
+
 /**
 *为给定的URL保存图像缓存。
  *
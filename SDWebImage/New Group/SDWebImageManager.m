@@ -8,6 +8,7 @@
 
 #import "SDWebImageManager.h"
 #import "NSImage+WebCache.h"
+#import "SDWebImageDownloaderOperation.h"
 #import <objc/message.h>
 
 @interface SDWebImageCombinedOperation : NSObject <SDWebImageOperation>
@@ -49,6 +50,10 @@
     if ((self = [super init])) {
         _imageCache = cache;
         _imageDownloader = downloader;
+        if (!downloader.streamToDiskDirectory) {
+            // Streamed downloads are written next to the disk cache, so the completed files can be moved into it
+            downloader.streamToDiskDirectory = cache.downloadingDiskCachePath;
+        }
         _failedURLs = [NSMutableSet new];
         _runningOperations = [NSMutableArray new];
     }
@@ -111,6 +116,14 @@
                                      options:(SDWebImageOptions)options
                                     progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                    completed:(nullable SDInternalCompletionBlock)completedBlock {
+    return [self loadImageWithURL:url options:options decodeOptions:nil progress:progressBlock completed:completedBlock];
+}
+
+- (id <SDWebImageOperation>)loadImageWithURL:(nullable NSURL *)url
+                                     options:(SDWebImageOptions)options
+                               decodeOptions:(nullable NSDictionary<NSString *, NSObject *> *)decodeOptions
+                                    progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                   completed:(nullable SDInternalCompletionBlock)completedBlock {
     // Invoking this method without a completedBlock is pointless
     NSAssert(completedBlock != nil, @"If you mean to prefetch the image, use -[SDWebImagePrefetcher prefetchURLs] instead");
 
@@ -149,9 +162,11 @@
     if (options & SDWebImageQueryDataWhenInMemory) cacheOptions |= SDImageCacheQueryDataWhenInMemory;
     if (options & SDWebImageQueryDiskSync) cacheOptions |= SDImageCacheQueryDiskSync;
     if (options & SDWebImageScaleDownLargeImages) cacheOptions |= SDImageCacheScaleDownLargeImages;
+    if (options & SDWebImageHighPriority) cacheOptions |= SDImageCacheHighPriority;
+    if (options & SDWebImageLowPriority) cacheOptions |= SDImageCacheLowPriority;
     
     __weak SDWebImageCombinedOperation *weakOperation = operation;
-    operation.cacheOperation = [self.imageCache queryCacheOperationForKey:key options:cacheOptions done:^(UIImage *cachedImage, NSData *cachedData, SDImageCacheType cacheType) {
+    operation.cacheOperation = [self.imageCache queryCacheOperationForKey:key options:cacheOptions decodeOptions:decodeOptions done:^(UIImage *cachedImage, NSData *cachedData, SDImageCacheType cacheType) {
         __strong __typeof(weakOperation) strongOperation = weakOperation;
         if (!strongOperation || strongOperation.isCancelled) {
             [self safelyRemoveOperationFromRunning:strongOperation];
@@ -179,6 +194,8 @@
             if (options & SDWebImageAllowInvalidSSLCertificates) downloaderOptions |= SDWebImageDownloaderAllowInvalidSSLCertificates;
             if (options & SDWebImageHighPriority) downloaderOptions |= SDWebImageDownloaderHighPriority;
             if (options & SDWebImageScaleDownLargeImages) downloaderOptions |= SDWebImageDownloaderScaleDownLargeImages;
+            if (options & SDWebImageStreamToDisk) downloaderOptions |= SDWebImageDownloaderStreamToDisk;
+            if (options & SDWebImageResumeIncompleteDownloads) downloaderOptions |= SDWebImageDownloaderResumeIncompleteDownloads;
             
             if (cachedImage && options & SDWebImageRefreshCached) {
                 // force progressive off if image already cached but forced refreshing
@@ -187,9 +204,17 @@
                 downloaderOptions |= SDWebImageDownloaderIgnoreCachedResponse;
             }
             
+            // Encoding images without data for the disk cache follows the request priority
+            NSOperationQueuePriority storePriority = NSOperationQueuePriorityNormal;
+            if (options & SDWebImageHighPriority) {
+                storePriority = NSOperationQueuePriorityHigh;
+            } else if (options & SDWebImageLowPriority) {
+                storePriority = NSOperationQueuePriorityLow;
+            }
+            
             // `SDWebImageCombinedOperation` -> `SDWebImageDownloadToken` -> `downloadOperationCancelToken`, which is a `SDCallbacksDictionary` and retain the completed block below, so we need weak-strong again to avoid retain cycle
             __weak typeof(strongOperation) weakSubOperation = strongOperation;
-            strongOperation.downloadToken = [self.imageDownloader downloadImageWithURL:url options:downloaderOptions progress:progressBlock completed:^(UIImage *downloadedImage, NSData *downloadedData, NSError *error, BOOL finished) {
+            strongOperation.downloadToken = [self.imageDownloader downloadImageWithURL:url options:downloaderOptions decodeOptions:decodeOptions progress:progressBlock completed:^(UIImage *downloadedImage, NSData *downloadedData, NSError *error, BOOL finished) {
                 __strong typeof(weakSubOperation) strongSubOperation = weakSubOperation;
                 if (!strongSubOperation || strongSubOperation.isCancelled) {
                     // Do nothing if the operation was cancelled
@@ -247,7 +272,7 @@
                                 } else {
                                     cacheData = (imageWasTransformed ? nil : downloadedData);
                                 }
-                                [self.imageCache storeImage:transformedImage imageData:cacheData forKey:key toDisk:cacheOnDisk completion:nil];
+                                [self.imageCache storeImage:transformedImage imageData:cacheData forKey:key decodeOptions:decodeOptions priority:storePriority toDisk:cacheOnDisk completion:nil];
                             }
                             
                             [self callCompletionBlockForOperation:strongSubOperation completion:completedBlock image:transformedImage data:downloadedData error:nil cacheType:SDImageCacheTypeNone finished:finished url:url];
@@ -257,10 +282,16 @@
                             if (self.cacheSerializer) {
                                 dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
                                     NSData *cacheData = self.cacheSerializer(downloadedImage, downloadedData, url);
-                                    [self.imageCache storeImage:downloadedImage imageData:cacheData forKey:key toDisk:cacheOnDisk completion:nil];
+                                    [self.imageCache storeImage:downloadedImage imageData:cacheData forKey:key decodeOptions:decodeOptions priority:storePriority toDisk:cacheOnDisk completion:nil];
                                 });
                             } else {
-                                [self.imageCache storeImage:downloadedImage imageData:downloadedData forKey:key toDisk:cacheOnDisk completion:nil];
+                                // Data streamed to disk is stored by moving its file
+                                NSURL *downloadedFileURL = [SDWebImageDownloaderOperation fileURLForDownloadedData:downloadedData];
+                                if (downloadedFileURL) {
+                                    [self.imageCache storeImage:downloadedImage imageData:downloadedData fileURL:downloadedFileURL forKey:key decodeOptions:decodeOptions toDisk:cacheOnDisk completion:nil];
+                                } else {
+                                    [self.imageCache storeImage:downloadedImage imageData:downloadedData forKey:key decodeOptions:decodeOptions priority:storePriority toDisk:cacheOnDisk completion:nil];
+                                }
                             }
                         }
                         [self callCompletionBlockForOperation:strongSubOperation completion:completedBlock image:downloadedImage data:downloadedData error:nil cacheType:SDImageCacheTypeNone finished:finished url:url];
@@ -8,6 +8,7 @@
 
 #import "SDWebImageCompat.h"
 #import "UIImage+MultiFormat.h"
+#import "SDWebImageCoderHelper.h"
 
 #if !__has_feature(objc_arc)
     #error SDWebImage is ARC only. Either turn on ARC for the project or use -fobjc-arc flag
@@ -25,7 +26,19 @@ inline UIImage *SDScaledImageForKey(NSString * _Nullable key, UIImage * _Nullabl
 #if SD_MAC
     return image;
 #elif SD_UIKIT || SD_WATCH
-    if ((image.images).count > 0) {
+    NSArray<SDWebImageFrame *> *frames = image.sd_imageFrames;
+    if (frames.count > 0) {
+        // Scale each distinct frame once and keep the exact durations
+        NSMutableArray<SDWebImageFrame *> *scaledFrames = [NSMutableArray arrayWithCapacity:frames.count];
+        for (SDWebImageFrame *frame in frames) {
+            [scaledFrames addObject:[SDWebImageFrame frameWithImage:SDScaledImageForKey(key, frame.image) duration:frame.duration]];
+        }
+        UIImage *animatedImage = [SDWebImageCoderHelper animatedImageWithFrames:scaledFrames];
+        if (animatedImage) {
+            animatedImage.sd_imageLoopCount = image.sd_imageLoopCount;
+        }
+        return animatedImage;
+    } else if ((image.images).count > 0) {
         NSMutableArray<UIImage *> *scaledImages = [NSMutableArray array];
 
         for (UIImage *tempImage in image.images) {
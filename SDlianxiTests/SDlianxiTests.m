@@ -7,6 +7,218 @@
 //
 
 #import <XCTest/XCTest.h>
+#import "SDWebImageImageIOCoder.h"
+#import "SDImageResampler.h"
+#import "SDImagePixelConverter.h"
+#import "SDImageHeaderParser.h"
+#import "SDWebImageGIFCoder.h"
+#import "SDWebImageCoderHelper.h"
+#import "SDWebImageAnimatedImage.h"
+#import "SDImageCache.h"
+#import "SDWebImageDecodeScheduler.h"
+#import "SDWebImageDownloaderOperation.h"
+#import "SDWebImageDownloader.h"
+#import "SDWebImageDownloadConcurrencyController.h"
+#import "UIImage+MultiFormat.h"
+#import <mach/mach.h>
+#import <malloc/malloc.h>
+#import <ImageIO/ImageIO.h>
+#import <MobileCoreServices/MobileCoreServices.h>
+#ifdef SD_WEBP
+#import "SDWebImageWebPCoder.h"
+#endif
+
+// A GIF coder which counts the frames it decodes, so the frame buffer of an animated image can be observed
+@interface SDTestCountingGIFCoder : SDWebImageGIFCoder
+@property (assign, atomic) NSUInteger decodedFrameCount;
+@end
+
+@implementation SDTestCountingGIFCoder
+
+- (UIImage *)animatedImageFrameAtIndex:(NSUInteger)index {
+    self.decodedFrameCount++;
+    return [super animatedImageFrameAtIndex:index];
+}
+
+@end
+
+// An operation which creates its task up front and only counts the data it receives, so the downloader routing can be measured without a network
+@interface SDTestRoutingOperation : SDWebImageDownloaderOperation
+@property (assign, atomic) NSUInteger receivedDataCount;
+@end
+
+@implementation SDTestRoutingOperation {
+    NSURLSessionTask *_testTask;
+}
+
+- (instancetype)initWithRequest:(NSURLRequest *)request inSession:(NSURLSession *)session options:(SDWebImageDownloaderOptions)options {
+    if ((self = [super initWithRequest:request inSession:session options:options])) {
+        _testTask = [session dataTaskWithRequest:request];
+    }
+    return self;
+}
+
+- (NSURLSessionTask *)dataTask {
+    return _testTask;
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
+    self.receivedDataCount++;
+}
+
+@end
+
+// An operation which runs until the test finishes it, so the downloader scheduling can be observed without a network
+@interface SDWebImageDownloaderOperation (SDTestState)
+- (void)setExecuting:(BOOL)executing;
+- (void)done;
+@end
+
+@interface SDTestHostOperation : SDWebImageDownloaderOperation
+@end
+
+@implementation SDTestHostOperation
+
+- (void)start {
+    @synchronized (self) {
+        if (self.isCancelled) {
+            [self done];
+            return;
+        }
+        self.executing = YES;
+    }
+}
+
+- (void)cancel {
+    @synchronized (self) {
+        [super cancel];
+        if (self.isExecuting) {
+            [self done];
+        }
+    }
+}
+
+@end
+
+// A server for `Range` requests on one image with an ETag, which can drop the connection partway through a response
+@interface SDTestRangeURLProtocol : NSURLProtocol
+@property (class, copy, nonatomic) NSData *body;
+@property (class, assign, nonatomic) NSUInteger failAfterBytes; // Fail the next response after this many bytes, 0 to send it whole
+@property (class, assign, nonatomic) NSInteger staleRangeStatusCode; // Answer the next range request with 416, or with 206 for a range one byte late, 0 to answer it right
+@property (class, readonly, nonatomic) NSMutableArray<NSHTTPURLResponse *> *responses;
+@property (class, readonly, nonatomic) NSMutableArray<NSURLRequest *> *requests;
+@end
+
+@implementation SDTestRangeURLProtocol
+
+static NSData *SDTestRangeBody;
+static NSUInteger SDTestRangeFailAfterBytes;
+static NSInteger SDTestRangeStaleStatusCode;
+
++ (NSData *)body {
+    return SDTestRangeBody;
+}
+
++ (void)setBody:(NSData *)body {
+    SDTestRangeBody = [body copy];
+}
+
++ (NSUInteger)failAfterBytes {
+    return SDTestRangeFailAfterBytes;
+}
+
++ (void)setFailAfterBytes:(NSUInteger)failAfterBytes {
+    SDTestRangeFailAfterBytes = failAfterBytes;
+}
+
++ (NSInteger)staleRangeStatusCode {
+    return SDTestRangeStaleStatusCode;
+}
+
++ (void)setStaleRangeStatusCode:(NSInteger)staleRangeStatusCode {
+    SDTestRangeStaleStatusCode = staleRangeStatusCode;
+}
+
++ (NSMutableArray<NSHTTPURLResponse *> *)responses {
+    static NSMutableArray *responses;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        responses = [NSMutableArray array];
+    });
+    return responses;
+}
+
++ (NSMutableArray<NSURLRequest *> *)requests {
+    static NSMutableArray *requests;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        requests = [NSMutableArray array];
+    });
+    return requests;
+}
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request {
+    return [request.URL.host isEqualToString:@"range.test"];
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request {
+    return request;
+}
+
+- (void)startLoading {
+    NSData *body = [[self class] body];
+    NSString *ETag = @"\"sdtest\"";
+    NSUInteger start = 0;
+    NSString *range = [self.request valueForHTTPHeaderField:@"Range"];
+    if (range && [[self.request valueForHTTPHeaderField:@"If-Range"] isEqualToString:ETag]) {
+        NSScanner *scanner = [NSScanner scannerWithString:range];
+        NSInteger value = 0;
+        if ([scanner scanString:@"bytes=" intoString:NULL] && [scanner scanInteger:&value] && value < (NSInteger)body.length) {
+            start = (NSUInteger)value;
+        }
+    }
+    NSInteger staleRangeStatusCode = [[self class] staleRangeStatusCode];
+    if (start > 0 && staleRangeStatusCode > 0) {
+        [[self class] setStaleRangeStatusCode:0];
+        if (staleRangeStatusCode == 416) {
+            NSDictionary *headers = @{@"ETag" : ETag, @"Content-Range" : [NSString stringWithFormat:@"bytes */%lu", (unsigned long)body.length], @"Content-Length" : @"0"};
+            NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:416 HTTPVersion:@"HTTP/1.1" headerFields:headers];
+            @synchronized ([self class]) {
+                [[[self class] requests] addObject:self.request];
+                [[[self class] responses] addObject:response];
+            }
+            [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+            [self.client URLProtocolDidFinishLoading:self];
+            return;
+        }
+        start++;
+    }
+    NSMutableDictionary *headers = [@{@"Content-Type" : @"image/png", @"ETag" : ETag, @"Content-Length" : @(body.length - start).stringValue} mutableCopy];
+    if (start > 0) {
+        headers[@"Content-Range"] = [NSString stringWithFormat:@"bytes %lu-%lu/%lu", (unsigned long)start, (unsigned long)body.length - 1, (unsigned long)body.length];
+    }
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:start > 0 ? 206 : 200 HTTPVersion:@"HTTP/1.1" headerFields:headers];
+    @synchronized ([self class]) {
+        [[[self class] requests] addObject:self.request];
+        [[[self class] responses] addObject:response];
+    }
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    NSData *data = [body subdataWithRange:NSMakeRange(start, body.length - start)];
+    NSUInteger failAfterBytes = [[self class] failAfterBytes];
+    if (failAfterBytes > 0 && failAfterBytes < data.length) {
+        [[self class] setFailAfterBytes:0];
+        [self.client URLProtocol:self didLoadData:[data subdataWithRange:NSMakeRange(0, failAfterBytes)]];
+        [self.client URLProtocol:self didFailWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil]];
+        return;
+    }
+    [self.client URLProtocol:self didLoadData:data];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading {
+}
+
+@end
 
 @interface SDlianxiTests : XCTestCase
 
@@ -29,6 +241,1536 @@
     // Use XCTAssert and related functions to verify your tests produce the correct results.
 }
 
+// A 6000x4000 opaque image, larger than the scale down limit
+- (UIImage *)largeTestImage {
+    size_t width = 6000;
+    size_t height = 4000;
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGBitmapByteOrder32Host | kCGImageAlphaNoneSkipFirst);
+    CGColorSpaceRelease(colorSpace);
+    for (size_t i = 0; i < 64; i++) {
+        CGContextSetRGBFillColor(context, (i % 4) / 3.0, (i % 7) / 6.0, (i % 5) / 4.0, 1);
+        CGContextFillRect(context, CGRectMake(0, i * height / 64.0, width, height / 64.0));
+    }
+    CGImageRef imageRef = CGBitmapContextCreateImage(context);
+    CGContextRelease(context);
+    UIImage *image = [UIImage imageWithCGImage:imageRef];
+    CGImageRelease(imageRef);
+    return image;
+}
+
+// A GIF with one solid color per frame, frame i lasts 0.05 * (i + 1) seconds
+- (NSData *)animatedTestGIFDataWithFrameCount:(size_t)frameCount width:(size_t)width height:(size_t)height {
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    NSMutableArray<SDWebImageFrame *> *frames = [NSMutableArray array];
+    for (size_t i = 0; i < frameCount; i++) {
+        CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGBitmapByteOrder32Little | kCGImageAlphaNoneSkipFirst);
+        CGContextSetRGBFillColor(context, i / (CGFloat)frameCount, 0.5, 1 - i / (CGFloat)frameCount, 1);
+        CGContextFillRect(context, CGRectMake(0, 0, width, height));
+        CGImageRef imageRef = CGBitmapContextCreateImage(context);
+        [frames addObject:[SDWebImageFrame frameWithImage:[[UIImage alloc] initWithCGImage:imageRef] duration:0.05 * (i + 1)]];
+        CGImageRelease(imageRef);
+        CGContextRelease(context);
+    }
+    CGColorSpaceRelease(colorSpace);
+    return [[SDWebImageGIFCoder sharedCoder] encodedDataWithImage:[SDWebImageCoderHelper animatedImageWithFrames:frames] format:SDImageFormatGIF];
+}
+
+- (void)testScaleDownLargeImage {
+    UIImage *image = [self largeTestImage];
+    UIImage *scaledImage = [[SDWebImageImageIOCoder sharedCoder] decompressedImageWithImage:image data:NULL options:@{SDWebImageCoderScaleDownLargeImagesKey : @YES}];
+    XCTAssertNotNil(scaledImage);
+    XCTAssertLessThan(CGImageGetWidth(scaledImage.CGImage), CGImageGetWidth(image.CGImage));
+    XCTAssertLessThan(CGImageGetHeight(scaledImage.CGImage), CGImageGetHeight(image.CGImage));
+}
+
+- (void)testScaledPixelSizeKeepsAspectRatio {
+    CGSize imageSize = CGSizeMake(4000, 3000);
+    // Fit scales by the smaller ratio, fill by the larger one
+    CGSize fitSize = [SDWebImageCoderHelper scaledPixelSizeWithImageSize:imageSize targetPixelSize:CGSizeMake(400, 400) contentMode:SDWebImageCoderContentModeAspectFit];
+    XCTAssertTrue(CGSizeEqualToSize(fitSize, CGSizeMake(400, 300)));
+    CGSize fillSize = [SDWebImageCoderHelper scaledPixelSizeWithImageSize:imageSize targetPixelSize:CGSizeMake(400, 400) contentMode:SDWebImageCoderContentModeAspectFill];
+    XCTAssertTrue(CGSizeEqualToSize(fillSize, CGSizeMake(533, 400)));
+    // Never scaled up, and an empty target keeps the image size
+    XCTAssertTrue(CGSizeEqualToSize([SDWebImageCoderHelper scaledPixelSizeWithImageSize:imageSize targetPixelSize:CGSizeMake(8000, 8000) contentMode:SDWebImageCoderContentModeAspectFit], imageSize));
+    XCTAssertTrue(CGSizeEqualToSize([SDWebImageCoderHelper scaledPixelSizeWithImageSize:imageSize targetPixelSize:CGSizeMake(8000, 100) contentMode:SDWebImageCoderContentModeAspectFill], imageSize));
+    XCTAssertTrue(CGSizeEqualToSize([SDWebImageCoderHelper scaledPixelSizeWithImageSize:imageSize targetPixelSize:CGSizeZero contentMode:SDWebImageCoderContentModeAspectFit], imageSize));
+    // A thin image keeps at least one pixel
+    CGSize thinSize = [SDWebImageCoderHelper scaledPixelSizeWithImageSize:CGSizeMake(10000, 2) targetPixelSize:CGSizeMake(100, 100) contentMode:SDWebImageCoderContentModeAspectFit];
+    XCTAssertTrue(CGSizeEqualToSize(thinSize, CGSizeMake(100, 1)));
+}
+
+- (void)testImageKeyDependsOnDecodeOptions {
+    NSString *key = @"http://example.com/image.jpg";
+    XCTAssertNil(SDImageKeyForDecodeOptions(nil, @{SDWebImageCoderDecodeLazyFramesKey : @YES}));
+    // Options which do not change the decoded image keep the key
+    XCTAssertEqualObjects(SDImageKeyForDecodeOptions(key, nil), key);
+    XCTAssertEqualObjects(SDImageKeyForDecodeOptions(key, @{SDWebImageCoderDecodeLazyFramesKey : @NO, SDWebImageCoderDecodePixelFormatKey : @(SDWebImageCoderPixelFormatAutomatic), SDWebImageCoderDecodeTargetPixelSizeKey : [NSValue valueWithCGSize:CGSizeZero]}), key);
+    
+    NSArray<NSDictionary<NSString *, NSObject *> *> *optionSets = @[@{SDWebImageCoderDecodeTargetPixelSizeKey : [NSValue valueWithCGSize:CGSizeMake(100, 100)]},
+                                                                    @{SDWebImageCoderDecodeTargetPixelSizeKey : [NSValue valueWithCGSize:CGSizeMake(200, 100)]},
+                                                                    @{SDWebImageCoderDecodeTargetPixelSizeKey : [NSValue valueWithCGSize:CGSizeMake(100, 100)], SDWebImageCoderDecodeTargetContentModeKey : @(SDWebImageCoderContentModeAspectFill)},
+                                                                    @{SDWebImageCoderDecodeLazyFramesKey : @YES},
+                                                                    @{SDWebImageCoderDecodePixelFormatKey : @(SDWebImageCoderPixelFormat32Bit)},
+                                                                    @{SDWebImageCoderDecodePixelFormatKey : @(SDWebImageCoderPixelFormatAllow16Bit)},
+                                                                    @{SDWebImageCoderDecodeTargetPixelSizeKey : [NSValue valueWithCGSize:CGSizeMake(100, 100)], SDWebImageCoderDecodeLazyFramesKey : @YES, SDWebImageCoderDecodePixelFormatKey : @(SDWebImageCoderPixelFormatAllow16Bit)}];
+    NSMutableSet<NSString *> *keys = [NSMutableSet setWithObject:key];
+    for (NSDictionary<NSString *, NSObject *> *options in optionSets) {
+        NSString *optionsKey = SDImageKeyForDecodeOptions(key, options);
+        XCTAssertTrue([optionsKey hasPrefix:key]);
+        // The same options give the same key
+        XCTAssertEqualObjects(SDImageKeyForDecodeOptions(key, [options copy]), optionsKey);
+        [keys addObject:optionsKey];
+    }
+    // Different options give different keys
+    XCTAssertEqual(keys.count, optionSets.count + 1);
+}
+
+- (void)testScaleDownLargeImagePerformance {
+    // Scale down with 1 tile at a time, then with more tiles up to the processor count: the output is the same and more tiles are faster
+    UIImage *image = [self largeTestImage];
+    NSUInteger processorCount = [NSProcessInfo processInfo].activeProcessorCount;
+    NSData *serialPixels;
+    CFTimeInterval serialTime = 0;
+    for (NSUInteger maxConcurrentTiles = 1; maxConcurrentTiles <= MIN(processorCount, 4u); maxConcurrentTiles *= 2) {
+        NSDictionary *options = @{SDWebImageCoderScaleDownLargeImagesKey : @YES, SDWebImageCoderScaleDownMaxConcurrentTilesKey : @(maxConcurrentTiles)};
+        // Best of 3 runs
+        CFTimeInterval time = DBL_MAX;
+        UIImage *scaledImage;
+        for (NSUInteger run = 0; run < 3; run++) {
+            CFTimeInterval start = CACurrentMediaTime();
+            scaledImage = [[SDWebImageImageIOCoder sharedCoder] decompressedImageWithImage:image data:NULL options:options];
+            time = MIN(time, CACurrentMediaTime() - start);
+        }
+        CFDataRef pixels = CGDataProviderCopyData(CGImageGetDataProvider(scaledImage.CGImage));
+        if (maxConcurrentTiles == 1) {
+            serialPixels = (__bridge_transfer NSData *)pixels;
+            serialTime = time;
+        } else {
+            XCTAssertEqualObjects((__bridge_transfer NSData *)pixels, serialPixels);
+            XCTAssertLessThan(time, serialTime, @"%lu tiles", (unsigned long)maxConcurrentTiles);
+        }
+    }
+    
+    [self measureBlock:^{
+        [[SDWebImageImageIOCoder sharedCoder] decompressedImageWithImage:image data:NULL options:@{SDWebImageCoderScaleDownLargeImagesKey : @YES}];
+    }];
+}
+
+// A smooth RGBA test pattern
+static uint8_t *SDTestCreatePattern(size_t width, size_t height) {
+    uint8_t *pixels = malloc(width * height * 4);
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            uint8_t *p = pixels + (y * width + x) * 4;
+            p[0] = (uint8_t)(127.5 + 127 * sin(x * 0.01));
+            p[1] = (uint8_t)(y * 255 / height);
+            p[2] = (uint8_t)(127.5 + 127 * cos((x + y) * 0.005));
+            p[3] = 255;
+        }
+    }
+    return pixels;
+}
+
+static double SDTestPSNR(const uint8_t *a, const uint8_t *b, size_t length) {
+    double error = 0;
+    for (size_t i = 0; i < length; i++) {
+        double d = (double)a[i] - b[i];
+        error += d * d;
+    }
+    error /= length;
+    return error == 0 ? INFINITY : 10 * log10(255.0 * 255.0 / error);
+}
+
+- (void)testResamplerPSNR {
+    // Downscale by 3 and compare with the exact average of each 3x3 block
+    size_t width = 1200, height = 900, scaledWidth = 400, scaledHeight = 300;
+    uint8_t *pixels = SDTestCreatePattern(width, height);
+    uint8_t *expected = malloc(scaledWidth * scaledHeight * 4);
+    for (size_t y = 0; y < scaledHeight; y++) {
+        for (size_t x = 0; x < scaledWidth; x++) {
+            for (int c = 0; c < 4; c++) {
+                int sum = 0;
+                for (int j = 0; j < 3; j++) {
+                    for (int i = 0; i < 3; i++) {
+                        sum += pixels[((y * 3 + j) * width + x * 3 + i) * 4 + c];
+                    }
+                }
+                expected[(y * scaledWidth + x) * 4 + c] = (uint8_t)(sum / 9.0 + 0.5);
+            }
+        }
+    }
+    uint8_t *scaled = malloc(scaledWidth * scaledHeight * 4);
+    SDImageResamplingFilter filters[] = {SDImageResamplingFilterBox, SDImageResamplingFilterBilinear, SDImageResamplingFilterLanczos3};
+    for (int i = 0; i < 3; i++) {
+        XCTAssertEqual(SDImageResample(pixels, width, height, width * 4, scaled, scaledWidth, scaledHeight, scaledWidth * 4, filters[i]), 0);
+        XCTAssertGreaterThan(SDTestPSNR(scaled, expected, scaledWidth * scaledHeight * 4), 40);
+    }
+    free(pixels);
+    free(expected);
+    free(scaled);
+}
+
+- (void)testResamplerBandsMatchWholeImage {
+    size_t width = 1000, height = 700, scaledWidth = 310, scaledHeight = 217;
+    uint8_t *pixels = SDTestCreatePattern(width, height);
+    uint8_t *whole = malloc(scaledWidth * scaledHeight * 4);
+    uint8_t *bands = malloc(scaledWidth * scaledHeight * 4);
+    SDImageResampler *resampler = SDImageResamplerCreate(width, height, scaledWidth, scaledHeight, SDImageResamplingFilterLanczos3);
+    XCTAssertEqual(SDImageResamplerResampleRows(resampler, pixels, 0, height, width * 4, whole, 0, scaledHeight, scaledWidth * 4), 0);
+    for (size_t y = 0; y < scaledHeight; y += 37) {
+        size_t rows = MIN(37, scaledHeight - y);
+        size_t srcY, srcRows;
+        SDImageResamplerGetSourceRows(resampler, y, rows, &srcY, &srcRows);
+        XCTAssertEqual(SDImageResamplerResampleRows(resampler, pixels + srcY * width * 4, srcY, srcRows, width * 4, bands + y * scaledWidth * 4, y, rows, scaledWidth * 4), 0);
+    }
+    XCTAssertEqual(memcmp(whole, bands, scaledWidth * scaledHeight * 4), 0);
+    SDImageResamplerRelease(resampler);
+    free(pixels);
+    free(whole);
+    free(bands);
+}
+
+- (void)testResamplerPerformance {
+    size_t width = 4000, height = 3000, scaledWidth = 1000, scaledHeight = 750;
+    uint8_t *pixels = SDTestCreatePattern(width, height);
+    uint8_t *scaled = malloc(scaledWidth * scaledHeight * 4);
+    // The filters read about 4, 8 and 24 source pixels per axis at this scale, so the wider ones are never faster (best of 3 runs)
+    SDImageResamplingFilter filters[] = {SDImageResamplingFilterBox, SDImageResamplingFilterBilinear, SDImageResamplingFilterLanczos3};
+    CFTimeInterval times[3];
+    for (int i = 0; i < 3; i++) {
+        times[i] = DBL_MAX;
+        for (int run = 0; run < 3; run++) {
+            CFTimeInterval start = CACurrentMediaTime();
+            XCTAssertEqual(SDImageResample(pixels, width, height, width * 4, scaled, scaledWidth, scaledHeight, scaledWidth * 4, filters[i]), 0);
+            times[i] = MIN(times[i], CACurrentMediaTime() - start);
+        }
+    }
+    XCTAssertLessThan(times[0], times[2]);
+    XCTAssertLessThan(times[1], times[2]);
+    [self measureBlock:^{
+        SDImageResample(pixels, width, height, width * 4, scaled, scaledWidth, scaledHeight, scaledWidth * 4, SDImageResamplingFilterLanczos3);
+    }];
+    free(pixels);
+    free(scaled);
+}
+
+- (void)testPixelConverterMatchesCoreGraphics {
+    // Converting straight RGBA to premultiplied BGRA in one pass should match drawing it with Core Graphics
+    size_t width = 257, height = 31;
+    uint8_t *rgba = SDTestCreatePattern(width, height);
+    for (size_t i = 0; i < width * height; i++) {
+        rgba[i * 4 + 3] = (uint8_t)(i * 7);
+    }
+    uint8_t *converted = malloc(width * height * 4);
+    SDPixelPremultiply(rgba, width * 4, converted, width * 4, width, height, true);
+    
+    CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, rgba, width * height * 4, NULL);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGImageRef imageRef = CGImageCreate(width, height, 8, 32, width * 4, colorSpace, kCGBitmapByteOrder32Big | kCGImageAlphaLast, provider, NULL, NO, kCGRenderingIntentDefault);
+    CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, width * 4, colorSpace, kCGBitmapByteOrder32Little | kCGImageAlphaPremultipliedFirst);
+    CGContextSetBlendMode(context, kCGBlendModeCopy);
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), imageRef);
+    const uint8_t *drawn = CGBitmapContextGetData(context);
+    size_t maxError = 0;
+    for (size_t i = 0; i < width * height * 4; i++) {
+        maxError = MAX(maxError, (size_t)abs((int)drawn[i] - (int)converted[i]));
+    }
+    XCTAssertLessThanOrEqual(maxError, 1);
+    
+    // Unpremultiplying gives the straight colors back for the opaque enough pixels
+    uint8_t *restored = malloc(width * height * 4);
+    SDPixelUnpremultiply(converted, width * 4, restored, width * 4, width, height, true);
+    for (size_t i = 0; i < width * height; i++) {
+        if (rgba[i * 4 + 3] >= 128) {
+            XCTAssertLessThanOrEqual(abs((int)restored[i * 4] - (int)rgba[i * 4]), 1);
+        }
+    }
+    
+    CGContextRelease(context);
+    CGImageRelease(imageRef);
+    CGColorSpaceRelease(colorSpace);
+    CGDataProviderRelease(provider);
+    free(rgba);
+    free(converted);
+    free(restored);
+}
+
+- (void)testPixelConverterPerformance {
+    // Compare the RGBA to BGRA kernel with building a CGImage and redrawing it into a BGRA canvas
+    size_t width = 4000, height = 3000;
+    uint8_t *rgba = SDTestCreatePattern(width, height);
+    uint8_t *bgra = malloc(width * height * 4);
+    CFTimeInterval start = CACurrentMediaTime();
+    SDPixelSwapRedBlue(rgba, width * 4, bgra, width * 4, width, height);
+    CFTimeInterval kernelTime = CACurrentMediaTime() - start;
+    
+    start = CACurrentMediaTime();
+    CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, rgba, width * height * 4, NULL);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGImageRef imageRef = CGImageCreate(width, height, 8, 32, width * 4, colorSpace, kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipLast, provider, NULL, NO, kCGRenderingIntentDefault);
+    CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGBitmapByteOrder32Little | kCGImageAlphaNoneSkipFirst);
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), imageRef);
+    CGImageRef drawnImageRef = CGBitmapContextCreateImage(context);
+    CFTimeInterval drawTime = CACurrentMediaTime() - start;
+    XCTAssertLessThan(kernelTime, drawTime);
+    CGImageRelease(drawnImageRef);
+    CGContextRelease(context);
+    CGImageRelease(imageRef);
+    CGColorSpaceRelease(colorSpace);
+    CGDataProviderRelease(provider);
+    
+    [self measureBlock:^{
+        SDPixelSwapRedBlue(rgba, width * 4, bgra, width * 4, width, height);
+    }];
+    free(rgba);
+    free(bgra);
+}
+
+- (void)testAnimatedImageDecodesFramesLazily {
+    // Encode a 20 frame GIF, then check the lazy image reads the metadata up front and keeps the buffer in budget
+    size_t width = 200, height = 150, frameCount = 20;
+    NSData *gifData = [self animatedTestGIFDataWithFrameCount:frameCount width:width height:height];
+    XCTAssertNotNil(gifData);
+    
+    UIImage *image = [[SDWebImageGIFCoder sharedCoder] decodedImageWithData:gifData options:@{SDWebImageCoderDecodeLazyFramesKey : @YES}];
+    XCTAssertTrue([image isKindOfClass:[SDWebImageAnimatedImage class]]);
+    SDWebImageAnimatedImage *animatedImage = (SDWebImageAnimatedImage *)image;
+    XCTAssertEqual(animatedImage.animatedImageFrameCount, frameCount);
+    XCTAssertEqualWithAccuracy([animatedImage animatedImageDurationAtIndex:3], 0.2, 0.011);
+    XCTAssertEqual(animatedImage.bufferedFrameCount, 1u);
+    
+    // 4 frames fit in the budget
+    animatedImage.maxBufferSize = width * height * 4 * 4;
+    for (size_t i = 0; i < frameCount; i++) {
+        UIImage *frame = [animatedImage animatedImageFrameAtIndex:i];
+        XCTAssertEqual(frame.size.width, width);
+        XCTAssertLessThanOrEqual(animatedImage.bufferedFrameCount, 4u);
+    }
+    XCTAssertNil([animatedImage animatedImageFrameAtIndex:frameCount]);
+}
+
+// Reads the private prefetch flag, which is cleared once the look-ahead window is full
+- (void)waitForPrefetchOfAnimatedImage:(SDWebImageAnimatedImage *)animatedImage {
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"prefetching == NO"] evaluatedWithObject:animatedImage handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+- (void)testAnimatedImagePrefetchWrapsAroundTheLastFrame {
+    // 5 frames in a buffer of 4 shown at frame 3: the look-ahead window 4, 0, 1 wraps past the last frame and must end up buffered without decoding forever
+    size_t width = 16, height = 16, frameCount = 5;
+    NSData *gifData = [self animatedTestGIFDataWithFrameCount:frameCount width:width height:height];
+    SDTestCountingGIFCoder *coder = [[SDTestCountingGIFCoder alloc] initWithAnimatedImageData:gifData options:nil];
+    SDWebImageAnimatedImage *animatedImage = [[SDWebImageAnimatedImage alloc] initWithAnimatedCoder:coder];
+    XCTAssertNotNil(animatedImage);
+    animatedImage.maxBufferSize = CGImageGetBytesPerRow(animatedImage.CGImage) * height * 4;
+    
+    // The prefetch starts before the frame is returned, and must stop once the window is full
+    XCTAssertNotNil([animatedImage animatedImageFrameAtIndex:3]);
+    [self waitForPrefetchOfAnimatedImage:animatedImage];
+    XCTAssertEqual(animatedImage.bufferedFrameCount, 4u);
+    // Frame 3 and the 3 frames after it were each decoded once, next to the first frame decoded up front
+    NSUInteger decodedFrameCount = coder.decodedFrameCount;
+    XCTAssertLessThanOrEqual(decodedFrameCount, 5u);
+    
+    // The window frames come from the buffer
+    XCTAssertNotNil([animatedImage animatedImageFrameAtIndex:4]);
+    XCTAssertNotNil([animatedImage animatedImageFrameAtIndex:0]);
+    XCTAssertNotNil([animatedImage animatedImageFrameAtIndex:1]);
+    XCTAssertLessThanOrEqual(animatedImage.bufferedFrameCount, 4u);
+    [self waitForPrefetchOfAnimatedImage:animatedImage];
+    // Only the frames which entered the window on the way were decoded
+    XCTAssertLessThanOrEqual(coder.decodedFrameCount - decodedFrameCount, 3u);
+}
+
+- (void)testAnimatedImageKeepsFrameTimeline {
+    // Mixed 10ms / 2s durations used to expand to 201 images
+    UIImage *shortImage = [self largeTestImage];
+    UIImage *longImage = [[UIImage alloc] initWithCGImage:shortImage.CGImage scale:2 orientation:UIImageOrientationUp];
+    NSArray<SDWebImageFrame *> *frames = @[[SDWebImageFrame frameWithImage:shortImage duration:0.01],
+                                           [SDWebImageFrame frameWithImage:longImage duration:2]];
+    UIImage *animatedImage = [SDWebImageCoderHelper animatedImageWithFrames:frames];
+    // About 4 repeats per frame, up to rounding
+    XCTAssertLessThanOrEqual(animatedImage.images.count, 10u);
+    
+    NSArray<SDWebImageFrame *> *timeline = [SDWebImageCoderHelper framesFromAnimatedImage:animatedImage];
+    XCTAssertEqual(timeline.count, 2u);
+    XCTAssertEqual(timeline[0].image, shortImage);
+    XCTAssertEqual(timeline[1].image, longImage);
+    XCTAssertEqualWithAccuracy(timeline[0].duration, 0.01, 0.0001);
+    XCTAssertEqualWithAccuracy(timeline[1].duration, 2, 0.0001);
+    
+    // Without durations UIKit picks the timing, each frame is shown once
+    frames = @[[SDWebImageFrame frameWithImage:shortImage duration:0],
+               [SDWebImageFrame frameWithImage:longImage duration:0]];
+    animatedImage = [SDWebImageCoderHelper animatedImageWithFrames:frames];
+    XCTAssertEqual(animatedImage.images.count, 2u);
+    XCTAssertEqual(animatedImage.images[1], longImage);
+}
+
+- (void)testProgressiveDecodingWithAppendedData {
+    // Feed the data in chunks as a download would, only the new bytes are passed each time
+    NSData *data = [[SDWebImageImageIOCoder sharedCoder] encodedDataWithImage:[self largeTestImage] format:SDImageFormatJPEG];
+    XCTAssertNotNil(data);
+    SDWebImageImageIOCoder *coder = [[SDWebImageImageIOCoder alloc] init];
+    NSUInteger chunkSize = 16 * 1024;
+    UIImage *image;
+    for (NSUInteger offset = 0; offset < data.length; offset += chunkSize) {
+        NSUInteger length = MIN(chunkSize, data.length - offset);
+        BOOL finished = offset + length == data.length;
+        image = [coder incrementallyDecodedImageWithAppendedData:[data subdataWithRange:NSMakeRange(offset, length)] finished:finished];
+    }
+    UIImage *fullImage = [[SDWebImageImageIOCoder sharedCoder] decodedImageWithData:data];
+    XCTAssertNotNil(image);
+    XCTAssertTrue(CGSizeEqualToSize(image.size, fullImage.size));
+}
+
+- (void)testProgressiveDecodesAreCoalesced {
+    // Feed a progressive download chunks below and above the thresholds, only the chunks past a threshold are decoded
+    size_t width = 600, height = 400;
+    uint8_t *pixels = malloc(width * height * 4);
+    arc4random_buf(pixels, width * height * 4);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(pixels, width, height, 8, width * 4, colorSpace, kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipLast);
+    CGImageRef imageRef = CGBitmapContextCreateImage(context);
+    NSData *data = [[SDWebImageImageIOCoder sharedCoder] encodedDataWithImage:[[UIImage alloc] initWithCGImage:imageRef] format:SDImageFormatJPEG];
+    CGImageRelease(imageRef);
+    CGContextRelease(context);
+    CGColorSpaceRelease(colorSpace);
+    free(pixels);
+    NSUInteger chunkSize = 4 * 1024;
+    XCTAssertGreaterThan(data.length, 40 * chunkSize);
+    
+    NSURL *url = [NSURL URLWithString:@"http://progressive.test/noise.jpg"];
+    SDWebImageDownloaderOperation *operation = [[SDWebImageDownloaderOperation alloc] initWithRequest:[NSURLRequest requestWithURL:url] inSession:nil options:SDWebImageDownloaderProgressiveDownload];
+    operation.shouldDecompressImages = NO;
+    operation.progressiveDecodeMinimumBytes = 16 * chunkSize;
+    operation.progressiveDecodeMinimumInterval = 0;
+    operation.progressiveDecodeMaximumInterval = 100;
+    NSMutableArray<UIImage *> *partialImages = [NSMutableArray array];
+    [operation addHandlersForProgress:nil completed:^(UIImage *image, NSData *imageData, NSError *error, BOOL finished) {
+        if (image && !finished) {
+            [partialImages addObject:image];
+        }
+    }];
+    NSURLSessionDataTask *dataTask = [[NSURLSession sharedSession] dataTaskWithURL:url];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:@{@"Content-Length" : [NSString stringWithFormat:@"%lu", (unsigned long)data.length]}];
+    [operation URLSession:[NSURLSession sharedSession] dataTask:dataTask didReceiveResponse:response completionHandler:nil];
+    __block NSUInteger offset = 0;
+    void (^feed)(NSUInteger) = ^(NSUInteger chunkCount) {
+        for (NSUInteger i = 0; i < chunkCount && offset < data.length; i++) {
+            NSUInteger length = MIN(chunkSize, data.length - offset);
+            [operation URLSession:[NSURLSession sharedSession] dataTask:dataTask didReceiveData:[data subdataWithRange:NSMakeRange(offset, length)]];
+            offset += length;
+        }
+    };
+    void (^waitForDecode)(void) = ^{
+        [self expectationForPredicate:[NSPredicate predicateWithFormat:@"progressiveDecoding == NO"] evaluatedWithObject:operation handler:nil];
+        [self waitForExpectationsWithTimeout:10 handler:nil];
+    };
+    
+    // The first chunk is decoded, nothing was shown yet
+    feed(1);
+    XCTAssertEqual(operation.progressiveDecodeCount, 1u);
+    waitForDecode();
+    // Below the byte threshold
+    feed(15);
+    XCTAssertEqual(operation.progressiveDecodeCount, 1u);
+    XCTAssertEqual(operation.progressiveDecodeSkippedCount, 15u);
+    // The byte threshold is reached
+    feed(1);
+    XCTAssertEqual(operation.progressiveDecodeCount, 2u);
+    waitForDecode();
+    // Above the byte threshold but within the minimum interval
+    operation.progressiveDecodeMinimumInterval = 100;
+    feed(20);
+    XCTAssertEqual(operation.progressiveDecodeCount, 2u);
+    XCTAssertEqual(operation.progressiveDecodeSkippedCount, 35u);
+    // Below the byte threshold past the maximum interval, which a maximum interval of 0 always is
+    operation.progressiveDecodeMinimumInterval = 0;
+    operation.progressiveDecodeMinimumBytes = NSUIntegerMax;
+    operation.progressiveDecodeMaximumInterval = 0;
+    feed(1);
+    XCTAssertEqual(operation.progressiveDecodeCount, 3u);
+    waitForDecode();
+    // The last chunk is always decoded
+    operation.progressiveDecodeMaximumInterval = 100;
+    feed(NSUIntegerMax);
+    waitForDecode();
+    XCTAssertEqual(operation.progressiveDecodeCount, 4u);
+    XCTAssertEqual(operation.progressiveDecodeCount + operation.progressiveDecodeSkippedCount, (data.length + chunkSize - 1) / chunkSize);
+    
+    // The partial images are drawn in one reused canvas, each keeps the pixels it was drawn with
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"count >= 3"] evaluatedWithObject:partialImages handler:nil];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    NSData *(^pixelData)(UIImage *) = ^NSData *(UIImage *image) {
+        return CFBridgingRelease(CGDataProviderCopyData(CGImageGetDataProvider(image.CGImage)));
+    };
+    UIImage *firstImage = partialImages.firstObject;
+    XCTAssertTrue(CGSizeEqualToSize(firstImage.size, CGSizeMake(width, height)));
+    XCTAssertFalse([pixelData(firstImage) isEqualToData:pixelData(partialImages.lastObject)]);
+}
+
+- (void)testCacheEncodesStoresOffTheIOQueue {
+    // Stores without data are encoded on the encode queue, reads see them before they reach the disk
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"SDlianxiTestsEncode" diskCacheDirectory:NSTemporaryDirectory()];
+    cache.config.maxPendingEncodes = 4;
+    // Files left by an earlier run would count as overwrites
+    [cache clearDiskOnCompletion:nil];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"stores finished"];
+    NSUInteger storeCount = 10;
+    __block NSUInteger completedCount = 0;
+    UIImage *image = [self largeTestImage];
+    for (NSUInteger i = 0; i < storeCount; i++) {
+        NSString *key = [NSString stringWithFormat:@"encode-%lu", (unsigned long)i];
+        [cache storeImage:image imageData:nil forKey:key decodeOptions:nil priority:(i == 0 ? NSOperationQueuePriorityHigh : NSOperationQueuePriorityNormal) toDisk:YES completion:^{
+            if (++completedCount == storeCount) {
+                [expectation fulfill];
+            }
+        }];
+    }
+    XCTAssertTrue([cache diskImageDataExistsWithKey:@"encode-0"]);
+    // A query does not wait for the encode, it answers with the pending image
+    __block UIImage *queriedImage;
+    [cache clearMemory];
+    [cache queryCacheOperationForKey:@"encode-9" options:SDImageCacheQueryDiskSync done:^(UIImage *cachedImage, NSData *cachedData, SDImageCacheType cacheType) {
+        queriedImage = cachedImage;
+    }];
+    XCTAssertNotNil(queriedImage);
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    
+    // Every store completes, the dropped ones only stay in memory
+    XCTAssertEqual(cache.pendingEncodeCount, 0u);
+    XCTAssertEqual(cache.encodedWriteCount + cache.droppedEncodeCount, storeCount);
+    XCTAssertEqual(cache.encodedWriteCount, cache.diskWriteCount);
+    XCTAssertEqual(cache.encodedWriteBytes, cache.diskWriteBytes);
+    // Each key was written once
+    XCTAssertEqual(cache.overwrittenBytes, 0u);
+    [cache clearDiskOnCompletion:nil];
+}
+
+- (void)testDecodeSchedulerKeepsBudgetAndPriorities {
+    SDWebImageDecodeScheduler *scheduler = [SDWebImageDecodeScheduler new];
+    scheduler.maxConcurrentDecodes = 4;
+    scheduler.maxDecodingBytes = 100;
+    dispatch_semaphore_t lock = dispatch_semaphore_create(1);
+    __block NSUInteger decodingBytes = 0, maxDecodingBytes = 0;
+    dispatch_group_t group = dispatch_group_create();
+    // Each decode holds its bytes until it is released, so the admitted decodes overlap
+    dispatch_semaphore_t started = dispatch_semaphore_create(0);
+    dispatch_semaphore_t released = dispatch_semaphore_create(0);
+    NSUInteger decodeCount = 20;
+    for (NSUInteger i = 0; i < decodeCount; i++) {
+        dispatch_group_enter(group);
+        [scheduler scheduleDecodeWithEstimatedBytes:40 priority:SDWebImageDecodePriorityDefault block:^{
+            dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+            decodingBytes += 40;
+            maxDecodingBytes = MAX(maxDecodingBytes, decodingBytes);
+            dispatch_semaphore_signal(lock);
+            dispatch_semaphore_signal(started);
+            dispatch_semaphore_wait(released, DISPATCH_TIME_FOREVER);
+            dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+            decodingBytes -= 40;
+            dispatch_semaphore_signal(lock);
+            dispatch_group_leave(group);
+        }];
+    }
+    // 2 decodes of 40 bytes fit in 100 bytes, they both run while the others wait
+    XCTAssertEqual(dispatch_semaphore_wait(started, dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_SEC)), 0);
+    XCTAssertEqual(dispatch_semaphore_wait(started, dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_SEC)), 0);
+    XCTAssertEqual(scheduler.decodingCount, 2u);
+    XCTAssertEqual(scheduler.decodingBytes, 80u);
+    XCTAssertEqual(scheduler.pendingDecodeCount, decodeCount - 2);
+    XCTAssertEqual(maxDecodingBytes, 80u);
+    for (NSUInteger i = 0; i < decodeCount; i++) {
+        dispatch_semaphore_signal(released);
+    }
+    XCTAssertEqual(dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_SEC)), 0);
+    XCTAssertEqual(maxDecodingBytes, 80u);
+    
+    // A single worker, busy while the other decodes are queued, then runs them by priority
+    scheduler.maxConcurrentDecodes = 1;
+    dispatch_semaphore_t busy = dispatch_semaphore_create(0);
+    NSMutableArray<NSNumber *> *order = [NSMutableArray array];
+    dispatch_group_enter(group);
+    [scheduler scheduleDecodeWithEstimatedBytes:0 priority:SDWebImageDecodePriorityDefault block:^{
+        dispatch_semaphore_wait(busy, DISPATCH_TIME_FOREVER);
+        dispatch_group_leave(group);
+    }];
+    for (NSNumber *priority in @[@(SDWebImageDecodePriorityLow), @(SDWebImageDecodePriorityDefault), @(SDWebImageDecodePriorityHigh)]) {
+        dispatch_group_enter(group);
+        [scheduler scheduleDecodeWithEstimatedBytes:0 priority:priority.integerValue block:^{
+            [order addObject:priority];
+            dispatch_group_leave(group);
+        }];
+    }
+    XCTAssertEqual(scheduler.pendingDecodeCount, 3u);
+    dispatch_semaphore_signal(busy);
+    XCTAssertEqual(dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_SEC)), 0);
+    XCTAssertEqualObjects(order, (@[@(SDWebImageDecodePriorityHigh), @(SDWebImageDecodePriorityDefault), @(SDWebImageDecodePriorityLow)]));
+    
+    // The estimate comes from the header, not the compressed size
+    NSData *data = [[SDWebImageImageIOCoder sharedCoder] encodedDataWithImage:[self largeTestImage] format:SDImageFormatJPEG];
+    CGImageRef imageRef = [self largeTestImage].CGImage;
+    XCTAssertEqual([SDWebImageDecodeScheduler estimatedDecodedBytesForData:data options:nil], CGImageGetWidth(imageRef) * CGImageGetHeight(imageRef) * 4);
+}
+
+- (void)testDecodePixelFormatReducesMemoryCost {
+    SDWebImageImageIOCoder *coder = [SDWebImageImageIOCoder sharedCoder];
+    size_t width = 640, height = 480;
+    
+    // A grayscale JPEG decompresses to 8-bit gray, unless 32-bit is forced
+    CGContextRef grayContext = CGBitmapContextCreate(NULL, width, height, 8, 0, SDCGColorSpaceGetDeviceGray(), kCGImageAlphaNone);
+    CGContextSetGrayFillColor(grayContext, 0.5, 1);
+    CGContextFillRect(grayContext, CGRectMake(0, 0, width, height / 2));
+    CGImageRef grayImageRef = CGBitmapContextCreateImage(grayContext);
+    CGContextRelease(grayContext);
+    NSData *grayData = [coder encodedDataWithImage:[UIImage imageWithCGImage:grayImageRef] format:SDImageFormatJPEG];
+    CGImageRelease(grayImageRef);
+    UIImage *grayImage = [coder decodedImageWithData:grayData];
+    UIImage *automaticImage = [coder decompressedImageWithImage:grayImage data:NULL options:@{}];
+    UIImage *forcedImage = [coder decompressedImageWithImage:grayImage data:NULL options:@{SDWebImageCoderDecodePixelFormatKey : @(SDWebImageCoderPixelFormat32Bit)}];
+    XCTAssertEqual(CGImageGetBitsPerPixel(automaticImage.CGImage), 8);
+    XCTAssertEqual(CGImageGetBitsPerPixel(forcedImage.CGImage), 32);
+    XCTAssertEqual(automaticImage.sd_memoryCost * 4, forcedImage.sd_memoryCost);
+    XCTAssertEqual([SDWebImageDecodeScheduler estimatedDecodedBytesForData:grayData options:nil], width * height);
+    
+    // Opaque color images go down to 16-bit only when allowed, images with alpha stay 32-bit
+    NSDictionary *allow16BitOptions = @{SDWebImageCoderDecodePixelFormatKey : @(SDWebImageCoderPixelFormatAllow16Bit)};
+    uint8_t *rgba = SDTestCreatePattern(width, height);
+    CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, rgba, width * height * 4, NULL);
+    CGImageRef opaqueImageRef = CGImageCreate(width, height, 8, 32, width * 4, SDCGColorSpaceGetDeviceRGB(), kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipLast, provider, NULL, NO, kCGRenderingIntentDefault);
+    CGImageRef alphaImageRef = CGImageCreate(width, height, 8, 32, width * 4, SDCGColorSpaceGetDeviceRGB(), kCGBitmapByteOrder32Big | kCGImageAlphaLast, provider, NULL, NO, kCGRenderingIntentDefault);
+    UIImage *opaqueImage = [coder decompressedImageWithImage:[UIImage imageWithCGImage:opaqueImageRef] data:NULL options:allow16BitOptions];
+    UIImage *alphaImage = [coder decompressedImageWithImage:[UIImage imageWithCGImage:alphaImageRef] data:NULL options:allow16BitOptions];
+    UIImage *automaticOpaqueImage = [coder decompressedImageWithImage:[UIImage imageWithCGImage:opaqueImageRef] data:NULL options:nil];
+    XCTAssertEqual(CGImageGetBitsPerPixel(opaqueImage.CGImage), 16);
+    XCTAssertEqual(CGImageGetBitsPerPixel(alphaImage.CGImage), 32);
+    XCTAssertEqual(CGImageGetBitsPerPixel(automaticOpaqueImage.CGImage), 32);
+    XCTAssertEqual(opaqueImage.sd_memoryCost * 2, automaticOpaqueImage.sd_memoryCost);
+    
+    // The packing kernel keeps the top 5 bits of each component, in the layout Core Graphics uses
+    uint16_t *packed = malloc(width * height * 2);
+    SDPixelConvertRGBXToXRGB1555(rgba, width * 4, (uint8_t *)packed, width * 2, width, height, false);
+    for (size_t i = 0; i < width * height; i++) {
+        uint16_t expected = (rgba[i * 4] >> 3) << 10 | (rgba[i * 4 + 1] >> 3) << 5 | (rgba[i * 4 + 2] >> 3);
+        XCTAssertEqual(CFSwapInt16LittleToHost(packed[i]), expected);
+    }
+    
+    CGImageRelease(opaqueImageRef);
+    CGImageRelease(alphaImageRef);
+    CGDataProviderRelease(provider);
+    free(rgba);
+    free(packed);
+}
+
+- (void)testHeaderParserMatchesImageIO {
+    // Encode the same image with an orientation in each format, the parser should agree with the ImageIO properties
+    CGContextRef context = CGBitmapContextCreate(NULL, 320, 200, 8, 0, SDCGColorSpaceGetDeviceRGB(), kCGBitmapByteOrder32Host | kCGImageAlphaPremultipliedFirst);
+    CGContextSetRGBFillColor(context, 1, 0, 0, 0.5);
+    CGContextFillRect(context, CGRectMake(0, 0, 160, 200));
+    CGImageRef imageRef = CGBitmapContextCreateImage(context);
+    CGContextRelease(context);
+    for (NSString *type in @[(__bridge NSString *)kUTTypeJPEG, (__bridge NSString *)kUTTypePNG, (__bridge NSString *)kUTTypeGIF]) {
+        NSMutableData *data = [NSMutableData data];
+        CGImageDestinationRef destination = CGImageDestinationCreateWithData((__bridge CFMutableDataRef)data, (__bridge CFStringRef)type, 1, NULL);
+        CGImageDestinationAddImage(destination, imageRef, (__bridge CFDictionaryRef)@{(__bridge NSString *)kCGImagePropertyOrientation : @6});
+        CGImageDestinationFinalize(destination);
+        CFRelease(destination);
+        
+        CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data, NULL);
+        NSDictionary *properties = (__bridge_transfer NSDictionary *)CGImageSourceCopyPropertiesAtIndex(source, 0, NULL);
+        CFRelease(source);
+        SDImageHeaderInfo info;
+        XCTAssertEqual(SDImageHeaderParse(data.bytes, data.length, &info), SDImageHeaderStatusOK, @"%@", type);
+        XCTAssertEqual(info.width, [properties[(__bridge NSString *)kCGImagePropertyPixelWidth] unsignedIntValue], @"%@", type);
+        XCTAssertEqual(info.height, [properties[(__bridge NSString *)kCGImagePropertyPixelHeight] unsignedIntValue], @"%@", type);
+        XCTAssertEqual(info.orientation, [properties[(__bridge NSString *)kCGImagePropertyOrientation] ?: @1 unsignedIntValue], @"%@", type);
+        
+        // A prefix which ends before the size asks for more data
+        XCTAssertEqual(SDImageHeaderParse(data.bytes, 10, &info), SDImageHeaderStatusNeedMoreData, @"%@", type);
+        
+        if ([type isEqualToString:(__bridge NSString *)kUTTypeJPEG]) {
+            // Cameras and editors write an XMP packet in a second APP1 segment, it must not hide the EXIF orientation
+            NSRange exifRange = [data rangeOfData:[NSData dataWithBytes:"Exif\0\0" length:6] options:0 range:NSMakeRange(0, data.length)];
+            XCTAssertNotEqual(exifRange.location, NSNotFound);
+            const uint8_t *bytes = data.bytes;
+            NSUInteger exifEnd = exifRange.location - 2 + ((bytes[exifRange.location - 2] << 8) | bytes[exifRange.location - 1]);
+            NSMutableData *xmp = [[@"http://ns.adobe.com/xap/1.0/" dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+            [xmp appendBytes:"\0" length:1];
+            [xmp appendData:[@"<x:xmpmeta xmlns:x=\"adobe:ns:meta/\"><rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\"><rdf:Description rdf:about=\"\"/></rdf:RDF></x:xmpmeta>" dataUsingEncoding:NSUTF8StringEncoding]];
+            uint8_t xmpHeader[4] = {0xFF, 0xE1, (uint8_t)((xmp.length + 2) >> 8), (uint8_t)(xmp.length + 2)};
+            NSMutableData *xmpData = [[data subdataWithRange:NSMakeRange(0, exifEnd)] mutableCopy];
+            [xmpData appendBytes:xmpHeader length:sizeof(xmpHeader)];
+            [xmpData appendData:xmp];
+            [xmpData appendData:[data subdataWithRange:NSMakeRange(exifEnd, data.length - exifEnd)]];
+            
+            source = CGImageSourceCreateWithData((__bridge CFDataRef)xmpData, NULL);
+            properties = (__bridge_transfer NSDictionary *)CGImageSourceCopyPropertiesAtIndex(source, 0, NULL);
+            CFRelease(source);
+            XCTAssertEqual(SDImageHeaderParse(xmpData.bytes, xmpData.length, &info), SDImageHeaderStatusOK);
+            XCTAssertEqual(info.orientation, 6);
+            XCTAssertEqual(info.orientation, [properties[(__bridge NSString *)kCGImagePropertyOrientation] ?: @1 unsignedIntValue]);
+        }
+    }
+    CGImageRelease(imageRef);
+    
+    SDImageHeaderInfo info;
+    NSData *text = [@"<html><body>Not Found</body></html>" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertEqual(SDImageHeaderParse(text.bytes, text.length, &info), SDImageHeaderStatusUnsupported);
+}
+
+- (void)testDownloadCancelsImageOverPixelLimit {
+    // The header of a 30000x30000 PNG, the operation should read the size from the first chunk and fail with the limit error
+    uint8_t header[33] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n', 0, 0, 0, 13, 'I', 'H', 'D', 'R',
+        0, 0, 0x75, 0x30, 0, 0, 0x75, 0x30, 8, 6, 0, 0, 0};
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://example.com/bomb.png"]];
+    SDWebImageDownloaderOperation *operation = [[SDWebImageDownloaderOperation alloc] initWithRequest:request inSession:nil options:0];
+    operation.maxImagePixels = 4096 * 4096;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Image too large"];
+    [operation addHandlersForProgress:nil completed:^(UIImage *image, NSData *data, NSError *error, BOOL finished) {
+        XCTAssertNil(image);
+        XCTAssertEqualObjects(error.domain, SDWebImageErrorDomain);
+        XCTAssertEqual(error.code, SDWebImageDownloaderErrorCodeImageTooLarge);
+        [expectation fulfill];
+    }];
+    
+    [operation URLSession:nil dataTask:nil didReceiveData:[NSData dataWithBytes:header length:20]];
+    XCTAssertTrue(CGSizeEqualToSize(operation.imagePixelSize, CGSizeZero));
+    [operation URLSession:nil dataTask:nil didReceiveData:[NSData dataWithBytes:header + 20 length:sizeof(header) - 20]];
+    XCTAssertTrue(CGSizeEqualToSize(operation.imagePixelSize, CGSizeMake(30000, 30000)));
+    // The task was cancelled, it completes with the cancellation error
+    [operation URLSession:nil task:nil didCompleteWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+- (void)testDownloadCancelsImageOverByteLimitWithHugeFrameCount {
+    // A 65536x65536 APNG header claiming 2^30 frames, 2^64 bytes once decoded would wrap to 0 and slip under the byte limit
+    uint8_t header[53] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n', 0, 0, 0, 13, 'I', 'H', 'D', 'R',
+        0, 1, 0, 0, 0, 1, 0, 0, 8, 6, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 8, 'a', 'c', 'T', 'L', 0x40, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    NSData *data = [NSData dataWithBytes:header length:sizeof(header)];
+    XCTAssertEqual([SDWebImageDecodeScheduler estimatedDecodedBytesForData:data options:nil], NSUIntegerMax);
+    
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://example.com/frames.png"]];
+    SDWebImageDownloaderOperation *operation = [[SDWebImageDownloaderOperation alloc] initWithRequest:request inSession:nil options:0];
+    operation.maxImageBytes = 100 * 1024 * 1024;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Image too large"];
+    [operation addHandlersForProgress:nil completed:^(UIImage *image, NSData *imageData, NSError *error, BOOL finished) {
+        XCTAssertNil(image);
+        XCTAssertEqual(error.code, SDWebImageDownloaderErrorCodeImageTooLarge);
+        [expectation fulfill];
+    }];
+    [operation URLSession:nil dataTask:nil didReceiveData:data];
+    [operation URLSession:nil task:nil didCompleteWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+static uint64_t SDTestMemoryFootprint(void) {
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.phys_footprint;
+}
+
+#ifdef SD_WEBP
+- (void)testWebPDecodePerformance {
+    // A single decode buffer means the footprint grows by one bitmap, the previous decode-then-redraw path needed two
+    size_t width = 2000, height = 1500;
+    uint8_t *rgba = SDTestCreatePattern(width, height);
+    CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, rgba, width * height * 4, NULL);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGImageRef imageRef = CGImageCreate(width, height, 8, 32, width * 4, colorSpace, kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipLast, provider, NULL, NO, kCGRenderingIntentDefault);
+    UIImage *sourceImage = [[UIImage alloc] initWithCGImage:imageRef];
+    NSData *webpData = [[SDWebImageWebPCoder sharedCoder] encodedDataWithImage:sourceImage format:SDImageFormatWebP];
+    CGImageRelease(imageRef);
+    CGColorSpaceRelease(colorSpace);
+    CGDataProviderRelease(provider);
+    free(rgba);
+    XCTAssertNotNil(webpData);
+    
+    uint64_t footprint = SDTestMemoryFootprint();
+    UIImage *image = [[SDWebImageWebPCoder sharedCoder] decodedImageWithData:webpData];
+    uint64_t growth = SDTestMemoryFootprint() - footprint;
+    XCTAssertEqual(image.size.width, width);
+    XCTAssertLessThan(growth, width * height * 4 * 3 / 2);
+    
+    [self measureBlock:^{
+        @autoreleasepool {
+            [[SDWebImageWebPCoder sharedCoder] decodedImageWithData:webpData];
+        }
+    }];
+}
+
+- (void)testAnimatedWebPEncodePerformance {
+    // 30 distinct 400x300 frames, encoded one at a time and then concurrently, plus the output size of a few option sets
+    size_t width = 400, height = 300, frameCount = 30;
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    NSMutableArray<SDWebImageFrame *> *frames = [NSMutableArray array];
+    for (size_t i = 0; i < frameCount; i++) {
+        CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGBitmapByteOrder32Little | kCGImageAlphaPremultipliedFirst);
+        CGContextSetRGBFillColor(context, i / (CGFloat)frameCount, 0.5, 1 - i / (CGFloat)frameCount, 1);
+        CGContextFillRect(context, CGRectMake(0, 0, width, height));
+        CGContextSetRGBFillColor(context, 1, 1, 1, 0.5);
+        CGContextFillEllipseInRect(context, CGRectMake(i * 10, i * 5, 100, 100));
+        CGImageRef imageRef = CGBitmapContextCreateImage(context);
+        [frames addObject:[SDWebImageFrame frameWithImage:[[UIImage alloc] initWithCGImage:imageRef] duration:0.1]];
+        CGImageRelease(imageRef);
+        CGContextRelease(context);
+    }
+    CGColorSpaceRelease(colorSpace);
+    UIImage *animatedImage = [SDWebImageCoderHelper animatedImageWithFrames:frames];
+    SDWebImageWebPCoder *coder = [SDWebImageWebPCoder sharedCoder];
+    
+    CFTimeInterval start = CACurrentMediaTime();
+    NSData *serialData = [coder encodedDataWithImage:animatedImage format:SDImageFormatWebP options:@{SDWebImageCoderEncodeMaxConcurrentFramesKey : @1}];
+    CFTimeInterval serialTime = CACurrentMediaTime() - start;
+    start = CACurrentMediaTime();
+    NSData *parallelData = [coder encodedDataWithImage:animatedImage format:SDImageFormatWebP];
+    CFTimeInterval parallelTime = CACurrentMediaTime() - start;
+    // The frames are assembled in order, so the output does not depend on the concurrency
+    XCTAssertEqualObjects(serialData, parallelData);
+    XCTAssertGreaterThan([coder decodedImageWithData:parallelData].images.count, 0u);
+    if ([NSProcessInfo processInfo].activeProcessorCount > 1) {
+        XCTAssertLessThan(parallelTime, serialTime);
+    }
+    
+    // A lower quality or a target size gives a smaller file than the default full quality
+    NSArray<NSDictionary<NSString *, NSObject *> *> *smallerOptionSets = @[@{SDWebImageCoderEncodeCompressionQualityKey : @0.75},
+                                                                           @{SDWebImageCoderEncodeCompressionQualityKey : @0.75, SDWebImageCoderEncodeMethodKey : @6},
+                                                                           @{SDWebImageCoderEncodeCompressionQualityKey : @0.75, SDWebImageCoderEncodeMethodKey : @0, SDWebImageCoderEncodeThreadLevelKey : @1},
+                                                                           @{SDWebImageCoderEncodeTargetSizeKey : @2000}];
+    for (NSDictionary<NSString *, NSObject *> *options in smallerOptionSets) {
+        NSData *data = [coder encodedDataWithImage:animatedImage format:SDImageFormatWebP options:options];
+        XCTAssertNotNil(data);
+        XCTAssertLessThan(data.length, parallelData.length, @"%@", options);
+    }
+    XCTAssertNotNil([coder encodedDataWithImage:animatedImage format:SDImageFormatWebP options:@{SDWebImageCoderEncodeLosslessKey : @YES}]);
+    
+    [self measureBlock:^{
+        @autoreleasepool {
+            [coder encodedDataWithImage:animatedImage format:SDImageFormatWebP options:@{SDWebImageCoderEncodeCompressionQualityKey : @0.75}];
+        }
+    }];
+}
+
+static uint8_t *SDTestCopyPixels(CGImageRef imageRef) {
+    size_t width = CGImageGetWidth(imageRef), height = CGImageGetHeight(imageRef);
+    uint8_t *pixels = calloc(width * height, 4);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(pixels, width, height, 8, width * 4, colorSpace, kCGBitmapByteOrder32Big | kCGImageAlphaPremultipliedLast);
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), imageRef);
+    CGContextRelease(context);
+    CGColorSpaceRelease(colorSpace);
+    return pixels;
+}
+
+- (void)testAnimatedWebPEncodesChangedRectangles {
+    // A small square moving over a static background, frames 3 and 4 are the same
+    size_t width = 200, height = 150, frameCount = 8;
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    NSMutableArray<SDWebImageFrame *> *frames = [NSMutableArray array];
+    for (size_t i = 0; i < frameCount; i++) {
+        size_t position = i == 4 ? 3 : i;
+        CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGBitmapByteOrder32Little | kCGImageAlphaNoneSkipFirst);
+        for (size_t y = 0; y < height; y += 10) {
+            CGContextSetRGBFillColor(context, y / (CGFloat)height, 0.5, 0.25, 1);
+            CGContextFillRect(context, CGRectMake(0, y, width, 10));
+        }
+        CGContextSetRGBFillColor(context, 1, 1, 1, 1);
+        CGContextFillRect(context, CGRectMake(20 + position * 15, 30 + position * 7, 15, 15));
+        CGImageRef imageRef = CGBitmapContextCreateImage(context);
+        [frames addObject:[SDWebImageFrame frameWithImage:[[UIImage alloc] initWithCGImage:imageRef] duration:0.1]];
+        CGImageRelease(imageRef);
+        CGContextRelease(context);
+    }
+    CGColorSpaceRelease(colorSpace);
+    UIImage *animatedImage = [SDWebImageCoderHelper animatedImageWithFrames:frames];
+    SDWebImageWebPCoder *coder = [SDWebImageWebPCoder sharedCoder];
+    NSDictionary *options = @{SDWebImageCoderEncodeLosslessKey : @YES};
+    
+    NSData *data = [coder encodedDataWithImage:animatedImage format:SDImageFormatWebP options:options];
+    NSData *fullFrameData = [coder encodedDataWithImage:frames[0].image format:SDImageFormatWebP options:options];
+    XCTAssertNotNil(data);
+    XCTAssertLessThan(data.length, frameCount * fullFrameData.length / 2);
+    
+    // The frames decode back to the source pixels
+    SDWebImageWebPCoder *decoder = [[SDWebImageWebPCoder alloc] initWithAnimatedImageData:data options:nil];
+    XCTAssertEqual(decoder.animatedImageFrameCount, frameCount);
+    for (size_t i = 0; i < frameCount; i++) {
+        uint8_t *expected = SDTestCopyPixels(frames[i].image.CGImage);
+        uint8_t *decoded = SDTestCopyPixels([decoder animatedImageFrameAtIndex:i].CGImage);
+        XCTAssertGreaterThan(SDTestPSNR(decoded, expected, width * height * 4), 40);
+        free(expected);
+        free(decoded);
+    }
+    
+    NSMutableDictionary *mergeOptions = [options mutableCopy];
+    mergeOptions[SDWebImageCoderEncodeMergeIdenticalFramesKey] = @YES;
+    NSData *mergedData = [coder encodedDataWithImage:animatedImage format:SDImageFormatWebP options:mergeOptions];
+    SDWebImageWebPCoder *mergedDecoder = [[SDWebImageWebPCoder alloc] initWithAnimatedImageData:mergedData options:nil];
+    XCTAssertEqual(mergedDecoder.animatedImageFrameCount, frameCount - 1);
+    XCTAssertEqualWithAccuracy([mergedDecoder animatedImageDurationAtIndex:3], 0.2, 0.001);
+}
+#endif
+
+- (void)testDownloadBuffersChunksWithoutCopying {
+    // The chunks are only flattened once for decoding, a download in one chunk is never copied
+    NSData *data = [[SDWebImageImageIOCoder sharedCoder] encodedDataWithImage:[self largeTestImage] format:SDImageFormatPNG];
+    for (NSNumber *chunkSize in @[@(data.length), @(64 * 1024)]) {
+        NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://example.com/image.png"]];
+        SDWebImageDownloaderOperation *operation = [[SDWebImageDownloaderOperation alloc] initWithRequest:request inSession:nil options:0];
+        operation.shouldDecompressImages = NO;
+        XCTestExpectation *expectation = [self expectationWithDescription:@"Downloaded"];
+        [operation addHandlersForProgress:nil completed:^(UIImage *image, NSData *imageData, NSError *error, BOOL finished) {
+            XCTAssertNotNil(image);
+            XCTAssertEqualObjects(imageData, data);
+            [expectation fulfill];
+        }];
+        for (NSUInteger offset = 0; offset < data.length; offset += chunkSize.unsignedIntegerValue) {
+            NSData *chunk = [data subdataWithRange:NSMakeRange(offset, MIN(chunkSize.unsignedIntegerValue, data.length - offset))];
+            [operation URLSession:nil dataTask:nil didReceiveData:chunk];
+        }
+        [operation URLSession:nil task:nil didCompleteWithError:nil];
+        [self waitForExpectationsWithTimeout:10 handler:nil];
+        XCTAssertEqual(operation.receivedDataCopiedBytes, chunkSize.unsignedIntegerValue == data.length ? 0 : data.length);
+    }
+}
+
+- (void)testHeaderProbeWaitsForTheDataToDouble {
+    // A 64KB text chunk before the pixels pushes the end of the PNG header past many 1KB chunks, the prefix must not be flattened for each of them
+    NSData *data = [[SDWebImageImageIOCoder sharedCoder] encodedDataWithImage:[self largeTestImage] format:SDImageFormatPNG];
+    NSUInteger textLength = 64 * 1024;
+    uint8_t textHeader[] = {textLength >> 24, (textLength >> 16) & 0xFF, (textLength >> 8) & 0xFF, textLength & 0xFF, 't', 'E', 'X', 't'};
+    NSMutableData *paddedData = [[data subdataWithRange:NSMakeRange(0, 33)] mutableCopy];
+    [paddedData appendBytes:textHeader length:sizeof(textHeader)];
+    [paddedData appendData:[@"Comment" dataUsingEncoding:NSASCIIStringEncoding]];
+    [paddedData increaseLengthBy:textLength - 7 + 4];
+    [paddedData appendData:[data subdataWithRange:NSMakeRange(33, data.length - 33)]];
+    // The download is only probed, not decoded, so it can end with bytes past the image
+    if (paddedData.length < 2 * textLength) {
+        paddedData.length = 2 * textLength;
+    }
+    
+    SDWebImageDownloaderOperation *operation = [[SDWebImageDownloaderOperation alloc] initWithRequest:[NSURLRequest requestWithURL:[NSURL URLWithString:@"http://example.com/padded.png"]] inSession:nil options:0];
+    NSUInteger chunkSize = 1024;
+    for (NSUInteger offset = 0; offset < 2 * textLength; offset += chunkSize) {
+        [operation URLSession:nil dataTask:nil didReceiveData:[paddedData subdataWithRange:NSMakeRange(offset, chunkSize)]];
+    }
+    XCTAssertEqual(operation.imagePixelSize.width, 6000);
+    // Probing at 1, 2, 4 ... 128KB copies about twice the header, probing at each chunk would copy about 2MB
+    XCTAssertLessThan(operation.receivedDataCopiedBytes, 4 * textLength);
+    [operation cancel];
+}
+
+- (void)testStreamedDownloadsAreLeftOutOfTheCache {
+    // A download in progress is neither counted nor cleared with the cache, and a chunk after the cancel does not create a new file
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"SDlianxiTestsStreaming" diskCacheDirectory:NSTemporaryDirectory()];
+    XCTestExpectation *clearExpectation = [self expectationWithDescription:@"Cleared"];
+    [cache clearDiskOnCompletion:^{
+        [clearExpectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    [[NSFileManager defaultManager] removeItemAtPath:cache.downloadingDiskCachePath error:nil];
+    NSData *data = [[SDWebImageImageIOCoder sharedCoder] encodedDataWithImage:[self largeTestImage] format:SDImageFormatPNG];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://example.com/streaming.png"]];
+    SDWebImageDownloaderOperation *operation = [[SDWebImageDownloaderOperation alloc] initWithRequest:request inSession:nil options:SDWebImageDownloaderStreamToDisk];
+    operation.streamToDiskDirectory = cache.downloadingDiskCachePath;
+    NSData *chunk = [data subdataWithRange:NSMakeRange(0, data.length / 2)];
+    [operation URLSession:nil dataTask:nil didReceiveData:chunk];
+    XCTAssertEqual([[NSFileManager defaultManager] contentsOfDirectoryAtPath:cache.downloadingDiskCachePath error:nil].count, 1u);
+    XCTAssertEqual([cache getSize], 0u);
+    XCTAssertEqual([cache getDiskCount], 0u);
+    
+    clearExpectation = [self expectationWithDescription:@"Cleared again"];
+    [cache clearDiskOnCompletion:^{
+        [clearExpectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    XCTAssertEqual([[NSFileManager defaultManager] contentsOfDirectoryAtPath:cache.downloadingDiskCachePath error:nil].count, 1u);
+    
+    [operation cancel];
+    [operation URLSession:nil dataTask:nil didReceiveData:chunk];
+    XCTAssertEqual([[NSFileManager defaultManager] contentsOfDirectoryAtPath:cache.downloadingDiskCachePath error:nil].count, 0u);
+}
+
+- (void)testDownloadStreamsToDiskAndMovesIntoCache {
+    // The download is written to a file in the cache directory, decoded from the mapped file, and the file becomes the cache entry
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"SDlianxiTestsStream" diskCacheDirectory:NSTemporaryDirectory()];
+    [cache clearDiskOnCompletion:nil];
+    NSData *data = [[SDWebImageImageIOCoder sharedCoder] encodedDataWithImage:[self largeTestImage] format:SDImageFormatPNG];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://example.com/stream.png"]];
+    SDWebImageDownloaderOperation *operation = [[SDWebImageDownloaderOperation alloc] initWithRequest:request inSession:nil options:SDWebImageDownloaderStreamToDisk];
+    operation.streamToDiskDirectory = cache.downloadingDiskCachePath;
+    operation.shouldDecompressImages = NO;
+    __block UIImage *downloadedImage;
+    __block NSData *downloadedData;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Downloaded"];
+    [operation addHandlersForProgress:nil completed:^(UIImage *image, NSData *imageData, NSError *error, BOOL finished) {
+        downloadedImage = image;
+        downloadedData = imageData;
+        [expectation fulfill];
+    }];
+    for (NSUInteger offset = 0; offset < data.length; offset += 64 * 1024) {
+        [operation URLSession:nil dataTask:nil didReceiveData:[data subdataWithRange:NSMakeRange(offset, MIN(64 * 1024, data.length - offset))]];
+    }
+    [operation URLSession:nil task:nil didCompleteWithError:nil];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    XCTAssertNotNil(downloadedImage);
+    XCTAssertEqualObjects(downloadedData, data);
+    // Nothing was kept in memory to be flattened
+    XCTAssertEqual(operation.receivedDataCopiedBytes, 0u);
+    NSURL *fileURL = [SDWebImageDownloaderOperation fileURLForDownloadedData:downloadedData];
+    XCTAssertTrue([fileURL.path hasPrefix:cache.downloadingDiskCachePath]);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:fileURL.path]);
+    
+    XCTestExpectation *storeExpectation = [self expectationWithDescription:@"Stored"];
+    [cache storeImage:downloadedImage imageData:downloadedData fileURL:fileURL forKey:request.URL.absoluteString decodeOptions:nil toDisk:YES completion:^{
+        [storeExpectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    XCTAssertEqual(cache.movedFileCount, 1u);
+    XCTAssertEqual(cache.diskWriteCount, 0u);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:fileURL.path]);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:[cache defaultCachePathForKey:request.URL.absoluteString]], data);
+    // The mapping survives the move
+    XCTAssertEqualObjects(downloadedData, data);
+}
+
+// Download the image of the range server with the connection dropped halfway, and wait until the received half is saved
+- (void)saveHalfDownloadOfURL:(NSURL *)url withDownloader:(SDWebImageDownloader *)downloader directory:(NSString *)directory {
+    [[NSFileManager defaultManager] removeItemAtPath:directory error:nil];
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    SDTestRangeURLProtocol.failAfterBytes = SDTestRangeURLProtocol.body.length / 2;
+    [SDTestRangeURLProtocol.requests removeAllObjects];
+    [SDTestRangeURLProtocol.responses removeAllObjects];
+    XCTestExpectation *failExpectation = [self expectationWithDescription:@"Failed"];
+    [downloader downloadImageWithURL:url options:SDWebImageDownloaderResumeIncompleteDownloads progress:nil completed:^(UIImage *image, NSData *imageData, NSError *error, BOOL finished) {
+        XCTAssertNotNil(error);
+        [failExpectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    // The received half is written in the background, and can be resumed once its info is there
+    NSPredicate *saved = [NSPredicate predicateWithBlock:^BOOL(id object, NSDictionary *bindings) {
+        NSArray *files = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory error:nil];
+        return [files filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"self ENDSWITH '.plist'"]].count == 1;
+    }];
+    [self expectationForPredicate:saved evaluatedWithObject:self handler:nil];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+- (void)testDownloadResumesFromPartialContent {
+    // The first download drops halfway, the second only asks for the rest and the image is spliced together
+    NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"SDlianxiTestsPartial"];
+    NSData *data = [[SDWebImageImageIOCoder sharedCoder] encodedDataWithImage:[self largeTestImage] format:SDImageFormatPNG];
+    NSUInteger half = data.length / 2;
+    SDTestRangeURLProtocol.body = data;
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[SDTestRangeURLProtocol class]];
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] initWithSessionConfiguration:configuration];
+    downloader.streamToDiskDirectory = directory;
+    downloader.shouldDecompressImages = NO;
+    NSURL *url = [NSURL URLWithString:@"http://range.test/image.png"];
+    [self saveHalfDownloadOfURL:url withDownloader:downloader directory:directory];
+    
+    __block UIImage *downloadedImage;
+    __block NSData *downloadedData;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Resumed"];
+    [downloader downloadImageWithURL:url options:SDWebImageDownloaderResumeIncompleteDownloads progress:nil completed:^(UIImage *image, NSData *imageData, NSError *error, BOOL finished) {
+        XCTAssertNil(error);
+        downloadedImage = image;
+        downloadedData = imageData;
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    XCTAssertEqual(SDTestRangeURLProtocol.requests.count, 2u);
+    XCTAssertEqualObjects([SDTestRangeURLProtocol.requests[1] valueForHTTPHeaderField:@"Range"], ([NSString stringWithFormat:@"bytes=%lu-", (unsigned long)half]));
+    XCTAssertEqual(SDTestRangeURLProtocol.responses[1].statusCode, 206);
+    XCTAssertNotNil(downloadedImage);
+    XCTAssertEqualObjects(downloadedData, data);
+    // The saved half is not needed anymore
+    XCTAssertEqual([[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory error:nil].count, 0u);
+    [downloader invalidateSessionAndCancel:YES];
+}
+
+- (void)testDownloadRestartsWhenPartialContentIsStale {
+    // A range which does not continue the saved half, or a rejected range, drops the half and downloads the whole image again
+    NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"SDlianxiTestsPartial"];
+    NSData *data = [[SDWebImageImageIOCoder sharedCoder] encodedDataWithImage:[self largeTestImage] format:SDImageFormatPNG];
+    SDTestRangeURLProtocol.body = data;
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[SDTestRangeURLProtocol class]];
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] initWithSessionConfiguration:configuration];
+    downloader.streamToDiskDirectory = directory;
+    downloader.shouldDecompressImages = NO;
+    NSURL *url = [NSURL URLWithString:@"http://range.test/stale.png"];
+    for (NSNumber *statusCode in @[@206, @416]) {
+        [self saveHalfDownloadOfURL:url withDownloader:downloader directory:directory];
+        SDTestRangeURLProtocol.staleRangeStatusCode = statusCode.integerValue;
+        
+        __block NSData *downloadedData;
+        XCTestExpectation *expectation = [self expectationWithDescription:@"Restarted"];
+        [downloader downloadImageWithURL:url options:SDWebImageDownloaderResumeIncompleteDownloads progress:nil completed:^(UIImage *image, NSData *imageData, NSError *error, BOOL finished) {
+            XCTAssertNil(error);
+            XCTAssertNotNil(image);
+            downloadedData = imageData;
+            [expectation fulfill];
+        }];
+        [self waitForExpectationsWithTimeout:10 handler:nil];
+        XCTAssertEqual(SDTestRangeURLProtocol.requests.count, 3u);
+        XCTAssertEqual(SDTestRangeURLProtocol.responses[1].statusCode, statusCode.integerValue);
+        XCTAssertNil([SDTestRangeURLProtocol.requests[2] valueForHTTPHeaderField:@"Range"]);
+        XCTAssertNil([SDTestRangeURLProtocol.requests[2] valueForHTTPHeaderField:@"If-Range"]);
+        XCTAssertEqual(SDTestRangeURLProtocol.responses[2].statusCode, 200);
+        XCTAssertEqualObjects(downloadedData, data);
+        XCTAssertEqual([[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory error:nil].count, 0u);
+    }
+    [downloader invalidateSessionAndCancel:YES];
+}
+
+- (void)testDownloaderSharesSlotsAcrossHosts {
+    // A slow host holds its own slots only, the downloads of another host start next to it
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+    [downloader setOperationClass:[SDTestHostOperation class]];
+    downloader.maxConcurrentDownloads = 4;
+    downloader.maxConcurrentDownloadsPerHost = 2;
+    NSMutableDictionary<NSString *, NSMutableArray<SDTestHostOperation *> *> *operations = [@{@"slow.test" : [NSMutableArray array], @"fast.test" : [NSMutableArray array]} mutableCopy];
+    for (NSString *host in @[@"slow.test", @"fast.test"]) {
+        for (NSUInteger i = 0; i < 6; i++) {
+            NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://%@/%lu.png", host, (unsigned long)i]];
+            SDWebImageDownloadToken *token = [downloader downloadImageWithURL:url options:0 progress:nil completed:nil];
+            [operations[host] addObject:[token valueForKey:@"downloadOperation"]];
+        }
+    }
+    NSPredicate *(^executingCount)(NSString *, NSUInteger) = ^NSPredicate *(NSString *host, NSUInteger count) {
+        return [NSPredicate predicateWithBlock:^BOOL(id object, NSDictionary *bindings) {
+            return [operations[host] filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"isExecuting == YES"]].count == count;
+        }];
+    };
+    [self expectationForPredicate:executingCount(@"slow.test", 2) evaluatedWithObject:self handler:nil];
+    [self expectationForPredicate:executingCount(@"fast.test", 2) evaluatedWithObject:self handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual([downloader statisticsForHost:@"slow.test"].pendingCount, 4u);
+    XCTAssertEqual([downloader statisticsForHost:@"slow.test"].runningCount, 2u);
+    
+    // The slots freed by the fast host go to its next downloads, the slow host is at its limit
+    [operations[@"fast.test"][0] done];
+    [operations[@"fast.test"][1] done];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"isExecuting == YES"] evaluatedWithObject:operations[@"fast.test"][2] handler:nil];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"isExecuting == YES"] evaluatedWithObject:operations[@"fast.test"][3] handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    SDWebImageDownloadHostStatistics *statistics = downloader.hostStatistics[@"fast.test"];
+    XCTAssertEqual(statistics.finishedCount, 2u);
+    XCTAssertEqual(statistics.pendingCount, 2u);
+    XCTAssertGreaterThan(statistics.averageLatency, 0);
+    
+    // A high priority download goes before the downloads already waiting on its host
+    SDWebImageDownloadToken *token = [downloader downloadImageWithURL:[NSURL URLWithString:@"http://slow.test/high.png"] options:SDWebImageDownloaderHighPriority progress:nil completed:nil];
+    SDTestHostOperation *highPriorityOperation = [token valueForKey:@"downloadOperation"];
+    [operations[@"slow.test"][0] done];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"isExecuting == YES"] evaluatedWithObject:highPriorityOperation handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertFalse(operations[@"slow.test"][2].isExecuting);
+    
+    // A host without downloads left is dropped, the limit set for it applies again with its next downloads
+    [operations[@"fast.test"][2] done];
+    [operations[@"fast.test"][3] done];
+    [self expectationForPredicate:executingCount(@"fast.test", 2) evaluatedWithObject:self handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    [downloader setMaxConcurrentDownloads:1 forHost:@"fast.test"];
+    [operations[@"fast.test"][4] done];
+    [operations[@"fast.test"][5] done];
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(id object, NSDictionary *bindings) {
+        return [downloader statisticsForHost:@"fast.test"] == nil;
+    }] evaluatedWithObject:self handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertNil(downloader.hostStatistics[@"fast.test"]);
+    SDTestHostOperation *againOperation = [[downloader downloadImageWithURL:[NSURL URLWithString:@"http://fast.test/again.png"] options:0 progress:nil completed:nil] valueForKey:@"downloadOperation"];
+    SDTestHostOperation *waitingOperation = [[downloader downloadImageWithURL:[NSURL URLWithString:@"http://fast.test/waiting.png"] options:0 progress:nil completed:nil] valueForKey:@"downloadOperation"];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"isExecuting == YES"] evaluatedWithObject:againOperation handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertFalse(waitingOperation.isExecuting);
+    statistics = [downloader statisticsForHost:@"fast.test"];
+    XCTAssertEqual(statistics.finishedCount, 0u);
+    XCTAssertEqual(statistics.pendingCount, 1u);
+    [downloader cancelAllDownloads];
+}
+
+// Feed the controller the downloads of a simulated throttled server, one round of `limit` downloads at a time. The response waits for the round trip and for the requests beyond the server's slots, then the downloads share the bandwidth. Return the limit after each round.
+static NSArray<NSNumber *> *SDTestSimulateConcurrency(SDWebImageDownloadConcurrencyController *controller, NSTimeInterval roundTrip, double bandwidth, NSUInteger size, NSUInteger serverSlots, NSUInteger rounds) {
+    NSMutableArray<NSNumber *> *limits = [NSMutableArray arrayWithCapacity:rounds];
+    for (NSUInteger round = 0; round < rounds; round++) {
+        NSUInteger inFlight = controller.limit;
+        NSTimeInterval timeToFirstByte = roundTrip + (inFlight > serverSlots ? inFlight - serverSlots : 0) * size / bandwidth;
+        NSTimeInterval duration = timeToFirstByte + inFlight * size / bandwidth;
+        for (NSUInteger i = 0; i < inFlight; i++) {
+            [controller recordDownloadWithTimeToFirstByte:timeToFirstByte bytes:size duration:duration inFlight:inFlight];
+        }
+        [limits addObject:@(controller.limit)];
+    }
+    return limits;
+}
+
+- (void)testConcurrencyControllerConverges {
+    // From a low and a high start, the limit settles above the usual 6 on a fast network and near the server's slots on a congested one
+    for (NSNumber *start in @[@2, @16]) {
+        SDWebImageDownloadConcurrencyController *fastController = [[SDWebImageDownloadConcurrencyController alloc] initWithLimit:start.unsignedIntegerValue minimumLimit:1 maximumLimit:16];
+        NSArray<NSNumber *> *fastLimits = [SDTestSimulateConcurrency(fastController, 0.05, 10 * 1024 * 1024, 100 * 1024, 12, 400) subarrayWithRange:NSMakeRange(300, 100)];
+        SDWebImageDownloadConcurrencyController *congestedController = [[SDWebImageDownloadConcurrencyController alloc] initWithLimit:start.unsignedIntegerValue minimumLimit:1 maximumLimit:16];
+        NSArray<NSNumber *> *congestedLimits = [SDTestSimulateConcurrency(congestedController, 0.3, 200 * 1024, 100 * 1024, 2, 400) subarrayWithRange:NSMakeRange(300, 100)];
+        
+        double fastAverage = [[fastLimits valueForKeyPath:@"@avg.doubleValue"] doubleValue];
+        double congestedAverage = [[congestedLimits valueForKeyPath:@"@avg.doubleValue"] doubleValue];
+        XCTAssertGreaterThan(fastAverage, 6);
+        XCTAssertLessThanOrEqual([[fastLimits valueForKeyPath:@"@max.unsignedIntegerValue"] unsignedIntegerValue] - [[fastLimits valueForKeyPath:@"@min.unsignedIntegerValue"] unsignedIntegerValue], 4u);
+        XCTAssertLessThan(congestedAverage, 3);
+        XCTAssertLessThanOrEqual([[congestedLimits valueForKeyPath:@"@max.unsignedIntegerValue"] unsignedIntegerValue], 3u);
+    }
+}
+
+- (void)testPromotedDownloadsStartFirst {
+    // A list scrolled past 20 images and shows the last 4. Promoting them and demoting the others gives them the next slots, instead of the 17th to 20th
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+    [downloader setOperationClass:[SDTestHostOperation class]];
+    downloader.maxConcurrentDownloads = 2;
+    NSMutableArray<SDWebImageDownloadToken *> *tokens = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 20; i++) {
+        NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://list.test/%lu.png", (unsigned long)i]];
+        [tokens addObject:[downloader downloadImageWithURL:url options:0 progress:nil completed:nil]];
+    }
+    NSArray<SDTestHostOperation *> *operations = [tokens valueForKey:@"downloadOperation"];
+    NSMutableArray<SDTestHostOperation *> *startOrder = [NSMutableArray array];
+    // Wait until the free slots are taken and record the downloads which took them
+    void (^recordStarts)(void) = ^{
+        NSUInteger unfinishedCount = [operations filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"isFinished == NO"]].count;
+        NSPredicate *predicate = [NSPredicate predicateWithBlock:^BOOL(id object, NSDictionary *bindings) {
+            return [operations filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"isExecuting == YES"]].count == MIN(unfinishedCount, 2u);
+        }];
+        [self expectationForPredicate:predicate evaluatedWithObject:self handler:nil];
+        [self waitForExpectationsWithTimeout:5 handler:nil];
+        for (SDTestHostOperation *operation in operations) {
+            if (operation.isExecuting && [startOrder indexOfObjectIdenticalTo:operation] == NSNotFound) {
+                [startOrder addObject:operation];
+            }
+        }
+    };
+    recordStarts();
+    XCTAssertEqual(startOrder.count, 2u);
+    
+    for (NSUInteger i = 0; i < 20; i++) {
+        tokens[i].priority = i < 16 ? SDWebImageDownloaderPriorityLow : SDWebImageDownloaderPriorityHigh;
+    }
+    // The running downloads change their priority too
+    XCTAssertEqual(operations[0].queuePriority, NSOperationQueuePriorityLow);
+    XCTAssertEqual(operations[19].queuePriority, NSOperationQueuePriorityHigh);
+    while (startOrder.count < operations.count) {
+        for (SDTestHostOperation *operation in startOrder) {
+            if (operation.isExecuting) {
+                [operation done];
+                break;
+            }
+        }
+        recordStarts();
+    }
+    
+    NSUInteger lastVisibleStart = 0;
+    for (NSUInteger i = 16; i < 20; i++) {
+        NSUInteger position = [startOrder indexOfObjectIdenticalTo:operations[i]];
+        lastVisibleStart = MAX(lastVisibleStart, position);
+        // The visible downloads keep their order among themselves
+        XCTAssertEqual(position, i - 14);
+    }
+    // Only the 2 downloads running when the list was reprioritised went first, instead of 16
+    XCTAssertEqual(lastVisibleStart + 1 - 4, 2u);
+}
+
+- (void)testDownloadPriorityFollowsItsTokens {
+    // Two tokens share a download, it runs at the higher of their priorities and goes before an earlier download once promoted
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+    [downloader setOperationClass:[SDTestHostOperation class]];
+    downloader.maxConcurrentDownloads = 1;
+    SDWebImageDownloadToken *runningToken = [downloader downloadImageWithURL:[NSURL URLWithString:@"http://priority.test/running.png"] options:0 progress:nil completed:nil];
+    SDWebImageDownloadToken *earlierToken = [downloader downloadImageWithURL:[NSURL URLWithString:@"http://priority.test/earlier.png"] options:0 progress:nil completed:nil];
+    NSURL *url = [NSURL URLWithString:@"http://priority.test/shared.png"];
+    SDWebImageDownloadToken *token = [downloader downloadImageWithURL:url options:SDWebImageDownloaderLowPriority progress:nil completed:nil];
+    SDWebImageDownloadToken *otherToken = [downloader downloadImageWithURL:url options:0 progress:nil completed:nil];
+    SDTestHostOperation *operation = [token valueForKey:@"downloadOperation"];
+    XCTAssertEqual(otherToken.priority, SDWebImageDownloaderPriorityDefault);
+    XCTAssertEqual(operation.queuePriority, NSOperationQueuePriorityNormal);
+    
+    otherToken.priority = SDWebImageDownloaderPriorityLow;
+    XCTAssertEqual(operation.queuePriority, NSOperationQueuePriorityLow);
+    token.priority = SDWebImageDownloaderPriorityHigh;
+    XCTAssertEqual(operation.queuePriority, NSOperationQueuePriorityHigh);
+    
+    SDTestHostOperation *runningOperation = [runningToken valueForKey:@"downloadOperation"];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"isExecuting == YES"] evaluatedWithObject:runningOperation handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    [runningOperation done];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"isExecuting == YES"] evaluatedWithObject:operation handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertFalse(((SDTestHostOperation *)[earlierToken valueForKey:@"downloadOperation"]).isExecuting);
+    
+    // Without the token asking for the high priority, the download falls back to the other token's
+    [token cancel];
+    XCTAssertEqual(operation.queuePriority, NSOperationQueuePriorityLow);
+    
+    // A waiting download falls back in line too, whichever way its high priority token is cancelled
+    NSURL *lowURL = [NSURL URLWithString:@"http://priority.test/low.png"];
+    [downloader downloadImageWithURL:lowURL options:SDWebImageDownloaderLowPriority progress:nil completed:nil];
+    SDWebImageDownloadToken *lowHighToken = [downloader downloadImageWithURL:lowURL options:SDWebImageDownloaderHighPriority progress:nil completed:nil];
+    NSURL *normalURL = [NSURL URLWithString:@"http://priority.test/normal.png"];
+    [downloader downloadImageWithURL:normalURL options:0 progress:nil completed:nil];
+    SDWebImageDownloadToken *normalHighToken = [downloader downloadImageWithURL:normalURL options:SDWebImageDownloaderHighPriority progress:nil completed:nil];
+    SDTestHostOperation *lowOperation = [lowHighToken valueForKey:@"downloadOperation"];
+    SDTestHostOperation *normalOperation = [normalHighToken valueForKey:@"downloadOperation"];
+    [lowHighToken cancel];
+    [downloader cancel:normalHighToken];
+    XCTAssertEqual(lowOperation.queuePriority, NSOperationQueuePriorityLow);
+    XCTAssertEqual(normalOperation.queuePriority, NSOperationQueuePriorityNormal);
+    SDTestHostOperation *earlierOperation = [earlierToken valueForKey:@"downloadOperation"];
+    [operation done];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"isExecuting == YES"] evaluatedWithObject:earlierOperation handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertFalse(normalOperation.isExecuting);
+    [earlierOperation done];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"isExecuting == YES"] evaluatedWithObject:normalOperation handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertFalse(lowOperation.isExecuting);
+    [downloader cancelAllDownloads];
+}
+
+- (void)testDownloaderRoutesDataInConstantTime {
+    // Route chunks to the first queued task with 10 and with 1000 queued operations, the cost per chunk should not grow with the queue
+    NSData *chunk = [NSMutableData dataWithLength:16 * 1024];
+    NSUInteger chunkCount = 10000;
+    NSMutableArray<NSNumber *> *times = [NSMutableArray array];
+    for (NSNumber *operationCount in @[@10, @1000]) {
+        SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+        [downloader setOperationClass:[SDTestRoutingOperation class]];
+        [downloader setSuspended:YES];
+        SDWebImageDownloadToken *firstToken;
+        for (NSUInteger i = 0; i < operationCount.unsignedIntegerValue; i++) {
+            NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://example.com/%lu.png", (unsigned long)i]];
+            SDWebImageDownloadToken *token = [downloader downloadImageWithURL:url options:0 progress:nil completed:nil];
+            firstToken = firstToken ?: token;
+        }
+        SDTestRoutingOperation *operation = [firstToken valueForKey:@"downloadOperation"];
+        id<NSURLSessionDataDelegate> delegate = (id<NSURLSessionDataDelegate>)downloader;
+        CFTimeInterval start = CACurrentMediaTime();
+        for (NSUInteger i = 0; i < chunkCount; i++) {
+            [delegate URLSession:nil dataTask:(NSURLSessionDataTask *)operation.dataTask didReceiveData:chunk];
+        }
+        CFTimeInterval time = CACurrentMediaTime() - start;
+        XCTAssertEqual(operation.receivedDataCount, chunkCount);
+        [times addObject:@(time)];
+        [downloader cancelAllDownloads];
+        [downloader invalidateSessionAndCancel:YES];
+    }
+    // Generous for a noisy machine, a linear search would be about 100 times slower
+    XCTAssertLessThan(times[1].doubleValue, times[0].doubleValue * 10);
+}
+
+// The benchmark corpus, generated so every run measures the same files. Set SD_BENCHMARK_CORPUS to a directory to add real files, their format is detected from the data.
+- (NSArray<NSDictionary *> *)benchmarkCorpus {
+    NSMutableArray<NSDictionary *> *corpus = [NSMutableArray array];
+    NSDictionary *sizes = @{@"small" : [NSValue valueWithCGSize:CGSizeMake(320, 240)],
+                            @"medium" : [NSValue valueWithCGSize:CGSizeMake(1600, 1200)],
+                            @"large" : [NSValue valueWithCGSize:CGSizeMake(4000, 3000)]};
+    for (NSString *sizeName in sizes) {
+        CGSize size = [sizes[sizeName] CGSizeValue];
+        size_t width = size.width, height = size.height;
+        uint8_t *rgba = SDTestCreatePattern(width, height);
+        CGContextRef context = CGBitmapContextCreate(rgba, width, height, 8, width * 4, SDCGColorSpaceGetDeviceRGB(), kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipLast);
+        CGImageRef opaqueRef = CGBitmapContextCreateImage(context);
+        CGContextRelease(context);
+        // The same pattern with a transparent half and a translucent ellipse
+        context = CGBitmapContextCreate(NULL, width, height, 8, 0, SDCGColorSpaceGetDeviceRGB(), kCGBitmapByteOrder32Big | kCGImageAlphaPremultipliedLast);
+        CGContextDrawImage(context, CGRectMake(0, 0, width, height), opaqueRef);
+        CGContextClearRect(context, CGRectMake(0, 0, width / 2, height));
+        CGContextSetRGBFillColor(context, 0, 0, 1, 0.5);
+        CGContextFillEllipseInRect(context, CGRectMake(0, 0, width / 2, height));
+        CGImageRef alphaRef = CGBitmapContextCreateImage(context);
+        CGContextRelease(context);
+        free(rgba);
+        
+        NSArray *variants = @[@[@"jpeg", (__bridge NSString *)kUTTypeJPEG, (__bridge id)opaqueRef, @{}],
+                              @[@"jpeg-progressive", (__bridge NSString *)kUTTypeJPEG, (__bridge id)opaqueRef, @{(__bridge NSString *)kCGImagePropertyJFIFDictionary : @{(__bridge NSString *)kCGImagePropertyJFIFIsProgressive : @YES}}],
+                              @[@"png", (__bridge NSString *)kUTTypePNG, (__bridge id)opaqueRef, @{}],
+                              @[@"png-alpha", (__bridge NSString *)kUTTypePNG, (__bridge id)alphaRef, @{}],
+                              @[@"png-interlaced", (__bridge NSString *)kUTTypePNG, (__bridge id)alphaRef, @{(__bridge NSString *)kCGImagePropertyPNGDictionary : @{(__bridge NSString *)kCGImagePropertyPNGInterlaceType : @1}}],
+                              @[@"gif", (__bridge NSString *)kUTTypeGIF, (__bridge id)opaqueRef, @{}]];
+        for (NSArray *variant in variants) {
+            NSMutableData *data = [NSMutableData data];
+            CGImageDestinationRef destination = CGImageDestinationCreateWithData((__bridge CFMutableDataRef)data, (__bridge CFStringRef)variant[1], 1, NULL);
+            CGImageDestinationAddImage(destination, (__bridge CGImageRef)variant[2], (__bridge CFDictionaryRef)variant[3]);
+            CGImageDestinationFinalize(destination);
+            CFRelease(destination);
+            [corpus addObject:@{@"name" : [NSString stringWithFormat:@"%@-%@", variant[0], sizeName], @"data" : data}];
+        }
+#ifdef SD_WEBP
+        NSData *webpData = [[SDWebImageWebPCoder sharedCoder] encodedDataWithImage:[[UIImage alloc] initWithCGImage:alphaRef] format:SDImageFormatWebP];
+        [corpus addObject:@{@"name" : [NSString stringWithFormat:@"webp-%@", sizeName], @"data" : webpData}];
+#endif
+        CGImageRelease(opaqueRef);
+        CGImageRelease(alphaRef);
+    }
+    
+    // Animated files, 10 frames of 400x300
+    NSMutableArray<SDWebImageFrame *> *frames = [NSMutableArray array];
+    for (size_t i = 0; i < 10; i++) {
+        CGContextRef context = CGBitmapContextCreate(NULL, 400, 300, 8, 0, SDCGColorSpaceGetDeviceRGB(), kCGBitmapByteOrder32Host | kCGImageAlphaPremultipliedFirst);
+        CGContextSetRGBFillColor(context, i / 10.0, 0.5, 1 - i / 10.0, 1);
+        CGContextFillRect(context, CGRectMake(0, 0, 400, 300));
+        CGContextSetRGBFillColor(context, 1, 1, 1, 1);
+        CGContextFillEllipseInRect(context, CGRectMake(i * 20, i * 10, 100, 100));
+        CGImageRef imageRef = CGBitmapContextCreateImage(context);
+        [frames addObject:[SDWebImageFrame frameWithImage:[[UIImage alloc] initWithCGImage:imageRef] duration:0.1]];
+        CGImageRelease(imageRef);
+        CGContextRelease(context);
+    }
+    UIImage *animatedImage = [SDWebImageCoderHelper animatedImageWithFrames:frames];
+    [corpus addObject:@{@"name" : @"gif-animated", @"data" : [[SDWebImageGIFCoder sharedCoder] encodedDataWithImage:animatedImage format:SDImageFormatGIF]}];
+#ifdef SD_WEBP
+    [corpus addObject:@{@"name" : @"webp-animated", @"data" : [[SDWebImageWebPCoder sharedCoder] encodedDataWithImage:animatedImage format:SDImageFormatWebP]}];
+#endif
+    
+    NSString *corpusPath = [NSProcessInfo processInfo].environment[@"SD_BENCHMARK_CORPUS"];
+    for (NSString *file in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:corpusPath error:nil]) {
+        NSData *data = [NSData dataWithContentsOfFile:[corpusPath stringByAppendingPathComponent:file]];
+        if (data) {
+            [corpus addObject:@{@"name" : file, @"data" : data}];
+        }
+    }
+    return corpus;
+}
+
+static uint64_t SDTestPeakMemoryFootprint(void) {
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.ledger_phys_footprint_peak;
+}
+
+// Run the block `iterations` times, and return the latency percentiles, throughput, peak footprint growth and heap growth per run
+static NSDictionary *SDTestBenchmark(NSUInteger iterations, size_t pixels, void (^block)(void)) {
+    @autoreleasepool {
+        // Warm up the coder and the caches
+        block();
+    }
+    NSMutableArray<NSNumber *> *latencies = [NSMutableArray arrayWithCapacity:iterations];
+    uint64_t peakFootprint = SDTestPeakMemoryFootprint();
+    uint64_t footprint = SDTestMemoryFootprint();
+    malloc_statistics_t before, after;
+    size_t blocks = 0, bytes = 0;
+    for (NSUInteger i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            malloc_zone_statistics(NULL, &before);
+            CFTimeInterval start = CACurrentMediaTime();
+            block();
+            [latencies addObject:@(CACurrentMediaTime() - start)];
+            // Measured before the pool drains, so the heap growth is what one run keeps alive at its end
+            malloc_zone_statistics(NULL, &after);
+            blocks += after.blocks_in_use > before.blocks_in_use ? after.blocks_in_use - before.blocks_in_use : 0;
+            bytes += after.size_in_use > before.size_in_use ? after.size_in_use - before.size_in_use : 0;
+        }
+    }
+    uint64_t peakGrowth = SDTestPeakMemoryFootprint() > MAX(peakFootprint, footprint) ? SDTestPeakMemoryFootprint() - MAX(peakFootprint, footprint) : 0;
+    [latencies sortUsingSelector:@selector(compare:)];
+    double total = [[latencies valueForKeyPath:@"@sum.self"] doubleValue];
+    NSNumber *(^percentile)(double) = ^NSNumber *(double p) {
+        return @(latencies[MIN((NSUInteger)(p * iterations), iterations - 1)].doubleValue * 1000);
+    };
+    return @{@"iterations" : @(iterations),
+             @"megapixelsPerSecond" : @(pixels * iterations / 1e6 / total),
+             @"p50Milliseconds" : percentile(0.5),
+             @"p90Milliseconds" : percentile(0.9),
+             @"p99Milliseconds" : percentile(0.99),
+             @"peakFootprintGrowthBytes" : @(peakGrowth),
+             @"heapBlocksPerImage" : @(blocks / iterations),
+             @"heapBytesPerImage" : @(bytes / iterations)};
+}
+
+- (void)testCoderBenchmark {
+    // Run every operation of every coder over the corpus and write one JSON record per coder, operation and file, so runs on different commits can be diffed.
+    // It only runs when SD_RUN_BENCHMARK or SD_BENCHMARK_OUTPUT is set, the corpus is too slow for every test run.
+    // The output goes to SD_BENCHMARK_OUTPUT, or to the temporary directory. SD_BENCHMARK_ITERATIONS sets the number of runs, 5 by default.
+    NSDictionary *environment = [NSProcessInfo processInfo].environment;
+    if (!environment[@"SD_RUN_BENCHMARK"] && !environment[@"SD_BENCHMARK_OUTPUT"]) {
+        NSLog(@"Skipping the coder benchmark, set SD_RUN_BENCHMARK to run it");
+        return;
+    }
+    NSUInteger iterations = MAX([environment[@"SD_BENCHMARK_ITERATIONS"] integerValue], 0) ?: 5;
+    NSMutableArray<id<SDWebImageCoder>> *coders = [NSMutableArray arrayWithObjects:[SDWebImageImageIOCoder sharedCoder], [SDWebImageGIFCoder sharedCoder], nil];
+#ifdef SD_WEBP
+    [coders addObject:[SDWebImageWebPCoder sharedCoder]];
+#endif
+    NSMutableArray<NSDictionary *> *records = [NSMutableArray array];
+    for (NSDictionary *file in [self benchmarkCorpus]) {
+        NSData *data = file[@"data"];
+        SDImageFormat format = [NSData sd_imageFormatForImageData:data];
+        for (id<SDWebImageCoder> coder in coders) {
+            if (![coder canDecodeFromData:data]) {
+                continue;
+            }
+            UIImage *image = [coder decodedImageWithData:data];
+            XCTAssertNotNil(image, @"%@ %@", NSStringFromClass([coder class]), file[@"name"]);
+            if (!image) {
+                continue;
+            }
+            size_t pixels = CGImageGetWidth(image.CGImage) * CGImageGetHeight(image.CGImage) * MAX(image.images.count, 1u);
+            NSMutableDictionary<NSString *, void (^)(void)> *operations = [NSMutableDictionary dictionary];
+            operations[@"decode"] = ^{
+                [coder decodedImageWithData:data];
+            };
+            if ([coder conformsToProtocol:@protocol(SDWebImageProgressiveCoder)] && [(id<SDWebImageProgressiveCoder>)coder canIncrementallyDecodeFromData:data]) {
+                // Feed growing prefixes as a download would, 64KB at a time
+                operations[@"incrementalDecode"] = ^{
+                    id<SDWebImageProgressiveCoder> progressiveCoder = [[[coder class] alloc] init];
+                    for (NSUInteger length = MIN(data.length, 65536u); ; length = MIN(length + 65536, data.length)) {
+                        [progressiveCoder incrementallyDecodedImageWithData:[data subdataWithRange:NSMakeRange(0, length)] finished:length == data.length];
+                        if (length == data.length) {
+                            break;
+                        }
+                    }
+                };
+            }
+            operations[@"decompress"] = ^{
+                NSData *imageData = data;
+                [coder decompressedImageWithImage:image data:&imageData options:nil];
+            };
+            if ([coder canEncodeToFormat:format]) {
+                operations[@"encode"] = ^{
+                    [coder encodedDataWithImage:image format:format];
+                };
+            }
+            for (NSString *operation in operations) {
+                NSMutableDictionary *record = [SDTestBenchmark(iterations, pixels, operations[operation]) mutableCopy];
+                record[@"coder"] = NSStringFromClass([coder class]);
+                record[@"operation"] = operation;
+                record[@"file"] = file[@"name"];
+                record[@"bytes"] = @(data.length);
+                record[@"pixels"] = @(pixels);
+                [records addObject:record];
+            }
+        }
+    }
+    XCTAssertGreaterThan(records.count, 0u);
+    
+    NSDictionary *report = @{@"label" : environment[@"SD_BENCHMARK_LABEL"] ?: @"",
+                             @"device" : [NSProcessInfo processInfo].operatingSystemVersionString,
+                             @"processorCount" : @([NSProcessInfo processInfo].activeProcessorCount),
+                             @"results" : records};
+    NSData *json = [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted error:nil];
+    NSString *outputPath = environment[@"SD_BENCHMARK_OUTPUT"] ?: [NSTemporaryDirectory() stringByAppendingPathComponent:@"SDCoderBenchmark.json"];
+    XCTAssertTrue([json writeToFile:outputPath atomically:YES]);
+    NSLog(@"Coder benchmark: %@ results written to %@", @(records.count), outputPath);
+}
+
 - (void)testPerformanceExample {
     // This is an example of a performance test case.
     [self measureBlock:^{